@@ -0,0 +1,44 @@
+#
+# Copyright (c) 2009-2012, Reto Grieder
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+# This software is provided 'as-is', without any express or implied warranty.
+#
+#  Description:
+#    Sets the right compiler and linker flags for GCC and Clang.
+#    Only the tracking core and the command line tools are built with them,
+#    the application itself requires the Microsoft compiler (device SDKs).
+#
+
+INCLUDE(FlagUtilities)
+
+
+#################### Compiler Flags #####################
+
+# We keep the general flags but reset the build specific flags
+SET_COMPILER_FLAGS("" Debug RelWithDebInfo Release MinSizeRel)
+
+# Never omit frame pointers to avoid useless stack traces (same as -Oy- for MSVC)
+ADD_COMPILER_FLAGS("-fno-omit-frame-pointer")
+
+# Set build specific flags.
+# -g        Generate debug symbols
+# -O[0|2|s] No optimisations, optimise for speed, optimise for size
+ADD_COMPILER_FLAGS("-g  -O0 -D_DEBUG" Debug)
+ADD_COMPILER_FLAGS("-g  -O2 -DNDEBUG" RelWithDebInfo)
+ADD_COMPILER_FLAGS("    -O2 -DNDEBUG" Release)
+ADD_COMPILER_FLAGS("    -Os -DNDEBUG" MinSizeRel)
+
+
+####################### Warnings ########################
+
+OPTION(EXTRA_COMPILER_WARNINGS "Enable some extra warnings (heavily pollutes the output)" FALSE)
+
+IF(EXTRA_COMPILER_WARNINGS)
+  ADD_COMPILER_FLAGS("-Wall -Wextra")
+ELSE()
+  REMOVE_COMPILER_FLAGS("-Wextra")
+  ADD_COMPILER_FLAGS("-Wall")
+ENDIF()
@@ -85,6 +85,16 @@ namespace tracker
         mImageCounter = 0;
     }
 
+    void Camera::logFramePoolStatistics()
+    {
+        if (mFramePool.getAcquiredCount() > 0)
+            TRACKER_INFO(QString("Camera frames: %1, without pooled buffer: %2, average pool utilisation: %3%")
+                .arg(mFramePool.getAcquiredCount())
+                .arg(mFramePool.getExhaustedCount())
+                .arg(mFramePool.getUtilisation() * 100.0, 0, 'f', 1), Logger::Low);
+        mFramePool.resetStatistics();
+    }
+
     void Camera::Trigger(){
         emit AllowLightForTheNextFrame();
     }
@@ -234,6 +244,7 @@ namespace tracker
         settings.beginGroup("Camera");
 
         mSingleShotMinTimeout = qMax(0, settings.value("Single_Shot_Min_Timeout", 200000).toInt());
+        mFramePool.setCapacity(settings.value("Frame_Pool_Size", 16).toInt());
 
         settings.endGroup();
     }
@@ -244,6 +255,7 @@ namespace tracker
         settings.beginGroup("Camera");
 
         settings.setValue("Single_Shot_Min_Timeout", mSingleShotMinTimeout);
+        settings.setValue("Frame_Pool_Size",         mFramePool.getCapacity());
 
         settings.endGroup();
     }
@@ -16,6 +16,7 @@
 #include <QPair>
 #include <QVector>
 
+#include "FramePool.h"
 #include "Thread.h"
 #include "Timing.h"
 
@@ -38,6 +39,8 @@ namespace tracker
          - \c Single_Shot_Min_Timeout: Minimum time to wait for a single shot
            image to be taken. Depending on the exposure time, this timeout
            can be significantly higher.
+         - \c Frame_Pool_Size: Number of image buffers the streaming images
+           are taken from (see FramePool).
     */
     class Camera : public Runnable
     {
@@ -66,6 +69,12 @@ namespace tracker
 
         //! Returns the image size of a specific camera mode
         virtual QSize getImageSize(QString mode) const = 0;
+        /** Tells whether a mode only reads out a region of the sensor.
+            Its pixels are the same as in the full frame, the exposure time
+            does not depend on the image size (default: false).
+        */
+        virtual bool isRegionOfInterest(QString mode) const
+            { return false; }
 
         //! Returns the currently applied exposure time in microseconds
         virtual int getExposureTime() const = 0;
@@ -181,9 +190,13 @@ namespace tracker
         bool singleShotTimedOut(quint64 referenceTime)
             { return referenceTime > mSingleShotEndTime; }
 
+        //! Logs the statistics of mFramePool and resets them (call at the end of a stream)
+        void logFramePoolStatistics();
+
         HPClock              mClock;                      //!< High precision clock used for frame time stamps
         FrameCounter         mFrameCounter;               //!< Frame count used to compute the average framerate
         bool                 mIsRunning;                  //!< Tells whether the streaming is running
+        FramePool            mFramePool;                  //!< Buffers for the streaming images
 
     private:
         Q_DISABLE_COPY(Camera)
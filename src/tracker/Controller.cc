@@ -12,7 +12,6 @@
 
 #include <cmath>
 #include <QApplication>
-#include <QCursor>
 #include <QSettings>
 #include <QThreadPool>
 #include <QtConcurrentRun>
@@ -25,7 +24,13 @@
 #include "Logger.h"
 #include "Exception.h"
 #include "Stage.h"
+#include "StageCommandScheduler.h"
+#include "ThreadProfile.h"
 #include "Correlator.h"
+#include "CorrelatorCache.h"
+#include "DebugImageRenderer.h"
+#include "DeviceStateCache.h"
+#include "MultiRoiTracker.h"
 #include "FocusTracker.h"
 #include "PathConfig.h"
 #include "TMath.h"
@@ -36,16 +41,64 @@
 
 namespace tracker
 {
+    static MultiRoiTracker* buildMultiRoiTracker(QSize roiSize, QVector<QPoint> centres, int threadCount)
+    {
+        // Runs in the global thread pool like the Correlator builds (FFTW planner)
+        try
+        {
+            return new MultiRoiTracker(roiSize, centres, threadCount);
+        }
+        catch (const Exception& ex)
+        {
+            TRACKER_WARNING("Creating the region tracker failed:" + ex.getDescription());
+            return NULL;
+        }
+    }
+
+    static void destroyMultiRoiTracker(MultiRoiTracker* tracker)
+    {
+        delete tracker;
+    }
+
     Controller::Controller(QVector<QPair<QString, QSize> > cameraModes)
         : mStage(NULL)
+        , mDeviceStateCache(NULL)
+        , mStageScheduler(NULL)
+        , mStageSchedulerThread(NULL)
         , mFocusTracker(NULL)
         , mCorrelator(NULL)
+        , mCorrelatorCache(NULL)
+        , mPendingCorrelator(NULL)
+        , mLatestCorrelator(NULL)
+        , mMultiRoiTracker(NULL)
+        , mMultiRoiWatcher(NULL)
+        , mCorrelatorCacheSize(8)
+        , mCorrelatorMaxDepth(4)
+        , mAdaptiveCorrelatorDepth(false)
+        , mSharpPeakConfidence(10.0)
+        , mMinimumPeakConfidence(0.0)
+        , mMultiRoiSize(64, 64)
+        , mMultiRoiThreads(2)
+        , mMultiRoiPolicy(MultiRoiTracker::Mean)
+        , mDebugImageRenderer(NULL)
+        , mDebugImageThread(NULL)
+        , mDebugImageFrequency(10.0)
+        , mLastDebugImageTime(0)
+        , mDebugImageVisible(true)
+        , mMotionPredictorType(0)
+        , mKalmanProcessNoise(1000.0)
+        , mKalmanMeasurementNoise(0.5)
+        , mPredictionLookahead(0.0)
+        , mAdaptiveStableFrames(100)
+        , mAdaptiveNarrowConfidence(20.0)
+        , mAdaptiveWidenConfidence(6.0)
+        , mStableFrameCount(0)
+        , mCameraModeRequestTime(0)
         , mInitialised(false)
         , mCurrentOptions(NULL)
         , mCurrentMode(Tracking)
         , mIsRunning(false)
         , mFrameCounter(2.0)
-        , mTotalStageMove(0.0, 0.0)
         , mTuningStep(0.0)
         , mAdaptiveAutoFocusEnabled(false)
         , mUseEstimatedWindowSize(false)
@@ -76,6 +129,9 @@ namespace tracker
         // Assumption: No other part of the programs uses QThreadPool!
         QThreadPool::globalInstance()->setMaxThreadCount(1);
 
+        // Filled for every image while tracking, see logIssuedStageCommands()
+        mIssuedCommands.reserve(64);
+
         // Workaround: reading settings requires mCurrentOptions
         mCurrentOptions = new OptionSet();
         // Read settings from file
@@ -92,17 +148,30 @@ namespace tracker
             mOptions[mode.first] = new OptionSet();
             mCurrentOptions = mOptions[mode.first];
             mOptionsKeys.append(mode.first);
+            mCameraModeSizes[mode.first] = mode.second;
             this->readSettings(mode.first, mode.second);
         }
         mCurrentOptionsKey = mOptionsKeys[0];
         mCurrentOptions = mOptions[mCurrentOptionsKey];
 
+        // Room for every camera mode plus one FFT size or depth change
+        mCorrelatorCache = new CorrelatorCache(qMax(mCorrelatorCacheSize, mOptionsKeys.size() + 1));
+        this->connect(mCorrelatorCache, SIGNAL(builtCorrelator(QSize, int)), SLOT(correlatorInitialised()));
+
+        // Debug images are created in a low priority thread of their own
+        mDebugImageRenderer = new DebugImageRenderer();
+        mDebugImageThread = new QThread(this);
+        mDebugImageRenderer->moveToThread(mDebugImageThread);
+        this->connect(mDebugImageRenderer, SIGNAL(imageRendered(QImage)), SIGNAL(debugImage(QImage)));
+        mDebugImageThread->start(QThread::LowestPriority);
+
         // Z tracker
         mDirection = 1;             // 1 or -1
         mDistance = 0.1;            // initial distance in microns
         mFocusError.prepend(1000);  // initialize error
         mFocusError.prepend(1000);
-        mFocii.prepend(0);
+        mFocii.setCapacity(10);
+        mFocii.push(0);
         mFocusThreshold = 0.01;     // threshold to activate focus correction (default is 0.005)
         mPropGainZ = 0.7;             // proportional gain for focus controller
 
@@ -127,13 +196,40 @@ namespace tracker
         foreach (OptionSet* options, mOptions)
             delete options;
 
-        delete mCorrelator;
+        if (mStageSchedulerThread && mStageSchedulerThread->isRunning())
+        {
+            mStageScheduler->stop();
+            mStageSchedulerThread->wait();
+        }
+        delete mStageScheduler;
+
+        mDebugImageThread->quit();
+        mDebugImageThread->wait();
+        delete mDebugImageRenderer;
+
+        // The cache owns the Correlators
+        mCorrelatorCache->release(mPendingCorrelator.fetchAndStoreOrdered(NULL));
+        mCorrelatorCache->release(mCorrelator);
+        delete mCorrelatorCache;
+        // Pending builds finish first (the planner is not thread safe).
+        // Their finished() signals will never be handled anymore.
+        QThreadPool::globalInstance()->waitForDone();
+        foreach (QFutureWatcher<MultiRoiTracker*>* watcher, mPendingMultiRoiWatchers)
+            delete watcher->result();
+        delete mMultiRoiTracker;
         delete mFocusTracker;
     }
 
     void Controller::run(Thread* thread)
     {
-        mIsRunning = true;
+        {
+            // updateCorrelator() decides on mIsRunning how to hand over a Correlator
+            QMutexLocker lock(&mCorrelatorMutex);
+            mIsRunning = true;
+            Correlator* pending = mPendingCorrelator.fetchAndStoreOrdered(NULL);
+            if (pending)
+                this->adoptCorrelator(pending);
+        }
         bool ready = true;
 
         if (mStage->thread() != this->thread())
@@ -161,10 +257,14 @@ namespace tracker
 
             // Reset controller variables
             mCorrelator->reset();
-            mTotalStageMove = QPointF(0.0, 0.0);
-            for (QList<QPointF>::iterator it = mSmithPredictor.begin();
-                 it != mSmithPredictor.end(); ++it)
-                 *it = QPointF(0.0, 0.0);
+            if (mMultiRoiTracker)
+                mMultiRoiTracker->reset();
+            mTransferFunction.reset(mMotionPredictorType, mKalmanProcessNoise, mKalmanMeasurementNoise);
+            mStableFrameCount = 0;
+            mRequestedOptionsKey.clear();
+            mSessionStatistics = SessionStatistics();
+            // Appending while tracking must not reallocate
+            mSessionStatistics.commandLatencies.reserve(SessionStatistics::MAX_COMMAND_LATENCIES);
 
             // Initialise tuner
             mTimingState          = WaitingOnStartup;
@@ -177,8 +277,8 @@ namespace tracker
             mTunerResults.clear();
 
             // Confine this thread to a single CPU core to avoid problems with the
-            // high performance timer on Windows.
-            setThreadAffinity(0);
+            // high performance timer on Windows (the core is configurable)
+            applyThreadProfile("Controller");
 
             // Start timer to periodically update the frame rate
             int timerID = this->startTimer(500);
@@ -246,7 +346,7 @@ namespace tracker
                 if (!mLogFileXYStageMove.isOpen())
                     TRACKER_WARNING("Could not open log file");
                 mLogFileStreamXYStageMove.setDevice(&mLogFileXYStageMove);
-                mLogFileStreamXYStageMove << "mCLock, duration, rx, ry\n";
+                mLogFileStreamXYStageMove << "mCLock, duration, rx, ry, deadline, lateness\n";
                 mLogFileStreamXYStageMove.flush();
 
                 QString fileNamePressure = storageFolder + "tracker_pressure.csv";
@@ -271,7 +371,7 @@ namespace tracker
                 if (!mLogFileContinuous.isOpen())
                     TRACKER_WARNING("Could not open log file");
                 mLogFileStreamContinuous.setDevice(&mLogFileContinuous);
-                mLogFileStreamContinuous << "captureTime,mClock,isMovingXY,isMovingZ,zPos,BV\n";
+                mLogFileStreamContinuous << "captureTime,mClock,isMovingXY,isMovingZ,zPos,BV,stateAge\n";
                 mLogFileStreamContinuous.flush();
 
                 QString fileNameParams = storageFolder + "tracker_parametersettings.csv";
@@ -344,11 +444,31 @@ namespace tracker
                 break;
             }
 
+            // Stage moves are issued from a separate thread at the right moment
+            mStageScheduler->resetStatistics();
+            mStageSchedulerThread->start(QThread::TimeCriticalPriority);
+
             // Start event loop
             thread->exec();
 
             this->killTimer(timerID);
 
+            mStageScheduler->stop();
+            mStageSchedulerThread->wait();
+            this->logIssuedStageCommands();
+            if (mStageScheduler->getIssuedCount() > 0)
+                TRACKER_INFO(QString("Stage commands issued: %1, average lateness: %2 us, maximum lateness: %3 us")
+                    .arg(mStageScheduler->getIssuedCount())
+                    .arg(mStageScheduler->getAverageLateness(), 0, 'f', 1)
+                    .arg(mStageScheduler->getMaximumLateness()), Logger::Low);
+            // Allows comparing the motion predictors on the same trajectory
+            if (mTransferFunction.getTrackingErrorCount() > 0)
+                TRACKER_INFO(QString("Tracking error (RMS): %1 over %2 images, motion predictor %3")
+                    .arg(mTransferFunction.getTrackingError(), 0, 'f', 3)
+                    .arg(mTransferFunction.getTrackingErrorCount())
+                    .arg(mMotionPredictorType == 0 ? "Smith" : mMotionPredictorType == 1
+                        ? "Kalman (constant velocity)" : "Kalman (constant acceleration)"), Logger::Low);
+
             trackerTimer->stop();
             trackerTimerXY->stop();
             //Temporal test solution -Set mLastPressureChangePassed to false 20170609
@@ -410,13 +530,21 @@ namespace tracker
             }
         }
 
-        mIsRunning = false;
+        {
+            QMutexLocker lock(&mCorrelatorMutex);
+            mIsRunning = false;
+            // A Correlator might have been handed over after the last image
+            Correlator* pending = mPendingCorrelator.fetchAndStoreOrdered(NULL);
+            if (pending)
+                this->adoptCorrelator(pending);
+        }
 
         this->moveToThread(QApplication::instance()->thread());
     }
 
     void Controller::stopIntern()
     {
+        QMutexLocker lock(&mCorrelatorMutex);
         mIsRunning = false;
         emit quit();
     }
@@ -427,9 +555,16 @@ namespace tracker
             return;
 
         mStage = stage;
+        mStageScheduler = new StageCommandScheduler(mStage);
+        mStageSchedulerThread = new Thread(mStageScheduler, this);
         mFocusTracker = new FocusTracker(mStage, mCurrentOptions->fftImageSize);
         mInitialised = true;
+
+        // Plan the Correlators of all camera modes in the background, starting
+        // with the current one
         this->updateCorrelator();
+        foreach (OptionSet* options, mOptions)
+            mCorrelatorCache->prebuild(options->fftImageSize, qMax(mCorrelatorMaxDepth, options->correlatorDepth));
     }
 
     void Controller::timerEvent(QTimerEvent* event)
@@ -448,6 +583,11 @@ namespace tracker
         //mLogFileStreamTrackerTiming << "trackImage: start at " << trackImage_start_time << "\n";
         mLogFileStreamTrackerTiming << "trackImage: start " << "\n";
 
+        // Switch to a Correlator handed over by updateCorrelator() in between two images
+        Correlator* pending = mPendingCorrelator.fetchAndStoreOrdered(NULL);
+        if (pending)
+            this->adoptCorrelator(pending);
+
         // No processing anymore if thread is waiting to be stopped
         if (!mIsRunning) {
             mLogFileStreamDuration << "return_track_image_1," << mClock.getTime() << "\n";
@@ -459,17 +599,31 @@ namespace tracker
         //mCorrelator->AssignImageToMemory(image);
         // continuous logging of z stage movement, brenner value computation, capture time, system time.        
         mCorrelator->computeBrennerValueForSnapshot(image); //temporal 20190130
-        mLogFileStreamContinuous << captureTime << "," << mClock.getTime() << "," << mStage->isMovingXY() <<
-                                    "," << mStage->isMovingZ() << "," << mStage->getZpos() << "," << mCorrelator->getLastFocus().brennerFocus << "\n";
+        // Three blocking stage queries per image are too many, use the cached state if possible
+        // (stateAge: microseconds since the readout, 0 for direct queries)
+        if (mDeviceStateCache)
+        {
+            const DeviceState state = mDeviceStateCache->getState();
+            mLogFileStreamContinuous << captureTime << "," << mClock.getTime() << "," << state.movingXY <<
+                                        "," << state.movingZ << "," << state.zPos << "," << mCorrelator->getLastFocus().brennerFocus <<
+                                        "," << (mClock.getTime() - state.time) << "\n";
+        }
+        else
+        {
+            mLogFileStreamContinuous << captureTime << "," << mClock.getTime() << "," << mStage->isMovingXY() <<
+                                        "," << mStage->isMovingZ() << "," << mStage->getZpos() << "," << mCorrelator->getLastFocus().brennerFocus <<
+                                        "," << 0 << "\n";
+        }
         //std::cout<< "BrennerValue: "<< mCorrelator->getLastFocus().brennerFocus<<std::endl;
 
         // Don't let the image buffer overflow due to missing CPU power
         quint64 currentTime = mClock.getTime();
+        ++mSessionStatistics.receivedFrames;
         if (currentTime > processTime + mMaxProcessDelay)
         {
+            ++mSessionStatistics.droppedFrames;
             // Be sure to update the Smith Predictor (acts frame based)
-            mSmithPredictor.append(QPointF(0.0, 0.0));
-            mSmithPredictor.removeFirst();
+            mTransferFunction.addStageMove(QPointF(0.0, 0.0));
             mLogFileStreamDuration << "return_track_image_2," << mClock.getTime() << "\n";
            // std::cout<<"trackImage:return_track_image_2: currentTime > processTime + mMaxProcessDelay"<<std::endl;
             return;
@@ -497,11 +651,28 @@ namespace tracker
 
         // Update frame counter (do this after the overflow protection)
         mFrameCounter.addFrame(currentTime);
+        if (mSessionStatistics.firstFrameTime == 0)
+            mSessionStatistics.firstFrameTime = currentTime;
+        mSessionStatistics.lastFrameTime = currentTime;
+
+        // Camera mode requested by adaptCameraMode(): wait for its images, but not forever
+        if (!mRequestedOptionsKey.isEmpty())
+        {
+            if ((mRequestedOptionsKey == mCurrentOptionsKey && image.size() == mCameraModeSizes[mRequestedOptionsKey])
+                || currentTime > mCameraModeRequestTime + 2000000)
+                mRequestedOptionsKey.clear();
+        }
 
         // Image has to be larger than the correlator image size
-        if (image.size().width()  < mCurrentOptions->fftImageSize.width() ||
-            image.size().height() < mCurrentOptions->fftImageSize.height())
+        if (image.size().width()  < mCorrelator->getComputationSize().width() ||
+            image.size().height() < mCorrelator->getComputationSize().height())
         {
+            // Images of the previous (smaller) camera mode are still on their way
+            if (!mRequestedOptionsKey.isEmpty())
+            {
+                mTransferFunction.addStageMove(QPointF(0.0, 0.0));
+                return;
+            }
             TRACKER_WARNING("Tracking aborted: Camera image was smaller than the FFT image");
             this->stopIntern();
             mLogFileStreamDuration << "return_track_image_4," << mClock.getTime() << "\n";
@@ -692,27 +863,50 @@ namespace tracker
         quint64 correlatorTrackImage_start_time = mClock.getTime();
         // mLogFileStreamTrackerTiming << "correlatorTrackImage: start at " << correlatorTrackImage_start_time << "\n";
         mLogFileStreamDuration << "mcorrelator_track_image," << mClock.getTime() << "\n";
-        QPointF imageOffset = mCorrelator->track(image);
-        quint64 correlatorTrackImage_end_time = mClock.getTime();
-        // mLogFileStreamTrackerTiming << "correlatorTrackImage: end at " << correlatorTrackImage_end_time << "\n";
-        mLogFileStreamTrackerTiming << "correlatorTrackImage: duration " << (correlatorTrackImage_end_time-correlatorTrackImage_start_time) << "\n";
-        mLogFileStreamDuration << "mcorrelator_track_image_end," << mClock.getTime() << "\n";
-        // Show the DFT spectrum if not using Brenner focus value
-        if (!mBrennerEnabled) {
-            // mBrennerEnabled is false, thus emit image. Duration:
-            emit debugImage(mCorrelator->getLastAdjustedDFTImage());
+        float confidence = 0.0f;
+        QPointF imageOffset;
+        bool ready;
+        if (mMultiRoiTracker)
+        {
+            imageOffset = mMultiRoiTracker->track(image, &confidence);
+            ready = mMultiRoiTracker->isReady();
+            mLogFileStreamTrackerTiming << "correlatorTrackImage: duration " << (mClock.getTime() - correlatorTrackImage_start_time)
+                                        << " regions " << mMultiRoiTracker->getRegions().size() << " confidence " << confidence << "\n";
+
+            this->reportTrackingRegions(false);
         }
+        else
+        {
+            imageOffset = mCorrelator->track(image, &confidence);
+            ready = mCorrelator->isReady();
+            quint64 correlatorTrackImage_end_time = mClock.getTime();
+            // mLogFileStreamTrackerTiming << "correlatorTrackImage: end at " << correlatorTrackImage_end_time << "\n";
+            mLogFileStreamTrackerTiming << "correlatorTrackImage: duration " << (correlatorTrackImage_end_time-correlatorTrackImage_start_time)
+                                        << " depth " << mCorrelator->getLastTrackDepth() << " confidence " << confidence << "\n";
+        }
+        mLogFileStreamDuration << "mcorrelator_track_image_end," << mClock.getTime() << "\n";
+        if (ready && mCurrentMode == Tracking && !mMultiRoiTracker)
+            this->adaptCameraMode(confidence);
+        // Show the DFT spectrum if not using Brenner focus value (there is none for the regions)
+        if (!mBrennerEnabled && !mMultiRoiTracker)
+            this->requestDebugImage();
 
         emit focusUpdated(mCorrelator->getLastFocus());
 
         // Controller transfer function
         QPointF stageMove(0.0, 0.0);
-        if (mCorrelator->isReady())
+        if (ready && mCurrentMode == Tracking && confidence < mMinimumPeakConfidence)
+        {
+            // A stage move based on an ambiguous peak does more harm than
+            // skipping one image (the Smith Predictor gets a zero move below)
+            mLogFileStreamTrackerTiming << "stageMove: skipped because of low confidence" << "\n";
+        }
+        else if (ready)
         {
             switch (mCurrentMode)
             {
             case Tracking:
-                stageMove = this->transferFunction(imageOffset);
+                stageMove = this->transferFunction(imageOffset, captureTime);
                 break;
             case Measuring:
                 stageMove = this->measuringFunction(imageOffset, image.size());
@@ -728,9 +922,11 @@ namespace tracker
         mLogFileStreamTrackerTiming << "mStage: is it moving Z? " << mStage->isMovingZ() << "\n";
         mLogFileStreamTrackerTiming << "stageMove: how much? rx: " <<  stageMove.rx() << ", ry: " << stageMove.ry() << "\n";
 
-        // Do this right here right after the image has been taken to allow for
-        // a constant delay (assuming the camera is slower than this loop)
-        if (!stageMove.isNull() && !mStage->isMovingXY())
+        // Write the moves the scheduler has issued in the meantime
+        this->logIssuedStageCommands();
+
+        // A move that is still waiting for its deadline counts as a moving stage
+        if (!stageMove.isNull() && !mStage->isMovingXY() && !mStageScheduler->hasPendingCommands())
         {
             mLogFileStreamTrackerTiming << "stageMove is not-null and stage is not moving" << "\n";
 
@@ -749,9 +945,9 @@ namespace tracker
                 }
             }
 
-            mTotalStageMove += stageMove;
             // Limit total movement
-            if (qAbs(mTotalStageMove.x()) > mMaxTotalStageMove || qAbs(mTotalStageMove.y()) > mMaxTotalStageMove)
+            const QPointF totalStageMove = mTransferFunction.getTotalStageMove() + stageMove;
+            if (qAbs(totalStageMove.x()) > mMaxTotalStageMove || qAbs(totalStageMove.y()) > mMaxTotalStageMove)
             {
                 TRACKER_WARNING("Tracking aborted: Total distance moved by the stage was exceeded");
                 this->stopIntern();
@@ -759,49 +955,59 @@ namespace tracker
                 std::cout<<"trackXY:return_track_image_5 "<<std::endl;
                 return;
             }
-            //if (clock.getTime() > imageAcquireTime + stageCommandDelay)
-            //    TRACKER_INFO("Stage command period was too high");
-
-            // Busy wait (mSleep dynamics is too slow) until the timing is just right to move the stage
-            // If we wait too long or too short, the Smith Predictor will fail
-            // Also note that we're using busyWait() instead of just queriying the time. The reason
-            // is that the query is a kernel call and high kernel times can cause the timer to go crazy
-            // (no kidding, see Microsoft KB274323)
-
-            quint64 busyWaitBeforeStageMovement_start_time = mClock.getTime();
-            // mLogFileStreamTrackerTiming << "busyWaitBeforeStageMovement: start at " << busyWaitBeforeStageMovement_start_time << "\n";
-            while (mClock.getTime() < captureTime + mCurrentOptions->stageCommandDelay * 1000)
-                busyWait(); // Wait for about 100 microseconds (not very precise at all!)
-            quint64 busyWaitBeforeStageMovement_end_time = mClock.getTime();
-            //mLogFileStreamTrackerTiming << "busyWaitBeforeStageMovement: end at " << busyWaitBeforeStageMovement_end_time << "\n";
-            mLogFileStreamTrackerTiming << "busyWaitBeforeStageMovement: duration " << (busyWaitBeforeStageMovement_end_time-busyWaitBeforeStageMovement_start_time) << "\n";
-
-            // Move
-            quint64 moveStage_start_time = mClock.getTime();
-            // TODO: test blocking
-            // 0 as second parameter calls this functionally blocking, i.e. it waits until the stage move has been completed
-            // 1 as second parameter immediately returns
-            mLogFileStreamDuration << "call_move_XY_stage" << "," << mClock.getTime() << "\n";
-            //std::cout <<"XY stage move: " << stageMove.rx() << "," << stageMove.ry() << " as blocking? " << mXYStageEnabledBlocking << std::endl;
 
-            // use the blocking state defined in the GUI
-            mStage->move(stageMove, mXYStageEnabledBlocking);
-
-            quint64 moveStage_end_time = mClock.getTime();
-            mLogFileStreamXYStageMove << mClock.getTime() << "," << (mClock.getTime()-moveStage_start_time) << "," << stageMove.rx() << "," << stageMove.ry() << "\n";
+            // The move has to be issued at exactly the stage command delay after
+            // the capture, otherwise the Smith Predictor will fail. Instead of
+            // busy waiting here, the scheduler thread sleeps until just before
+            // that moment and we can already process the next image.
+            // 0 as blocking parameter returns right after issuing the command,
+            // 1 waits (in the scheduler thread) until the move has been completed
+            quint64 deadline = captureTime + (quint64)(mCurrentOptions->stageCommandDelay * 1000);
+            mLogFileStreamDuration << "schedule_move_XY_stage" << "," << mClock.getTime() << "\n";
+            mLogFileStreamTrackerTiming << "scheduleStageMovement: due in " << ((qint64)deadline - (qint64)mClock.getTime()) << "\n";
 
-            mLogFileStreamTrackerTiming << "moveStageXY: duration " << (moveStage_end_time-moveStage_start_time) << "\n";
+            // use the blocking state defined in the GUI
+            mStageScheduler->schedule(stageMove, mXYStageEnabledBlocking, deadline, captureTime);
 
-            mSmithPredictor.append(stageMove);
+            mTransferFunction.addStageMove(stageMove);
         }
         else
         {
             mLogFileStreamTrackerTiming << "stageMove is null or stage is moving" << "\n";
-            mSmithPredictor.append(QPointF(0.0, 0.0));
+            mTransferFunction.addStageMove(QPointF(0.0, 0.0));
         }
+    }
 
-        // Advance in ring buffer for the Smith Predictor
-        mSmithPredictor.removeFirst();
+    void Controller::logIssuedStageCommands()
+    {
+        // resize(0) keeps the reserved memory, clear() would free it
+        mIssuedCommands.resize(0);
+        mStageScheduler->takeIssuedCommands(mIssuedCommands);
+        for (int i = 0; i < mIssuedCommands.size(); ++i)
+        {
+            const StageCommandScheduler::Command& command = mIssuedCommands[i];
+            // Bounded for sessions that run for days
+            if (mSessionStatistics.commandLatencies.size() < SessionStatistics::MAX_COMMAND_LATENCIES)
+                mSessionStatistics.commandLatencies.append((quint32)command.getLatency());
+            mLogFileStreamXYStageMove << command.issueTime << "," << command.duration << ","
+                                      << command.distance.x() << "," << command.distance.y() << ","
+                                      << command.deadline << "," << command.getLateness() << "\n";
+        }
+    }
+
+    void Controller::reportTrackingRegions(bool force)
+    {
+        const QVector<MultiRoiTracker::Region>& regions = mMultiRoiTracker->getRegions();
+        bool moved = force || regions.size() != mTrackedCentres.size();
+        for (int i = 0; !moved && i < regions.size(); ++i)
+            moved = regions[i].centre != mTrackedCentres[i];
+        if (!moved)
+            return;
+
+        mTrackedCentres = QVector<QPoint>(regions.size());
+        for (int i = 0; i < regions.size(); ++i)
+            mTrackedCentres[i] = regions[i].centre;
+        emit trackingRegionsUpdated(mTrackedCentres);
     }
 
     void Controller::trackZ(const QImage image, quint64 captureTime)
@@ -886,7 +1092,7 @@ namespace tracker
         double zPos = mStage->getZpos();
 
         // Keep track of past focus values
-        mFocii.prepend(brennerFocus);
+        mFocii.push(brennerFocus);
         mDistance = 0.0;
 
         // Wait until at least two focus values are available
@@ -1041,9 +1247,6 @@ namespace tracker
         }
         */
 
-        while (mFocii.size() > 10)
-            mFocii.pop_back();
-
         mLogFileStreamTrackerTiming << "trackZ: measured window half-width of brenner function " << mFocusTracker->getHalfWindowSize() << "\n";
 
         quint64 focustime = mClock.getTime();
@@ -1118,20 +1321,17 @@ namespace tracker
 
     }
 
-    QPointF Controller::transferFunction(QPointF imageOffset)
+    QPointF Controller::transferFunction(QPointF imageOffset, quint64 captureTime)
     {
         mLogFileStreamTrackerTiming << "transferFunction: start " << "\n";
-        QPointF stageMove = -stageCoordinates(imageOffset);
-
-        // Subtract all stage movements that are not yet visible on the image
-        for (int i = 0; i < mSmithPredictor.size(); ++i) {
-            // mLogFileStreamTrackerTiming << "transferFunction: mSmithPredictor i " << i << " is " <<  mSmithPredictor[i] << "\n";
-            stageMove -= mSmithPredictor[i];
-        }
-
-        // Apply controller gain
+        quint64 landingTime = captureTime
+            + (quint64)((mCurrentOptions->stageCommandDelay + mPredictionLookahead) * 1000);
+        QPointF stageMove = mTransferFunction.compute(-stageCoordinates(imageOffset), captureTime,
+                                                      landingTime, mCurrentOptions->controllerGain);
+        if (mMotionPredictorType != 0)
+            mLogFileStreamTrackerTiming << "transferFunction: predicted velocity x " << mTransferFunction.getVelocity().x()
+                                        << " y " << mTransferFunction.getVelocity().y() << "\n";
         mLogFileStreamTrackerTiming << "transferFunction: controller gain is " << mCurrentOptions->controllerGain << "\n";
-        stageMove *= mCurrentOptions->controllerGain;
 
         mLogFileStreamTrackerTiming << "transferFunction: final stage movement rx " << stageMove.rx() << " ry " << stageMove.ry() << "\n";
 
@@ -1360,81 +1560,77 @@ namespace tracker
         this->updateCorrelator();
     }
 
-    Correlator* updateCorrelatorAsynchronous(QSize fftSize, int depth)
+    void Controller::updateCorrelator()
     {
-        // Note: max. thread count is 1 for QThreadPool --> this function
-        // never runs concurrently. This is also required because the FFTW
-        // planners share data.
-        try
+        // Don't update anything at startup
+        if (!mInitialised)
+            return;
+
+        QMutexLocker lock(&mCorrelatorMutex);
+        QSize fftSize = mCurrentOptions->fftImageSize;
+        // The track depth itself can be changed without a new Correlator
+        int depth = qMax(mCorrelatorMaxDepth, mCurrentOptions->correlatorDepth);
+
+        if (mLatestCorrelator && mLatestCorrelator->getComputationSize() == fftSize &&
+            mLatestCorrelator->getMaxTrackDepth() == depth)
+            return;
+
+        Correlator* correlator = mCorrelatorCache->acquire(fftSize, depth);
+        if (!correlator)
+        {
+            // Being built, correlatorInitialised() tries again. While running,
+            // the old Correlator simply continues until then.
+            if (!mIsRunning && mCorrelator)
+            {
+                mCorrelatorCache->release(mCorrelator);
+                mCorrelator = NULL;
+                mLatestCorrelator = NULL;
+                emit validityChanged();
+            }
+            return;
+        }
+
+        mLatestCorrelator = correlator;
+        if (mIsRunning)
         {
-            return new Correlator(fftSize, depth);
+            // trackImage() picks it up before the next image
+            mCorrelatorCache->release(mPendingCorrelator.fetchAndStoreOrdered(correlator));
         }
-        catch (const Exception& ex)
+        else
         {
-            TRACKER_WARNING("Updating the correlator failed:" + ex.getDescription());
-            return NULL;
+            this->adoptCorrelator(correlator);
+            emit validityChanged();
         }
     }
 
-    void Controller::updateCorrelator()
+    void Controller::adoptCorrelator(Correlator* correlator)
     {
-        // Don't update anything at startup
-        if (!mInitialised)
-            return;
-
-        if (mIsRunning)
+        if (correlator == mCorrelator)
         {
-            TRACKER_WARNING("Cannot update Tracker while running");
+            // Acquired twice (swapped back before the last one was adopted)
+            mCorrelatorCache->release(correlator);
             return;
         }
 
+        mCorrelatorCache->release(mCorrelator);
+        mCorrelator = correlator;
+        mCorrelator->reset();
+        mCorrelator->setMinimumOffset(mMinOffset);
+        mCorrelator->setTrackDepth(mCurrentOptions->correlatorDepth);
+        mCorrelator->setAdaptiveDepth(mAdaptiveCorrelatorDepth);
+        mCorrelator->setSharpPeakConfidence(mSharpPeakConfidence);
+        if (mIsRunning && mCurrentMode == Tracking)
+            mCorrelator->setBrennerRoiPercentage(mBrennerRoiPercentage);
+
         // It's not correlator related, but since the image size might have
         // changed we need to adjust the focus tracker as well
-        mFocusTracker->resizeImageBuffer(mCurrentOptions->fftImageSize);
-
-        delete mCorrelator;
-        mCorrelator = NULL;
-
-        emit validityChanged();
-
-        // Set mouse cursor to wait symbol
-        QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
-
-        // Note: Since QThreadPool only operates with one thread, we can safely
-        // assume that the order in the Queue is preserved when the functions finish
-        QFutureWatcher<Correlator*>* watcher = new QFutureWatcher<Correlator*>(this);
-        this->connect(watcher, SIGNAL(finished()), SLOT(correlatorInitialised()));
-        mFutureCorrelatorWatchers.enqueue(watcher);
-
-        // Run planning asynchronously
-        QFuture<Correlator*> fCorrelator = QtConcurrent::run(updateCorrelatorAsynchronous,
-            mCurrentOptions->fftImageSize, mCurrentOptions->correlatorDepth);
-        watcher->setFuture(fCorrelator);
+        mFocusTracker->resizeImageBuffer(mCorrelator->getComputationSize());
     }
 
     void Controller::correlatorInitialised()
     {
-        QFutureWatcher<Correlator*>* watcher = mFutureCorrelatorWatchers.dequeue();
-        if (mIsRunning)
-        {
-            TRACKER_WARNING("Correlator was about to change while running the Tracker!");
-            delete watcher->result();
-        }
-        else
-        {
-            if (!mFutureCorrelatorWatchers.isEmpty())
-                delete watcher->result(); // New computations pending
-            else
-            {
-                mCorrelator = watcher->result();
-                mCorrelator->setMinimumOffset(mMinOffset);
-                emit validityChanged();
-            }
-        }
-
-        delete watcher;
-        // Note: Acts like a stack, so do this for EVERY call
-        QApplication::restoreOverrideCursor();
+        // The Correlator for the current options might be among the new ones
+        this->updateCorrelator();
     }
 
     void Controller::setUpperBrennerThreshold(double thresh)
@@ -1480,10 +1676,7 @@ namespace tracker
     void Controller::setPredictorSize(int value)
     {
         mCurrentOptions->predictorSize = qMax(0, value);
-        while (mSmithPredictor.size() < mCurrentOptions->predictorSize)
-            mSmithPredictor.append(QPointF(0.0, 0.0));
-        while (mSmithPredictor.size() > mCurrentOptions->predictorSize)
-            mSmithPredictor.removeLast();
+        mTransferFunction.setPredictorSize(mCurrentOptions->predictorSize);
     }
 
     void Controller::setPixelSize(QPointF value)
@@ -1542,10 +1735,216 @@ namespace tracker
         if (value != mCurrentOptions->correlatorDepth)
         {
             mCurrentOptions->correlatorDepth = value;
+            // Only builds a new Correlator beyond the maximum depth
             this->updateCorrelator();
+            if (mCorrelator && value <= mCorrelator->getMaxTrackDepth())
+                mCorrelator->setTrackDepth(value);
         }
     }
 
+    void Controller::setAdaptiveCorrelatorDepth(bool enable)
+    {
+        mAdaptiveCorrelatorDepth = enable;
+        if (mCorrelator)
+            mCorrelator->setAdaptiveDepth(enable);
+    }
+
+    void Controller::setSharpPeakConfidence(double value)
+    {
+        mSharpPeakConfidence = qMax(0.0, value);
+        if (mCorrelator)
+            mCorrelator->setSharpPeakConfidence(mSharpPeakConfidence);
+    }
+
+    void Controller::setMinimumPeakConfidence(double value)
+    {
+        mMinimumPeakConfidence = qMax(0.0, value);
+        if (mMultiRoiTracker)
+            mMultiRoiTracker->setMinimumConfidence(mMinimumPeakConfidence);
+    }
+
+    void Controller::setDebugImageFrequency(double value)
+    {
+        mDebugImageFrequency = qMax(0.0, value);
+    }
+
+    void Controller::setDebugImageVisible(bool value)
+    {
+        mDebugImageVisible = value;
+    }
+
+    void Controller::requestDebugImage()
+    {
+        // Nobody would look at it
+        if (mDebugImageFrequency <= 0.0 || !mDebugImageVisible)
+            return;
+
+        quint64 now = mClock.getTime();
+        if (now - mLastDebugImageTime < (quint64)(1e6 / mDebugImageFrequency))
+            return;
+        // Drop the image if the last one is still being rendered
+        if (!mDebugImageRenderer->tryReserve())
+            return;
+        mLastDebugImageTime = now;
+
+        QMetaObject::invokeMethod(mDebugImageRenderer, "renderSpectrum", Qt::QueuedConnection,
+                                  Q_ARG(QVector<float>, mCorrelator->getLastSpectrum()),
+                                  Q_ARG(QSize, mCorrelator->getSpectrumSize()));
+    }
+
+    void Controller::setMultiRoiSize(QSize value)
+    {
+        mMultiRoiSize = value.expandedTo(QSize(16, 16));
+    }
+
+    void Controller::setMultiRoiThreads(int value)
+    {
+        mMultiRoiThreads = qMax(1, value);
+    }
+
+    void Controller::setMotionPredictor(int value)
+    {
+        mMotionPredictorType = qBound(0, value, 2);
+    }
+
+    void Controller::setKalmanProcessNoise(double value)
+    {
+        mKalmanProcessNoise = qMax(0.0, value);
+    }
+
+    void Controller::setKalmanMeasurementNoise(double value)
+    {
+        // A perfect measurement would make the filter ignore its model entirely
+        mKalmanMeasurementNoise = qMax(1e-3, value);
+    }
+
+    void Controller::setPredictionLookahead(double value)
+    {
+        mPredictionLookahead = qMax(0.0, value);
+    }
+
+    void Controller::setAdaptiveCameraModes(QStringList modes)
+    {
+        mAdaptiveCameraModes = modes;
+    }
+
+    void Controller::setAdaptiveStableFrames(int value)
+    {
+        mAdaptiveStableFrames = qMax(1, value);
+    }
+
+    void Controller::setAdaptiveNarrowConfidence(double value)
+    {
+        mAdaptiveNarrowConfidence = qMax(0.0, value);
+    }
+
+    void Controller::setAdaptiveWidenConfidence(double value)
+    {
+        mAdaptiveWidenConfidence = qMax(0.0, value);
+    }
+
+    void Controller::adaptCameraMode(float confidence)
+    {
+        // Wait until the last request has been served
+        if (mAdaptiveCameraModes.size() < 2 || !mRequestedOptionsKey.isEmpty())
+            return;
+
+        // Options keys are made of the camera name and the camera mode
+        const QString separator = "__sep__";
+        int index = mAdaptiveCameraModes.indexOf(mCurrentOptionsKey.section(separator, 1));
+        if (index < 0)
+            return;
+
+        int target = index;
+        if (confidence < mAdaptiveWidenConfidence)
+        {
+            // Don't narrow down step by step, the object may be leaving the image
+            mStableFrameCount = 0;
+            target = 0;
+        }
+        else if (confidence >= mAdaptiveNarrowConfidence)
+        {
+            if (++mStableFrameCount >= mAdaptiveStableFrames && index + 1 < mAdaptiveCameraModes.size())
+                target = index + 1;
+        }
+        else
+            mStableFrameCount = 0;
+
+        if (target == index)
+            return;
+
+        QString key = mCurrentOptionsKey.section(separator, 0, 0) + separator + mAdaptiveCameraModes[target];
+        if (!mOptions.contains(key))
+        {
+            TRACKER_WARNING("Controller: Adaptive camera mode '" + mAdaptiveCameraModes[target]
+                            + "' does not exist, adaptive camera modes disabled");
+            mAdaptiveCameraModes.clear();
+            return;
+        }
+
+        mStableFrameCount = 0;
+        mRequestedOptionsKey = key;
+        mCameraModeRequestTime = mClock.getTime();
+        mLogFileStreamTrackerTiming << "adaptCameraMode: requesting " << mAdaptiveCameraModes[target]
+                                    << " at confidence " << confidence << "\n";
+        emit cameraModeRequested(mAdaptiveCameraModes[target]);
+    }
+
+    void Controller::setMultiRoiPolicy(int value)
+    {
+        mMultiRoiPolicy = qBound((int)MultiRoiTracker::Mean, value, (int)MultiRoiTracker::WeightedMean);
+        if (mMultiRoiTracker)
+            mMultiRoiTracker->setPolicy((MultiRoiTracker::Policy)mMultiRoiPolicy);
+    }
+
+    void Controller::setTrackingRegions(QVector<QPoint> centres)
+    {
+        // Whatever is still being built is outdated now
+        // (multiRoiTrackerBuilt() deletes it)
+        mMultiRoiWatcher = NULL;
+
+        if (centres.isEmpty())
+        {
+            QtConcurrent::run(destroyMultiRoiTracker, mMultiRoiTracker);
+            mMultiRoiTracker = NULL;
+            mTrackedCentres.clear();
+            emit trackingRegionsUpdated(centres);
+            return;
+        }
+
+        mMultiRoiWatcher = new QFutureWatcher<MultiRoiTracker*>(this);
+        this->connect(mMultiRoiWatcher, SIGNAL(finished()), SLOT(multiRoiTrackerBuilt()));
+        mPendingMultiRoiWatchers.append(mMultiRoiWatcher);
+        mMultiRoiWatcher->setFuture(QtConcurrent::run(buildMultiRoiTracker, mMultiRoiSize, centres, mMultiRoiThreads));
+    }
+
+    void Controller::multiRoiTrackerBuilt()
+    {
+        QFutureWatcher<MultiRoiTracker*>* watcher = static_cast<QFutureWatcher<MultiRoiTracker*>*>(this->sender());
+        MultiRoiTracker* tracker = watcher->result();
+        watcher->deleteLater();
+        mPendingMultiRoiWatchers.removeOne(watcher);
+
+        if (watcher != mMultiRoiWatcher)
+        {
+            QtConcurrent::run(destroyMultiRoiTracker, tracker);
+            return;
+        }
+        mMultiRoiWatcher = NULL;
+        if (!tracker)
+            return;
+
+        // Slots run in the thread of the Controller, so this is always in
+        // between two images
+        QtConcurrent::run(destroyMultiRoiTracker, mMultiRoiTracker);
+        mMultiRoiTracker = tracker;
+        mMultiRoiTracker->setPolicy((MultiRoiTracker::Policy)mMultiRoiPolicy);
+        mMultiRoiTracker->setMinimumConfidence(mMinimumPeakConfidence);
+        mMultiRoiTracker->setMinimumOffset(mMinOffset);
+
+        this->reportTrackingRegions(true);
+    }
+
     void Controller::setTunerTimeToWaitAfterStartup(int value)
     {
         mTunerTimeToWaitAfterStartup = qMax(0, value);
@@ -1578,6 +1977,19 @@ namespace tracker
         mMaxProcessDelay = qMax(0, value);
     }
 
+    void Controller::setCorrelatorMaxDepth(int value)
+    {
+        // Takes effect with the next Correlator built
+        mCorrelatorMaxDepth = qMax(1, value);
+    }
+
+    void Controller::setCorrelatorCacheSize(int value)
+    {
+        mCorrelatorCacheSize = qMax(1, value);
+        if (mCorrelatorCache)
+            mCorrelatorCache->setCapacity(qMax(mCorrelatorCacheSize, mOptionsKeys.size() + 1));
+    }
+
     void Controller::setExposureTime(double exposureTime)
     {
         mCameraExposureTime = exposureTime;
@@ -1683,6 +2095,23 @@ namespace tracker
         setTunerMinimumPixelsForMeasure(settings.value("Tuner_Minimum_Pixels_For_Measure",      10).toInt());
         setTunerMeasureMovePercentage  (settings.value("Tuner_Measure_Move_Percentage",        0.2).toDouble());
         setMaxProcessDelay             (settings.value("Max_Process_Delay",                   3000).toInt());
+        setCorrelatorCacheSize         (settings.value("Correlator_Cache_Size",                  8).toInt());
+        setCorrelatorMaxDepth          (settings.value("Correlator_Max_Depth",                   4).toInt());
+        setAdaptiveCorrelatorDepth     (settings.value("Adaptive_Correlator_Depth",          false).toBool());
+        setSharpPeakConfidence         (settings.value("Sharp_Peak_Confidence",               10.0).toDouble());
+        setMinimumPeakConfidence       (settings.value("Minimum_Peak_Confidence",              0.0).toDouble());
+        setMultiRoiSize                (settings.value("Multi_ROI_Size",          QSize(64, 64)).toSize());
+        setMultiRoiThreads             (settings.value("Multi_ROI_Threads",                      2).toInt());
+        setMultiRoiPolicy              (settings.value("Multi_ROI_Policy",                       0).toInt());
+        setDebugImageFrequency         (settings.value("Debug_Image_Frequency",               10.0).toDouble());
+        setMotionPredictor             (settings.value("Motion_Predictor",                       0).toInt());
+        setKalmanProcessNoise          (settings.value("Kalman_Process_Noise",              1000.0).toDouble());
+        setKalmanMeasurementNoise      (settings.value("Kalman_Measurement_Noise",             0.5).toDouble());
+        setPredictionLookahead         (settings.value("Prediction_Lookahead",                 0.0).toDouble());
+        setAdaptiveCameraModes         (settings.value("Adaptive_Camera_Modes",      QStringList()).toStringList());
+        setAdaptiveStableFrames        (settings.value("Adaptive_Stable_Frames",               100).toInt());
+        setAdaptiveNarrowConfidence    (settings.value("Adaptive_Narrow_Confidence",          20.0).toDouble());
+        setAdaptiveWidenConfidence     (settings.value("Adaptive_Widen_Confidence",            6.0).toDouble());
     }
 
     void Controller::writeSettings()
@@ -1699,6 +2128,23 @@ namespace tracker
         settings.setValue("Tuner_Minimum_Pixels_For_Measure", mTunerMinimumPixelsForMeasure);
         settings.setValue("Tuner_Measure_Move_Percentage",    mTunerMeasureMovePercentage);
         settings.setValue("Max_Process_Delay",                mMaxProcessDelay);
+        settings.setValue("Correlator_Cache_Size",            mCorrelatorCacheSize);
+        settings.setValue("Correlator_Max_Depth",             mCorrelatorMaxDepth);
+        settings.setValue("Adaptive_Correlator_Depth",        mAdaptiveCorrelatorDepth);
+        settings.setValue("Sharp_Peak_Confidence",            mSharpPeakConfidence);
+        settings.setValue("Minimum_Peak_Confidence",          mMinimumPeakConfidence);
+        settings.setValue("Multi_ROI_Size",                   mMultiRoiSize);
+        settings.setValue("Multi_ROI_Threads",                mMultiRoiThreads);
+        settings.setValue("Multi_ROI_Policy",                 mMultiRoiPolicy);
+        settings.setValue("Debug_Image_Frequency",            mDebugImageFrequency);
+        settings.setValue("Motion_Predictor",                 mMotionPredictorType);
+        settings.setValue("Kalman_Process_Noise",             mKalmanProcessNoise);
+        settings.setValue("Kalman_Measurement_Noise",         mKalmanMeasurementNoise);
+        settings.setValue("Prediction_Lookahead",             mPredictionLookahead);
+        settings.setValue("Adaptive_Camera_Modes",            mAdaptiveCameraModes);
+        settings.setValue("Adaptive_Stable_Frames",           mAdaptiveStableFrames);
+        settings.setValue("Adaptive_Narrow_Confidence",       mAdaptiveNarrowConfidence);
+        settings.setValue("Adaptive_Widen_Confidence",        mAdaptiveWidenConfidence);
     }
 
     void Controller::readSettings(QString settingsKey, QSize maxSize)
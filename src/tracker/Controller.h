@@ -13,17 +13,23 @@
 
 #include "TrackerPrereqs.h"
 
+#include <QAtomicPointer>
 #include <QFile>
 #include <QFutureWatcher>
 #include <QImage>
+#include <QList>
 #include <QMap>
-#include <QQueue>
+#include <QMutex>
 #include <QSize>
+#include <QStringList>
 #include <QVector>
 #include <QTimer>
 
+#include "RingBuffer.h"
+#include "StageCommandScheduler.h"
 #include "Thread.h"
 #include "Timing.h"
+#include "TransferFunction.h"
 
 namespace tracker
 {
@@ -66,6 +72,23 @@ namespace tracker
          - \ref setMaxTotalStageMove()            "Max Total Stage Move"
          - \ref setMinOffset()                    "Min Offset"
          - \ref setMaxProcessDelay                "Max Process Delay"
+         - \ref setCorrelatorCacheSize()          "Correlator Cache Size"
+         - \ref setCorrelatorMaxDepth()           "Correlator Max Depth"
+         - \ref setAdaptiveCorrelatorDepth()      "Adaptive Correlator Depth"
+         - \ref setSharpPeakConfidence()          "Sharp Peak Confidence"
+         - \ref setMinimumPeakConfidence()        "Minimum Peak Confidence"
+         - \ref setMultiRoiSize()                 "Multi ROI Size"
+         - \ref setMultiRoiThreads()              "Multi ROI Threads"
+         - \ref setMultiRoiPolicy()               "Multi ROI Policy"
+         - \ref setDebugImageFrequency()          "Debug Image Frequency"
+         - \ref setMotionPredictor()              "Motion Predictor"
+         - \ref setKalmanProcessNoise()           "Kalman Process Noise"
+         - \ref setKalmanMeasurementNoise()       "Kalman Measurement Noise"
+         - \ref setPredictionLookahead()          "Prediction Lookahead"
+         - \ref setAdaptiveCameraModes()          "Adaptive Camera Modes"
+         - \ref setAdaptiveStableFrames()         "Adaptive Stable Frames"
+         - \ref setAdaptiveNarrowConfidence()     "Adaptive Narrow Confidence"
+         - \ref setAdaptiveWidenConfidence()      "Adaptive Widen Confidence"
         - Options related to measuring or timing
          - \ref setTuningStep()                   "Tuning Step"
          - \ref setTunerTimeout()                 "Tuner timeout"
@@ -150,6 +173,26 @@ namespace tracker
             ZStack,
         };
 
+        /** Frame and latency counters of a run (see getSessionStatistics()).
+            Used by the session benchmark (dummy/SessionBenchmark.h) to
+            compare the whole camera to stage path between builds.
+        */
+        struct SessionStatistics
+        {
+            SessionStatistics()
+                : receivedFrames(0), droppedFrames(0), firstFrameTime(0), lastFrameTime(0)
+                { }
+
+            quint64          receivedFrames;    ///< Images delivered to trackImage() while running
+            quint64          droppedFrames;     ///< Images older than the maximum process delay
+            quint64          firstFrameTime;    ///< Time stamp of the first image processed
+            quint64          lastFrameTime;     ///< Time stamp of the last image processed
+            QVector<quint32> commandLatencies;  ///< Capture to Stage::move() per XY command (us)
+
+            //! Bound of commandLatencies (4 MB), reserved when the session starts
+            static const int MAX_COMMAND_LATENCIES = 1 << 20;
+        };
+
     public:
         /** Basically just sets up all the options, calls readSettings().
         @param cameraModes
@@ -223,6 +266,90 @@ namespace tracker
         */
         void setMaxProcessDelay(int value);
 
+        /** Sets how many fully planned Correlators are kept in memory.
+            Switching to a camera mode, FFT image size or correlator depth
+            that is in the cache is instantaneous, even while running. The
+            Correlators of all camera modes are always kept.
+        */
+        void setCorrelatorCacheSize(int value);
+
+        /** Sets the largest correlator depth that can be selected without
+            building a new Correlator. Every Correlator keeps that many past
+            images, so larger values cost memory but not computation time.
+            Takes effect with the next Correlator built.
+        */
+        void setCorrelatorMaxDepth(int value);
+
+        /** Sets the maximum rate of debugImage() in Hertz (0 disables it).
+            The images are only created while setDebugImageVisible() is true.
+        */
+        void setDebugImageFrequency(double value);
+
+        /** Sets the size of each region given to setTrackingRegions().
+            Takes effect with the next call to setTrackingRegions().
+        */
+        void setMultiRoiSize(QSize value);
+        /// Returns the value described in setMultiRoiSize()
+        QSize getMultiRoiSize() const
+            { return mMultiRoiSize; }
+
+        /** Sets the number of threads that correlate the regions given to
+            setTrackingRegions() in parallel.
+            Takes effect with the next call to setTrackingRegions().
+        */
+        void setMultiRoiThreads(int value);
+
+        /** Sets how the offsets of the tracking regions are combined into one
+            stage move (see MultiRoiTracker::Policy).
+        */
+        void setMultiRoiPolicy(int value);
+
+        /** Selects how transferFunction() compensates the loop latency.
+            - 0: Smith Predictor, the stage moves not yet visible on the
+              image are subtracted from the measured offset
+            - 1: Kalman filter with a constant velocity model (MotionPredictor)
+            - 2: Kalman filter with a constant acceleration model
+            \n Takes effect with the next start of the tracker.
+        */
+        void setMotionPredictor(int value);
+
+        /// See MotionPredictor::setProcessNoise() (stage units per s^2 or s^3)
+        void setKalmanProcessNoise(double value);
+
+        /// See MotionPredictor::setMeasurementNoise() (stage units)
+        void setKalmanMeasurementNoise(double value);
+
+        /** Sets the time in milliseconds from the moment a stage command is
+            issued until the stage has arrived. The Kalman predictors aim at
+            the sample position at capture time + stage command delay + this
+            value.
+        */
+        void setPredictionLookahead(double value);
+
+        /** Sets the camera modes the tracker may switch between on its own,
+            from the largest field of view to the smallest. \n
+            Once the tracking has been stable for the
+            \ref setAdaptiveStableFrames() "Adaptive Stable Frames", the next
+            smaller mode (sensor ROI or higher binning) is requested with
+            cameraModeRequested(). The tracked object stays in the centre of
+            the image, so a centred ROI keeps it in view. If the confidence
+            drops below the \ref setAdaptiveWidenConfidence()
+            "Adaptive Widen Confidence", the first mode is requested again.
+            \n Less than two modes disable the feature. Nothing happens either
+            while the current mode is not in the list (chosen manually) or
+            while tracking regions (setTrackingRegions()).
+        */
+        void setAdaptiveCameraModes(QStringList modes);
+
+        /// Sets the number of consecutive confident images required to narrow the camera mode
+        void setAdaptiveStableFrames(int value);
+
+        /// Sets the peak to sidelobe ratio from which on an image counts as stable
+        void setAdaptiveNarrowConfidence(double value);
+
+        /// Sets the peak to sidelobe ratio below which the widest camera mode is requested
+        void setAdaptiveWidenConfidence(double value);
+
         /// Sets the current \ref Controller::Mode "mode" (ignored if running)
         void setMode(Mode mode)
             { mCurrentMode = mIsRunning ? mCurrentMode : mode; }
@@ -321,15 +448,29 @@ namespace tracker
         */
         void initialise(Stage* stage);
 
+        /** Lets the continuous log take the stage state from \c cache instead
+            of querying the stage for every image (NULL: query the stage).
+            The control decisions still ask the stage directly.
+        */
+        void setDeviceStateCache(const DeviceStateCache* cache)
+            { mDeviceStateCache = cache; }
+
         /** Returns whether the Controller is ready, or more precisely whether
             there is a valid Correlator or not. \n
             This function only returns false before initialise() was called or
-            when the Correlator is currently being updated (might take a few
-            seconds).
+            when the Correlator for the current options is still being built
+            while the tracker is stopped (might take a few seconds).
         */
         bool valid() const
             { return mCorrelator != NULL; }
 
+        /** Returns the counters of the current or last run.
+            They are reset when the tracking thread starts and are not
+            synchronised: read them after the thread has finished.
+        */
+        const SessionStatistics& getSessionStatistics() const
+            { return mSessionStatistics; }
+
         /// Transforms image coordinates to stage coordinates by scaling (no inversion)
         QPointF stageCoordinates(QPointF imageCoordinates) const;
 
@@ -475,6 +616,8 @@ namespace tracker
             actual movement between the exposure of two images. That is only
             possible if the camera is not limited by the exposure time but
             by the data transfer rate. \n
+            The move itself is issued by a StageCommandScheduler so that the
+            Controller does not have to wait for that moment.
         @param value
             Delay in seconds
         */
@@ -482,10 +625,46 @@ namespace tracker
 
         /** Controls how many images are compared when computing the offset.
             A correlator depth of 1 simply means that the current image is
-            only compared to the last one.
+            only compared to the last one. \n
+            Up to \ref setCorrelatorMaxDepth() "Correlator Max Depth", the
+            change is immediate. With the adaptive depth, this is the largest
+            depth used.
         */
         void setCorrelatorDepth(int value);
 
+        /** Compares the current image only to the last one as long as the
+            correlation peak is sharp, and with all images given by the
+            correlator depth otherwise (see Correlator).
+        */
+        void setAdaptiveCorrelatorDepth(bool enable);
+
+        /** Sets the peak to sidelobe ratio of the correlation from which on
+            the adaptive correlator depth considers an image unambiguous.
+        */
+        void setSharpPeakConfidence(double value);
+
+        /** Sets the peak to sidelobe ratio of the correlation below which no
+            stage move is issued in Tracking mode. \n
+            The image is still used as reference for the next ones. 0 disables
+            the check.
+        */
+        void setMinimumPeakConfidence(double value);
+
+        /** Tracks the given regions (centres in image coordinates) instead of
+            the centred FFT image. Each region is followed on its own with a
+            MultiRoiTracker, their offsets are combined into one stage move
+            according to the \ref setMultiRoiPolicy() "Multi ROI Policy". \n
+            The MultiRoiTracker is planned in the background, the current
+            tracking continues until it is ready. An empty vector switches
+            back to the Correlator.
+        */
+        void setTrackingRegions(QVector<QPoint> centres);
+
+        /** Tells whether debugImage() is displayed at all (default: true).
+            No debug images are rendered while it is false.
+        */
+        void setDebugImageVisible(bool value);
+
         /** Set number of the delay frames for the Smith Predictor.
             On other words, this number tells you how many frames it takes
             for a stage movement to be visible on the image.
@@ -556,9 +735,21 @@ namespace tracker
         /// Raised when a new frame rate was computed (unit is frames per second)
         void frameRateUpdated(double);
 
-        /// Optionally sends debug images (has to be used specifically in the code)
+        /** Optionally sends debug images (has to be used specifically in the code).
+            Raised from a worker thread, at most with the
+            \ref setDebugImageFrequency() "Debug Image Frequency".
+        */
         void debugImage(QImage);
         void focusUpdated(const FocusValue &);
+
+        /// Raised with the current centres of the regions after every image tracked with setTrackingRegions()
+        void trackingRegionsUpdated(QVector<QPoint> centres);
+
+        /** Raised when the tracker wants to stream in a different camera mode
+            (see setAdaptiveCameraModes()). The receiver is expected to switch
+            the camera and call setOptionsKey() like for a manual change.
+        */
+        void cameraModeRequested(QString mode);
         void zmoved(double);
         void StageisMOVED();
         void takeAutoPicture();
@@ -588,13 +779,18 @@ namespace tracker
         void OffLineZstackImage(QImage imae, quint64 capturetime, quint64 processtime); // For debugging the ZstackOffLine
 
     private slots:
-        /** Called whenever the Correlator used internally was fully initialised.
-            This function properly handles the results stored in
-            Controller::mFutureCorrelatorWatchers.
+        /** Called whenever Controller::mCorrelatorCache has finished building a
+            Correlator. Tries to switch to the Correlator for the current
+            options in case it was among the missing ones.
         @see updateCorrelator()
         */
         void correlatorInitialised();
 
+        /** Switches to the MultiRoiTracker built for the last call of
+            setTrackingRegions(). Results of earlier calls are discarded.
+        */
+        void multiRoiTrackerBuilt();
+
         /// Stops the event loop by raising the Runnable::quit() signal
         void stopIntern();
 
@@ -622,7 +818,9 @@ namespace tracker
             It is called whenever the tracker starts in its own thread.
         @note
             The function confines itself to the first (virtual) CPU core to
-            avoid possible issues with the Windows Performance Timer. \n
+            avoid possible issues with the Windows Performance Timer. The core
+            and the scheduling class can be changed with the \c Controller
+            thread profile (see ThreadProfile.h). \n
             Also, before returning, the function pushes the Controller object
             back to the application's main thread (UI thread)!
         @remarks
@@ -631,27 +829,35 @@ namespace tracker
         */
         void run(Thread* thread);
 
-        /** Destroys the old Correlator and asynchronously creates a new one.
-            The actual implementation is a little tricky here, the reason being
-            the fact that initialising the Correlator might take up to 10s.
-            So it is run in another thread (hence no UI blocking) by means of
-            \c QtConcurrent::run() and we have to wait for it to finish. That's
-            when this slot is called and we can assign the new Correlator
-            (updating it always creates a new one) to Controller::mCorrelator.
+        /** Hands the Correlator matching the current options over to the tracker.
+            The Correlators come from Controller::mCorrelatorCache, which plans
+            them in the background (that might take up to 10s). If the one
+            required is not ready yet, a build is started and
+            correlatorInitialised() calls this function again when it is done.
+        @par Running
+            While stopped, the new Correlator replaces Controller::mCorrelator
+            right away. While running, it is stored in
+            Controller::mPendingCorrelator instead and trackImage() swaps it in
+            before the next image, so there is no gap in the tracking. Until a
+            missing Correlator is ready, the old one simply continues.
         @note
-            While an asynchronous Correlator initialisation is run,
-            the user might change some options again, triggering yet a
-            new initialisation. To avoid mixups in the finishing order, we
-            restrict Qt to only use one single worker thread.
-        @par Warning
-            As stated above, only one worker thread is used. However this is a
-            global Setting in \c QThreadPool. We assume here that no other part
-            of the application uses thread pools! \n
-            The setting is changed in the \ref Controller() "constructor".
-        @see correlatorFinished()
+            May be called from the UI thread (direct calls) as well as from the
+            tracking thread (queued slots), hence Controller::mCorrelatorMutex.
         */
         void updateCorrelator();
 
+        /** Requests a different camera mode according to the confidence of
+            the last image if \ref setAdaptiveCameraModes() "Adaptive Camera
+            Modes" are configured. Called for every image tracked.
+        */
+        void adaptCameraMode(float confidence);
+
+        /** Makes @a correlator the one used for tracking and gives the old one
+            back to the cache. Only call this from the thread the Controller
+            lives in (or with the tracker stopped).
+        */
+        void adoptCorrelator(Correlator* correlator);
+
         /** Focus Tracking using the Z stack.
             This makes use of the Z stack (which was acquired off-line) to
             estimate the distance from the current Z position to the Z position
@@ -659,10 +865,28 @@ namespace tracker
         */
         void trackZ(const QImage image, quint64 captureTime);
 
+        /** Hands a copy of the current spectrum to Controller::mDebugImageRenderer
+            if debugImage() is \ref setDebugImageVisible() "visible", the rate
+            allows it and the renderer is idle.
+        */
+        void requestDebugImage();
+
         /** Track image in XY
         */
         void trackXY(const QImage image, quint64 captureTime, quint64 processTime);
 
+        /** Writes the stage moves issued by Controller::mStageScheduler since
+            the last call to the XY stage movement log file.
+        */
+        void logIssuedStageCommands();
+
+        /** Emits trackingRegionsUpdated() with the centres of
+            Controller::mMultiRoiTracker if they moved since the last call (or
+            always with @a force). Every emit needs a vector of its own because
+            the queued signal shares it with the GUI thread.
+        */
+        void reportTrackingRegions(bool force);
+
         /** Reads all settings from the ini file.
             For all available settings see detailed documentation of the
             \ref Controller "class"
@@ -691,10 +915,16 @@ namespace tracker
 
         /** In terms of control theory, this is THE controller.
             It returns a desired stage movement by considering the controller
-            gain and the values stored in the \ref mSmithPredictor
-            "Smith Predictor".
+            gain and the moves stored in the Smith Predictor (see
+            TransferFunction). \n
+            With a Kalman \ref setMotionPredictor() "Motion Predictor", the
+            sample position is estimated from all images so far and the
+            stage is sent to where the sample will be when the move lands.
+            Without motion, both variants issue the same moves.
+        @param captureTime
+            Time the image with \c imageOffset was captured (microseconds)
         */
-        QPointF transferFunction(QPointF imageOffset);
+        QPointF transferFunction(QPointF imageOffset, quint64 captureTime);
 
         /// Implements the Controller::Timing mode
         QPointF timingFunction(QPointF imageOffset);
@@ -731,13 +961,50 @@ namespace tracker
         */
         Stage*                      mStage;
 
+        /// See setDeviceStateCache()
+        const DeviceStateCache*     mDeviceStateCache;
+
         /*** Object ***/
 
+        /** Issues the XY stage moves at the right time from its own thread.
+            Created in initialise() and only running while the Controller runs.
+        */
+        StageCommandScheduler*      mStageScheduler;
+        /// Thread of Controller::mStageScheduler
+        Thread*                     mStageSchedulerThread;
+
         /// Pointer to a valid correlator (can be NULL though). @see updateCorrelator()
         Correlator*                 mCorrelator;
 
-        /// Stores future Correlator pointers when initialising it (or them)
-        QQueue<QFutureWatcher<Correlator*>*> mFutureCorrelatorWatchers;
+        /// Builds and owns the Correlators of all camera modes (lives in the UI thread)
+        CorrelatorCache*            mCorrelatorCache;
+
+        /// Correlator to be swapped in by trackImage() before the next image (NULL if none)
+        QAtomicPointer<Correlator>  mPendingCorrelator;
+
+        /// Serialises updateCorrelator() and the changes of Controller::mIsRunning
+        QMutex                      mCorrelatorMutex;
+
+        /// Correlator last handed over in updateCorrelator() (protected by Controller::mCorrelatorMutex)
+        Correlator*                 mLatestCorrelator;
+
+        /// Tracks the regions of setTrackingRegions() instead of Controller::mCorrelator if not NULL
+        MultiRoiTracker*            mMultiRoiTracker;
+
+        /// Centres last reported with trackingRegionsUpdated()
+        QVector<QPoint>             mTrackedCentres;
+        /// Collects the commands for logIssuedStageCommands() (reserved, never shrinks)
+        QVector<StageCommandScheduler::Command> mIssuedCommands;
+
+        /// Background build of the last setTrackingRegions() call (NULL if none)
+        QFutureWatcher<MultiRoiTracker*>* mMultiRoiWatcher;
+        /// All builds whose result was not collected yet, superseded ones included (freed in the destructor)
+        QList<QFutureWatcher<MultiRoiTracker*>*> mPendingMultiRoiWatchers;
+
+        /// Creates the debug images in Controller::mDebugImageThread
+        DebugImageRenderer*         mDebugImageRenderer;
+        /// Low priority thread of Controller::mDebugImageRenderer
+        QThread*                    mDebugImageThread;
 
         /// High precision clock used to compute the frame rate
         HPClock                     mClock;
@@ -763,15 +1030,44 @@ namespace tracker
         bool                        mIsRunning;
         /// Helps to easily compute the frame rate
         FrameCounter                mFrameCounter;
-        /// Stores the intermediate values for the Smith Predictor. See trackImage()
-        QList<QPointF>              mSmithPredictor;
-        /// Stores the total stage movement during a single tracker run (gets reset when restarting)
-        QPointF                     mTotalStageMove;
+        /// See getSessionStatistics()
+        SessionStatistics           mSessionStatistics;
+        /// Smith Predictor or Kalman filter, total stage movement and tracking error of a run. See transferFunction()
+        TransferFunction            mTransferFunction;
 
         /*** General options ***/
         double                      mMinOffset;             ///< See setMinOffset()
         double                      mMaxTotalStageMove;     ///< See setMaxTotalStageMove()
         int                         mMaxProcessDelay;       ///< See setMaxProcessDelay()
+        int                         mCorrelatorCacheSize;   ///< See setCorrelatorCacheSize()
+        int                         mCorrelatorMaxDepth;    ///< See setCorrelatorMaxDepth()
+        bool                        mAdaptiveCorrelatorDepth; ///< See setAdaptiveCorrelatorDepth()
+        double                      mSharpPeakConfidence;   ///< See setSharpPeakConfidence()
+        double                      mMinimumPeakConfidence; ///< See setMinimumPeakConfidence()
+        QSize                       mMultiRoiSize;          ///< See setMultiRoiSize()
+        int                         mMultiRoiThreads;       ///< See setMultiRoiThreads()
+        int                         mMultiRoiPolicy;        ///< See setMultiRoiPolicy()
+        double                      mDebugImageFrequency;   ///< See setDebugImageFrequency()
+        quint64                     mLastDebugImageTime;    ///< Time of the last debug image requested
+        bool                        mDebugImageVisible;     ///< See setDebugImageVisible()
+        int                         mMotionPredictorType;   ///< See setMotionPredictor()
+        double                      mKalmanProcessNoise;    ///< See setKalmanProcessNoise()
+        double                      mKalmanMeasurementNoise; ///< See setKalmanMeasurementNoise()
+        double                      mPredictionLookahead;   ///< See setPredictionLookahead()
+        QStringList                 mAdaptiveCameraModes;   ///< See setAdaptiveCameraModes()
+        int                         mAdaptiveStableFrames;  ///< See setAdaptiveStableFrames()
+        double                      mAdaptiveNarrowConfidence; ///< See setAdaptiveNarrowConfidence()
+        double                      mAdaptiveWidenConfidence;  ///< See setAdaptiveWidenConfidence()
+
+        /*** Adaptive camera mode ***/
+        /// Image size of every camera mode (options key), as given to the constructor
+        QMap<QString, QSize>        mCameraModeSizes;
+        /// Number of consecutive images above the Adaptive Narrow Confidence
+        int                         mStableFrameCount;
+        /// Options key requested with cameraModeRequested(), empty once the new images arrive
+        QString                     mRequestedOptionsKey;
+        /// Time of the last cameraModeRequested()
+        quint64                     mCameraModeRequestTime;
 
         /*** Tuner variables ***/
         TimingState                 mTimingState;
@@ -800,7 +1096,7 @@ namespace tracker
         double                      mMaxFocus;              ///< Maximal focus value (setpoint of controller)
         int                         mDirection;             ///< Direction of the vertical movement (-1 or 1)
         double                      mDistance;              ///< Distance to move vertically (in microns)
-        QVector<double>             mFocii;                 ///< Vector of focus values
+        RingBuffer<double>          mFocii;                 ///< Last focus values (mFocii[0] is the newest)
         QVector<double>             mFocusError;            ///< Vector of focus errors
         double                      mFocusThreshold;        ///< Threshold for zMovements
         bool                        mMovedInLastCycle;      ///< Flag if we moved stage in z the last cycle
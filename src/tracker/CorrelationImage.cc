@@ -14,10 +14,13 @@
 #include <ctime>
 #include <cassert>
 #include <algorithm>
+#include <limits>
 #include <QPainter>
+#include <QVector>
 
 #include "Exception.h"
 #include "Logger.h"
+#include "PixelKernels.h"
 #include "TMath.h"
 #include "Timing.h"
 #include <iostream>
@@ -40,22 +43,27 @@ namespace tracker
 
         // Compute spatial window function
         // We multiply this with each input image to reduce edge effects
-        for (int row = 0; row < mSize.height(); ++row)
+        computeWindow(mWindow, mSize);
+    }
+
+    /*static*/ void BaseImage::computeWindow(float* window, QSize size)
+    {
+        for (int row = 0; row < size.height(); ++row)
         {
-            for (int col = 0; col < mSize.width(); ++col)
+            for (int col = 0; col < size.width(); ++col)
             {
-                int   i = row * mSize.width() + col;
-                float x = (col - mSize.width()  * 0.5f) / mSize.width();
-                float y = (row - mSize.height() * 0.5f) / mSize.height();
+                int   i = row * size.width() + col;
+                float x = (col - size.width()  * 0.5f) / size.width();
+                float y = (row - size.height() * 0.5f) / size.height();
                 // Hamming window
-                //mWindow[i]  = 0.54f + 0.46f * std::cos(2.0f * math::pi * x);
-                //mWindow[i] *= 0.54f + 0.46f * std::cos(2.0f * math::pi * y);
+                //window[i]  = 0.54f + 0.46f * std::cos(2.0f * math::pi * x);
+                //window[i] *= 0.54f + 0.46f * std::cos(2.0f * math::pi * y);
                 // Hann window (preferred over Hamming because it reaches 0 at the edges)
-                mWindow[i]  = 0.5f * (1 +  std::cos(2.0f * math::pi * x));
-                mWindow[i] *= 0.5f * (1 +  std::cos(2.0f * math::pi * y));
+                window[i]  = 0.5f * (1 +  std::cos(2.0f * math::pi * x));
+                window[i] *= 0.5f * (1 +  std::cos(2.0f * math::pi * y));
                 // Blackman window, seems to have more unwanted edge effects than the Hamming window
-                //mWindow[i]  = 0.42f + 0.5f * std::cos(2.0f * math::pi * x) + 0.08f * std::cos(4.0f * math::pi * x);
-                //mWindow[i] *= 0.42f + 0.5f * std::cos(2.0f * math::pi * y) + 0.08f * std::cos(4.0f * math::pi * y);
+                //window[i]  = 0.42f + 0.5f * std::cos(2.0f * math::pi * x) + 0.08f * std::cos(4.0f * math::pi * x);
+                //window[i] *= 0.42f + 0.5f * std::cos(2.0f * math::pi * y) + 0.08f * std::cos(4.0f * math::pi * y);
             }
         }
     }
@@ -67,14 +75,10 @@ namespace tracker
         fftwf_free(mWindow);
     }
 
-    float BaseImage::assign(const QImage image, float dcValue)
+    template <class T>
+    float BaseImage::assignSamples(const QImage& image, float dcValue)
     {
-        quint64 start_time = mClock.getTime();
-
-        // Just to be sure we don't enlarge the image...
-        assert(mSize.width() <= image.width() && mSize.height() <= image.height());
-
-        // Copy the 8 bit integer values to the float array for the DFT.
+        // Copy the integer values to the float array for the DFT.
         // Place the extract (e.g. 384x256) in the middle of the image (e.g. 400x300) for best results
         // Also multiply each value with a window function (mWindow) to reduce edge effects
         // and (very important!) first subtract the DC component (average pixel intensity)
@@ -83,104 +87,58 @@ namespace tracker
         int rowStart = (image.height() - mSize.height()) / 2;
         int rowEnd   = (image.height() - mSize.height()) / 2 + mSize.height();
         int columnStart = (image.width() - mSize.width()) / 2;
-        int fastWidth = mSize.width() - mSize.width() % 4;
         float* target = mSpatialData;
-        float* targetz = mSpatialDataZ;
-        float* window = mWindow;
-        int newDCValue = 0;
+        const float* window = mWindow;
+        quint64 newDCValue = 0;
         for (int y = rowStart; y < rowEnd; ++y)
         {
-            const uchar* sourceStart = image.scanLine(y) + columnStart;
-            const uchar* source = sourceStart;
+            const T* source = reinterpret_cast<const T*>(image.scanLine(y)) + columnStart;
+            newDCValue += PixelKernels<T>::ingestWindowed(source, window, target, mSize.width(), dcValue);
+            target += mSize.width();
+            window += mSize.width();
+        }
 
-            // Copy 4 values at a time
-            const uchar* sourceEnd = sourceStart + fastWidth;
-            while (source < sourceEnd)
-            {
-                //Z
-               // targetz[0] = ((float)source[0]);
-               // targetz[1] = ((float)source[1]);
-               // targetz[2] = ((float)source[2]);
-               // targetz[3] = ((float)source[3]);
-               // targetz += 4;
-                //XY
-                target[0] = ((float)source[0] - dcValue) * window[0];
-                newDCValue += source[0];
-                target[1] = ((float)source[1] - dcValue) * window[1];
-                newDCValue += source[1];
-                target[2] = ((float)source[2] - dcValue) * window[2];
-                newDCValue += source[2];
-                target[3] = ((float)source[3] - dcValue) * window[3];
-                newDCValue += source[3];
-                source += 4;
-                target += 4;
-                window += 4;
-            }
+        return (float)newDCValue / mArea;
+    }
 
-            // Copy the rest (at most 3, probably none)
-            sourceEnd = sourceStart + mSize.width();
-            while (source < sourceEnd)
-            {
-                //z
-                //targetz[0] = (float)source[0];
-                //++targetz;
-                //xy
-                target[0] = ((float)source[0] - dcValue) * window[0];
-                newDCValue += source[0];
-                ++source;
-                ++target;
-                ++window;
-            }
+    template <class T>
+    void BaseImage::assignSamplesZ(const QImage& image)
+    {
+        // Copy the integer values to the float array, no window this time
+        int rowStart = (image.height() - mSize.height()) / 2;
+        int rowEnd   = (image.height() - mSize.height()) / 2 + mSize.height();
+        int columnStart = (image.width() - mSize.width()) / 2;
+        float* targetz = mSpatialDataZ;
+        for (int y = rowStart; y < rowEnd; ++y)
+        {
+            const T* source = reinterpret_cast<const T*>(image.scanLine(y)) + columnStart;
+            PixelKernels<T>::ingest(source, targetz, mSize.width());
+            targetz += mSize.width();
         }
+    }
 
-        //std::cout<<"BaseImage::assign (without extractFocusBrenner): "<< (mClock.getTime()-start_time)/1000. << " ms "<<std::endl;
+    float BaseImage::assign(const QImage image, float dcValue)
+    {
+        // Just to be sure we don't enlarge the image...
+        assert(mSize.width() <= image.width() && mSize.height() <= image.height());
 
         // extract focus value based on Brenner function
         //extractFocusBrenner();
 
-        return (float)newDCValue / mArea;
+        if (isMono16(image))
+            return this->assignSamples<quint16>(image, dcValue);
+        else
+            return this->assignSamples<uchar>(image, dcValue);
     }
 
     void BaseImage::assignZ(const QImage image){
-        quint64 start_time = mClock.getTime();
-
         // Just to be sure we don't enlarge the image...
         assert(mSize.width() <= image.width() && mSize.height() <= image.height());
 
-        // Copy the 8 bit integer values to the float array for the DFT.
-        int rowStart = (image.height() - mSize.height()) / 2;
-        int rowEnd   = (image.height() - mSize.height()) / 2 + mSize.height();
-        int columnStart = (image.width() - mSize.width()) / 2;
-        int fastWidth = mSize.width() - mSize.width() % 4;
-        float* targetz = mSpatialDataZ;
-        for (int y = rowStart; y < rowEnd; ++y)
-        {
-            const uchar* sourceStart = image.scanLine(y) + columnStart;
-            const uchar* source = sourceStart;
-
-            // Copy 4 values at a time
-            const uchar* sourceEnd = sourceStart + fastWidth;
-            while (source < sourceEnd)
-            {
-                //Z
-                targetz[0] = ((float)source[0]);
-                targetz[1] = ((float)source[1]);
-                targetz[2] = ((float)source[2]);
-                targetz[3] = ((float)source[3]);
-                targetz += 4;
-                source += 4;
-            }
-
-            // Copy the rest (at most 3, probably none)
-            sourceEnd = sourceStart + mSize.width();
-            while (source < sourceEnd)
-            {
-                //z
-                targetz[0] = (float)source[0];
-                ++targetz ;
-                ++source;
-            }
-        }
+        if (isMono16(image))
+            this->assignSamplesZ<quint16>(image);
+        else
+            this->assignSamplesZ<uchar>(image);
 
         // extract focus value based on Brenner function
         /*double sum = 0.0;
@@ -327,6 +285,22 @@ namespace tracker
         mReducedMagnitude =         (float*)fftwf_malloc(sizeof(float) * mSmallerSize);
         mFrequencyData    = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * mFrequencyArea);
 
+        computeBandPassFilter(mFilter, mFrequencySize);
+
+        //std::cout<<"CorrelationImage::CorrelationImage (data allocation): "<< (mClock.getTime()-start_time)/1000. << " ms "<<std::endl;
+
+        start_time = mClock.getTime();
+        
+        // Plan forward DFT
+        mDFTPlan = fftwf_plan_dft_r2c_2d(mSize.height(), mSize.width(), mSpatialData, mFrequencyData, FFTW_MEASURE);
+        // Plan reverse DFT
+        mInverseDFTPlan = fftwf_plan_dft_c2r_2d(mSize.height(), mSize.width(), mFrequencyData, mSpatialData, FFTW_MEASURE);
+
+        //std::cout<<"CorrelationImage::CorrelationImage (setup forward and reverse DFD plans): "<< (mClock.getTime()-start_time)/1000. << " ms "<<std::endl;
+    }
+
+    /*static*/ void CorrelationImage::computeBandPassFilter(float* filter, QSize frequencySize)
+    {
         // Compute frequency window function (Gaussian low pass)
         /* Explanation:
          * Using a Gaussian filter does not produce ringing in either the
@@ -345,38 +319,27 @@ namespace tracker
          */
         float a = 6.0f;
         float b = 100.0f;
-        for (int yi = 0; yi < mFrequencySize.height(); ++yi)
+        for (int yi = 0; yi < frequencySize.height(); ++yi)
         {
             // This magic maps the pixel coordinate to a meaningful value between
             // 0 and Pi but so that 0 marks the lowest frequency.
             // (Pi is in the middle then)
-            float y = (1.0f - qAbs(2.0f * yi / mFrequencySize.height() - 1.0f)) * math::pi;
-            for (int xi = 0; xi < mFrequencySize.width(); ++xi)
+            float y = (1.0f - qAbs(2.0f * yi / frequencySize.height() - 1.0f)) * math::pi;
+            for (int xi = 0; xi < frequencySize.width(); ++xi)
             {
-                float x = (float)xi / mFrequencySize.width() * math::pi;
+                float x = (float)xi / frequencySize.width() * math::pi;
 
                 float d = std::sqrt(x * x + y * y);
                 float p = std::cos(d) - 1.0f;
                 float coeff = std::exp(a * p) * (1 - std::exp(b * p));
 
-                int i = yi * mFrequencySize.width() + xi;
+                int i = yi * frequencySize.width() + xi;
                 // Apply filter twice: we only filter the image AFTER the multiplication
                 // in the frequency domain. That requires only one filter step, but
                 // with a double filter.
-                mFilter[i] = coeff * coeff;
+                filter[i] = coeff * coeff;
             }
         }
-
-        //std::cout<<"CorrelationImage::CorrelationImage (data allocation): "<< (mClock.getTime()-start_time)/1000. << " ms "<<std::endl;
-
-        start_time = mClock.getTime();
-        
-        // Plan forward DFT
-        mDFTPlan = fftwf_plan_dft_r2c_2d(mSize.height(), mSize.width(), mSpatialData, mFrequencyData, FFTW_MEASURE);
-        // Plan reverse DFT
-        mInverseDFTPlan = fftwf_plan_dft_c2r_2d(mSize.height(), mSize.width(), mFrequencyData, mSpatialData, FFTW_MEASURE);
-
-        //std::cout<<"CorrelationImage::CorrelationImage (setup forward and reverse DFD plans): "<< (mClock.getTime()-start_time)/1000. << " ms "<<std::endl;
     }
 
     CorrelationImage::~CorrelationImage()
@@ -475,23 +438,82 @@ namespace tracker
         }
     }
 
-    QPoint CorrelationImage::getSpatialMaximum() const
+    QPoint CorrelationImage::getSpatialMaximum(float* confidence) const
+    {
+        return findMaximum(mSpatialData, mSize, confidence);
+    }
+
+    /*static*/ QPoint CorrelationImage::findMaximum(const float* spatialData, QSize size, float* confidence)
     {
+        const int area = size.width() * size.height();
         float max = 0; // all values are positive
         int maxIndex = 0;
-        float* data = mSpatialData;
-        float* dataEnd = data + mArea;
-        while (data < dataEnd)
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        const float* data = spatialData;
+        const float* dataEnd = data + area;
+        if (confidence)
+        {
+            // Separate loop to keep the plain search as lean as before
+            while (data < dataEnd)
+            {
+                float value = *data;
+                sum += value;
+                sumSquares += (double)value * value;
+                if (value > max)
+                {
+                    maxIndex = data - spatialData;
+                    max = value;
+                }
+                ++data;
+            }
+        }
+        else
         {
-            if (*data > max)
+            while (data < dataEnd)
             {
-                maxIndex = data - mSpatialData;
-                max = *data;
+                if (*data > max)
+                {
+                    maxIndex = data - spatialData;
+                    max = *data;
+                }
+                ++data;
             }
-            ++data;
         }
+        QPoint maximum(maxIndex % size.width(), maxIndex / size.width());
 
-        return QPoint(maxIndex % mSize.width(), maxIndex / mSize.width());
+        if (confidence)
+        {
+            // Take the window around the peak out of the sums. The correlation
+            // is periodic, hence the wrapped coordinates.
+            const int radius = 5;
+            int count = area;
+            for (int dy = -radius; dy <= radius; ++dy)
+            {
+                int y = (maximum.y() + dy + size.height()) % size.height();
+                for (int dx = -radius; dx <= radius; ++dx)
+                {
+                    int x = (maximum.x() + dx + size.width()) % size.width();
+                    float value = spatialData[y * size.width() + x];
+                    sum -= value;
+                    sumSquares -= (double)value * value;
+                    --count;
+                }
+            }
+
+            *confidence = 0.0f;
+            if (count > 1)
+            {
+                double mean = sum / count;
+                double variance = sumSquares / count - mean * mean;
+                if (variance > 0.0)
+                    *confidence = (float)((max - mean) / std::sqrt(variance));
+                else
+                    *confidence = std::numeric_limits<float>::max();
+            }
+        }
+
+        return maximum;
     }
 
     QImage CorrelationImage::getSpatialImage()
@@ -528,7 +550,8 @@ namespace tracker
         //  magnitude[i] = std::log(std::sqrt(mFrequencyData[i][0] * mFrequencyData[i][0] + mFrequencyData[i][1] * mFrequencyData[i][1]) + 1);
         //}
 
-        QImage image = makeQImagegraph(this->mReducedMagnitude);
+        this->reduce();
+        QImage image = makeQImagegraph(this->mReducedMagnitude, mSmallerSize);
         //delete[] magnitude;
         return image;
     }
@@ -549,38 +572,54 @@ namespace tracker
 
     void CorrelationImage::reduce()
     {
+        reduceSpectrum(mFrequencyData, mFrequencySize, mMagnitude, mReducedMagnitude);
+    }
+
+    /*static*/ void CorrelationImage::reduceSpectrum(const fftwf_complex* data, QSize frequencySize, float* magnitude, float* reduced)
+    {
+        const int frequencyArea = frequencySize.width() * frequencySize.height();
+        const int smallerSize = std::min(frequencySize.width(), frequencySize.height());
+
         // Calculate 2D magnitude and ignore phase
         // Note: x and y dimensions are swapped to have a 4 byte aligned row dimension
-        for (int i = 0; i < mFrequencyArea; ++i)
+        for (int i = 0; i < frequencyArea; ++i)
         {
             //int iOut = (i % mFrequencySize.width()) * mFrequencySize.height() + i / mFrequencySize.width();
-            mMagnitude[i] = std::log(std::sqrt(mFrequencyData[i][0] * mFrequencyData[i][0] + mFrequencyData[i][1] * mFrequencyData[i][1]) + 1);
+            magnitude[i] = std::log(std::sqrt(data[i][0] * data[i][0] + data[i][1] * data[i][1]) + 1);
         }
 
         // reduce data 1dim with square approximation Maximum of indices is sufficient
-        for (int i = 0; i < mSmallerSize; ++i)
+        for (int i = 0; i < smallerSize; ++i)
         {
-            mReducedMagnitude[i] = 0.0;
+            reduced[i] = 0.0;
         }
 
-        for (int k = 0; k < mSmallerSize; ++k)
+        for (int k = 0; k < smallerSize; ++k)
         {
-            for (int j = 0; j < mSmallerSize; ++j)
+            for (int j = 0; j < smallerSize; ++j)
             {
-                int q = mSmallerSize * k + j;   // forward index
-                int l = mSmallerSize * (mFrequencySize.height() - 1 - k) + j; // backward index
+                int q = smallerSize * k + j;   // forward index
+                int l = smallerSize * (frequencySize.height() - 1 - k) + j; // backward index
                 int i = std::max(j, k);
 
-                mReducedMagnitude[i] += mMagnitude[q] + mMagnitude[l];
+                reduced[i] += magnitude[q] + magnitude[l];
             }
         }
 
-        for (int n = 0; n < mSmallerSize; ++n)
+        for (int n = 0; n < smallerSize; ++n)
         {
-            mReducedMagnitude[n] /= (2 * n + 1); // normalize
+            reduced[n] /= (2 * n + 1); // normalize
         }
     }
 
+    /*static*/ QImage CorrelationImage::makeSpectrumImage(const fftwf_complex* data, QSize frequencySize)
+    {
+        QVector<float> magnitude(frequencySize.width() * frequencySize.height());
+        QVector<float> reduced(std::min(frequencySize.width(), frequencySize.height()));
+        reduceSpectrum(data, frequencySize, magnitude.data(), reduced.data());
+        return makeQImagegraph(reduced.constData(), reduced.size());
+    }
+
     void CorrelationImage::extractFocusDFT()
     {
         float rampsum = 0;
@@ -685,9 +724,8 @@ namespace tracker
         return image;
     }
 
-    QImage CorrelationImage::makeQImagegraph(float* data)
+    /*static*/ QImage CorrelationImage::makeQImagegraph(const float* data, int length)
     {
-        int length = this->mSmallerSize;
         // Find largest value for normalisation
         float maxValue = 0.0f;
         float minValue = 1e36f;
@@ -37,6 +37,7 @@ namespace tracker
         @param image
             Any QImage that represents a spatial image and exceeds both
             dimensions specified in CorrelationImage::CorrelationImage().
+            8 bit grey or Mono16Format (see PixelKernels.h).
         @param dcValue
             The average pixel value of the image.
         @return
@@ -91,6 +92,17 @@ namespace tracker
             mBrennerRoiPercentage = clamp(roiPrecentage, 0, 100);
         }
 
+        //! Fills \c window (\c size.width() * \c size.height() values) with the Hann window used by assign()
+        static void computeWindow(float* window, QSize size);
+
+    private:
+        //! assign() for images with samples of type T (uchar or quint16, see PixelKernels)
+        template <class T>
+        float assignSamples(const QImage& image, float dcValue);
+        //! assignZ() for images with samples of type T
+        template <class T>
+        void assignSamplesZ(const QImage& image);
+
     protected:
         QSize           mSize;          //!< Size of the spatial image
         int             mArea;          //!< Pixel area of the spatial image
@@ -231,11 +243,43 @@ namespace tracker
         //! Const overload function of getFrequencyData()
         const fftwf_complex* getFrequencyData() const
             { return mFrequencyData; }
+        //! Returns the size of the complex frequency domain image
+        QSize getFrequencySize() const
+            { return mFrequencySize; }
+
+        /** Fills \c filter with the Gaussian band pass used by
+            assignAndTransform(const CorrelationImage*, const CorrelationImage*).
+            The filter is already squared (applied once to the cross spectrum).
+        @param filter
+            Array with \c frequencySize.width() * \c frequencySize.height() values
+        @param frequencySize
+            Size of the complex frequency domain image (width is half the
+            spatial width plus one)
+        */
+        static void computeBandPassFilter(float* filter, QSize frequencySize);
+
+        /** Returns the position of the highest value in a real image.
+            See getSpatialMaximum() for the meaning of \c confidence.
+        */
+        static QPoint findMaximum(const float* data, QSize size, float* confidence = NULL);
 
         /** Returns the point in the spatial image with the highest value.
             Sub pixel accuracy is neither done nor required here.
+        @param confidence
+            If not NULL, receives the peak to sidelobe ratio (PSR): the distance
+            of the maximum to the mean of the sidelobe (everything outside a
+            small window around the maximum) in units of the standard
+            deviation of the sidelobe. Values below about 5 indicate an
+            ambiguous peak, values above 10 a clear one. The sums are collected
+            in the same pass that finds the maximum.
         */
-        QPoint getSpatialMaximum() const;
+        QPoint getSpatialMaximum(float* confidence = NULL) const;
+
+        /** Apply band pass filter on the image in the frequency domain.
+            Part of assignAndTransform(const CorrelationImage*, const CorrelationImage*),
+            public so that tools/KernelBenchmark.cc can time it on its own.
+        */
+        void filterImage();
 
         //! Debug function: Returns the spatial image (the real image) as normal QImage
         QImage getSpatialImage();
@@ -256,19 +300,30 @@ namespace tracker
         */
         QImage getSpectrumPhaseImage();
 
+        /** Debug function: Same as getSpectrumMagnitudeImage(), but for a copy
+            of the frequency domain data. Does not need an object and can
+            therefore run in any thread.
+        */
+        static QImage makeSpectrumImage(const fftwf_complex* data, QSize frequencySize);
+
         QSize getSize() const
             { return mSize; }
 
     private:
-        /** Apply band pass filter on the image in the frequency domain. */
-        void filterImage();
-
         /** Extract focus value by integrating over reduced DFT data. */
         void extractFocusDFT();
 
         /** Reduces 2D DFT data to 1D with square approximation. */
         void reduce();
 
+        /** Implementation of reduce().
+        @param magnitude
+            Temporary array with \c frequencySize.width() * \c frequencySize.height() values
+        @param reduced
+            Result with as many values as the smaller dimension of \c frequencySize
+        */
+        static void reduceSpectrum(const fftwf_complex* data, QSize frequencySize, float* magnitude, float* reduced);
+
     protected:
         /** Normalises a float image and converts it to a QImage. Also, the highest
             value is marked with a red cross.
@@ -278,7 +333,7 @@ namespace tracker
         /** Converts 1D data into a graph like image of sizw length^2,
             normalized to highest value.
         */
-        QImage makeQImagegraph(float* data);
+        static QImage makeQImagegraph(const float* data, int length);
 
         int             mSmallerSize;       //!< The smaller of the two dimensions of the spatial image
         QSize           mFrequencySize;     //!< Size of the complex frequency domain image
@@ -10,6 +10,7 @@
 #include "Correlator.h"
 
 #include <cmath>
+#include <cstring>
 
 #include "PathConfig.h"
 #include "Logger.h"
@@ -18,21 +19,28 @@
 
 namespace tracker
 {
-    Correlator::Correlator(QSize computationSize, int trackDepth)
+    Correlator::Correlator(QSize computationSize, int maxTrackDepth)
         : mCurrentImage(NULL)
         , mCurrentDCValue(128.0f)
         , mMinimumOffset(2.0f)
-        , mTrackDepth(trackDepth)
+        , mTrackDepth(maxTrackDepth)
+        , mLastTrackDepth(maxTrackDepth)
+        , mAdaptiveDepth(false)
+        , mSharpPeakConfidence(10.0f)
         , mImageSize(computationSize)
+        , mFocusRegister(6)
+        , mFocusRegisterBrenner(6)
     {
         // Track depth 0 makes no sense
-        if (trackDepth == 0)
+        if (maxTrackDepth <= 0)
             TRACKER_EXCEPTION("A track depth of 0 makes absolutely no sense!");
 
         // Create the CorrelationImages that represent the float images
         mCurrentImage = new CorrelationImage(mImageSize);
-        for (int i = 0; i < mTrackDepth; ++i)
+        for (int i = 0; i < maxTrackDepth; ++i)
             mPreviousImages.push_back(new CorrelationImage(mImageSize));
+        mLocalOffsets.resize(maxTrackDepth);
+        mLocalConfidences.resize(maxTrackDepth);
 
         // CorrelationImages for the backward DFT of the convolved images
         mConvolution = new CorrelationImage(mImageSize);
@@ -43,7 +51,7 @@ namespace tracker
     Correlator::~Correlator()
     {
         delete mCurrentImage;
-        for (int i = 0; i < mTrackDepth; ++i)
+        for (int i = 0; i < mPreviousImages.size(); ++i)
             delete mPreviousImages[i];
         delete mConvolution;
     }
@@ -51,12 +59,17 @@ namespace tracker
     void Correlator::reset()
     {
         mImagesTracked = 0;
-        for (int i = 0; i < mTrackDepth; ++i)
+        for (int i = 0; i < mPreviousImages.size(); ++i)
             mPreviousImages[i]->setOffset(QPointF(0.0, 0.0));
         mCurrentImage->setOffset(QPointF(0.0, 0.0));
     }
 
-    QPointF Correlator::track(const QImage snapshot)
+    void Correlator::setTrackDepth(int value)
+    {
+        mTrackDepth = qBound(1, value, mPreviousImages.size());
+    }
+
+    QPointF Correlator::track(const QImage snapshot, float* confidence)
     {
         quint64 start_time = mClock.getTime();
         //std::cout<<"Correlator::track start "<<std::endl;
@@ -68,8 +81,12 @@ namespace tracker
         // Only do this if the last image had significant changes
         if (!this->isReady() || mCurrentImage->getOffset().manhattanLength() > mMinimumOffset)
         {
-            mPreviousImages.push_front(mCurrentImage);
-            mCurrentImage = mPreviousImages.takeLast();
+            // Rotate in place, the queue never changes its size
+            CorrelationImage* oldest = mPreviousImages.last();
+            for (int i = mPreviousImages.size() - 1; i > 0; --i)
+                mPreviousImages[i] = mPreviousImages[i - 1];
+            mPreviousImages[0] = mCurrentImage;
+            mCurrentImage = oldest;
         }
 
         // Copy and convert image data and compute DFT
@@ -81,45 +98,62 @@ namespace tracker
         if (!this->isReady())
         {
             ++mImagesTracked;
+            if (confidence)
+                *confidence = 0.0f;
             return QPointF(0.0, 0.0);
         }
 
-        // Compare the current image with each of the previous ones and store the results
-        QVector<QPoint> localOffsets;
-        for (int i = 0; i < mPreviousImages.size(); ++i)
-            localOffsets.push_back(this->computeCorrelationMaximum(i));
+        // Compare the current image with the last one first. With an
+        // unambiguous peak, the adaptive depth skips the older images.
+        mLocalOffsets[0] = this->computeCorrelationMaximum(0, &mLocalConfidences[0]);
+        int depth = mTrackDepth;
+        if (mAdaptiveDepth && mLocalConfidences[0] >= mSharpPeakConfidence)
+            depth = 1;
+        mLastTrackDepth = depth;
+        if (confidence)
+            *confidence = mLocalConfidences[0];
+
+        // Compare the current image with the other previous ones and store the results
+        for (int i = 1; i < depth; ++i)
+            mLocalOffsets[i] = this->computeCorrelationMaximum(i, &mLocalConfidences[i]);
 
         // Calculate the first estimate based on the correlation with the last image
-        QPointF currentOffset = mPreviousImages[0]->getOffset() + localOffsets[0];
+        QPointF currentOffset = mPreviousImages[0]->getOffset() + mLocalOffsets[0];
         // Iterate through the other correlation and dispose of it in case it is
         // predicted that the local offset is larger than 13% of the image size
-        // or if it is within 10% of the predicted offset
-        QPointF temp(currentOffset);
-        size_t count = 1;
-        for (int i = 1; i < mPreviousImages.size(); ++i)
+        // or if it is within 10% of the predicted offset.
+        // The remaining ones are weighted with the confidence of their peak.
+        // The bounds keep flat correlations meaningful and perfect ones finite.
+        const float minimumWeight = 1e-3f;
+        const float maximumWeight = 1e3f;
+        float weight = qBound(minimumWeight, mLocalConfidences[0], maximumWeight);
+        QPointF temp(currentOffset * weight);
+        float weightSum = weight;
+        for (int i = 1; i < depth; ++i)
         {
             QPointF prediction = currentOffset - mPreviousImages[i]->getOffset();
             const float magicValue = 0.13f;
+            weight = qBound(minimumWeight, mLocalConfidences[i], maximumWeight);
             if (qAbs(prediction.x()) < mImageSize.width() * magicValue && qAbs(prediction.y()) < mImageSize.height() * magicValue)
             {
                 // Consider this value into the averaging
-                ++count;
-                temp += mPreviousImages[i]->getOffset() + localOffsets[i];
+                weightSum += weight;
+                temp += (mPreviousImages[i]->getOffset() + mLocalOffsets[i]) * weight;
             }
             else
             {
                 // Second chance: if the local offset is within 10% of its prediction, we consider it after all
                 const float magicValue = 0.1f;
-                if ((qAbs(prediction.x()) < 2 || qAbs((prediction.x() - localOffsets[i].x()) / prediction.x()) < magicValue)
-                 && (qAbs(prediction.y()) < 2 || qAbs((prediction.y() - localOffsets[i].y()) / prediction.y()) < magicValue))
+                if ((qAbs(prediction.x()) < 2 || qAbs((prediction.x() - mLocalOffsets[i].x()) / prediction.x()) < magicValue)
+                 && (qAbs(prediction.y()) < 2 || qAbs((prediction.y() - mLocalOffsets[i].y()) / prediction.y()) < magicValue))
                 {
-                    ++count;
-                    temp += mPreviousImages[i]->getOffset() + localOffsets[i];
+                    weightSum += weight;
+                    temp += (mPreviousImages[i]->getOffset() + mLocalOffsets[i]) * weight;
                 }
             }
         }
-        // Average
-        mCurrentImage->setOffset(temp / count);
+        // Weighted average
+        mCurrentImage->setOffset(temp / weightSum);
 
         ++mImagesTracked;
 
@@ -154,13 +188,13 @@ namespace tracker
         //std::cout<<"Correlator::computeBrennerValueForSnapshot : "<< (mClock.getTime()-start_time)/1000. << " ms "<<std::endl;
     }
 
-    QPoint Correlator::computeCorrelationMaximum(int index)
+    QPoint Correlator::computeCorrelationMaximum(int index, float* confidence)
     {
         // Compute cross correlation in the frequency domain by multiplying the complex values
         mConvolution->assignAndTransform(mCurrentImage, mPreviousImages[index]);
 
         // Calculate maximum
-        QPoint offset = mConvolution->getSpatialMaximum();
+        QPoint offset = mConvolution->getSpatialMaximum(confidence);
 
         // Correlation function is periodic
         if (offset.x() > mImageSize.width() / 2)
@@ -181,15 +215,27 @@ namespace tracker
         return mCurrentImage->getSpectrumMagnitudeImage();
     }
 
+    QVector<float> Correlator::getLastSpectrum() const
+    {
+        QSize size = mCurrentImage->getFrequencySize();
+        QVector<float> spectrum(2 * size.width() * size.height());
+        memcpy(spectrum.data(), mCurrentImage->getFrequencyData(), sizeof(float) * spectrum.size());
+        return spectrum;
+    }
+
+    QSize Correlator::getSpectrumSize() const
+    {
+        return mCurrentImage->getFrequencySize();
+    }
+
     FocusValue Correlator::getLastFocus()
     {
-        // add a filtered focus for signal stability
+        // add a filtered focus for signal stability (average of the last 6 values)
         FocusValue focuses;
-        const int registersize = 6;
 
         focuses = mCurrentImage->getFocus();
-        mFocusRegister.prepend(focuses.gaussFocus); // filter gaussFocus or integralFocus
-        mFocusRegisterBrenner.prepend(focuses.brennerFocus);    // TEMP
+        mFocusRegister.push(focuses.gaussFocus); // filter gaussFocus or integralFocus
+        mFocusRegisterBrenner.push(focuses.brennerFocus);    // TEMP
 
         double registersum = 0;
         for (int i = 0; i < mFocusRegister.size(); i++)
@@ -203,19 +249,13 @@ namespace tracker
 
         focuses.avgBrennerFocus = registersum / mFocusRegisterBrenner.size();
 
-        if (mFocusRegister.size() >= registersize)
-            mFocusRegister.remove(registersize-1);
-
-        if (mFocusRegisterBrenner.size() >= registersize)
-            mFocusRegisterBrenner.remove(registersize-1);
-
         return focuses;
     }
 
     void Correlator::setBrennerRoiPercentage(unsigned int roiPercentage)
     {
         mCurrentImage->setBrennerRoiPercentage(roiPercentage);
-        for (int i = 0; i < mTrackDepth; ++i)
+        for (int i = 0; i < mPreviousImages.size(); ++i)
             mPreviousImages[i]->setBrennerRoiPercentage(roiPercentage);
     }
 }
@@ -13,9 +13,9 @@
 #include "TrackerPrereqs.h"
 
 #include <QImage>
-#include <QList>
 #include <QVector>
 
+#include "RingBuffer.h"
 #include "Timing.h"
 
 namespace tracker
@@ -24,7 +24,20 @@ namespace tracker
         are fed in a continuous stream. The first image defines the origin. \n
         In order to compensate for possible motion blur, you can specify that
         the current image is compared not only to the last image, but to the
-        last N images. N can be specified in the constructor via \c trackDepth.
+        last N images. The constructor allocates the images for the largest N
+        (\c maxTrackDepth), the N actually used can be changed at any time with
+        setTrackDepth().
+    @par Adaptive depth
+        With setAdaptiveDepth(), the current image is first only compared to the
+        last one. The older images are only taken into account when the
+        correlation peak of that comparison is ambiguous (see
+        setSharpPeakConfidence()). The cost per image then follows the
+        difficulty of the image instead of the worst case.
+    @par Confidence
+        Every correlation peak comes with its peak to sidelobe ratio (see
+        CorrelationImage::getSpatialMaximum()). The offsets to the previous
+        images are averaged with these values as weights, and track() reports
+        the confidence of the comparison with the last image.
         \n\n
         For detailed information about the image analysis algorithms used, see
         CorrelationImage.
@@ -36,8 +49,14 @@ namespace tracker
     class Correlator
     {
     public:
-        //! Initializes all the required CorrelationImages.
-        Correlator(QSize computationSize, int trackDepth);
+        /** Initializes all the required CorrelationImages.
+        @param computationSize
+            Size of the images used for the correlation
+        @param maxTrackDepth
+            Largest track depth that can be selected with setTrackDepth(). The
+            track depth is initially set to this value.
+        */
+        Correlator(QSize computationSize, int maxTrackDepth);
 
         ~Correlator();
 
@@ -51,12 +70,16 @@ namespace tracker
             with offsets that are clearly wrong when looking at the offsets of
             preceding/succeeding images.
         @note
-            The first few images (about as many as \c trackDepth) do not yet
+            The first few images (about as many as the track depth) do not yet
             yield any useful result (just 0|0).
         @param snapshot
             The current image for which the displacement should be computed.
+        @param confidence
+            If not NULL, receives the peak to sidelobe ratio of the correlation
+            with the last image (0 while not yet ready). Low values mean the
+            returned offset should not be trusted.
         */
-        QPointF track(const QImage snapshot);
+        QPointF track(const QImage snapshot, float* confidence = NULL);
 
         /** Sets a minimum offset under which an image is simply ignored
             and doesn't affect any succeeding images.
@@ -67,16 +90,62 @@ namespace tracker
         float getMinimumOffset() const
             { return mMinimumOffset; }
 
+        //! Returns the size of the images used for the correlation.
+        QSize getComputationSize() const
+            { return mImageSize; }
+
         /** Returns whether enough images have been submitted to fill the queue
             and therefore start with the tracking. See note in track().
         */
         bool isReady() const
             { return mImagesTracked > mTrackDepth + 1; }
 
+        /** Sets how many previous images the current one is compared to.
+            Takes effect with the next image, the past images are always kept
+            for the maximum track depth.
+        @param value
+            Clamped to [1, getMaxTrackDepth()]
+        */
+        void setTrackDepth(int value);
+        //! Returns the value described in setTrackDepth().
+        int getTrackDepth() const
+            { return mTrackDepth; }
+        //! Returns the \c maxTrackDepth specified in the constructor.
+        int getMaxTrackDepth() const
+            { return mPreviousImages.size(); }
+        //! Returns the track depth that was effectively used for the last image.
+        int getLastTrackDepth() const
+            { return mLastTrackDepth; }
+
+        //! Enables or disables the adaptive track depth (see class description).
+        void setAdaptiveDepth(bool enable)
+            { mAdaptiveDepth = enable; }
+        //! Returns the value described in setAdaptiveDepth().
+        bool getAdaptiveDepth() const
+            { return mAdaptiveDepth; }
+
+        /** Sets the peak to sidelobe ratio from which on a correlation peak
+            is considered unambiguous by the adaptive track depth.
+        */
+        void setSharpPeakConfidence(float value)
+            { mSharpPeakConfidence = value; }
+        //! Returns the value described in setSharpPeakConfidence().
+        float getSharpPeakConfidence() const
+            { return mSharpPeakConfidence; }
+
         //! Debug image: returns the last inverse Fourier transform of the cross spectrum.
         QImage getLastCorrelationImage();
         //! Debug image: returns the last spectrum magnitude image of the input image.
         QImage getLastAdjustedDFTImage();
+
+        /** Returns a copy of the spectrum of the last image (interleaved real
+            and imaginary parts), see CorrelationImage::makeSpectrumImage().
+            Copying is cheap compared to creating the debug image itself,
+            which can then be done in another thread.
+        */
+        QVector<float> getLastSpectrum() const;
+        //! Returns the size of the complex spectrum returned by getLastSpectrum()
+        QSize getSpectrumSize() const;
         //! extracts the last focus values
         FocusValue getLastFocus();
         //! Set the Brenner focus region percentage
@@ -87,21 +156,28 @@ namespace tracker
         void computeBrennerValueForSnapshot(const QImage snapshot);
 
     private:
-        //! Computes the offset of the current image with one from the queue with index \c index.
-        QPoint computeCorrelationMaximum(int index);
+        /** Computes the offset of the current image with one from the queue with index \c index.
+            The peak to sidelobe ratio is stored in \c confidence.
+        */
+        QPoint computeCorrelationMaximum(int index, float* confidence);
 
-        QList<CorrelationImage*>    mPreviousImages;    //!< Array of last N images delivered to the algorithm
+        QVector<CorrelationImage*>  mPreviousImages;    //!< Last images delivered to the algorithm (always the maximum track depth)
         CorrelationImage*           mCurrentImage;      //!< Image currently being processed
         float                       mCurrentDCValue;    //!< DC value (average pixel intensity) of the last image
         CorrelationImage*           mConvolution;       //!< Temporary image used for the offset calculation
         float                       mMinimumOffset;     //!< See setMinimumOffset()
-        const int                   mTrackDepth;        //!< Specifies how many images are to be compared
+        int                         mTrackDepth;        //!< Specifies how many images are to be compared
+        int                         mLastTrackDepth;    //!< See getLastTrackDepth()
+        bool                        mAdaptiveDepth;     //!< See setAdaptiveDepth()
+        float                       mSharpPeakConfidence; //!< See setSharpPeakConfidence()
+        QVector<QPoint>             mLocalOffsets;      //!< Offsets to the previous images (kept to avoid allocations)
+        QVector<float>              mLocalConfidences;  //!< Peak to sidelobe ratios belonging to mLocalOffsets
         QSize                       mImageSize;         //!< Easy access to image dimensions
         int                         mImagesTracked;     //!< Number of images already tracked (can be reset)
-        QVector<double>             mFocusRegister;     //!< Register of saved focus values, used for filtering of focus signal
+        RingBuffer<double>          mFocusRegister;     //!< Register of saved focus values, used for filtering of focus signal
 
         // TEMP
-        QVector<double>             mFocusRegisterBrenner;
+        RingBuffer<double>          mFocusRegisterBrenner;
         HPClock                     mClock;
     };
 }
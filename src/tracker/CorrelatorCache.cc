@@ -0,0 +1,193 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "CorrelatorCache.h"
+
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentRun>
+
+#include "Correlator.h"
+#include "Exception.h"
+#include "Logger.h"
+
+namespace tracker
+{
+    static Correlator* buildCorrelator(QSize fftSize, int depth)
+    {
+        // Note: max. thread count is 1 for QThreadPool --> this function
+        // never runs concurrently. This is also required because the FFTW
+        // planners share data.
+        try
+        {
+            return new Correlator(fftSize, depth);
+        }
+        catch (const Exception& ex)
+        {
+            TRACKER_WARNING("Creating the correlator failed:" + ex.getDescription());
+            return NULL;
+        }
+    }
+
+    static void destroyCorrelator(Correlator* correlator)
+    {
+        // Destroying the FFTW plans must not interfere with a build either
+        delete correlator;
+    }
+
+    CorrelatorCache::CorrelatorCache(int capacity, QObject* parent)
+        : QObject(parent)
+        , mUseCounter(0)
+        , mCapacity(qMax(1, capacity))
+    {
+    }
+
+    CorrelatorCache::~CorrelatorCache()
+    {
+        foreach (QFutureWatcher<Correlator*>* watcher, mPending)
+        {
+            watcher->waitForFinished();
+            delete watcher->result();
+            delete watcher;
+        }
+        // Pending deletions from evict()
+        QThreadPool::globalInstance()->waitForDone();
+
+        foreach (const Entry& entry, mEntries)
+        {
+            if (entry.users > 0)
+                TRACKER_WARNING("CorrelatorCache: Deleting a Correlator that is still in use");
+            delete entry.correlator;
+        }
+    }
+
+    void CorrelatorCache::prebuild(QSize fftSize, int depth)
+    {
+        if (QThread::currentThread() != this->thread())
+        {
+            // The watcher has to live in our thread
+            QMetaObject::invokeMethod(this, "prebuild", Qt::QueuedConnection,
+                                      Q_ARG(QSize, fftSize), Q_ARG(int, depth));
+            return;
+        }
+
+        Key key(fftSize, depth);
+        QMutexLocker lock(&mMutex);
+        if (mEntries.contains(key) || mPending.contains(key))
+            return;
+
+        QFutureWatcher<Correlator*>* watcher = new QFutureWatcher<Correlator*>(this);
+        this->connect(watcher, SIGNAL(finished()), SLOT(buildFinished()));
+        mPending.insert(key, watcher);
+        watcher->setFuture(QtConcurrent::run(buildCorrelator, fftSize, depth));
+    }
+
+    Correlator* CorrelatorCache::acquire(QSize fftSize, int depth)
+    {
+        {
+            QMutexLocker lock(&mMutex);
+            QMap<Key, Entry>::iterator it = mEntries.find(Key(fftSize, depth));
+            if (it != mEntries.end())
+            {
+                ++it->users;
+                it->lastUse = ++mUseCounter;
+                return it->correlator;
+            }
+        }
+
+        this->prebuild(fftSize, depth);
+        return NULL;
+    }
+
+    void CorrelatorCache::release(Correlator* correlator)
+    {
+        if (!correlator)
+            return;
+
+        QMutexLocker lock(&mMutex);
+        for (QMap<Key, Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+        {
+            if (it->correlator == correlator)
+            {
+                if (it->users > 0)
+                    --it->users;
+                break;
+            }
+        }
+        this->evict();
+    }
+
+    bool CorrelatorCache::isCached(QSize fftSize, int depth) const
+    {
+        QMutexLocker lock(&mMutex);
+        return mEntries.contains(Key(fftSize, depth));
+    }
+
+    void CorrelatorCache::setCapacity(int capacity)
+    {
+        QMutexLocker lock(&mMutex);
+        mCapacity = qMax(1, capacity);
+        this->evict();
+    }
+
+    void CorrelatorCache::buildFinished()
+    {
+        QFutureWatcher<Correlator*>* watcher = static_cast<QFutureWatcher<Correlator*>*>(this->sender());
+        Correlator* correlator = watcher->result();
+
+        QMutexLocker lock(&mMutex);
+        QSize fftSize;
+        int depth = 0;
+        for (QMap<Key, QFutureWatcher<Correlator*>*>::iterator it = mPending.begin(); it != mPending.end(); ++it)
+        {
+            if (it.value() == watcher)
+            {
+                fftSize = it.key().size;
+                depth   = it.key().depth;
+                if (correlator)
+                {
+                    Entry entry;
+                    entry.correlator = correlator;
+                    entry.users      = 0;
+                    entry.lastUse    = ++mUseCounter;
+                    mEntries.insert(it.key(), entry);
+                }
+                mPending.erase(it);
+                break;
+            }
+        }
+        this->evict();
+        lock.unlock();
+
+        watcher->deleteLater();
+        if (correlator)
+            emit builtCorrelator(fftSize, depth);
+    }
+
+    void CorrelatorCache::evict()
+    {
+        while (mEntries.size() > mCapacity)
+        {
+            QMap<Key, Entry>::iterator oldest = mEntries.end();
+            for (QMap<Key, Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+            {
+                if (it->users == 0 && (oldest == mEntries.end() || it->lastUse < oldest->lastUse))
+                    oldest = it;
+            }
+            // Everything else is in use
+            if (oldest == mEntries.end())
+                break;
+
+            QtConcurrent::run(destroyCorrelator, oldest->correlator);
+            mEntries.erase(oldest);
+        }
+    }
+}
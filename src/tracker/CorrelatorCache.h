@@ -0,0 +1,128 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _CorrelatorCache_H__
+#define _CorrelatorCache_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QFutureWatcher>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QSize>
+
+namespace tracker
+{
+    /** Keeps fully planned Correlator objects around, keyed by FFT image size
+        and maximum track depth.
+        Creating a Correlator takes up to several seconds because of the FFTW
+        planning. The cache builds the instances in the background (see
+        prebuild()) and hands them out with acquire() as soon as they are ready,
+        so switching between camera modes or FFT sizes does not need to stall
+        the tracker.
+    @par Ownership
+        The cache owns all Correlators. A Correlator handed out by acquire() is
+        never evicted or deleted before it was given back with release().
+    @par FFTW
+        Building and deleting Correlators both use the FFTW planner, which is
+        not thread safe. Both are therefore done with \c QtConcurrent::run() in
+        the global thread pool that the Controller limits to one thread.
+        Executing existing plans (tracking) may run concurrently.
+    @par Thread safety
+        All public functions may be called from any thread. Builds are always
+        started in the thread the cache lives in, which is also where
+        builtCorrelator() is raised.
+    */
+    class CorrelatorCache : public QObject
+    {
+        Q_OBJECT;
+
+    public:
+        /** Creates an empty cache.
+        @param capacity
+            Maximum number of Correlators kept. Correlators in use are never
+            evicted, even if that exceeds the limit.
+        */
+        CorrelatorCache(int capacity, QObject* parent = NULL);
+        //! Waits for pending builds and deletes all Correlators
+        ~CorrelatorCache();
+
+        /** Returns a ready Correlator for the given parameters or NULL if
+            there is none yet. In the latter case, a build is started.
+            Each successful call has to be matched by a release().
+        */
+        Correlator* acquire(QSize fftSize, int depth);
+
+        //! Hands back a Correlator obtained with acquire() (NULL is ignored)
+        void release(Correlator* correlator);
+
+        //! Tells whether a Correlator with the given parameters is ready
+        bool isCached(QSize fftSize, int depth) const;
+
+        //! Sets the number of unused Correlators kept (at least 1)
+        void setCapacity(int capacity);
+
+    public slots:
+        /** Starts building a Correlator in the background unless it is
+            already cached or being built. Never blocks.
+        */
+        void prebuild(QSize fftSize, int depth);
+
+    signals:
+        //! Raised when a background build has finished successfully
+        void builtCorrelator(QSize fftSize, int depth);
+
+    private slots:
+        //! Moves the results of finished builds into the cache
+        void buildFinished();
+
+    private:
+        Q_DISABLE_COPY(CorrelatorCache);
+
+        //! Identifies a Correlator configuration
+        struct Key
+        {
+            Key(QSize size, int depth)
+                : size(size), depth(depth) { }
+
+            bool operator<(const Key& other) const
+            {
+                if (size.width() != other.size.width())
+                    return size.width() < other.size.width();
+                if (size.height() != other.size.height())
+                    return size.height() < other.size.height();
+                return depth < other.depth;
+            }
+
+            QSize size;
+            int   depth;
+        };
+
+        //! A cached Correlator with its usage information
+        struct Entry
+        {
+            Correlator* correlator;
+            int         users;      //!< Number of acquire() calls not yet released
+            quint64     lastUse;    //!< Value of CorrelatorCache::mUseCounter at the last acquire()
+        };
+
+        //! Deletes unused Correlators (least recently used first) beyond the capacity. Expects mMutex to be locked.
+        void evict();
+
+        mutable QMutex                              mMutex;         //!< Protects mEntries, mPending and mUseCounter
+        QMap<Key, Entry>                            mEntries;       //!< Ready Correlators
+        QMap<Key, QFutureWatcher<Correlator*>*>     mPending;       //!< Builds in progress
+        quint64                                     mUseCounter;    //!< Increases with every acquire()
+        int                                         mCapacity;      //!< See setCapacity()
+    };
+}
+
+#endif /* _CorrelatorCache_H__ */
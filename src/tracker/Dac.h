@@ -15,6 +15,10 @@
 
 namespace tracker
 {
+    /** Abstract interface to the DAC that sets and reads the pressure.
+        setvoltage() and readvoltage() are called from the GUI and from the
+        DeviceStateCache thread, implementations have to serialise them.
+    */
     class Dac : public QObject
     {
         //Q_OBJECT;
@@ -0,0 +1,36 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "DebugImageRenderer.h"
+
+#include <QMetaType>
+
+#include "CorrelationImage.h"
+
+namespace tracker
+{
+    DebugImageRenderer::DebugImageRenderer(QObject* parent)
+        : QObject(parent)
+        , mBusy(0)
+    {
+        // Required for the queued renderSpectrum() calls
+        qRegisterMetaType<QVector<float> >("QVector<float>");
+    }
+
+    void DebugImageRenderer::renderSpectrum(QVector<float> spectrum, QSize frequencySize)
+    {
+        if (spectrum.size() == 2 * frequencySize.width() * frequencySize.height())
+        {
+            const fftwf_complex* data = reinterpret_cast<const fftwf_complex*>(spectrum.constData());
+            emit imageRendered(CorrelationImage::makeSpectrumImage(data, frequencySize));
+        }
+        mBusy.fetchAndStoreOrdered(0);
+    }
+}
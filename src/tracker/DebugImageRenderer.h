@@ -0,0 +1,67 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _DebugImageRenderer_H__
+#define _DebugImageRenderer_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QObject>
+#include <QSize>
+#include <QVector>
+
+namespace tracker
+{
+    /** Creates the debug images of the Controller from copies of the tracking
+        data, so the tracking thread only pays for the copy.
+    @par Usage
+        Move the object to a (low priority) worker thread. Call tryReserve()
+        from the producing thread and only if it succeeds, invoke
+        renderSpectrum() with a queued connection. That way, at most one
+        request is pending and images are dropped instead of queued up when
+        the worker falls behind.
+    */
+    class DebugImageRenderer : public QObject
+    {
+        Q_OBJECT;
+
+    public:
+        DebugImageRenderer(QObject* parent = NULL);
+
+        /** Returns true if no image is being rendered and marks the renderer
+            busy until the next renderSpectrum() call has finished.
+        */
+        bool tryReserve()
+            { return mBusy.testAndSetOrdered(0, 1); }
+
+    public slots:
+        /** Creates the spectrum image (see CorrelationImage::makeSpectrumImage())
+            and raises imageRendered().
+        @param spectrum
+            Complex values with interleaved real and imaginary parts
+        @param frequencySize
+            Size of the complex frequency domain image
+        */
+        void renderSpectrum(QVector<float> spectrum, QSize frequencySize);
+
+    signals:
+        //! Raised from the worker thread for every image created
+        void imageRendered(QImage image);
+
+    private:
+        Q_DISABLE_COPY(DebugImageRenderer);
+
+        QAtomicInt  mBusy;  //!< 1 between tryReserve() and the end of renderSpectrum()
+    };
+}
+
+#endif /* _DebugImageRenderer_H__ */
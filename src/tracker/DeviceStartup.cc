@@ -0,0 +1,410 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "DeviceStartup.h"
+
+#include <exception>
+#include <QFile>
+#include <QMetaObject>
+#include <QRunnable>
+#include <QSettings>
+#include <QTextStream>
+
+#include "Exception.h"
+#include "Logger.h"
+#include "PathConfig.h"
+
+namespace tracker
+{
+    //! Runs one Background task in the pool
+    class DeviceStartup::Runner : public QRunnable
+    {
+    public:
+        Runner(DeviceStartup* startup, Task* task, int index)
+            : mStartup(startup)
+            , mTask(task)
+            , mIndex(index)
+            { }
+
+        void run()
+        {
+            mStartup->execute(mTask);
+            QMetaObject::invokeMethod(mStartup, "backgroundTaskDone", Qt::QueuedConnection, Q_ARG(int, mIndex));
+        }
+
+    private:
+        DeviceStartup*  mStartup;
+        Task*           mTask;
+        int             mIndex;
+    };
+
+    static QString toMilliseconds(quint64 time)
+    {
+        return QString::number(time / 1000.0, 'f', 1);
+    }
+
+    DeviceStartup::DeviceStartup(QObject* parent)
+        : QObject(parent)
+        , mStarted(false)
+        , mFinished(false)
+        , mParallel(true)
+    {
+        mStartTime = mClock.getTime();
+        this->readSettings();
+    }
+
+    DeviceStartup::~DeviceStartup()
+    {
+        // The tasks reference objects that are about to be destroyed
+        this->waitForDone();
+        qDeleteAll(mTasks);
+        this->writeSettings();
+    }
+
+    void DeviceStartup::readSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DeviceStartup");
+
+        mParallel = settings.value("Parallel", true).toBool();
+
+        settings.endGroup();
+    }
+
+    void DeviceStartup::writeSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DeviceStartup");
+
+        settings.setValue("Parallel", mParallel);
+
+        settings.endGroup();
+    }
+
+    void DeviceStartup::addTask(const QString& name, QObject* object, const char* method,
+                                const QStringList& dependencies, Execution execution)
+    {
+        if (mStarted)
+            TRACKER_EXCEPTION("DeviceStartup: Task '" + name + "' added after start()");
+        if (this->findTask(name))
+            TRACKER_EXCEPTION("DeviceStartup: Task '" + name + "' added twice");
+
+        Task* task = new Task();
+        task->name         = name;
+        task->object       = object;
+        task->method       = method;
+        task->dependencies = dependencies;
+        task->execution    = execution;
+        task->state        = Waiting;
+        task->queueTime    = 0;
+        task->startTime    = 0;
+        task->endTime      = 0;
+        mTasks.append(task);
+    }
+
+    void DeviceStartup::start()
+    {
+        if (mStarted)
+            return;
+
+        int backgroundTasks = 0;
+        foreach (Task* task, mTasks)
+        {
+            foreach (const QString& dependency, task->dependencies)
+            {
+                if (!this->findTask(dependency))
+                    TRACKER_EXCEPTION("DeviceStartup: Unknown dependency '" + dependency + "' of '" + task->name + "'");
+            }
+            if (task->object && task->execution == Background)
+                ++backgroundTasks;
+        }
+        // Each of them mostly waits for a device, the number of cores does not matter
+        mPool.setMaxThreadCount(mParallel ? qMax(1, backgroundTasks) : 1);
+
+        mStarted = true;
+        this->schedule();
+        this->checkFinished();
+    }
+
+    void DeviceStartup::waitForDone()
+    {
+        mPool.waitForDone();
+    }
+
+    void DeviceStartup::beginPhase(const QString& name, const QStringList& dependencies)
+    {
+        if (this->findTask(name))
+            return;
+
+        Task* task = new Task();
+        task->name         = name;
+        task->object       = NULL;
+        task->dependencies = dependencies;
+        task->execution    = GuiThread;
+        task->state        = Running;
+        task->queueTime    = this->elapsed();
+        task->startTime    = task->queueTime;
+        task->endTime      = 0;
+        mTasks.append(task);
+    }
+
+    void DeviceStartup::endPhase(const QString& name)
+    {
+        Task* task = this->findTask(name);
+        if (!task || task->object || task->state != Running)
+            return;
+
+        task->endTime = this->elapsed();
+        task->state   = Ready;
+        emit taskReady(name);
+
+        this->schedule();
+        this->checkFinished();
+    }
+
+    void DeviceStartup::schedule()
+    {
+        if (!mStarted)
+            return;
+
+        for (int i = 0; i < mTasks.size(); ++i)
+        {
+            Task* task = mTasks[i];
+            if (task->state != Waiting)
+                continue;
+
+            bool ready = true;
+            QString failedDependency;
+            foreach (const QString& dependency, task->dependencies)
+            {
+                const State state = this->findTask(dependency)->state;
+                if (state == Failed)
+                    failedDependency = dependency;
+                else if (state != Ready)
+                    ready = false;
+            }
+
+            if (!failedDependency.isEmpty())
+            {
+                task->state = Failed;
+                task->error = "Requires " + failedDependency;
+                emit taskFailed(task->name, task->error);
+                // Tasks before this one may depend on it
+                i = -1;
+                continue;
+            }
+            if (!ready)
+                continue;
+
+            task->state     = Running;
+            task->queueTime = this->elapsed();
+            if (task->execution == Background)
+                mPool.start(new Runner(this, task, i));
+            else
+                QMetaObject::invokeMethod(this, "runGuiTask", Qt::QueuedConnection, Q_ARG(int, i));
+        }
+    }
+
+    void DeviceStartup::execute(Task* task)
+    {
+        task->startTime = this->elapsed();
+        try
+        {
+            if (!QMetaObject::invokeMethod(task->object, task->method.constData(), Qt::DirectConnection))
+                task->error = "No slot " + QString(task->method);
+        }
+        catch (const Exception& ex)
+        {
+            task->error = ex.getDescription();
+        }
+        catch (const std::exception& ex)
+        {
+            task->error = ex.what();
+        }
+        catch (...)
+        {
+            task->error = "Unknown exception";
+        }
+        task->endTime = this->elapsed();
+    }
+
+    void DeviceStartup::backgroundTaskDone(int index)
+    {
+        this->complete(mTasks[index]);
+    }
+
+    void DeviceStartup::runGuiTask(int index)
+    {
+        Task* task = mTasks[index];
+        this->execute(task);
+        this->complete(task);
+    }
+
+    void DeviceStartup::complete(Task* task)
+    {
+        if (task->error.isEmpty())
+        {
+            task->state = Ready;
+            emit taskReady(task->name);
+        }
+        else
+        {
+            task->state = Failed;
+            TRACKER_LOG_GENERIC(tracker::Logger::Exception, "Starting '" + task->name + "' failed: " + task->error, 0, Logger::High);
+            emit taskFailed(task->name, task->error);
+        }
+
+        this->schedule();
+        this->checkFinished();
+    }
+
+    void DeviceStartup::checkFinished()
+    {
+        if (!mStarted || mFinished || !this->getPendingTasks().isEmpty())
+            return;
+
+        mFinished = true;
+        emit finished();
+    }
+
+    DeviceStartup::Task* DeviceStartup::findTask(const QString& name) const
+    {
+        foreach (Task* task, mTasks)
+        {
+            if (task->name == name)
+                return task;
+        }
+        return NULL;
+    }
+
+    bool DeviceStartup::isReady(const QString& name) const
+    {
+        Task* task = this->findTask(name);
+        return task && task->state == Ready;
+    }
+
+    QStringList DeviceStartup::getPendingTasks() const
+    {
+        QStringList pending;
+        foreach (Task* task, mTasks)
+        {
+            if (task->state == Waiting || task->state == Running)
+                pending.append(task->name);
+        }
+        return pending;
+    }
+
+    QStringList DeviceStartup::getFailedTasks() const
+    {
+        QStringList failed;
+        foreach (Task* task, mTasks)
+        {
+            if (task->state == Failed)
+                failed.append(task->name);
+        }
+        return failed;
+    }
+
+    QList<DeviceStartup::Task*> DeviceStartup::getCriticalPath() const
+    {
+        Task* last = NULL;
+        foreach (Task* task, mTasks)
+        {
+            if (task->state == Ready && (!last || task->endTime >= last->endTime))
+                last = task;
+        }
+
+        QList<Task*> path;
+        for (Task* task = last; task; )
+        {
+            path.prepend(task);
+            Task* previous = NULL;
+            foreach (const QString& dependency, task->dependencies)
+            {
+                Task* candidate = this->findTask(dependency);
+                if (candidate && (!previous || candidate->endTime > previous->endTime))
+                    previous = candidate;
+            }
+            task = previous;
+        }
+        return path;
+    }
+
+    QString DeviceStartup::getTimeline() const
+    {
+        QString text;
+        QTextStream stream(&text);
+
+        const QList<Task*> criticalPath = this->getCriticalPath();
+        const quint64 total = criticalPath.isEmpty() ? 0 : criticalPath.last()->endTime;
+
+        stream << "Startup timeline (" << (mParallel ? "parallel" : "sequential")
+               << ", ms since the start, total " << toMilliseconds(total) << " ms):";
+        foreach (Task* task, mTasks)
+        {
+            stream << "\n  " << task->name.leftJustified(20, ' ');
+            if (task->state == Waiting)
+            {
+                stream << "not started";
+                continue;
+            }
+            const quint64 end = task->state == Running ? this->elapsed() : task->endTime;
+            stream << toMilliseconds(task->startTime).rightJustified(8, ' ') << " - "
+                   << toMilliseconds(end).rightJustified(8, ' ') << "  ("
+                   << toMilliseconds(end - task->startTime) << " ms";
+            // Time in the queue of the pool or of the event loop
+            if (task->startTime > task->queueTime)
+                stream << ", queued " << toMilliseconds(task->startTime - task->queueTime) << " ms";
+            stream << (task->object ? (task->execution == Background ? ", pool" : ", GUI") : ", phase") << ")";
+            if (task->state == Running)
+                stream << " still running";
+            else if (task->state == Failed)
+                stream << " FAILED: " << task->error;
+        }
+
+        if (!criticalPath.isEmpty())
+        {
+            QStringList path;
+            foreach (Task* task, criticalPath)
+                path.append(task->name);
+            stream << "\n  Critical path: " << path.join(" -> ");
+        }
+
+        stream.flush();
+        return text;
+    }
+
+    bool DeviceStartup::writeTimeline(const QString& filename) const
+    {
+        QFile file(filename);
+        if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text))
+        {
+            TRACKER_WARNING("DeviceStartup: Could not write " + filename);
+            return false;
+        }
+
+        static const char* states[] = { "waiting", "running", "ready", "failed" };
+        const QList<Task*> criticalPath = this->getCriticalPath();
+        QTextStream stream(&file);
+        stream << "name,execution,queued_ms,start_ms,end_ms,state,critical,error\n";
+        foreach (Task* task, mTasks)
+        {
+            stream << task->name << ","
+                   << (task->object ? (task->execution == Background ? "pool" : "gui") : "phase") << ","
+                   << toMilliseconds(task->queueTime) << ","
+                   << toMilliseconds(task->startTime) << ","
+                   << toMilliseconds(task->endTime) << ","
+                   << states[task->state] << ","
+                   << (criticalPath.contains(task) ? 1 : 0) << ","
+                   << "\"" << QString(task->error).replace('"', "'") << "\"\n";
+        }
+        return true;
+    }
+}
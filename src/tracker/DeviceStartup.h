@@ -0,0 +1,184 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _DeviceStartup_H__
+#define _DeviceStartup_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "Timing.h"
+
+namespace tracker
+{
+    /** Brings up the devices as named tasks with dependencies and records a
+        timeline of where the startup time goes.
+        Opening the stage driver, the camera SDK, the DAQ tasks and the serial
+        ports are all blocking calls that have nothing to do with each other.
+        A task starts as soon as all of its dependencies are ready, the ones
+        running in the background do so concurrently on a pool of their own
+        (the global pool is reserved for the FFTW planning, see Controller).
+    @par Tasks
+        A task is a slot of some QObject that is invoked without arguments.
+        \c Background tasks run in a pool thread: objects they create have to
+        be moved to the GUI thread before the slot returns and cannot have a
+        parent in the GUI thread. \c GuiThread tasks are queued in the thread
+        DeviceStartup lives in and do everything else (connections, widgets).
+        A task fails if its slot throws; everything depending on it fails as
+        well and is never started.
+    @par Phases
+        Work that is started elsewhere and finishes on its own (e.g. the
+        Correlator built in the background) can be added to the timeline with
+        beginPhase() and endPhase().
+    @par Settings
+         - \c Parallel: Run the background tasks concurrently (default: true).
+           \c false runs them one after the other, which is the sequential
+           startup to compare the timeline with.
+    */
+    class DeviceStartup : public QObject
+    {
+        Q_OBJECT;
+
+    public:
+        //! Where a task is run
+        enum Execution
+        {
+            Background, //!< Pool thread, concurrently with the others
+            GuiThread   //!< Thread of the DeviceStartup (queued)
+        };
+
+        //! Reads the settings, the timeline starts here
+        DeviceStartup(QObject* parent = NULL);
+        //! Waits for the running background tasks and calls writeSettings()
+        ~DeviceStartup();
+
+        /** Adds a task, only before start().
+        @param name
+            Unique name, also used in the timeline
+        @param object
+            Object with the slot (not owned)
+        @param method
+            Name of the slot without signature, e.g. "openStage"
+        @param dependencies
+            Names of the tasks that have to be ready first
+        @param execution
+            See Execution
+        */
+        void addTask(const QString& name, QObject* object, const char* method,
+                     const QStringList& dependencies = QStringList(), Execution execution = Background);
+        //! Starts all tasks without dependencies and returns immediately
+        void start();
+        //! Blocks until no background task is running anymore
+        void waitForDone();
+
+        //! Adds a phase that ends with endPhase() to the timeline
+        void beginPhase(const QString& name, const QStringList& dependencies = QStringList());
+        //! Ends a phase started with beginPhase() (ignored if there is none)
+        void endPhase(const QString& name);
+
+        //! Returns true if the task or phase @a name has finished successfully
+        bool isReady(const QString& name) const;
+        //! Returns the names of the tasks and phases that have not finished yet
+        QStringList getPendingTasks() const;
+        //! Returns the names of the failed tasks
+        QStringList getFailedTasks() const;
+
+        /** Returns the timeline as text: start, end and duration of every task
+            and phase in milliseconds since construction, the time it waited
+            for its dependencies and the critical path.
+        */
+        QString getTimeline() const;
+        /** Writes the timeline as CSV file, returns false on failure.
+            The column \c critical is 1 for the tasks on the critical path.
+        */
+        bool writeTimeline(const QString& filename) const;
+
+    signals:
+        /** A task or phase finished successfully.
+            Emitted before any task depending on it is started.
+        */
+        void taskReady(const QString& name);
+        //! A task failed, either itself or because of a dependency
+        void taskFailed(const QString& name, const QString& error);
+        //! All tasks and phases have finished (successfully or not)
+        void finished();
+
+    private slots:
+        //! Queued from the pool thread when a background task has returned
+        void backgroundTaskDone(int index);
+        //! Queued by schedule() for the GuiThread tasks
+        void runGuiTask(int index);
+
+    private:
+        Q_DISABLE_COPY(DeviceStartup);
+
+        class Runner;
+
+        enum State
+        {
+            Waiting,    //!< Dependencies not ready yet
+            Running,    //!< Started (or queued in the pool)
+            Ready,      //!< Finished successfully
+            Failed      //!< Threw or a dependency failed
+        };
+
+        struct Task
+        {
+            QString     name;
+            QObject*    object;         //!< NULL for phases
+            QByteArray  method;
+            QStringList dependencies;
+            Execution   execution;
+            State       state;
+            quint64     queueTime;      //!< All dependencies ready (us since mStartTime)
+            quint64     startTime;      //!< Slot entered
+            quint64     endTime;        //!< Slot returned
+            QString     error;          //!< Exception description if it failed
+        };
+
+        //! Starts every waiting task whose dependencies are ready
+        void schedule();
+        //! Invokes the slot, records the times and catches the exceptions
+        void execute(Task* task);
+        //! Updates the state after execute() and continues with the dependents
+        void complete(Task* task);
+        //! Emits finished() once nothing is pending anymore
+        void checkFinished();
+
+        Task* findTask(const QString& name) const;
+        /** Returns the tasks from the start to the one that finished last,
+            following the dependency that was ready last.
+        */
+        QList<Task*> getCriticalPath() const;
+        //! Microseconds since construction
+        quint64 elapsed() const
+            { return mClock.getTime() - mStartTime; }
+
+        void readSettings();
+        void writeSettings();
+
+        QList<Task*>        mTasks;         //!< Tasks and phases in the order they were added
+        QThreadPool         mPool;          //!< Runs the Background tasks
+        bool                mStarted;
+        bool                mFinished;      //!< finished() has been emitted
+        bool                mParallel;      //!< See settings
+
+        HPClock             mClock;
+        quint64             mStartTime;     //!< Origin of the timeline
+    };
+}
+
+#endif /* _DeviceStartup_H__ */
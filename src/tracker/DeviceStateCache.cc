@@ -0,0 +1,117 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "DeviceStateCache.h"
+
+#include <QApplication>
+#include <QSettings>
+
+#include "Dac.h"
+#include "PathConfig.h"
+#include "PressureSensor.h"
+#include "Stage.h"
+#include "ThreadProfile.h"
+
+namespace tracker
+{
+    DeviceStateCache::DeviceStateCache(Stage* stage, Dac* dac, PressureSensor* pressureSensor)
+        : mStage(stage)
+        , mDac(dac)
+        , mPressureSensor(pressureSensor)
+        , mSequence(0)
+        , mPollInterval(20)
+    {
+        DeviceState empty = { 0, 0.0, 0.0, 0.0, false, false, 0.0f, 0.0f };
+        mState = empty;
+
+        this->readSettings();
+        // Nobody should ever see the empty state
+        this->poll();
+    }
+
+    DeviceStateCache::~DeviceStateCache()
+    {
+        this->writeSettings();
+    }
+
+    void DeviceStateCache::readSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DeviceStateCache");
+
+        mPollInterval = qMax(1, settings.value("Poll_Interval_[ms]", 20).toInt());
+
+        settings.endGroup();
+    }
+
+    void DeviceStateCache::writeSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DeviceStateCache");
+
+        settings.setValue("Poll_Interval_[ms]", mPollInterval);
+
+        settings.endGroup();
+    }
+
+    void DeviceStateCache::run(Thread* thread)
+    {
+        applyThreadProfile("DeviceState");
+
+        int timerID = this->startTimer(mPollInterval);
+        thread->exec();
+        this->killTimer(timerID);
+
+        this->moveToThread(QApplication::instance()->thread());
+    }
+
+    void DeviceStateCache::timerEvent(QTimerEvent*)
+    {
+        this->poll();
+    }
+
+    void DeviceStateCache::poll()
+    {
+        // Read everything first, the driver calls must not extend the write section
+        DeviceState state = mState;
+        if (mStage)
+        {
+            state.xPos     = mStage->getXpos();
+            state.yPos     = mStage->getYpos();
+            state.zPos     = mStage->getZpos();
+            state.movingXY = mStage->isMovingXY();
+            state.movingZ  = mStage->isMovingZ();
+        }
+        if (mDac)
+            state.dacVoltage = mDac->readvoltage();
+        if (mPressureSensor)
+            state.pressure = mPressureSensor->getPressure();
+        state.time = mClock.getTime();
+
+        // Odd sequence number while writing (the atomic operations are full barriers)
+        mSequence.fetchAndAddOrdered(1);
+        mState = state;
+        mSequence.fetchAndAddOrdered(1);
+    }
+
+    DeviceState DeviceStateCache::getState() const
+    {
+        forever
+        {
+            const int before = mSequence.fetchAndAddOrdered(0);
+            if (before & 1)
+                continue;   // Writer busy, the copy takes nanoseconds
+
+            DeviceState state = mState;
+            if (mSequence.fetchAndAddOrdered(0) == before)
+                return state;
+        }
+    }
+}
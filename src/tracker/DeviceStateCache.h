@@ -0,0 +1,100 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _DeviceStateCache_H__
+#define _DeviceStateCache_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QAtomicInt>
+
+#include "Thread.h"
+#include "Timing.h"
+
+namespace tracker
+{
+    //! Readings of the slow devices at one point in time
+    struct DeviceState
+    {
+        quint64     time;           //!< HPClock time at the end of the readout
+        double      xPos;           //!< Stage X position in micrometers
+        double      yPos;           //!< Stage Y position in micrometers
+        double      zPos;           //!< Stage Z position in micrometers
+        bool        movingXY;       //!< See Stage::isMovingXY()
+        bool        movingZ;        //!< See Stage::isMovingZ()
+        float       dacVoltage;     //!< See Dac::readvoltage()
+        float       pressure;       //!< See PressureSensor::getPressure()
+    };
+
+    /** Polls the stage, the DAC and the pressure sensor at a fixed rate and
+        keeps the latest readings for everybody else.
+        Every stage or DAC query is a blocking driver call (the DAC even
+        restarts its task for every read). Code that runs per frame (display,
+        continuous log, image metadata) reads getState() instead, which never
+        touches the hardware.
+    @par Seqlock
+        The snapshot is published with a sequence counter that is odd while
+        the polling thread writes. getState() copies the snapshot and retries
+        if the counter was odd or changed in the meantime. Readers never
+        block the writer and never wait for a driver call.
+    @par Thread safety
+        getState() may be called from any thread. Like the
+        StageCommandScheduler, the polling thread queries the stage while the
+        Controller uses it as well.
+    @par Settings
+         - \c Poll_Interval_[ms]: Time between two readouts (default: 20)
+         - CPU core and priority: \c DeviceState thread profile (see ThreadProfile.h)
+    */
+    class DeviceStateCache : public Runnable
+    {
+        Q_OBJECT;
+
+    public:
+        /** Reads the settings and takes a first snapshot right away.
+            Any of the devices may be NULL, its values stay 0 then.
+        */
+        DeviceStateCache(Stage* stage, Dac* dac, PressureSensor* pressureSensor);
+        //! Calls writeSettings()
+        ~DeviceStateCache();
+
+        //! Returns the latest snapshot (lock free, from any thread)
+        DeviceState getState() const;
+
+        //! Returns the time between two readouts in milliseconds
+        int getPollInterval() const
+            { return mPollInterval; }
+
+    private:
+        Q_DISABLE_COPY(DeviceStateCache);
+
+        //! Polls the devices until the thread quits
+        void run(Thread* thread);
+        //! Takes a snapshot whenever the poll timer fires
+        void timerEvent(QTimerEvent* event);
+
+        //! Reads all devices and publishes the result
+        void poll();
+
+        void readSettings();
+        void writeSettings();
+
+        Stage*              mStage;
+        Dac*                mDac;
+        PressureSensor*     mPressureSensor;
+
+        mutable QAtomicInt  mSequence;      //!< Odd while mState is being written
+        DeviceState         mState;         //!< Only written by poll()
+
+        int                 mPollInterval;  //!< See getPollInterval()
+        HPClock             mClock;
+    };
+}
+
+#endif /* _DeviceStateCache_H__ */
@@ -12,6 +12,7 @@
 #include <QPainter>
 #include "TMath.h"
 #include "Logger.h"
+#include "PixelKernels.h"
 
 namespace tracker
 {
@@ -20,6 +21,7 @@ namespace tracker
         , mTimerID(0)
         , mZoom(1.0)
         , mLastPosition(0, 0)
+        , mRegionSize(64, 64)
     {
         this->setDisplayFrequency(24);
     }
@@ -46,10 +48,56 @@ namespace tracker
         }
     }
 
+    void DraggableLabel::setRegionSize(QSize size)
+    {
+        mRegionSize = size;
+        mUpdateImage = true;
+    }
+
     void DraggableLabel::mousePressEvent(QMouseEvent* ev)
     {
         QLabel::mousePressEvent(ev);
         mLastPosition = ev->pos();
+
+        if (ev->button() != Qt::RightButton || mNewImage.isNull())
+            return;
+
+        // Edit the regions that are drawn: the tracked ones have moved away
+        // from the clicks and sending the clicks again would snap them back
+        if (!mTrackedRegions.isEmpty())
+        {
+            mSelectedRegions = mTrackedRegions;
+            // Show the edited selection until the new regions are reported
+            mTrackedRegions.clear();
+        }
+
+        if (ev->modifiers() & Qt::ShiftModifier)
+            mSelectedRegions.clear();
+        else
+        {
+            QPoint position = ev->pos() / mZoom;
+            if (position.x() >= mNewImage.width() || position.y() >= mNewImage.height())
+                return;
+
+            // Remove the region under the cursor or add a new one
+            bool removed = false;
+            for (int i = 0; i < mSelectedRegions.size(); ++i)
+            {
+                QRect region(QPoint(0, 0), mRegionSize);
+                region.moveCenter(mSelectedRegions[i]);
+                if (region.contains(position))
+                {
+                    mSelectedRegions.remove(i);
+                    removed = true;
+                    break;
+                }
+            }
+            if (!removed)
+                mSelectedRegions.append(position);
+        }
+
+        mUpdateImage = true;
+        emit regionsSelected(mSelectedRegions);
     }
 
     void DraggableLabel::mouseMoveEvent(QMouseEvent* ev)
@@ -99,9 +147,20 @@ namespace tracker
             if (qRound(mZoom * 100.0) != 100)
                 painter.scale(mZoom, mZoom);
 
-            painter.drawImage(0, 0, mNewImage);
+            // Only converts 16 bit images, and only the ones actually painted
+            painter.drawImage(0, 0, toDisplayImage(mNewImage));
             if (!mNewDebugImage.isNull())
                 painter.drawImage(0, mNewImage.height(), mNewDebugImage);
+
+            // Tracking regions (the ones actually tracked if available)
+            const QVector<QPoint>& regions = mTrackedRegions.isEmpty() ? mSelectedRegions : mTrackedRegions;
+            painter.setPen(mTrackedRegions.isEmpty() ? Qt::yellow : Qt::green);
+            for (int i = 0; i < regions.size(); ++i)
+            {
+                QRect region(QPoint(0, 0), mRegionSize);
+                region.moveCenter(regions[i]);
+                painter.drawRect(region);
+            }
         }
     }
 
@@ -117,6 +176,12 @@ namespace tracker
         mUpdateImage = true;
     }
 
+    void DraggableLabel::showTrackedRegions(QVector<QPoint> centres)
+    {
+        mTrackedRegions = centres;
+        mUpdateImage = true;
+    }
+
     void DraggableLabel::timerEvent(QTimerEvent* event)
     {
         if (mUpdateImage)
@@ -15,6 +15,7 @@
 #include <QImage>
 #include <QLabel>
 #include <QMouseEvent>
+#include <QVector>
 #include <QWheelEvent>
 
 namespace tracker
@@ -27,7 +28,11 @@ namespace tracker
         The label itself doesn't perform any dragging action. Only the resizing
         via scroll wheel events is handled directly. \n
         Use displayImage() to display images that are only drawn with a
-        specified update frequency (see setDisplayFrequency()).
+        specified update frequency (see setDisplayFrequency()). \n
+        A right click selects a region for tracking at the cursor or removes
+        the region under it, shift + right click removes all of them. Every
+        change is reported with regionsSelected(). Once showTrackedRegions()
+        has been called, the tracked centres are the ones that are edited.
     @note
         Zooming (resizing) is always proportional to the current size. The
         resulting offsets caused by the discretisation are compensated for.
@@ -57,6 +62,9 @@ namespace tracker
         double getZoom() const
             { return mZoom; }
 
+        //! Sets the size of the regions selected with the right mouse button (image pixels)
+        void setRegionSize(QSize size);
+
     public slots:
         /** Stores a new image to be displayed in a buffer. It only gets drawn
             upon the update timer event. There is almost no performance penalty
@@ -67,6 +75,10 @@ namespace tracker
         void displayDebugImage(QImage image);
         //! Overwrites the content of the label with background colour.
         void clearImage();
+        /** Draws the tracked regions at the given centres instead of the
+            selected ones (an empty vector shows the selection again).
+        */
+        void showTrackedRegions(QVector<QPoint> centres);
 
     signals:
         //! Occurs whenever the user dragged (click+move) the label content.
@@ -76,6 +88,8 @@ namespace tracker
         */
         void zoomChanged(double);
 		void labelrequestszmove(double);
+        //! Occurs whenever the user added or removed a tracking region (centres in image pixels)
+        void regionsSelected(QVector<QPoint> centres);
 
     protected:
         virtual void mousePressEvent(QMouseEvent* ev);
@@ -98,6 +112,10 @@ namespace tracker
         bool        mUpdateImage;
 
         QPoint      mLastPosition;          //!< Stores the last know mouse position
+
+        QSize           mRegionSize;        //!< See setRegionSize()
+        QVector<QPoint> mSelectedRegions;   //!< Centres selected with the mouse
+        QVector<QPoint> mTrackedRegions;    //!< Centres reported by showTrackedRegions()
     };
 }
 
@@ -51,6 +51,8 @@ namespace tracker
         // We throw away 3 images, so we need to have at least 2 to consider
         // for statistical measures (mean, stddev)
         assert(ZSTACK_IMAGES_PER_POSITION >= 5);
+        // resize(0) keeps reserved memory, clear() would free it for every position
+        mBrennerTemp.reserve(ZSTACK_IMAGES_PER_POSITION + 1);
     }
 
     FocusTracker::~FocusTracker()
@@ -220,7 +222,7 @@ namespace tracker
             mStage->moveZ(mStepSize, 1);
             mStampStageMoved = mClock.getTime();
 
-            mBrennerTemp.clear();
+            mBrennerTemp.resize(0);
 
             // Check whether we've taken enough images and if so, emit zStackFinished()
             if (mZStack.size() == mStackNumImages) {
@@ -331,7 +333,7 @@ namespace tracker
             mStage->moveZ(mStepSize, 1);
             mStampStageMoved = mClock.getTime();
 
-            mBrennerTemp.clear();
+            mBrennerTemp.resize(0);
 
             // Check whether we've taken enough images and if so, emit zStackFinished()
             if (mZStack.size() == mStackNumImages) {
@@ -0,0 +1,359 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "FrameCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+namespace tracker
+{
+    // Payload: one header byte (number of zero low bits shifted away), then
+    // for each line blocks of up to sBlockSize samples: 5 bit Rice parameter
+    // followed by the codes of the zigzag folded prediction errors. A code is
+    // a unary quotient (zeros terminated by a one) and k remainder bits, or
+    // sEscape zeros, a one and the raw value. Bits are packed LSB first.
+
+    // Noise the codes cannot shrink is stored raw (header byte sRawFlag).
+
+    static const int sBlockSize = 16;
+    static const int sRawFlag   = 0x80;
+    static const int sEscape    = 16;   //!< Longest unary quotient
+
+    //! Index of the lowest set bit (\c value must not be 0)
+    static inline int lowestBit(quint64 value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+#  ifdef _M_X64
+        _BitScanForward64(&index, value);
+#  else
+        if (!_BitScanForward(&index, (unsigned long)value))
+        {
+            _BitScanForward(&index, (unsigned long)(value >> 32));
+            index += 32;
+        }
+#  endif
+        return (int)index;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+
+    class BitWriter
+    {
+    public:
+        BitWriter(uchar* target)
+            : mTarget(target), mBegin(target), mBuffer(0), mCount(0)
+            { }
+
+        //! Appends the lowest \c bits (at most 32) of \c value
+        void put(quint32 value, int bits)
+        {
+            mBuffer |= (quint64)value << mCount;
+            mCount += bits;
+            if (mCount >= 32)
+            {
+                const quint32 word = (quint32)mBuffer;
+                memcpy(mTarget, &word, 4);
+                mTarget += 4;
+                mBuffer >>= 32;
+                mCount -= 32;
+            }
+        }
+
+        //! Writes the remaining bits and returns the total number of bytes
+        int finish()
+        {
+            for (; mCount > 0; mCount -= 8, mBuffer >>= 8)
+                *mTarget++ = (uchar)mBuffer;
+            mCount = 0;
+            return (int)(mTarget - mBegin);
+        }
+
+    private:
+        uchar*          mTarget;
+        uchar*          mBegin;
+        quint64         mBuffer;
+        int             mCount;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uchar* source, qint64 size)
+            : mSource(source), mEnd(source + size), mBuffer(0), mCount(0), mPadding(0)
+            { this->refill(); }
+
+        //! Makes sure at least 57 bits are buffered (zeros past the end)
+        void refill()
+        {
+            while (mCount <= 56)
+            {
+                if (mSource < mEnd)
+                    mBuffer |= (quint64)*mSource++ << mCount;
+                else
+                    ++mPadding;
+                mCount += 8;
+            }
+        }
+
+        quint32 get(int bits)
+        {
+            this->refill();
+            const quint32 value = (quint32)(mBuffer & (((quint64)1 << bits) - 1));
+            mBuffer >>= bits;
+            mCount -= bits;
+            return value;
+        }
+
+        //! Reads a unary number, returns -1 if it is longer than \c limit
+        int getUnary(int limit)
+        {
+            this->refill();
+            if ((mBuffer & (((quint64)2 << limit) - 1)) == 0)
+                return -1;
+            const int zeros = lowestBit(mBuffer);
+            mBuffer >>= zeros + 1;
+            mCount -= zeros + 1;
+            return zeros;
+        }
+
+        //! Tells whether more bits were read than there are
+        bool overrun() const
+            { return mPadding * 8 > mCount; }
+
+    private:
+        const uchar*    mSource;
+        const uchar*    mEnd;
+        quint64         mBuffer;
+        int             mCount;
+        int             mPadding;       //!< Zero bytes added past the end
+    };
+
+    //! Median edge detector of LOCO-I (a: left, b: up, c: upper left)
+    static inline int predict(int a, int b, int c)
+    {
+        const int mx = a > b ? a : b;
+        const int mn = a > b ? b : a;
+        if (c >= mx)
+            return mn;
+        if (c <= mn)
+            return mx;
+        return a + b - c;
+    }
+
+    /** Computes the folded prediction errors of line \c y.
+        \c line and \c previous are the (shifted) samples of this and the line
+        above (NULL for the first line).
+    */
+    static inline void computeErrors(const quint32* line, const quint32* previous, int width,
+                                     int bits, quint32* errors)
+    {
+        const int mask = (1 << bits) - 1;
+        const int half = 1 << (bits - 1);
+        for (int x = 0; x < width; ++x)
+        {
+            int prediction;
+            if (previous == NULL)
+                prediction = x > 0 ? line[x - 1] : 0;
+            else if (x == 0)
+                prediction = previous[0];
+            else
+                prediction = predict(line[x - 1], previous[x], previous[x - 1]);
+
+            // Modulo the sample range, the error then fits into 'bits' bits
+            int error = ((int)line[x] - prediction) & mask;
+            if (error >= half)
+                error -= mask + 1;
+            errors[x] = (quint32)((error << 1) ^ (error >> 31));
+        }
+    }
+
+    template <class T>
+    static int compressSamples(const uchar* data, int width, int height, int bytesPerLine, uchar* target)
+    {
+        // Low bits that are zero everywhere carry no information
+        quint32 used = 0;
+        for (int y = 0; y < height; ++y)
+        {
+            const T* source = reinterpret_cast<const T*>(data + y * bytesPerLine);
+            for (int x = 0; x < width; ++x)
+                used |= source[x];
+        }
+        int shift = 0;
+        if (used != 0)
+            shift = lowestBit(used);
+        const int bits = (int)sizeof(T) * 8 - shift;
+
+        target[0] = (uchar)shift;
+        BitWriter writer(target + 1);
+
+        std::vector<quint32> lines(2 * width);
+        std::vector<quint32> errors(width);
+        quint32* line     = &lines[0];
+        quint32* previous = &lines[width];
+        for (int y = 0; y < height; ++y)
+        {
+            const T* source = reinterpret_cast<const T*>(data + y * bytesPerLine);
+            for (int x = 0; x < width; ++x)
+                line[x] = source[x] >> shift;
+            computeErrors(line, y > 0 ? previous : NULL, width, bits, &errors[0]);
+
+            for (int start = 0; start < width; start += sBlockSize)
+            {
+                const int count = qMin(sBlockSize, width - start);
+                const quint32* block = &errors[start];
+
+                // Rice parameter close to log2 of the mean error
+                quint32 sum = 0;
+                for (int i = 0; i < count; ++i)
+                    sum += block[i];
+                int k = 0;
+                while (k < bits && ((quint32)count << k) < sum)
+                    ++k;
+                writer.put(k, 5);
+
+                for (int i = 0; i < count; ++i)
+                {
+                    const quint32 quotient = block[i] >> k;
+                    if (quotient < (quint32)sEscape)
+                    {
+                        // Unary quotient and remainder in one go (at most 32 bits)
+                        const quint32 remainder = block[i] & ((1u << k) - 1);
+                        writer.put((1u << quotient) | (remainder << (quotient + 1)), quotient + 1 + k);
+                    }
+                    else
+                    {
+                        writer.put(1u << sEscape, sEscape + 1);
+                        writer.put(block[i], bits);
+                    }
+                }
+            }
+            std::swap(line, previous);
+        }
+
+        return 1 + writer.finish();
+    }
+
+    template <class T>
+    static bool decompressSamples(const uchar* source, qint64 size, uchar* data,
+                                  int width, int height, int bytesPerLine)
+    {
+        if (width <= 0 || height <= 0 || size < 1 || source[0] >= sizeof(T) * 8)
+            return false;
+        const int shift = source[0];
+        const int bits  = (int)sizeof(T) * 8 - shift;
+        const int mask  = (1 << bits) - 1;
+
+        BitReader reader(source + 1, size - 1);
+
+        std::vector<quint32> lines(2 * width);
+        std::vector<quint32> errors(width);
+        quint32* line     = &lines[0];
+        quint32* previous = &lines[width];
+        for (int y = 0; y < height; ++y)
+        {
+            for (int start = 0; start < width; start += sBlockSize)
+            {
+                const int count = qMin(sBlockSize, width - start);
+                const int k = reader.get(5);
+                if (k > bits)
+                    return false;
+                for (int i = start; i < start + count; ++i)
+                {
+                    const int quotient = reader.getUnary(sEscape);
+                    if (quotient < 0)
+                        return false;
+                    if (quotient < sEscape)
+                        errors[i] = ((quint32)quotient << k) | (k > 0 ? reader.get(k) : 0);
+                    else
+                        errors[i] = reader.get(bits);
+                }
+            }
+            if (reader.overrun())
+                return false;
+
+            // Same prediction as computeErrors(), on the decoded samples
+            T* target = reinterpret_cast<T*>(data + y * bytesPerLine);
+            for (int x = 0; x < width; ++x)
+            {
+                int prediction;
+                if (y == 0)
+                    prediction = x > 0 ? line[x - 1] : 0;
+                else if (x == 0)
+                    prediction = previous[0];
+                else
+                    prediction = predict(line[x - 1], previous[x], previous[x - 1]);
+
+                const int error = (int)(errors[x] >> 1) ^ -(int)(errors[x] & 1);
+                line[x] = (quint32)((prediction + error) & mask);
+                target[x] = (T)(line[x] << shift);
+            }
+            std::swap(line, previous);
+        }
+        return true;
+    }
+
+    QByteArray compressFrame(const uchar* data, int width, int height, int bytesPerLine, int bytesPerSample)
+    {
+        if (width <= 0 || height <= 0)
+            return QByteArray();
+
+        // Worst case: 5 bits per block plus escape code and raw value per sample
+        const int blocks = (width + sBlockSize - 1) / sBlockSize * height;
+        const qint64 maxBits = (qint64)blocks * 5 + (qint64)width * height * (sEscape + 1 + 8 * bytesPerSample);
+        QByteArray result;
+        result.resize((int)(maxBits / 8 + 16));
+
+        uchar* target = reinterpret_cast<uchar*>(result.data());
+        int size;
+        if (bytesPerSample == 2)
+            size = compressSamples<quint16>(data, width, height, bytesPerLine, target);
+        else
+            size = compressSamples<uchar>(data, width, height, bytesPerLine, target);
+
+        const int lineSize = width * bytesPerSample;
+        if (size > 1 + lineSize * height)
+        {
+            size = 1 + lineSize * height;
+            target[0] = sRawFlag;
+            for (int y = 0; y < height; ++y)
+                memcpy(target + 1 + y * lineSize, data + y * bytesPerLine, lineSize);
+        }
+        result.resize(size);
+        return result;
+    }
+
+    bool decompressFrame(const char* source, qint64 size, uchar* target,
+                         int width, int height, int bytesPerLine, int bytesPerSample)
+    {
+        const uchar* bytes = reinterpret_cast<const uchar*>(source);
+        const int lineSize = width * bytesPerSample;
+        if (size > 0 && bytes[0] == sRawFlag)
+        {
+            if (size != 1 + (qint64)lineSize * height)
+                return false;
+            for (int y = 0; y < height; ++y)
+                memcpy(target + y * bytesPerLine, bytes + 1 + y * lineSize, lineSize);
+            return true;
+        }
+
+        if (bytesPerSample == 2)
+            return decompressSamples<quint16>(bytes, size, target, width, height, bytesPerLine);
+        else
+            return decompressSamples<uchar>(bytes, size, target, width, height, bytesPerLine);
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Fast lossless compression of 8 and 16 bit grey frames.
+
+@par Scheme
+    Every sample is predicted from its left, upper and upper left neighbours
+    (median edge detector, as in LOCO-I/JPEG-LS). The prediction errors of
+    microscopy frames are small and roughly Laplacian, they are coded with
+    Golomb-Rice codes whose parameter is chosen for each run of 16 samples.
+    Errors the code would make too long are written raw instead, and frames
+    that do not get smaller at all (pure noise) are stored uncompressed.
+@par
+    Bits that are zero in every sample (the low bits of MSB aligned 12 or 14
+    bit data in Mono16Format, see PixelKernels.h) are shifted away first.
+@par
+    There is no state between frames, so each frame can be compressed on any
+    thread. Compression is several times faster than PNG at a similar ratio,
+    tools/CodecBenchmark.cc measures both on real frames.
+*/
+
+#ifndef _FrameCodec_H__
+#define _FrameCodec_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QByteArray>
+
+namespace tracker
+{
+    /** Compresses a frame.
+    @param data
+        First sample of the first line
+    @param bytesPerLine
+        Distance between two lines in bytes (may include padding)
+    @param bytesPerSample
+        1 for 8 bit or 2 for 16 bit samples
+    */
+    QByteArray compressFrame(const uchar* data, int width, int height, int bytesPerLine, int bytesPerSample);
+
+    /** Decompresses a frame written by compressFrame() with the same size.
+    @return
+        False if \c source is corrupt or too short, \c target is undefined then.
+    */
+    bool decompressFrame(const char* source, qint64 size, uchar* target,
+                         int width, int height, int bytesPerLine, int bytesPerSample);
+}
+
+#endif /* _FrameCodec_H__ */
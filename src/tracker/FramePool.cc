@@ -0,0 +1,176 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "FramePool.h"
+
+#include <QMutexLocker>
+
+#include "Exception.h"
+#include "Logger.h"
+
+namespace tracker
+{
+    FramePool::FramePool(int capacity, int alignment)
+        : mCapacity(qMax(1, capacity))
+        , mAlignment(qMax(4, alignment))
+        , mNext(0)
+    {
+        this->resetStatistics();
+    }
+
+    FramePool::~FramePool()
+    {
+        int leaked = 0;
+        for (int i = 0; i < mSlots.size(); ++i)
+        {
+            if (isFree(mSlots[i]))
+                freeSlot(mSlots[i]);
+            else
+                ++leaked;
+        }
+        if (leaked > 0)
+            TRACKER_WARNING(QString("FramePool: %1 frames still in use upon destruction").arg(leaked));
+    }
+
+    /*static*/ void FramePool::freeSlot(Slot& slot)
+    {
+        slot.image = QImage();
+        qFreeAligned(slot.data);
+        slot.data = NULL;
+        slot.size = 0;
+    }
+
+    FramePool::Frame FramePool::acquire(QSize size, QImage::Format format, const QVector<QRgb>& colourTable)
+    {
+        QMutexLocker lock(&mMutex);
+        ++mAcquiredCount;
+
+        // Look for a free buffer, starting after the one given out last
+        int index = -1;
+        for (int i = 0; i < mSlots.size(); ++i)
+        {
+            int candidate = (mNext + i) % mSlots.size();
+            if (isFree(mSlots[candidate]))
+            {
+                index = candidate;
+                break;
+            }
+        }
+        if (index < 0 && mSlots.size() < mCapacity)
+        {
+            Slot slot = { NULL, 0, QImage() };
+            mSlots.append(slot);
+            index = mSlots.size() - 1;
+        }
+        mUtilisationSum += (double)(this->countInUse() + (index >= 0 ? 1 : 0)) / mCapacity;
+
+        Frame frame;
+        if (index < 0)
+        {
+            // Exhausted: consumers hold all buffers, don't drop the frame
+            ++mExhaustedCount;
+            frame.image = QImage(size, format);
+            if (!colourTable.isEmpty())
+                frame.image.setColorTable(colourTable);
+            frame.bits = frame.image.bits();
+            frame.bytesPerLine = frame.image.bytesPerLine();
+            return frame;
+        }
+
+        Slot& slot = mSlots[index];
+        mNext = (index + 1) % mSlots.size();
+        if (slot.image.size() != size || slot.image.format() != format)
+        {
+            // Camera mode changed (or first use). Same line alignment as an
+            // ordinary QImage (32 bit), consumers may rely on it.
+            slot.image = QImage();
+            int depth = QImage(1, 1, format).depth();
+            int bytesPerLine = ((size.width() * depth + 31) / 32) * 4;
+            int byteCount = bytesPerLine * size.height();
+            if (slot.size < byteCount)
+            {
+                qFreeAligned(slot.data);
+                slot.data = static_cast<uchar*>(qMallocAligned(byteCount, mAlignment));
+                if (!slot.data)
+                    TRACKER_EXCEPTION("FramePool: Could not allocate frame buffer");
+                slot.size = byteCount;
+            }
+            slot.image = QImage(slot.data, size.width(), size.height(), bytesPerLine, format);
+        }
+        // Only the pool holds the image, so this does not detach
+        if (!colourTable.isEmpty() && slot.image.colorTable() != colourTable)
+            slot.image.setColorTable(colourTable);
+
+        frame.image = slot.image;
+        frame.bits = slot.data;
+        frame.bytesPerLine = slot.image.bytesPerLine();
+        return frame;
+    }
+
+    void FramePool::setCapacity(int capacity)
+    {
+        QMutexLocker lock(&mMutex);
+        mCapacity = qMax(1, capacity);
+        // Remove free slots from the end, the others go with a later call
+        while (mSlots.size() > mCapacity && isFree(mSlots.last()))
+        {
+            freeSlot(mSlots.last());
+            mSlots.pop_back();
+        }
+        mNext = 0;
+    }
+
+    int FramePool::getCapacity() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mCapacity;
+    }
+
+    int FramePool::countInUse() const
+    {
+        int count = 0;
+        for (int i = 0; i < mSlots.size(); ++i)
+            if (!isFree(mSlots[i]))
+                ++count;
+        return count;
+    }
+
+    int FramePool::getInUseCount() const
+    {
+        QMutexLocker lock(&mMutex);
+        return this->countInUse();
+    }
+
+    quint64 FramePool::getAcquiredCount() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mAcquiredCount;
+    }
+
+    quint64 FramePool::getExhaustedCount() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mExhaustedCount;
+    }
+
+    double FramePool::getUtilisation() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mAcquiredCount > 0 ? mUtilisationSum / mAcquiredCount : 0.0;
+    }
+
+    void FramePool::resetStatistics()
+    {
+        QMutexLocker lock(&mMutex);
+        mAcquiredCount  = 0;
+        mExhaustedCount = 0;
+        mUtilisationSum = 0.0;
+    }
+}
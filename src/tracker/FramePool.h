@@ -0,0 +1,123 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _FramePool_H__
+#define _FramePool_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+#include <QVector>
+
+namespace tracker
+{
+    /** Preallocated, aligned image buffers for the Camera streams.
+        Every frame a Camera delivers used to be a fresh QImage (allocation
+        plus copy). With the pool, the camera writes into a buffer that is
+        already wrapped by a QImage and hands that QImage on.
+    @par Reference counting
+        The handles are the QImages themselves: all copies of a frame given
+        to consumers (Controller, display, storage) share the pooled buffer
+        through Qt's implicit sharing. As soon as the last copy is gone, the
+        buffer is free again. A consumer that writes to its copy detaches it
+        (regular copy-on-write), the pooled buffer is never modified behind
+        anyone's back.
+    @par Exhaustion
+        If all buffers are still held by consumers, acquire() falls back to
+        an ordinary QImage and counts it, see getExhaustedCount().
+    @note
+        The pool must outlive the frames it delivered. Buffers that are still
+        in use when the pool is destroyed are deliberately leaked.
+    */
+    class FramePool
+    {
+    public:
+        //! A frame to be filled by a camera
+        struct Frame
+        {
+            QImage  image;          //!< Shares the buffer, pass this on
+            uchar*  bits;           //!< Write access without detaching the image
+            int     bytesPerLine;   //!< Distance between two lines in bytes
+
+            //! Returns the start of line y (for writing)
+            uchar* scanLine(int y)
+                { return bits + y * bytesPerLine; }
+        };
+
+        /** Creates the pool (the buffers are allocated on first use).
+        @param capacity
+            Maximum number of buffers
+        @param alignment
+            Alignment of the buffer start in bytes
+        */
+        FramePool(int capacity = 16, int alignment = 64);
+        //! Frees all buffers that are not in use anymore
+        ~FramePool();
+
+        /** Returns a frame of the given size and format. The content is
+            undefined. Only allocates if the size of a buffer does not fit
+            (e.g. after a camera mode change) or if the pool is exhausted.
+        @param colourTable
+            Applied to indexed formats
+        */
+        Frame acquire(QSize size, QImage::Format format, const QVector<QRgb>& colourTable = QVector<QRgb>());
+
+        /** Sets the maximum number of buffers.
+            Buffers in use are never taken away, the pool shrinks later.
+        */
+        void setCapacity(int capacity);
+        //! Returns the value described in setCapacity()
+        int getCapacity() const;
+
+        //! Returns the number of buffers currently held by consumers
+        int getInUseCount() const;
+        //! Returns the number of frames delivered since resetStatistics()
+        quint64 getAcquiredCount() const;
+        //! Returns the number of frames that did not get a pooled buffer
+        quint64 getExhaustedCount() const;
+        //! Returns the average fraction of buffers in use upon acquire() (0 to 1)
+        double getUtilisation() const;
+        //! Resets the statistics
+        void resetStatistics();
+
+    private:
+        Q_DISABLE_COPY(FramePool);
+
+        //! A single buffer with the QImage wrapping it
+        struct Slot
+        {
+            uchar*  data;       //!< Aligned buffer
+            int     size;       //!< Size of the buffer in bytes
+            QImage  image;      //!< Wraps data, detached if nobody else uses it
+        };
+
+        //! Tells whether no consumer holds the image of the slot
+        static bool isFree(const Slot& slot)
+            { return slot.image.isNull() || slot.image.isDetached(); }
+        //! Frees the buffer of a slot that is not used anymore
+        static void freeSlot(Slot& slot);
+        //! Counts the slots currently in use (mutex must be locked)
+        int countInUse() const;
+
+        mutable QMutex  mMutex;
+        QVector<Slot>   mSlots;
+        int             mCapacity;      //!< See setCapacity()
+        int             mAlignment;     //!< Alignment of the buffer start in bytes
+        int             mNext;          //!< Slot to look at first (round robin)
+
+        quint64         mAcquiredCount; //!< See getAcquiredCount()
+        quint64         mExhaustedCount; //!< See getExhaustedCount()
+        double          mUtilisationSum; //!< Sum of the fractions in use, see getUtilisation()
+    };
+}
+
+#endif /* _FramePool_H__ */
@@ -0,0 +1,154 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "ImageWriter.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSettings>
+#include <QThread>
+
+#include "Logger.h"
+#include "PathConfig.h"
+#include "PixelKernels.h"
+
+namespace tracker
+{
+    //! Runs ImageWriter::process() for one job in the pool
+    class ImageWriter::Task : public QRunnable
+    {
+    public:
+        Task(ImageWriter* writer, const Job& job)
+            : mWriter(writer)
+            , mJob(job)
+            { }
+
+        void run()
+            { mWriter->process(mJob); }
+
+    private:
+        ImageWriter*    mWriter;
+        Job             mJob;
+    };
+
+    ImageWriter::ImageWriter(QObject* parent)
+        : QObject(parent)
+        , mPending(0)
+        , mCompressStacks(true)
+    {
+        this->readSettings();
+        mPool.setMaxThreadCount(mThreadCount);
+    }
+
+    ImageWriter::~ImageWriter()
+    {
+        // Images in the queue exist nowhere else anymore
+        this->closeStacks();
+        this->writeSettings();
+    }
+
+    void ImageWriter::readSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("ImageWriter");
+
+        mThreadCount = qMax(1, settings.value("Threads", qMax(1, QThread::idealThreadCount() / 2)).toInt());
+        mCapacity    = qMax(1, settings.value("Queue_Size", 64).toInt());
+        mCompressStacks = settings.value("Compress_Stacks", true).toBool();
+
+        settings.endGroup();
+    }
+
+    void ImageWriter::writeSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("ImageWriter");
+
+        settings.setValue("Threads",    mThreadCount);
+        settings.setValue("Queue_Size", mCapacity);
+        settings.setValue("Compress_Stacks", mCompressStacks);
+
+        settings.endGroup();
+    }
+
+    bool ImageWriter::submit(const Job& job)
+    {
+        // Reserve a place first, give it back if there was none
+        if (mPending.fetchAndAddOrdered(1) >= mCapacity)
+        {
+            mPending.deref();
+            return false;
+        }
+        mPool.start(new Task(this, job));
+        return true;
+    }
+
+    void ImageWriter::waitForDone()
+    {
+        mPool.waitForDone();
+    }
+
+    void ImageWriter::closeStacks()
+    {
+        mPool.waitForDone();
+
+        QMutexLocker lock(&mStackMutex);
+        foreach (StackFileWriter* stack, mStacks)
+            delete stack;
+        mStacks.clear();
+    }
+
+    StackFileWriter* ImageWriter::getStack(const QString& filename)
+    {
+        QMutexLocker lock(&mStackMutex);
+        StackFileWriter*& stack = mStacks[filename];
+        if (stack == NULL)
+        {
+            stack = new StackFileWriter();
+            stack->setCompression(mCompressStacks ? FrameCompression : NoCompression);
+            if (stack->open(filename))
+                TRACKER_INFO("Recording to stack file '" + filename + "'", Logger::Low);
+        }
+        return stack;
+    }
+
+    QString ImageWriter::makeUniqueFilename(const QString& base, const QString& suffix)
+    {
+        int& count = mNameCounts[base + suffix];
+        QString filename = base + (count > 0 ? "-" + QString::number(count) : QString()) + suffix;
+        ++count;
+        return filename;
+    }
+
+    void ImageWriter::process(const Job& job)
+    {
+        bool success;
+        if (!job.stackFilename.isEmpty())
+        {
+            // No encoding, the samples go to the file as they are
+            success = this->getStack(job.stackFilename)->append(job.image, job.info);
+        }
+        else
+        {
+            success = toDisplayImage(job.image).save(job.filename, job.format.constData(), job.quality);
+
+            if (success && !job.metadataFilename.isEmpty())
+            {
+                QFile file(job.metadataFilename);
+                const QByteArray text = job.info.toText().toLocal8Bit();
+                success = file.open(QIODevice::WriteOnly | QIODevice::Text) && file.write(text) == text.size();
+            }
+        }
+
+        mPending.deref();
+        emit imageWritten(job.stackFilename.isEmpty() ? job.filename : job.stackFilename, success);
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _ImageWriter_H__
+#define _ImageWriter_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+
+#include "StackFile.h"
+
+namespace tracker
+{
+    /** Encodes and writes images with their meta data files on a pool of
+        worker threads.
+        PNG encoding of a full resolution image takes a few hundred
+        milliseconds. Done in the GUI thread, it stalls the user interface
+        and everything that is queued there. Here the caller only submits a
+        Job and gets imageWritten() once the files are on disk.
+        Jobs with a \c stackFilename skip the encoding and are appended to
+        that stack file, which is created with the first such job.
+    @par Back-pressure
+        The number of jobs submitted but not yet written is limited by
+        \c Queue_Size. submit() refuses jobs beyond that instead of piling up
+        images in memory, the caller keeps them and tries again after the
+        next imageWritten().
+    @par Thread safety
+        submit() and the getters may be called from any thread,
+        makeUniqueFilename() only from the thread the writer lives in.
+        imageWritten() is raised in the worker threads, connect it queued
+        (the default for receivers in another thread).
+    @par Settings
+         - \c Threads: Number of worker threads (default: half the cores)
+         - \c Queue_Size: Maximum number of pending jobs (default: 64)
+         - \c Compress_Stacks: Compress the frames in stack files losslessly
+           (see FrameCodec.h, default: true)
+    */
+    class ImageWriter : public QObject
+    {
+        Q_OBJECT;
+
+    public:
+        //! Everything needed to store one image
+        struct Job
+        {
+            QImage      image;              //!< Converted to 8 bit if required (see toDisplayImage())
+            QString     filename;           //!< Full path of the image file
+            QByteArray  format;             //!< Format string for QImage::save(), e.g. "png"
+            int         quality;            //!< Quality for QImage::save() (-1 for the default)
+            QString     metadataFilename;   //!< Text file written next to the image (empty for none)
+            StackFrameInfo info;            //!< Written to the meta data file or the stack
+            QString     stackFilename;      //!< Append to this stack file instead (see StackFile.h)
+        };
+
+        //! Reads the settings and starts no thread yet
+        ImageWriter(QObject* parent = NULL);
+        //! Waits until all pending jobs are written and calls closeStacks()
+        ~ImageWriter();
+
+        /** Queues a job for the worker threads.
+        @return
+            False if the queue is full, nothing was queued in that case.
+        */
+        bool submit(const Job& job);
+
+        //! Returns the number of jobs submitted but not written yet
+        int getPendingCount() const
+            { return (int)mPending; }
+        //! Returns the maximum number of pending jobs
+        int getCapacity() const
+            { return mCapacity; }
+
+        //! Blocks until all pending jobs are written
+        void waitForDone();
+        //! Waits for the pending jobs and closes all stack files (writes their index)
+        void closeStacks();
+
+        /** Returns \c base + \c suffix, with "-1", "-2" etc. in between if
+            that name was already handed out. Unlike probing with
+            QFile::exists(), this does not touch the disk and also counts
+            files that are still in the queue.
+        */
+        QString makeUniqueFilename(const QString& base, const QString& suffix);
+
+    signals:
+        //! Raised from a worker thread when a job is done (success: both files written)
+        void imageWritten(QString filename, bool success);
+
+    private:
+        Q_DISABLE_COPY(ImageWriter);
+
+        class Task;
+        friend class Task;
+
+        //! Writes the files of a job (worker thread)
+        void process(const Job& job);
+        //! Returns the open stack file for \c filename, creates it if required (any thread)
+        StackFileWriter* getStack(const QString& filename);
+
+        void readSettings();
+        void writeSettings();
+
+        QThreadPool             mPool;          //!< Worker threads
+        QAtomicInt              mPending;       //!< See getPendingCount()
+        int                     mCapacity;      //!< See getCapacity()
+        int                     mThreadCount;   //!< Maximum number of worker threads
+        bool                    mCompressStacks; //!< Use FrameCompression for new stack files
+        QHash<QString, int>     mNameCounts;    //!< Names handed out by makeUniqueFilename()
+        QHash<QString, StackFileWriter*> mStacks; //!< Stack files opened by getStack()
+        QMutex                  mStackMutex;    //!< Protects mStacks
+    };
+}
+
+#endif /* _ImageWriter_H__ */
@@ -4,6 +4,7 @@
 
 #include <QObject>
 #include <QThread>
+#include "ThreadProfile.h"
 #include "Timing.h"
 
 #include "SerialInterface.h"
@@ -42,6 +43,7 @@ namespace tracker
   {
       Q_OBJECT
       void run() {
+          applyThreadProfile("Serial");
           bool res = m_lamp->setFreqBandAndIntensity(m_band, m_intensity);
           emit finishedSetFreqBandAndIntensity(res);
       }
@@ -66,6 +68,7 @@ namespace tracker
   {
       Q_OBJECT
       void run() {
+          applyThreadProfile("Serial");
           bool res = m_lamp->startMP1(m_band, m_intensity, m_t_on, m_t_off, m_iterations);
           emit finishedMP1(res);
       }
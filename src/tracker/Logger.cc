@@ -16,6 +16,7 @@
 #include "Logger.h"
 
 #include <cstdio>
+#include <QApplication>
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QFileInfo>
@@ -213,8 +214,9 @@ namespace tracker
             emit messageLogged(text);
         }
 
-        // Message box
-        if (overallLogLevel <= mTargetLogLevels[Logger::MsgBox] && !QCoreApplication::startingUp())
+        // Message box (not for the command line tools, they only have a QCoreApplication)
+        if (overallLogLevel <= mTargetLogLevels[Logger::MsgBox] && !QCoreApplication::startingUp()
+            && qobject_cast<QApplication*>(QCoreApplication::instance()) != NULL)
         {
             switch (entry->mType)
             {
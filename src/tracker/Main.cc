@@ -25,6 +25,12 @@
 #include "Exception.h"
 #include "MainWindow.h"
 #include "PathConfig.h"
+#include "StackFile.h"
+#include "ThreadProfile.h"
+
+#ifdef TRACKER_DUMMY
+#include "dummy/SessionBenchmark.h"
+#endif
 
 #ifdef TRACKER_PLATFORM_WINDOWS
 #include <windows.h>
@@ -72,9 +78,49 @@ int main(int argc, char** argv)
     libraryPaths.prepend(PathConfig::getExecutablePath().path() + "/plugins");
     QCoreApplication::setLibraryPaths(libraryPaths);
 
+#ifdef TRACKER_DUMMY
+    // "--session-benchmark [options]" runs a tracking session with the dummy
+    // devices and quits. No QApplication: no GUI and no message boxes.
+    for (int i = 1; i < argc; ++i)
+    {
+        if (QString(argv[i]) != "--session-benchmark")
+            continue;
+        QCoreApplication app(argc, argv);
+        lockProcessMemory();
+        applyThreadProfile("GUI");
+        try
+        {
+            return runSessionBenchmark(app.arguments().mid(i + 1));
+        }
+        catch (const tracker::Exception& ex)
+        {
+            TRACKER_LOG_GENERIC(tracker::Logger::Exception, ex.getDescription(), 0, Logger::High);
+            return 2;
+        }
+    }
+#endif
+
     // Load Qt
     QApplication app(argc, argv);
 
+    // "--export-stack <stack file> <base filename>" converts a stack file to
+    // PNG and .txt files and quits without starting the devices
+    const QStringList arguments = app.arguments();
+    const int exportIndex = arguments.indexOf("--export-stack");
+    if (exportIndex >= 0)
+    {
+        if (exportIndex + 2 >= arguments.size())
+        {
+            TRACKER_WARNING("Usage: tracker --export-stack <stack file> <base filename>");
+            return 1;
+        }
+        return exportStackToPng(arguments[exportIndex + 1], arguments[exportIndex + 2]) < 0 ? 1 : 0;
+    }
+
+    // Scheduling of the GUI thread and memory locking (see ThreadProfile.h)
+    lockProcessMemory();
+    applyThreadProfile("GUI");
+
     try
     {
         // Resources in a static library have to initialized manually
@@ -42,12 +42,17 @@
 
 #include "Camera.h"
 #include "Controller.h"
+#include "DeviceStartup.h"
+#include "DeviceStateCache.h"
 #include "DraggableLabel.h"
 #include "Exception.h"
 #include "FocusTracker.h"
+#include "ImageWriter.h"
 #include "Logger.h"
 #include "PathConfig.h"
+#include "PixelKernels.h"
 #include "PressureSensor.h"
+#include "RecordingBuffer.h"
 #include "Stage.h"
 #include "TimeSpinBox.h"
 
@@ -71,6 +76,7 @@ namespace tracker
     , mStoringImage(false)
     , mPreviousDisplayModeIndex(-1)
     , mCurrentImageArea(0)
+    , mKeepExposureTime(false)
     , mMaxSliderExposureTime(10000)
     , timer100ms(0)
     , pictureHeight(300)
@@ -82,10 +88,28 @@ namespace tracker
     , NumOfImages(0)
     , mMainChannel(4)
     , mAction(0)
+    , mPressureSensor(NULL)
+    , mStage(NULL)
+    , mDac(NULL)
+    , mAhmmicroscope(NULL)
+    , mLamp(NULL)
+    , mLinearMotor(NULL)
+#ifdef TRACKER_DUMMY
+    , mMicroscopeThread(NULL)
+#endif
+    , mCameraThread(NULL)
+    , mControllerThread(NULL)
+    , mDeviceStateCache(NULL)
+    , mDeviceStateThread(NULL)
   {
+    // The startup timeline begins here
+    mDeviceStartup = new DeviceStartup(this);
+    mDeviceStartup->beginPhase("User interface");
+
     /***************************** Create UI ******************************/
 
     qRegisterMetaType<FocusValue>("FocusValue");
+    qRegisterMetaType<QVector<QPoint> >("QVector<QPoint>");
 
     // Initialize first "time point"
     mTimeValues.append(0);
@@ -347,8 +371,6 @@ namespace tracker
     stretchUntilValueBox->setSuffix(" N");
 
     mAutoStretch = new AutoStretch(this);
-    mLinearMotor = new LinearMotor(this, mAutoStretch);
-    mLinearMotor->createMessagesHandler();
 
     graphWidget->addGraph();
     graphWidget->xAxis->setRange(0, 30);
@@ -363,8 +385,6 @@ namespace tracker
     /*connect(chooseMode,   SIGNAL(currentIndexChanged(int)),
             mAutoStretch, SLOT(updateAutoStretchMode(int)));
     */
-    connect(this,         SIGNAL(setZeroDistance(double)),
-            mLinearMotor, SLOT(setZeroDistance(double)));
     connect(chooseEF,     SIGNAL(currentIndexChanged(int)),
             mAutoStretch, SLOT(updateAutoStretchUnit(int)));
     connect(mAutoStretch, SIGNAL(setStretchUntilValueSuffix(QString)),
@@ -387,56 +407,20 @@ namespace tracker
     connect(this,           SIGNAL(updateAutoStretchMode(int)),
             mAutoStretch,   SLOT(updateAutoStretchMode(int)));
 
-    connect(mLinearMotor, SIGNAL(speedChanged(int)),
-            currentSpeed, SLOT(display(int)));
     connect(mAutoStretch, SIGNAL(updateMeasuredPoints(double, double)),
             this,         SLOT(updateMeasuredPoints(double, double)));
     connect(graphWidget, SIGNAL(mouseDoubleClick(QMouseEvent*)),
              this,        SLOT(exportPng()));
 
 
-    /************************* Create Components **************************/
-
-    // Note: Camera and Controller do not have parents because they need
-    //       to be moved to another thread.
-    mCamera.reset(Camera::makeCamera());
-    // Get camera mode strings
-    QVector<QPair<QString, QSize> > modes;
-    foreach (QString modeName, mCamera->getAvailableModes())
-        modes.append(qMakePair(mCamera->getName() + "__sep__" + modeName, mCamera->getImageSize(modeName)));
-
-    mController.reset(new Controller(modes));
-
-    // Note: Controller parent is required so that moveToThread works correctly
-    mStage = Stage::makeStage(mController.get());
-
-    mPressureSensor = new PressureSensor(this);
-    mAhmmicroscope = new ahmMicroscope();
-    // Display the shutter state and the illumination mode
-    switch(mAhmmicroscope->getFlShutterState()){
-      case 0:
-        shutterLabel->setText("close");
-        break;
-      case 1:
-        shutterLabel->setText("open");
-        break;
-    }
-    switch(mAhmmicroscope->getContrastingMethod()){
-      case ahmMicroscope::ilFluorescence:
-        illuminationLabel->setText("incident");
-        break;
-      case ahmMicroscope::ilWhiteLight:
-        illuminationLabel->setText("transmitted");
-        break;
-    }
+    /*************************** Components *******************************/
 
-    //Creating the lamp
-    mLamp = new Lamp();
     channel = 0;
     intensity = 0;
 
-    mDac = Dac::makeDac(this);
-    mDac->setvoltage(5);	// initialize to 5V which corresponds to 0kPa
+    mImageWriter = new ImageWriter(this);
+    mRecordingBuffer = new RecordingBuffer();
+
     tickcounter =0;			// initialize flags for pressure oscillation
     rising =true;
     dactimerID = 0;
@@ -449,6 +433,259 @@ namespace tracker
 
     cameratimer = new QTimer(this);
 
+    /****************** Connect UI (without devices) **********************/
+
+    connect(mNextRunShortcut,  SIGNAL(activated()),
+            storageRunSpinBox, SLOT(stepUp()));
+
+    connect(mImageWriter,         SIGNAL(imageWritten(QString, bool)),
+            this,                 SLOT(imageWritten(QString, bool)));
+
+    // move stage vertically if the pressure was changed by the pressure ramp algorithm
+    connect(this,                 SIGNAL(pressureStepped(float)),
+            this,                 SLOT(adjustStageZ(float)));
+
+    // --- Pressure Control ---
+
+    connect(this,                 SIGNAL(pressureSetRequested(float)),
+            this,                 SLOT(setPressure(float)));
+
+    // --- Time Lapse ---
+    connect(TimeLapse,   SIGNAL(clicked(bool)),
+            this, SLOT(SetTimeLapse(bool)));
+
+    //Multichannel-Imaging shortcuts
+    connect(mSetMultiImagesShortcut, SIGNAL(activated()),
+            this, SLOT(MultiImageToggle()));
+    connect(mSetMultiChannelsShortcut, SIGNAL(activated()),
+            this, SLOT(MultiChannelToggle()));
+
+    // Restore window positions now, the rest of readSettings() needs the camera
+    {
+      QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+      restoreGeometry(settings.value("geometry").toByteArray());
+      restoreState(settings.value("windowState").toByteArray());
+    }
+
+    /************************** Start Devices *****************************/
+
+    // Every dock stays disabled until the devices it uses are ready
+    cameraDockWidget->setEnabled(false);
+    trackerDockWidget->setEnabled(false);
+    trackerOptionsDockWidget->setEnabled(false);
+    focusdockWidget->setEnabled(false);
+    stageDockWidget->setEnabled(false);
+    pressureDockWidget->setEnabled(false);
+    ListDockWidget->setEnabled(false);
+    protocoldockWidget->setEnabled(false);
+    linmotdockWidget->setEnabled(false);
+    mComPortAction->setEnabled(false);
+    mScaleFactorAction->setEnabled(false);
+    mStretcherAction->setEnabled(false);
+
+    mStartupLabel = new QLabel(this);
+    mStartupLabel->setToolTip("Devices that are still starting");
+    this->statusBar()->addWidget(mStartupLabel);
+
+    // Opening the drivers and ports are independent blocking calls, run them concurrently
+    mDeviceStartup->endPhase("User interface");
+    mDeviceStartup->addTask("Camera",          this, "openCamera");
+    mDeviceStartup->addTask("Stage",           this, "openStage");
+    mDeviceStartup->addTask("DAC",             this, "openDac");
+    mDeviceStartup->addTask("Pressure sensor", this, "openPressureSensor");
+    mDeviceStartup->addTask("Linear motor",    this, "openLinearMotor");
+    mDeviceStartup->addTask("Lamp",            this, "openLamp");
+    mDeviceStartup->addTask("Microscope",      this, "openMicroscope");
+    mDeviceStartup->addTask("Tracker", this, "setupTracker",
+                            QStringList() << "Camera" << "Stage", DeviceStartup::GuiThread);
+    mDeviceStartup->addTask("Stretcher", this, "setupStretcher",
+                            QStringList() << "Pressure sensor" << "Linear motor", DeviceStartup::GuiThread);
+    mDeviceStartup->addTask("Device state", this, "setupDeviceState",
+                            QStringList() << "Tracker" << "DAC" << "Pressure sensor" << "Lamp" << "Microscope",
+                            DeviceStartup::GuiThread);
+
+    connect(mDeviceStartup, SIGNAL(taskReady(QString)),
+            this,           SLOT(deviceReady(QString)));
+    connect(mDeviceStartup, SIGNAL(taskFailed(QString, QString)),
+            this,           SLOT(deviceFailed(QString, QString)));
+    connect(mDeviceStartup, SIGNAL(finished()),
+            this,           SLOT(startupFinished()));
+
+    mDeviceStartup->start();
+    this->updateStartupLabel();
+  }
+
+  MainWindow::~MainWindow()
+  {
+    // A device that is still being opened cannot be interrupted
+    mDeviceStartup->waitForDone();
+
+#ifdef TRACKER_DUMMY
+    if (mMicroscopeThread) {
+      mMicroscopeThread->quit();
+      if (!mMicroscopeThread->wait(1000))
+        mMicroscopeThread->terminate();
+    }
+#endif
+
+    if (mCameraThread) {
+      mCameraThread->quit();
+      if (!mCameraThread->wait(1000))
+        mCameraThread->terminate();
+    }
+    if (mControllerThread) {
+      mControllerThread->quit();
+      if (!mControllerThread->wait(2000))
+        mControllerThread->terminate();
+    }
+    if (mDeviceStateThread) {
+      mDeviceStateThread->quit();
+      if (!mDeviceStateThread->wait(1000))
+        mDeviceStateThread->terminate();
+      delete mDeviceStateCache;
+    }
+
+    // Don't lose the images that are still buffered
+    flushRecordingBuffer();
+    delete mRecordingBuffer;
+
+    // Store all settings (the display modes only exist once the camera is there)
+    if (mInitialised)
+      this->writeSettings();
+  }
+
+  /**************************************************************************/
+  /**************************** Startup *************************************/
+  /**************************************************************************/
+
+  // Note: The open*() tasks run concurrently in pool threads. The objects
+  //       they create are moved to the GUI thread before returning and get
+  //       their parents in deviceReady(), they cannot have one in another
+  //       thread.
+
+  void MainWindow::openCamera()
+  {
+    // Note: Camera and Controller do not have parents because they need
+    //       to be moved to another thread.
+    mCamera.reset(Camera::makeCamera());
+    mCamera->moveToThread(QApplication::instance()->thread());
+  }
+
+  void MainWindow::openStage()
+  {
+    mStage = Stage::makeStage();
+    mStage->moveToThread(QApplication::instance()->thread());
+  }
+
+  void MainWindow::openDac()
+  {
+    mDac = Dac::makeDac(NULL);
+    mDac->setvoltage(5);	// initialize to 5V which corresponds to 0kPa
+    mDac->moveToThread(QApplication::instance()->thread());
+  }
+
+  void MainWindow::openPressureSensor()
+  {
+    mPressureSensor = new PressureSensor();
+    mPressureSensor->moveToThread(QApplication::instance()->thread());
+  }
+
+  void MainWindow::openLinearMotor()
+  {
+    mLinearMotor = new LinearMotor(NULL, mAutoStretch);
+    // Here, the MessagesHandler (no parent) can only be moved by its own thread
+    mLinearMotor->createMessagesHandler();
+    mLinearMotor->moveToThread(QApplication::instance()->thread());
+  }
+
+  void MainWindow::openLamp()
+  {
+    //Creating the lamp
+    mLamp = new Lamp();
+    mLamp->moveToThread(QApplication::instance()->thread());
+  }
+
+  void MainWindow::openMicroscope()
+  {
+    mAhmmicroscope = new ahmMicroscope();
+  }
+
+  void MainWindow::deviceReady(const QString& name)
+  {
+    if (name == "DAC") {
+      mDac->setParent(this);
+    } else if (name == "Pressure sensor") {
+      mPressureSensor->setParent(this);
+    } else if (name == "Linear motor") {
+      mLinearMotor->setParent(this);
+
+      connect(this,         SIGNAL(setZeroDistance(double)),
+              mLinearMotor, SLOT(setZeroDistance(double)));
+      connect(mLinearMotor, SIGNAL(speedChanged(int)),
+              currentSpeed, SLOT(display(int)));
+    } else if (name == "Lamp") {
+      // Connencting the Lamp with MainWindow
+      connect(Channel_0, SIGNAL(clicked()),
+      this, SLOT(on_Channel_0_clicked()));
+      connect(Channel_1, SIGNAL(clicked()),
+      this, SLOT(on_Channel_1_clicked()));
+      connect(Channel_2, SIGNAL(clicked()),
+      this, SLOT(on_Channel_2_clicked()));
+      connect(Channel_3, SIGNAL(clicked()),
+      this, SLOT(on_Channel_3_clicked()));
+      connect(Channel_4, SIGNAL(clicked()),
+      this, SLOT(on_Channel_4_clicked()));
+
+      // Lamp Shortcut
+      connect(mSetChannel0Shortcut, SIGNAL(activated()),
+              this, SLOT(on_Channel_0_clicked()));
+      connect(mSetChannel1Shortcut, SIGNAL(activated()),
+              this, SLOT(on_Channel_1_clicked()));
+      connect(mSetChannel2Shortcut, SIGNAL(activated()),
+              this, SLOT(on_Channel_2_clicked()));
+      connect(mSetChannel3Shortcut, SIGNAL(activated()),
+              this, SLOT(on_Channel_3_clicked()));
+      connect(mSetChannel4Shortcut, SIGNAL(activated()),
+              this, SLOT(on_Channel_4_clicked()));
+
+      connect(uProgram, SIGNAL(clicked()),
+      this, SLOT(on_StartMP_clicked()));
+    } else if (name == "Microscope") {
+      // Display the shutter state and the illumination mode
+      switch(mAhmmicroscope->getFlShutterState()){
+        case 0:
+          shutterLabel->setText("close");
+          break;
+        case 1:
+          shutterLabel->setText("open");
+          break;
+      }
+      switch(mAhmmicroscope->getContrastingMethod()){
+        case ahmMicroscope::ilFluorescence:
+          illuminationLabel->setText("incident");
+          break;
+        case ahmMicroscope::ilWhiteLight:
+          illuminationLabel->setText("transmitted");
+          break;
+      }
+      // The shutter shortcut is connected in setupDeviceState()
+    }
+
+    this->updateStartupLabel();
+  }
+
+  void MainWindow::setupTracker()
+  {
+    // Get camera mode strings
+    QVector<QPair<QString, QSize> > modes;
+    foreach (QString modeName, mCamera->getAvailableModes())
+        modes.append(qMakePair(mCamera->getName() + "__sep__" + modeName, mCamera->getImageSize(modeName)));
+
+    mController.reset(new Controller(modes));
+
+    // Note: Controller parent is required so that moveToThread works correctly
+    mStage->setParent(mController.get());
+
     // Create threads
     mCameraThread     = new Thread(mCamera.get(), this);
     mControllerThread = new Thread(mController.get(), this);
@@ -477,9 +714,6 @@ namespace tracker
    // connect(mController,       SIGNAL(singleShotRequested(QString, int, double)),
    //         mCamera.get(),     SLOT(takeSingleShot(QString, int, double)));
 
-    connect(mNextRunShortcut,  SIGNAL(activated()),
-            storageRunSpinBox, SLOT(stepUp()));
-
     // --- Camera ---
 
     // Fill combo box with camera modes
@@ -541,6 +775,21 @@ namespace tracker
 
     connect(mController.get(),    SIGNAL(debugImage(QImage)),
             mGraphLabel,          SLOT(displayImage(QImage)));
+    // The graph is always connected, only render it while it can be seen
+    connect(this,                 SIGNAL(debugImageVisibilityChanged(bool)),
+            mController.get(),    SLOT(setDebugImageVisible(bool)));
+    mController->setDebugImageVisible(focusdockWidget->isVisible());
+
+    // --- Multiple tracking regions (right click in the image)
+    mImageLabel->setRegionSize(mController->getMultiRoiSize());
+    connect(mImageLabel,          SIGNAL(regionsSelected(QVector<QPoint>)),
+            mController.get(),    SLOT(setTrackingRegions(QVector<QPoint>)));
+    connect(mController.get(),    SIGNAL(trackingRegionsUpdated(QVector<QPoint>)),
+            mImageLabel,          SLOT(showTrackedRegions(QVector<QPoint>)));
+
+    // --- Smaller camera modes while the tracking is stable
+    connect(mController.get(),    SIGNAL(cameraModeRequested(QString)),
+            this,                 SLOT(selectRequestedCameraMode(QString)));
 
     // --- TimeLapseIndicator
     connect(mController.get(),    SIGNAL(TimeLapseCounterUpdated(QString)),
@@ -577,56 +826,16 @@ namespace tracker
     // move stage back to its original position before imaging.
     connect(mCamera.get(),        SIGNAL(SetStage()),
             this,    SLOT(SetStageBack()));
-    // move stage vertically if the pressure was changed by the pressure ramp algorithm
-    connect(this,                 SIGNAL(pressureStepped(float)),
-            this,                 SLOT(adjustStageZ(float)));
 
     // Update on stage motion
     connect(mController.get(),     SIGNAL(StageisMOVED()),
             this,                   SLOT(SetAction()));
 
-
-    // --- Pressure Control ---
-
-    connect(this,                 SIGNAL(pressureSetRequested(float)),
-            this,                 SLOT(setPressure(float)));
-
-    // --- Time Lapse ---
-    connect(TimeLapse,   SIGNAL(clicked(bool)),
-            this, SLOT(SetTimeLapse(bool)));
-
-    // Shutter Shortcut
-    connect(mSetShutterShortcut, SIGNAL(activated()),
-            this, SLOT(on_toggleshutterButton_pressed()));
-
-    // Lamp Shortcut
-    connect(mSetChannel0Shortcut, SIGNAL(activated()),
-            this, SLOT(on_Channel_0_clicked()));
-    connect(mSetChannel1Shortcut, SIGNAL(activated()),
-            this, SLOT(on_Channel_1_clicked()));
-    connect(mSetChannel2Shortcut, SIGNAL(activated()),
-            this, SLOT(on_Channel_2_clicked()));
-    connect(mSetChannel3Shortcut, SIGNAL(activated()),
-            this, SLOT(on_Channel_3_clicked()));
-    connect(mSetChannel4Shortcut, SIGNAL(activated()),
-            this, SLOT(on_Channel_4_clicked()));
-
-    //Multichannel-Imaging shortcuts
-    connect(mSetMultiImagesShortcut, SIGNAL(activated()),
-            this, SLOT(MultiImageToggle()));
-    connect(mSetMultiChannelsShortcut, SIGNAL(activated()),
-            this, SLOT(MultiChannelToggle()));
-
     // --- Stage ---
 
     connect(this,                 SIGNAL(stageMoveRequested(QPointF)),
             mStage,               SLOT(move(QPointF)));
 
-    // --- Pressure Gauge ---
-
-    connect(mPressureSensor,      SIGNAL(pressureUpdated(double)),
-            this,                 SLOT(forceUpdated(double)));
-
     connect(mImageLabel,          SIGNAL(labelrequestszmove(double)),
             this,                 SLOT(wheelzmove(double)));
 
@@ -638,9 +847,13 @@ namespace tracker
     // Initialise the controller's correlator here because it's quite
     // computationally intensive (and filling the UI triggers updates)
     mController->initialise(mStage);
+    // The FFTW planning runs in the background, updateWidgetActivities() ends the phase
+    if (!mController->valid())
+      mDeviceStartup->beginPhase("Correlator", QStringList("Tracker"));
 
     // Just in case it hasn't been done yet
     this->updateWidgetActivities();
+    focusdockWidget->setEnabled(true);
 
     // Connect these only later to avoid problems when filling the combo boxes
     this->connect(cameraModeBox,  SIGNAL(currentIndexChanged(int)),
@@ -651,17 +864,39 @@ namespace tracker
     displayModeBox_currentIndexChanged(displayModeBox->currentIndex());
     cameraModeBox_currentIndexChanged(cameraModeBox->currentIndex());
 
-    // Connencting the Lamp with MainWindow
-    connect(Channel_0, SIGNAL(clicked()),
-    this, SLOT(on_Channel_0_clicked()));
-    connect(Channel_1, SIGNAL(clicked()),
-    this, SLOT(on_Channel_1_clicked()));
-    connect(Channel_2, SIGNAL(clicked()),
-    this, SLOT(on_Channel_2_clicked()));
-    connect(Channel_3, SIGNAL(clicked()),
-    this, SLOT(on_Channel_3_clicked()));
-    connect(Channel_4, SIGNAL(clicked()),
-    this, SLOT(on_Channel_4_clicked()));
+#ifdef TRACKER_DUMMY
+    mMicroscope.reset(new DummyMicroscope(static_cast<DummyStage*>(mStage)));
+
+    mMicroscopeThread = new Thread(mMicroscope.get(), this);
+    mMicroscope->moveToThread(mMicroscopeThread);
+    // Start the microscope in its own thread
+    mMicroscopeThread->start();
+    // Warning: Exceptions thrown after start() will generate a crash!
+#endif
+  }
+
+  void MainWindow::setupStretcher()
+  {
+    // --- Pressure Gauge ---
+
+    connect(mPressureSensor,      SIGNAL(pressureUpdated(double)),
+            this,                 SLOT(forceUpdated(double)));
+
+    linmotdockWidget->setEnabled(true);
+    mComPortAction->setEnabled(true);
+    mScaleFactorAction->setEnabled(true);
+    mStretcherAction->setEnabled(true);
+  }
+
+  void MainWindow::setupDeviceState()
+  {
+    // Stage, DAC and pressure readings for everything that runs per frame
+    mDeviceStateCache  = new DeviceStateCache(mStage, mDac, mPressureSensor);
+    mDeviceStateThread = new Thread(mDeviceStateCache, this);
+    mDeviceStateCache->moveToThread(mDeviceStateThread);
+    mDeviceStateThread->start();
+    mController->setDeviceStateCache(mDeviceStateCache);
+
     // Connencting the Lamp with Controller
     connect(mController.get(),SIGNAL(LightOFF()),
             this, SLOT(on_Channel_0_clicked()));
@@ -678,39 +913,43 @@ namespace tracker
    // connect(mCamera.get(),SIGNAL(AllowLightForTheNextFrame()),
    //        this,SLOT(TriggerFromCameraForFlash()));
 
+    // Shutter Shortcut (closing the shutter stops the tracker and releases the pressure)
+    connect(mSetShutterShortcut, SIGNAL(activated()),
+            this, SLOT(on_toggleshutterButton_pressed()));
 
-    connect(uProgram, SIGNAL(clicked()),
-    this, SLOT(on_StartMP_clicked()));
-
-
-#ifdef TRACKER_DUMMY
-    mMicroscope.reset(new DummyMicroscope(static_cast<DummyStage*>(mStage)));
+    // Streaming and storing images uses all devices
+    cameraDockWidget->setEnabled(true);
+    stageDockWidget->setEnabled(true);
+    pressureDockWidget->setEnabled(true);
+    ListDockWidget->setEnabled(true);
+    protocoldockWidget->setEnabled(true);
+  }
 
-    mMicroscopeThread = new Thread(mMicroscope.get(), this);
-    mMicroscope->moveToThread(mMicroscopeThread);
-    // Start the microscope in its own thread
-    mMicroscopeThread->start();
-    // Warning: Exceptions thrown after start() will generate a crash!
-#endif
+  void MainWindow::deviceFailed(const QString&, const QString&)
+  {
+    // The docks of the device stay disabled, DeviceStartup has logged the error
+    this->updateStartupLabel();
   }
 
-  MainWindow::~MainWindow()
+  void MainWindow::updateStartupLabel()
   {
-#ifdef TRACKER_DUMMY
-    mMicroscopeThread->quit();
-    if (!mMicroscopeThread->wait(1000))
-      mMicroscopeThread->terminate();
-#endif
+    QString text;
+    const QStringList failed = mDeviceStartup->getFailedTasks();
+    if (!failed.isEmpty())
+      text = "Failed: " + failed.join(", ") + "  ";
+    const QStringList pending = mDeviceStartup->getPendingTasks();
+    if (!pending.isEmpty())
+      text += "Starting: " + pending.join(", ");
 
-    mCameraThread->quit();
-    if (!mCameraThread->wait(1000))
-      mCameraThread->terminate();
-    mControllerThread->quit();
-    if (!mControllerThread->wait(2000))
-      mControllerThread->terminate();
+    mStartupLabel->setText(text);
+    mStartupLabel->setVisible(!text.isEmpty());
+  }
 
-    // Store all settings
-    this->writeSettings();
+  void MainWindow::startupFinished()
+  {
+    this->updateStartupLabel();
+    TRACKER_INFO(mDeviceStartup->getTimeline(), Logger::Low);
+    mDeviceStartup->writeTimeline(PathConfig::getLogPath().path() + "/startup_timeline.csv");
   }
 
   /**************************************************************************/
@@ -1096,6 +1335,7 @@ namespace tracker
     } else {
       acdeacFocusInformationAction->setChecked(true);
     }
+    emit debugImageVisibilityChanged(visible);
   }
 
   /**
@@ -1454,10 +1694,6 @@ namespace tracker
             measuringStartToolButton->setEnabled(false);
             timingStartToolButton->setEnabled(false);
         }
-
-        fftImageSizeXBox->setEnabled(!bControllerRunning);
-        fftImageSizeYBox->setEnabled(!bControllerRunning);
-        correlatorDepthBox->setEnabled(!bControllerRunning);
       } else {
         // Camera not running
 
@@ -1465,20 +1701,19 @@ namespace tracker
         timingStartToolButton->setEnabled(false);
         measuringStartToolButton->setEnabled(false);
         zstackStartToolButton->setEnabled(false);
-
-        fftImageSizeXBox->setEnabled(true);
-        fftImageSizeYBox->setEnabled(true);
-        correlatorDepthBox->setEnabled(true);
       }
-    }
 
-    if (bControllerRunning) {
-      cameraModeBox->setEnabled(false);
-      displayModeBox->setEnabled(false);
-    } else {
-      cameraModeBox->setEnabled(true);
-      displayModeBox->setEnabled(true);
+      // The Controller swaps its Correlator between two images, even while running
+      fftImageSizeXBox->setEnabled(true);
+      fftImageSizeYBox->setEnabled(true);
+      correlatorDepthBox->setEnabled(true);
     }
+
+    cameraModeBox->setEnabled(true);
+    displayModeBox->setEnabled(!bControllerRunning);
+
+    if (mController.get() && mController->valid())
+      mDeviceStartup->endPhase("Correlator");
   }
 
 
@@ -1489,9 +1724,10 @@ namespace tracker
   void MainWindow::displayImage(const QImage image, quint64, quint64)
   {
     mImageLabel->displayImage(image);
-    displayPressure(10 * (10 - mDac->readvoltage()));
-    displayXYpos(mStage->getXpos(), mStage->getYpos());
-    displayZpos(mStage->getZpos());
+    const DeviceState state = mDeviceStateCache->getState();
+    displayPressure(10 * (10 - state.dacVoltage));
+    displayXYpos(state.xPos, state.yPos);
+    displayZpos(state.zPos);
   }
 
   void MainWindow::on_mImageLabel_zoomChanged(double value)
@@ -2302,52 +2538,55 @@ namespace tracker
 
   void MainWindow::saveBuffertoHarddisk()
   {
-      std::cout<< "Are we storing ????"<< std::endl;
-    // if everything is okay for storing the data.
-      int i = Images.size()-1;
-      while (!Images.empty()){
-          // Saving the images from the buffer
-         // Images[i].Image.save(Images[i].Save);
-          QString format("png");
-          Images[i].Image.save(Images[i].Save,format.toAscii(), 100); // Improved speed with no compression instead of -1 to 100
-          TRACKER_INFO("Stored Image '" + Images[i].Save + "'", Logger::Low);
-          std::cout<< "Elapsed time for 1 full resolution image after saving the image:" << mClock.getTime()-getTrackFullImageAcq() << std::endl;
-          // Saving the corresponding metadata files from the buffer
-          const char *filename = Images[i].ba.data();
-          std::ofstream metadata(filename);
-          if(metadata.is_open()){
-              /* fprintf(metadata
-                      "x: %f\n"
-                      "y: %f\n"
-                      "z: %f\n"
-                      "pressure: %f\n"
-                      "gain: %f\n"
-                      "exposure_time: %f\n"
-                      "captureTime: %f\n"
-                      "processTime: %f\n",
-                      Images[i].X, Images[i].Y, Images[i].Z, Images[i].pressure,
-                      Images[i].gain,  Images[i].exposure, Images[i].captureTime, Images[i].processTime);
-                  fflush(metadata);*/
-
-                metadata << "x: " << Images[i].X << std::endl
-                         << "y: " << Images[i].Y << std::endl
-                         << "z: " << Images[i].Z << std::endl
-                         << "pressure: " << Images[i].pressure << std::endl
-                         << "gain: " << Images[i].gain << std::endl
-                         << "exposure_time: " <<  Images[i].exposure   << "ms" << std::endl
-                         //<< "illumination_mode: " << illMode << std::endl
-                        // << "cube: " << cube << std::endl
-                       //  << "shutter: " << shutter << std::endl
-                         << "captureTime: " << Images[i].captureTime << std::endl
-                         << "processTime: " << Images[i].processTime << std::endl;
-                metadata.close();
-
-            std::cout<< "Elapsed time for 1 full resolution image after saving the image and the metadata:" << mClock.getTime()-getTrackFullImageAcq() << std::endl;
-            TRACKER_INFO("Stored meta data '" + Images[i].path + Images[i].distinction +".txt" + "'", Logger::Low);
-          }
-          i = i-1;
-          Images.pop_back();
+    // Hand the buffered images over to the writer threads, oldest first.
+    // What doesn't fit into the queue stays buffered until imageWritten() makes room.
+    while (!mRecordingBuffer->isEmpty()
+           && mImageWriter->getPendingCount() < mImageWriter->getCapacity()) {
+      if (!mImageWriter->submit(mRecordingBuffer->front()))
+        return;
+      mRecordingBuffer->pop();
+    }
+  }
+
+  QString MainWindow::currentStackFilename()
+  {
+    // One stack file per base filename, a new one whenever the user changes it
+    if (mStackFilename.isEmpty() || mStackBase != storageFilename) {
+      if (!mStackFilename.isEmpty()) {
+        // Buffered images still belong to the old stack, which can't be reopened
+        flushRecordingBuffer();
+        mImageWriter->closeStacks();
       }
+
+      QString path = storageFilename;
+      if (!QFileInfo(path).isAbsolute())
+        path = PathConfig::getDataPath().path() + "/" + path;
+      path += "_" + QDate::currentDate().toString("yyyyMMdd") + "_" + QTime::currentTime().toString("hhmmss");
+
+      mStackFilename = mImageWriter->makeUniqueFilename(path, ".tfs");
+      mStackBase = storageFilename;
+    }
+    return mStackFilename;
+  }
+
+  void MainWindow::flushRecordingBuffer()
+  {
+    while (!mRecordingBuffer->isEmpty()) {
+      saveBuffertoHarddisk();
+      mImageWriter->waitForDone();
+    }
+  }
+
+  void MainWindow::imageWritten(QString filename, bool success)
+  {
+    if (success)
+      TRACKER_INFO("Stored Image '" + filename + "'", Logger::Low);
+    else
+      TRACKER_WARNING("Could not store image '" + filename + "'");
+
+    // There is room in the writer queue again
+    if (!mRecordingBuffer->isEmpty())
+      saveBuffertoHarddisk();
   }
 
   void MainWindow::storeSingleShot(QImage image, quint64 captureTime, quint64 processTime)
@@ -2391,15 +2630,9 @@ namespace tracker
     path += "_" +QString::number(channel)+"_"+QString::number(intensity)+ "_"+ cd.toString("yyyyMMdd") + "_" + ct.toString("hhmmss") + "_" + ct.toString("zzz");
     QString format = ".png";
 
-    // Find unique filename
-    int i = 0;
-    QString distinction;
-    ///while (QFile::exists(Images[Counter].path + Images[Counter].distinction + Images[Counter].format)) {
-    while (QFile::exists(path + distinction + format)) {
-      ++i;
-      distinction = "-" + QString::number(i);
-    }
-    QString Save = path + distinction + format;
+    // Find unique filename (the writer knows the names, no need to ask the disk)
+    QString Save = mImageWriter->makeUniqueFilename(path, format);
+    QString distinction = Save.mid(path.size(), Save.size() - path.size() - format.size());
 
     /*
     // Getting the MetaData Information
@@ -2444,17 +2677,27 @@ namespace tracker
       shutter = "close";
     }*/
 
-    //Images[Counter].ba = (Images[Counter].path + Images[Counter].distinction + ".txt").toLocal8Bit();
-    QByteArray ba = (path + distinction + ".txt").toLocal8Bit();
-    //  Images[Counter].Z = mStage->getZpos();
-    double   Z = mStage->getZpos();
-    double x        = mStage->getXpos();
-    double y        = mStage->getYpos();
-    float pressure  = -10*(10-mDac->readvoltage());
-    double gain     = gainBox->value();
-    double expt     = ((double)mCamera->getExposureTime()/1000);
-
-    Images.push_back(ImageBuffer(image,captureTime,processTime,path,format,Save,distinction,ba,Z,x,y,pressure,expt,gain));
+    const DeviceState state = mDeviceStateCache->getState();
+    ImageWriter::Job job;
+    job.image = image;
+    job.filename = Save;
+    job.format = "png";
+    job.quality = 100; // Improved speed with no compression instead of -1 to 100
+    job.metadataFilename = path + distinction + ".txt";
+    job.info.x = state.xPos;
+    job.info.y = state.yPos;
+    job.info.z = state.zPos;
+    job.info.pressure = -10*(10-state.dacVoltage);
+    job.info.gain = gainBox->value();
+    job.info.exposure = ((double)mCamera->getExposureTime()/1000);
+    job.info.captureTime = captureTime;
+    job.info.processTime = processTime;
+    if (mStorageFormat == "stack")
+      job.stackFilename = currentStackFilename();
+
+    // Stream to disk right away, the buffer spills to scratch files if the writer falls behind
+    mRecordingBuffer->push(job);
+    saveBuffertoHarddisk();
 
     /// Testing the new struct and structure for saving the files
     //int isSAVE = 4; // For testing the struct
@@ -2495,7 +2738,7 @@ namespace tracker
                 // Removes and deletes all item from the scene to prevent memory overflow.
                 previewGraphicsView->mGraphicsScene->clear();
                 // Display image in the preview screen
-                mPreviewPixmapItem = new QGraphicsPixmapItem(QPixmap::fromImage(image,0));
+                mPreviewPixmapItem = new QGraphicsPixmapItem(QPixmap::fromImage(toDisplayImage(image),0));
                 //mPreviewScene = new QGraphicsScene;
                 previewGraphicsView->mGraphicsScene->addItem(mPreviewPixmapItem);
                 //mPreviewScene->addItem(mPreviewPixmapItem);
@@ -2572,10 +2815,11 @@ namespace tracker
     const char *filename = ba.data();
     std::ofstream metadata(filename);
     if(metadata.is_open()){
-      metadata << "x: " << mStage->getXpos() << std::endl
-               << "y: " << mStage->getYpos() << std::endl
-               << "z: " << mStage->getZpos() << std::endl
-               << "pressure: " << -10*(10-mDac->readvoltage()) << std::endl
+      const DeviceState state = mDeviceStateCache->getState();
+      metadata << "x: " << state.xPos << std::endl
+               << "y: " << state.yPos << std::endl
+               << "z: " << state.zPos << std::endl
+               << "pressure: " << -10*(10-state.dacVoltage) << std::endl
                << "gain: " << gainBox->value() << std::endl
                << "exposure_time: " << ((double)mCamera->getExposureTime()/1000) << "ms" << std::endl
                << "illumination_mode: " << illMode << std::endl
@@ -2681,14 +2925,19 @@ namespace tracker
   {
     assert(mCamera->hasMode(cameraModeBox->currentText()));
 
-    // Adjust exposure time linearly with image area
+    // Adjust exposure time linearly with image area. Not for a region of
+    // interest (same pixels) and not for the adaptive camera modes, which
+    // switch back and forth and would let the exposure time drift.
+    // mCurrentImageArea stays the one of the last mode that was adjusted for.
     QSize size = mCamera->getImageSize(cameraModeBox->currentText());
-    if (mCurrentImageArea > 0) {
-      double areaRatio = (double)(size.width() * size.height()) / mCurrentImageArea;
-      int newExposureTime = qRound(mExposureTimeBox->value() * areaRatio);
-      mExposureTimeBox->setValue(newExposureTime);
+    if (!mKeepExposureTime && !mCamera->isRegionOfInterest(cameraModeBox->currentText())) {
+      if (mCurrentImageArea > 0) {
+        double areaRatio = (double)(size.width() * size.height()) / mCurrentImageArea;
+        int newExposureTime = qRound(mExposureTimeBox->value() * areaRatio);
+        mExposureTimeBox->setValue(newExposureTime);
+      }
+      mCurrentImageArea = size.width() * size.height();
     }
-    mCurrentImageArea = size.width() * size.height();
 
     emit cameraModeChanged(cameraModeBox->currentText(), -1, -1.0);
     ///Trigger
@@ -3097,6 +3346,22 @@ namespace tracker
       mController->setFFTImageSizeY(qMax(1, text.toInt()));
   }
 
+  void MainWindow::selectRequestedCameraMode(QString mode)
+  {
+    int index = cameraModeBox->findText(mode);
+    if (index < 0)
+    {
+      TRACKER_WARNING("Requested camera mode '" + mode + "' is not available");
+      return;
+    }
+    if (index != cameraModeBox->currentIndex())
+    {
+      mKeepExposureTime = true;
+      cameraModeBox->setCurrentIndex(index);
+      mKeepExposureTime = false;
+    }
+  }
+
   void MainWindow::displayControllerFrameRate(double frameRate)
   {
     if (mControllerThread->isRunning())
@@ -3807,14 +4072,17 @@ namespace tracker
   {
     QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
 
-    // Restore window positions, etc.
-    restoreGeometry(settings.value("geometry").toByteArray());
-    restoreState(settings.value("windowState").toByteArray());
+    // Note: Window positions are restored in the constructor, before the window is shown
 
     stageStepBox->setValue(settings.value("Stage_Step", 10).toInt());
     mMaxSliderExposureTime = qMax(1, settings.value("Max_Slider_Exposure_Time", 1000000).toInt());
     mImageLabel->setDisplayFrequency(qMax(0.0, settings.value("Image_Display_Frequency", 24.0).toDouble()));
     storageFilename = settings.value("Base_Filename", "").toString();
+    mStorageFormat = settings.value("Storage_Format", "png").toString();
+    if (mStorageFormat != "png" && mStorageFormat != "stack") {
+      TRACKER_WARNING("Unknown Storage_Format '" + mStorageFormat + "', storing PNG files");
+      mStorageFormat = "png";
+    }
     storageFilenameEdit->setText(storageFilename);
     if(mStoragePath != NULL) {
       mStoragePath->settingsStorageFilenameEdit->setText(storageFilename);
@@ -3881,6 +4149,7 @@ namespace tracker
     settings.setValue("Image_Display_Frequency", mImageLabel->getDisplayFrequency());
     //settings.setValue("Base_Filename", storageFilenameEdit->text());
     settings.setValue("Base_Filename", storageFilename);
+    settings.setValue("Storage_Format", mStorageFormat);
     settings.setValue("Experiment_Run", storageRunSpinBox->value());
 
     // Save values to array first
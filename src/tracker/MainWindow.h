@@ -66,6 +66,9 @@ namespace tracker
        - \c Image_Display_Frequency: Display update refresh rate
          in Hertz (default: 24)
        - \c Base_Filename: User specified infix for the image filenames
+       - \c Storage_Format: \c png for one PNG and one .txt file per image
+         (default) or \c stack to append all images of a session to one .tfs
+         stack file (see StackFile.h)
        - \c Experiment_Run: Currently used experiment run Nr.
        - List of all \ref DisplayMode "Display Modes"
   */
@@ -79,47 +82,25 @@ namespace tracker
         The following steps are performed:
          -# Set internal variables to useful values
          -# Create all the UI elements (specified by both code and designer)
-         -# Create the application components:
-            -# Camera
-            -# Controller
-            -# Stage
-            -# PressureSensor
-            -# \ref Thread "Threads"
-         -# Connect and configure UI
-         -# readSettings() and apply them
-         -# When testing offline (#TRACKER_DUMMY), create the DummyMicroscope
+         -# Start the device bring-up (see DeviceStartup) and return, so the
+            window shows up right away. The docks stay disabled until the
+            devices they use are ready:
+            -# In the background and concurrently: Camera, Stage, DAC,
+               PressureSensor, LinearMotor, Lamp and the Leica microscope
+            -# setupTracker() once Camera and Stage are ready: Controller,
+               \ref Thread "Threads", connections, readSettings() and the
+               Correlator (planned in the background by the Controller).
+               When testing offline (#TRACKER_DUMMY), the DummyMicroscope too.
+            -# setupStretcher() once PressureSensor and LinearMotor are ready
+            -# setupDeviceState() once everything else is ready
+         -# The startup timeline goes to the log and to startup_timeline.csv
+            in the log directory
     */
 
-    /** A Struct to store acquired images with meta data in order to flush the data
-          only once in an offline fashion to speed up the sequence image acquiring with
-          elimination of the individual file storage (~300-400ms)
-       */
-       struct ImageBuffer {
-           ImageBuffer(QImage i,quint64 c,quint64 p,QString pa,QString f, QString S,QString d,QByteArray b,
-                       double z, double x, double y, float pres, double exp, double g) :
-               Image(i), captureTime(c), processTime(p),
-               path(pa), format(f), Save(S), distinction(d), ba(b), Z(z),
-               X(x), Y(y), pressure(pres), exposure(exp), gain(g){}
-
-           QImage  Image;             //!< Acquired and processed image
-           quint64 captureTime;       //!< Image capture time
-           quint64 processTime;       //!< Image process time (?estimated?)
-           QString path;              //!< Image storage path
-           QString format;            //!< Image storage format
-           QString Save;              //!< Total path with set file name and format
-           QString distinction;       //!< Distinction file format
-           QByteArray ba;             //!< Metadata storage place
-           double   Z;                //!< Storing the Z position of the image
-           double   X;                //!< Storing the x position of the image
-           double   Y;                //!< Storing the x position of the image
-           float    pressure;         //!< Storing the pressure position of the image
-           double   exposure;         //!< Storing the exposure position of the image
-           double   gain;             //!< Storing the gain position of the image
-       };      
-
     MainWindow();
 
-    /** Stops all threads currently running and stores the settings.
+    /** Waits for the device bring-up, stops all threads currently running
+        and stores the settings.
     @note
         Destruction of QObjects is done automatically.
     */
@@ -178,6 +159,12 @@ namespace tracker
      */
     void closePressureSensorComPort();
 
+    /**
+     * @brief Signal to inform the Controller whether the debug images (focus dock) can be seen.
+     * @param visible Visibility of the focus dock
+     */
+    void debugImageVisibilityChanged(bool visible);
+
     /**
      * @brief Signal to inform PressureSensor to open the specified com port
      * @param mPort Com port on which the force sensor is attached
@@ -238,6 +225,38 @@ namespace tracker
     void setScaleFactor(double iNominalValue, double iMeasureEndValue, double iNominalForce, double iInputSensitivity);
 
   private slots:
+    /*** Startup tasks (run by mDeviceStartup, see MainWindow()) ***/
+
+    /// Creates the Camera (background)
+    void openCamera();
+    /// Creates the Stage, opens the driver (background)
+    void openStage();
+    /// Creates the DAC tasks and sets 0 kPa (background)
+    void openDac();
+    /// Opens the PressureSensor (force sensor) port (background)
+    void openPressureSensor();
+    /// Opens the LinearMotor port (background)
+    void openLinearMotor();
+    /// Opens the Lamp port (background)
+    void openLamp();
+    /// Initialises the Leica microscope (background)
+    void openMicroscope();
+    /// Creates the Controller and everything tracking related (GUI thread)
+    void setupTracker();
+    /// Connects the PressureSensor with the LinearMotor and AutoStretch (GUI thread)
+    void setupStretcher();
+    /// Creates the DeviceStateCache and enables the remaining docks (GUI thread)
+    void setupDeviceState();
+
+    /// Takes over a device created in the background and enables its widgets
+    void deviceReady(const QString& name);
+    /// Shows which device failed to start in the status bar
+    void deviceFailed(const QString& name, const QString& error);
+    /// Logs and stores the startup timeline
+    void startupFinished();
+    /// Lists the devices that are still starting in the status bar
+    void updateStartupLabel();
+
     /** Controller thread (in any \ref Controller::Mode "mode") finished
         (disconnects the signals, updates the UI and stops the animation)
     */
@@ -346,7 +365,8 @@ namespace tracker
 
     /** User selected another camera mode.
         This automatically adjusts the Camera exposure time linearly with
-        the resolution (area-based). \n
+        the resolution (area-based), except for a region of interest (see
+        Camera::isRegionOfInterest()). \n
         Also, all Controller related UI widgets get updated with the
         associated values (dictated by a Controller::OptionSet). That update
         process includes choosing some good (and fast) values for the FFT
@@ -354,6 +374,12 @@ namespace tracker
     */
     void cameraModeBox_currentIndexChanged(int index);
 
+    /** The Controller asks for another camera mode (adaptive camera modes).
+        Selects it in the combo box, so the change is handled like a manual
+        one, except that the exposure time is kept.
+    */
+    void selectRequestedCameraMode(QString mode);
+
     /** User selected another display mode.
         The state of the old DisplayMode gets saved first because the
         current values are actually 'stored' in the user interface widgets.
@@ -402,6 +428,9 @@ namespace tracker
     */
     void saveBuffertoHarddisk();
 
+    //! Logs a finished ImageWriter job and hands over more buffered images
+    void imageWritten(QString filename, bool success);
+
     //Tracking of storage time from the request for the image
     /// Tracking the time for full image resolution image acqusition
     void TrackFullImageAcq(quint64 value);
@@ -897,7 +926,9 @@ namespace tracker
     void addDisplayMode(QString name);
 
     /** Reads all settings from the ini file.
-        For a list see class \ref MainWindow "overview".
+        For a list see class \ref MainWindow "overview". \n
+        Except for the window geometry and state, which the constructor
+        restores before the window is shown.
     */
     void readSettings();
 
@@ -907,6 +938,15 @@ namespace tracker
     */
     void writeSettings();
 
+    /** Returns the stack file for stored images in \c stack Storage_Format.
+        Changing the base filename closes the current stack and starts a new
+        one, named after the base filename and the current time.
+    */
+    QString currentStackFilename();
+
+    //! Blocks until all images in mRecordingBuffer are written
+    void flushRecordingBuffer();
+
     /** Deciphers a camera mode.
         A string in the QSettings may not contain '/' and '\', so they were
         replaced by \c __fwd_sl__ and \c __bwd_sl__ respectively. \n
@@ -938,6 +978,7 @@ namespace tracker
     QLabel*              mCameraFrameRateLabel;     ///< Label for the camera fps
     QLabel*              mControllerFrameRateLabel; ///< Label for the controller fps
     QLabel*              mImageZoomLabel;           ///< Label for the center image zoom
+    QLabel*              mStartupLabel;             ///< Devices still starting (status bar)
     QIntValidator*       mFFTSizeXValidator;        ///< Qt validator for the FFT width
     QIntValidator*       mFFTSizeYValidator;        ///< Qt validator for the FFT height
     QSignalMapper*       mSingleShotButtonMapper;   ///< Connects multiple single shot buttons to one slot
@@ -966,6 +1007,10 @@ namespace tracker
     auto_ptr<Controller> mController;               ///< Controller object (managed here)
     Stage*               mStage;                    ///< Stage object (managed here)
     Dac*                 mDac;
+    ImageWriter*         mImageWriter;              ///< Writes the stored images in the background
+    QString              mStorageFormat;            ///< "png" (one file per image) or "stack" (see StackFile.h)
+    QString              mStackFilename;            ///< Stack file the stored images currently go to
+    QString              mStackBase;                ///< Base filename mStackFilename was created for
     ahmMicroscope*       mAhmmicroscope;
     Lamp*                mLamp;                     ///< LED lamp object
     ///TODO one day... started : 20180507
@@ -1003,6 +1048,9 @@ namespace tracker
 #endif
     Thread*              mCameraThread;             ///< Thread for the Camera
     Thread*              mControllerThread;         ///< Thread for the Controller
+    DeviceStateCache*    mDeviceStateCache;         ///< Cached stage, DAC and pressure readings (managed here)
+    Thread*              mDeviceStateThread;        ///< Thread polling the devices for mDeviceStateCache
+    DeviceStartup*       mDeviceStartup;            ///< Brings up the devices concurrently (managed here)
 
     bool                 mDiscardStageStepValue;    ///< See notes in source of on_stageStepBox_valueChanged()
     bool                 mDiscardExposureTimeValue; ///< See notes in source of on_stageStepBox_valueChanged()
@@ -1018,6 +1066,8 @@ namespace tracker
     int                  mPreviousDisplayModeIndex;
     ///< Total pixel area of the image (used to adjust Camera parameters automatically)
     int                  mCurrentImageArea;
+    ///< Set while selectRequestedCameraMode() changes the mode (no exposure time adjustment)
+    bool                 mKeepExposureTime;
 
     int                  newStorageRunSpinBoxValue; /**< New value of the storageSpinBoxes */
     int                  storageRunSpinBoxValue;    /**< Current value of the storageSpinBoxes */
@@ -1028,7 +1078,7 @@ namespace tracker
     int                  Counter;                   ///< Counter for the Image buffer for "offline" saving
     int                  NumOfImages;               /**< Number Of Images have been requested initiated from Controller::emitAutoPicture();
                                                          thorugh Camera::takeAutoPicture and finally set in MainWindow::shootautopicture()*/
-    std::vector<ImageBuffer>  Images;                    /**< Vector of the Images for online saving and easy way to push and pop values */
+    RecordingBuffer*     mRecordingBuffer;          ///< Stored images waiting for mImageWriter
 
     QVector<double> measuredForce;                  /**< Vector for the measured force */
     QVector<double> measuredLength;                 /**< Vector for the measured length */
@@ -13,6 +13,7 @@
 #include "LinearMotor.h"
 #include "AutoStretch.h"
 #include "SerialInterface.h"
+#include "ThreadProfile.h"
 #include <wxctb/serport.h>
 
 namespace tracker
@@ -52,6 +53,7 @@ namespace tracker
    */
   void MessagesHandler::start()
   {
+    applyThreadProfile("Serial");
     mTimer->setInterval(mMessagesTimerDuration);
     mTimer->start();
   }
@@ -0,0 +1,176 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "MotionPredictor.h"
+
+namespace tracker
+{
+    MotionPredictor::MotionPredictor(Model model)
+        : mModel(model)
+        , mProcessNoise(100.0)
+        , mMeasurementNoise(1.0)
+    {
+        this->reset();
+    }
+
+    void MotionPredictor::reset()
+    {
+        mInitialised = false;
+        mLastTime = 0;
+        for (int a = 0; a < 2; ++a)
+            this->initialise(mAxes[a], 0.0);
+    }
+
+    void MotionPredictor::setModel(Model model)
+    {
+        if (model == mModel)
+            return;
+        mModel = model;
+        this->reset();
+    }
+
+    void MotionPredictor::update(QPointF position, quint64 time)
+    {
+        if (!mInitialised)
+        {
+            this->initialise(mAxes[0], position.x());
+            this->initialise(mAxes[1], position.y());
+            mLastTime = time;
+            mInitialised = true;
+            return;
+        }
+
+        // Images might arrive out of order after a dropped frame, never go back in time
+        double dt = time > mLastTime ? (time - mLastTime) * 1e-6 : 0.0;
+        mLastTime = qMax(mLastTime, time);
+
+        this->propagate(mAxes[0], dt);
+        this->propagate(mAxes[1], dt);
+        this->correct(mAxes[0], position.x());
+        this->correct(mAxes[1], position.y());
+    }
+
+    QPointF MotionPredictor::predict(quint64 time) const
+    {
+        double dt = time > mLastTime ? (time - mLastTime) * 1e-6 : 0.0;
+        QPointF result;
+        for (int a = 0; a < 2; ++a)
+        {
+            const double* x = mAxes[a].x;
+            double position = x[0] + x[1] * dt;
+            if (mModel == ConstantAcceleration)
+                position += 0.5 * x[2] * dt * dt;
+            if (a == 0)
+                result.rx() = position;
+            else
+                result.ry() = position;
+        }
+        return result;
+    }
+
+    void MotionPredictor::initialise(Axis& axis, double position)
+    {
+        // Nothing is known about the motion yet, only the position is measured
+        const double unknown = 1e6;
+        for (int i = 0; i < 3; ++i)
+        {
+            axis.x[i] = 0.0;
+            for (int j = 0; j < 3; ++j)
+                axis.P[i][j] = 0.0;
+            axis.P[i][i] = unknown;
+        }
+        axis.x[0] = position;
+        axis.P[0][0] = mMeasurementNoise * mMeasurementNoise;
+    }
+
+    void MotionPredictor::propagate(Axis& axis, double dt) const
+    {
+        const int n = this->dimension();
+        const double dt2 = dt * dt;
+        const double dt3 = dt2 * dt;
+
+        // Transition matrix F (upper triangular)
+        double F[3][3] = {
+            { 1.0, dt,  0.5 * dt2 },
+            { 0.0, 1.0, dt        },
+            { 0.0, 0.0, 1.0       }
+        };
+
+        // Discretised white noise (van Loan) for the highest derivative
+        double Q[3][3];
+        const double q = mProcessNoise;
+        if (mModel == ConstantVelocity)
+        {
+            Q[0][0] = dt3 / 3.0 * q; Q[0][1] = dt2 / 2.0 * q;
+            Q[1][0] = dt2 / 2.0 * q; Q[1][1] = dt * q;
+        }
+        else
+        {
+            const double dt4 = dt3 * dt;
+            const double dt5 = dt4 * dt;
+            Q[0][0] = dt5 / 20.0 * q; Q[0][1] = dt4 / 8.0 * q; Q[0][2] = dt3 / 6.0 * q;
+            Q[1][0] = dt4 / 8.0  * q; Q[1][1] = dt3 / 3.0 * q; Q[1][2] = dt2 / 2.0 * q;
+            Q[2][0] = dt3 / 6.0  * q; Q[2][1] = dt2 / 2.0 * q; Q[2][2] = dt * q;
+        }
+
+        // x = F x
+        double x[3] = { 0.0, 0.0, 0.0 };
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+                x[i] += F[i][j] * axis.x[j];
+
+        // P = F P F' + Q
+        double FP[3][3];
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+            {
+                FP[i][j] = 0.0;
+                for (int k = 0; k < n; ++k)
+                    FP[i][j] += F[i][k] * axis.P[k][j];
+            }
+        for (int i = 0; i < n; ++i)
+        {
+            axis.x[i] = x[i];
+            for (int j = 0; j < n; ++j)
+            {
+                double value = Q[i][j];
+                for (int k = 0; k < n; ++k)
+                    value += FP[i][k] * F[j][k];
+                axis.P[i][j] = value;
+            }
+        }
+    }
+
+    void MotionPredictor::correct(Axis& axis, double position) const
+    {
+        const int n = this->dimension();
+
+        // H = [1 0 0] --> the innovation covariance is a scalar
+        double innovation = position - axis.x[0];
+        double S = axis.P[0][0] + mMeasurementNoise * mMeasurementNoise;
+        if (S <= 0.0)
+            return;
+
+        double K[3];
+        for (int i = 0; i < n; ++i)
+            K[i] = axis.P[i][0] / S;
+
+        // x = x + K y, P = (I - K H) P
+        double firstRow[3];
+        for (int j = 0; j < n; ++j)
+            firstRow[j] = axis.P[0][j];
+        for (int i = 0; i < n; ++i)
+        {
+            axis.x[i] += K[i] * innovation;
+            for (int j = 0; j < n; ++j)
+                axis.P[i][j] -= K[i] * firstRow[j];
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _MotionPredictor_H__
+#define _MotionPredictor_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QPointF>
+
+namespace tracker
+{
+    /** Kalman filter that estimates the motion of the sample from noisy
+        position measurements and extrapolates it into the future.
+        Both axes are filtered independently with the same kinematic model.
+    @par Coordinates
+        The positions are absolute sample positions in stage coordinates,
+        i.e. the stage position visible on the image plus the offset of the
+        sample on that image. TransferFunction computes them from the
+        image offset, the stage moves issued and the Smith Predictor queue.
+    @par Models
+        - ConstantVelocity: state is position and velocity, the acceleration
+          is white noise with the spectral density set by setProcessNoise().
+        - ConstantAcceleration: state additionally contains the acceleration,
+          the jerk is white noise.
+    */
+    class MotionPredictor
+    {
+    public:
+        //! Kinematic model of the sample motion
+        enum Model
+        {
+            ConstantVelocity,
+            ConstantAcceleration
+        };
+
+        MotionPredictor(Model model = ConstantVelocity);
+
+        //! Forgets the state, the next update() initialises the filter again
+        void reset();
+
+        /** Incorporates a new position measurement.
+        @param position
+            Absolute sample position in stage coordinates
+        @param time
+            Capture time of the image in microseconds (HPClock)
+        */
+        void update(QPointF position, quint64 time);
+
+        /** Returns the position the sample is expected to have at \c time.
+            Returns (0, 0) if the filter is not initialised yet.
+        */
+        QPointF predict(quint64 time) const;
+
+        //! Returns the estimated velocity in stage units per second
+        QPointF getVelocity() const
+            { return QPointF(mAxes[0].x[1], mAxes[1].x[1]); }
+
+        //! Tells whether update() was called since the last reset()
+        bool isInitialised() const
+            { return mInitialised; }
+
+        //! Sets the kinematic model (resets the filter if it changes)
+        void setModel(Model model);
+        //! Returns the value described in setModel()
+        Model getModel() const
+            { return mModel; }
+
+        /** Sets the spectral density of the white noise driving the model
+            (acceleration for ConstantVelocity, jerk for ConstantAcceleration).
+            Larger values follow sudden changes faster but pass on more noise.
+        */
+        void setProcessNoise(double value)
+            { mProcessNoise = value; }
+        //! Sets the standard deviation of a position measurement (stage units)
+        void setMeasurementNoise(double value)
+            { mMeasurementNoise = value; }
+
+    private:
+        //! Filter state of a single axis
+        struct Axis
+        {
+            double x[3];        //!< Position, velocity and acceleration
+            double P[3][3];     //!< Covariance of the estimate
+        };
+
+        //! Sets x to the measurement and P to the initial uncertainty
+        void initialise(Axis& axis, double position);
+        //! Propagates the state and covariance by dt seconds
+        void propagate(Axis& axis, double dt) const;
+        //! Incorporates a position measurement
+        void correct(Axis& axis, double position) const;
+
+        //! Number of state variables of the current model (2 or 3)
+        int dimension() const
+            { return mModel == ConstantVelocity ? 2 : 3; }
+
+        Model       mModel;
+        double      mProcessNoise;      //!< See setProcessNoise()
+        double      mMeasurementNoise;  //!< See setMeasurementNoise()
+        Axis        mAxes[2];           //!< x and y axis
+        quint64     mLastTime;          //!< Time of the last update()
+        bool        mInitialised;       //!< See isInitialised()
+    };
+}
+
+#endif /* _MotionPredictor_H__ */
@@ -0,0 +1,356 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "MultiRoiTracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <QRunnable>
+
+#include "CorrelationImage.h"
+#include "Exception.h"
+#include "PixelKernels.h"
+
+namespace tracker
+{
+    /** Consecutive regions that share one pair of batched FFTW plans.
+        Runs in one of the worker threads of MultiRoiTracker::mPool.
+    */
+    class MultiRoiTracker::Batch : public QRunnable
+    {
+    public:
+        Batch(MultiRoiTracker* tracker, int index, int first, int last)
+            : mForwardPlan(NULL), mInversePlan(NULL)
+            , mTracker(tracker), mIndex(index), mFirst(first), mLast(last)
+        {
+            this->setAutoDelete(false);
+
+            // Regions are stored one after another in the buffers
+            int dimensions[2] = { tracker->mRoiSize.height(), tracker->mRoiSize.width() };
+            int count = last - first;
+            float* spatial = tracker->mSpatialData + first * tracker->mArea;
+            fftwf_complex* spectra = tracker->mSpectra + first * tracker->mFrequencyArea;
+            fftwf_complex* cross = tracker->mCrossSpectra + first * tracker->mFrequencyArea;
+
+            mForwardPlan = fftwf_plan_many_dft_r2c(2, dimensions, count,
+                spatial, NULL, 1, tracker->mArea,
+                spectra, NULL, 1, tracker->mFrequencyArea, FFTW_MEASURE);
+            mInversePlan = fftwf_plan_many_dft_c2r(2, dimensions, count,
+                cross, NULL, 1, tracker->mFrequencyArea,
+                spatial, NULL, 1, tracker->mArea, FFTW_MEASURE);
+            if (!mForwardPlan || !mInversePlan)
+                TRACKER_EXCEPTION("Could not create the FFTW plans for the tracking regions");
+        }
+
+        ~Batch()
+        {
+            if (mForwardPlan)
+                fftwf_destroy_plan(mForwardPlan);
+            if (mInversePlan)
+                fftwf_destroy_plan(mInversePlan);
+        }
+
+        void run()
+        {
+            mTracker->processRegions(mIndex, mFirst, mLast);
+        }
+
+        fftwf_plan  mForwardPlan;   //!< Spatial data --> spectra
+        fftwf_plan  mInversePlan;   //!< Cross spectra --> spatial data
+
+    private:
+        MultiRoiTracker*    mTracker;
+        int                 mIndex;
+        int                 mFirst;
+        int                 mLast;
+    };
+
+    MultiRoiTracker::MultiRoiTracker(QSize roiSize, const QVector<QPoint>& centres, int threadCount)
+        : mRoiSize((roiSize.width() + 3) / 4 * 4, (roiSize.height() + 3) / 4 * 4)
+        , mInitialCentres(centres)
+        , mWindow(NULL)
+        , mFilter(NULL)
+        , mSpatialData(NULL)
+        , mSpectra(NULL)
+        , mReferenceSpectra(NULL)
+        , mCrossSpectra(NULL)
+        , mPolicy(Mean)
+        , mMinimumConfidence(0.0f)
+        , mMinimumOffset(2.0f)
+        , mImagesTracked(0)
+    {
+        if (centres.isEmpty())
+            TRACKER_EXCEPTION("Cannot track without any region");
+        // Smaller regions leave nothing but the peak for the confidence
+        if (mRoiSize.width() < 16 || mRoiSize.height() < 16)
+            TRACKER_EXCEPTION("Tracking regions have to be at least 16x16 pixels");
+
+        mFrequencySize = QSize(mRoiSize.width() / 2 + 1, mRoiSize.height());
+        mArea = mRoiSize.width() * mRoiSize.height();
+        mFrequencyArea = mFrequencySize.width() * mFrequencySize.height();
+
+        const int count = centres.size();
+        mWindow       =         (float*)fftwf_malloc(sizeof(float) * mArea);
+        mFilter       =         (float*)fftwf_malloc(sizeof(float) * mFrequencyArea);
+        mSpatialData  =         (float*)fftwf_malloc(sizeof(float) * mArea * count);
+        mSpectra      = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * mFrequencyArea * count);
+        mReferenceSpectra = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * mFrequencyArea * count);
+        mCrossSpectra = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * mFrequencyArea * count);
+
+        BaseImage::computeWindow(mWindow, mRoiSize);
+        CorrelationImage::computeBandPassFilter(mFilter, mFrequencySize);
+
+        mRegions.resize(count);
+        mReferenceCentres.resize(count);
+        mReferenceOffsets.resize(count);
+        mScratch.reserve(count);
+
+        // Split the regions into (almost) equally large batches
+        int batchCount = qBound(1, threadCount, count);
+        for (int i = 0; i < batchCount; ++i)
+            mBatches.push_back(new Batch(this, i, count * i / batchCount, count * (i + 1) / batchCount));
+        mPool.setMaxThreadCount(batchCount);
+
+        this->reset();
+    }
+
+    MultiRoiTracker::~MultiRoiTracker()
+    {
+        mPool.waitForDone();
+        for (int i = 0; i < mBatches.size(); ++i)
+            delete mBatches[i];
+
+        fftwf_free(mWindow);
+        fftwf_free(mFilter);
+        fftwf_free(mSpatialData);
+        fftwf_free(mSpectra);
+        fftwf_free(mReferenceSpectra);
+        fftwf_free(mCrossSpectra);
+    }
+
+    void MultiRoiTracker::reset()
+    {
+        mImagesTracked = 0;
+        for (int i = 0; i < mRegions.size(); ++i)
+        {
+            mRegions[i].centre = mInitialCentres[i];
+            mRegions[i].offset = QPointF(0.0, 0.0);
+            mRegions[i].confidence = 0.0f;
+            mReferenceCentres[i] = mInitialCentres[i];
+            mReferenceOffsets[i] = QPointF(0.0, 0.0);
+        }
+    }
+
+    QPointF MultiRoiTracker::track(const QImage snapshot, float* confidence)
+    {
+        // Regions must fit into the image
+        if (snapshot.width() < mRoiSize.width() || snapshot.height() < mRoiSize.height())
+            TRACKER_EXCEPTION("Tracking regions are larger than the image");
+
+        mSnapshot = snapshot;
+
+        // The last batch runs in this thread, there is nothing else to do meanwhile
+        for (int i = 0; i < mBatches.size() - 1; ++i)
+            mPool.start(mBatches[i]);
+        mBatches.last()->run();
+        mPool.waitForDone();
+
+        // Don't keep a reference to the camera buffer
+        mSnapshot = QImage();
+
+        // The first image has nothing to compare with
+        if (mImagesTracked++ == 0)
+        {
+            if (confidence)
+                *confidence = 0.0f;
+            return QPointF(0.0, 0.0);
+        }
+
+        QPointF offset = this->combine(confidence);
+        if (offset.manhattanLength() > mMinimumOffset)
+            return offset;
+        else
+            return QPointF(0.0, 0.0);
+    }
+
+    template <class T>
+    void MultiRoiTracker::assignRegion(const QImage& image, QPoint corner, float* target) const
+    {
+        const int width  = mRoiSize.width();
+        const int height = mRoiSize.height();
+
+        // Remove the DC component first, then multiply with the window
+        quint64 sum = 0;
+        for (int y = 0; y < height; ++y)
+        {
+            const T* source = reinterpret_cast<const T*>(image.scanLine(corner.y() + y)) + corner.x();
+            sum += PixelKernels<T>::sum(source, width);
+        }
+        const float dcValue = (float)sum / mArea;
+
+        const float* window = mWindow;
+        for (int y = 0; y < height; ++y)
+        {
+            const T* source = reinterpret_cast<const T*>(image.scanLine(corner.y() + y)) + corner.x();
+            PixelKernels<T>::ingestWindowed(source, window, target, width, dcValue);
+            target += width;
+            window += width;
+        }
+    }
+
+    void MultiRoiTracker::processRegions(int batch, int first, int last)
+    {
+        const int width  = mRoiSize.width();
+        const int height = mRoiSize.height();
+        const bool compare = mImagesTracked > 0;
+        // Const access only, the image must not detach from the camera buffer
+        const QImage& image = mSnapshot;
+
+        for (int i = first; i < last; ++i)
+        {
+            Region& region = mRegions[i];
+
+            // Keep the region inside the image
+            int left = qBound(0, region.centre.x() - width / 2, image.width() - width);
+            int top  = qBound(0, region.centre.y() - height / 2, image.height() - height);
+
+            if (isMono16(image))
+                this->assignRegion<quint16>(image, QPoint(left, top), mSpatialData + i * mArea);
+            else
+                this->assignRegion<uchar>(image, QPoint(left, top), mSpatialData + i * mArea);
+        }
+
+        // All regions of this batch at once
+        Batch* self = mBatches[batch];
+        fftwf_execute(self->mForwardPlan);
+
+        const size_t spectrumBytes = sizeof(fftwf_complex) * mFrequencyArea;
+        if (!compare)
+        {
+            // The first image is the reference of every region
+            std::memcpy(mReferenceSpectra + first * mFrequencyArea, mSpectra + first * mFrequencyArea,
+                        spectrumBytes * (last - first));
+            for (int i = first; i < last; ++i)
+            {
+                mReferenceCentres[i] = mRegions[i].centre;
+                mReferenceOffsets[i] = mRegions[i].offset;
+            }
+            return;
+        }
+
+        // Cross power spectra with the reference images, band pass filtered
+        const fftwf_complex* current  = mSpectra + first * mFrequencyArea;
+        const fftwf_complex* previous = mReferenceSpectra + first * mFrequencyArea;
+        fftwf_complex* cross = mCrossSpectra + first * mFrequencyArea;
+        for (int i = first; i < last; ++i)
+        {
+            const float* filter = mFilter;
+            const float* filterEnd = mFilter + mFrequencyArea;
+            while (filter < filterEnd)
+            {
+                cross[0][0] = (current[0][0] * previous[0][0] + current[0][1] * previous[0][1]) * filter[0];
+                cross[0][1] = (current[0][1] * previous[0][0] - current[0][0] * previous[0][1]) * filter[0];
+                ++cross; ++current; ++previous; ++filter;
+            }
+        }
+
+        fftwf_execute_dft_c2r(self->mInversePlan, mCrossSpectra + first * mFrequencyArea,
+            mSpatialData + first * mArea);
+
+        for (int i = first; i < last; ++i)
+        {
+            Region& region = mRegions[i];
+            QPoint measured = CorrelationImage::findMaximum(mSpatialData + i * mArea, mRoiSize, &region.confidence);
+
+            // Correlation function is periodic
+            if (measured.x() > width / 2)
+                measured.rx() -= width;
+            if (measured.y() > height / 2)
+                measured.ry() -= height;
+
+            // The region itself may have moved since its reference image
+            const QPointF shift = measured + (region.centre - mReferenceCentres[i]);
+            region.offset = mReferenceOffsets[i] + shift;
+
+            // Like Correlator::track(): only a significant move makes this the new reference
+            if (shift.manhattanLength() > mMinimumOffset)
+            {
+                std::memcpy(mReferenceSpectra + i * mFrequencyArea, mSpectra + i * mFrequencyArea, spectrumBytes);
+                mReferenceCentres[i] = region.centre;
+                mReferenceOffsets[i] = region.offset;
+            }
+
+            // Follow the content so that it stays in the centre of the region
+            QPoint centre = mInitialCentres[i] + region.offset.toPoint();
+            centre.rx() = qBound(width / 2, centre.x(), image.width() - width + width / 2);
+            centre.ry() = qBound(height / 2, centre.y(), image.height() - height + height / 2);
+            region.centre = centre;
+        }
+    }
+
+    QPointF MultiRoiTracker::combine(float* confidence)
+    {
+        // Leave out unreliable regions, but only if some remain
+        float threshold = mMinimumConfidence;
+        bool anyConfident = false;
+        for (int i = 0; i < mRegions.size(); ++i)
+            anyConfident |= mRegions[i].confidence >= threshold;
+        if (!anyConfident)
+            threshold = -1.0f;
+
+        QPointF offset(0.0, 0.0);
+        float confidenceSum = 0.0f;
+        int used = 0;
+        if (mPolicy == Median)
+        {
+            mScratch.clear();
+            for (int i = 0; i < mRegions.size(); ++i)
+                if (mRegions[i].confidence >= threshold)
+                    mScratch.push_back(mRegions[i].offset.x());
+            used = mScratch.size();
+            std::nth_element(mScratch.begin(), mScratch.begin() + used / 2, mScratch.end());
+            offset.rx() = mScratch[used / 2];
+
+            mScratch.clear();
+            for (int i = 0; i < mRegions.size(); ++i)
+            {
+                if (mRegions[i].confidence >= threshold)
+                {
+                    mScratch.push_back(mRegions[i].offset.y());
+                    confidenceSum += qMin(mRegions[i].confidence, 1e3f);
+                }
+            }
+            std::nth_element(mScratch.begin(), mScratch.begin() + used / 2, mScratch.end());
+            offset.ry() = mScratch[used / 2];
+        }
+        else
+        {
+            // Same bounds as in Correlator::track() for the weights
+            float weightSum = 0.0f;
+            for (int i = 0; i < mRegions.size(); ++i)
+            {
+                const Region& region = mRegions[i];
+                if (region.confidence < threshold)
+                    continue;
+                float weight = mPolicy == WeightedMean ? qBound(1e-3f, region.confidence, 1e3f) : 1.0f;
+                offset += region.offset * weight;
+                weightSum += weight;
+                confidenceSum += qMin(region.confidence, 1e3f);
+                ++used;
+            }
+            offset /= weightSum;
+        }
+
+        if (confidence)
+            *confidence = confidenceSum / used;
+        return offset;
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _MultiRoiTracker_H__
+#define _MultiRoiTracker_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QImage>
+#include <QPoint>
+#include <QPointF>
+#include <QSize>
+#include <QThreadPool>
+#include <QVector>
+
+#include <fftw3.h>
+
+namespace tracker
+{
+    /** Follows several small regions of interest (ROIs) in the same image
+        stream, for instance multiple cells in one field of view.
+        Each region is correlated with a reference image of the same region,
+        just like Correlator does with the whole image (track depth 1): the
+        reference is only replaced once the content moved by more than the
+        \ref setMinimumOffset() "minimum offset", so slow drifts add up until
+        they can be measured. The region then moves along with its content
+        so that the cell stays centred. The offsets of all regions are combined into one offset for
+        the stage according to the \ref Policy "policy".
+    @par Performance
+        All regions have the same size so that the Fourier transforms can be
+        computed with batched FFTW plans. The regions are split into as many
+        batches as there are worker threads and the batches run in parallel
+        on a private thread pool. The buffers are allocated once in the
+        constructor.
+    @par FFTW
+        The constructor and destructor use the FFTW planner, which is not
+        thread safe. Create and delete objects of this class in the same
+        (single threaded) pool the CorrelatorCache uses. track() may run in
+        any thread.
+    @note
+        The region size should be a multiple of 4 in both dimensions (at least
+        16). Other sizes are rounded up, otherwise the batches would not be
+        aligned for the SIMD code paths of FFTW.
+    */
+    class MultiRoiTracker
+    {
+    public:
+        //! How the offsets of the individual regions are combined
+        enum Policy
+        {
+            Mean,           //!< Average of all confident regions
+            Median,         //!< Component wise median (robust against single outliers)
+            WeightedMean    //!< Average weighted with the peak to sidelobe ratio
+        };
+
+        //! Tracking state of a single region
+        struct Region
+        {
+            QPoint  centre;         //!< Current centre in image coordinates
+            QPointF offset;         //!< Displacement of the content since the first image
+            float   confidence;     //!< Peak to sidelobe ratio of the last correlation
+        };
+
+        /** Plans the FFTs and allocates all buffers.
+        @param roiSize
+            Size of every region (rounded up to multiples of 4, at least 16x16)
+        @param centres
+            Initial centres of the regions in image coordinates (at least one)
+        @param threadCount
+            Number of worker threads (and batches)
+        */
+        MultiRoiTracker(QSize roiSize, const QVector<QPoint>& centres, int threadCount);
+        ~MultiRoiTracker();
+
+        //! Moves the regions back to their initial centres and forgets about past images
+        void reset();
+
+        /** Computes the offsets of all regions and combines them.
+        @param snapshot
+            8 bit image (regions extending beyond it are moved inside)
+        @param confidence
+            If not NULL, receives the average peak to sidelobe ratio of the
+            regions used for the combined offset (0 while not ready)
+        @return
+            Combined offset to the first image, or 0|0 when below the
+            \ref setMinimumOffset() "minimum offset"
+        */
+        QPointF track(const QImage snapshot, float* confidence = NULL);
+
+        //! Returns whether at least two images were tracked since the last reset()
+        bool isReady() const
+            { return mImagesTracked > 1; }
+
+        //! Returns the state of all regions after the last track()
+        const QVector<Region>& getRegions() const
+            { return mRegions; }
+        //! Returns the (rounded) size of every region
+        QSize getRoiSize() const
+            { return mRoiSize; }
+
+        //! Sets how the offsets of the regions are combined
+        void setPolicy(Policy policy)
+            { mPolicy = policy; }
+        //! Returns the value described in setPolicy()
+        Policy getPolicy() const
+            { return mPolicy; }
+
+        /** Regions with a lower peak to sidelobe ratio are left out of the
+            combination (unless all of them are).
+        */
+        void setMinimumConfidence(float value)
+            { mMinimumConfidence = value; }
+        //! Returns the value described in setMinimumConfidence()
+        float getMinimumConfidence() const
+            { return mMinimumConfidence; }
+
+        //! Same as Correlator::setMinimumOffset()
+        void setMinimumOffset(float value)
+            { mMinimumOffset = value; }
+        //! Returns the value described in setMinimumOffset()
+        float getMinimumOffset() const
+            { return mMinimumOffset; }
+
+    private:
+        Q_DISABLE_COPY(MultiRoiTracker);
+
+        class Batch;
+        friend class Batch;
+
+        //! Copies, windows and transforms the regions [first, last) and correlates them with their references
+        void processRegions(int batch, int first, int last);
+        //! Copies and windows the region with top left \c corner for samples of type T (see PixelKernels)
+        template <class T>
+        void assignRegion(const QImage& image, QPoint corner, float* target) const;
+        //! Combines the region offsets according to the policy
+        QPointF combine(float* confidence);
+
+        QSize                   mRoiSize;           //!< Size of every region
+        QSize                   mFrequencySize;     //!< Size of the complex spectrum of a region
+        int                     mArea;              //!< Number of pixels per region
+        int                     mFrequencyArea;     //!< Number of complex values per region
+
+        QVector<QPoint>         mInitialCentres;    //!< Centres given in the constructor, see reset()
+        QVector<Region>         mRegions;           //!< State of all regions
+        QVector<QPoint>         mReferenceCentres;  //!< Centre of each region in its reference image
+        QVector<QPointF>        mReferenceOffsets;  //!< Offset of each region in its reference image
+
+        float*                  mWindow;            //!< Hann window (one region)
+        float*                  mFilter;            //!< Band pass filter (one region)
+        float*                  mSpatialData;       //!< Spatial data of all regions
+        fftwf_complex*          mSpectra;           //!< Spectra of all regions in the current image
+        fftwf_complex*          mReferenceSpectra;  //!< Spectra of all regions in their reference images
+        fftwf_complex*          mCrossSpectra;      //!< Filtered cross power spectra of all regions
+
+        QVector<Batch*>         mBatches;           //!< One batch of regions per worker thread
+        QThreadPool             mPool;              //!< Private worker threads (never the global pool)
+        QImage                  mSnapshot;          //!< Image currently processed by the batches
+
+        Policy                  mPolicy;            //!< See setPolicy()
+        float                   mMinimumConfidence; //!< See setMinimumConfidence()
+        float                   mMinimumOffset;     //!< See setMinimumOffset()
+        int                     mImagesTracked;     //!< Number of images since the last reset()
+        QVector<float>          mScratch;           //!< Temporary values for combine()
+    };
+}
+
+#endif /* _MultiRoiTracker_H__ */
@@ -0,0 +1,44 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "PixelKernels.h"
+
+namespace tracker
+{
+    //! Colour table for 8 bit grey images
+    static QVector<QRgb> makeGreyColourTable()
+    {
+        QVector<QRgb> table(256);
+        for (int i = 0; i < 256; ++i)
+            table[i] = qRgb(i, i, i);
+        return table;
+    }
+    static const QVector<QRgb> sGreyColourTable = makeGreyColourTable();
+
+    const QVector<QRgb>& getGreyColourTable()
+    {
+        return sGreyColourTable;
+    }
+
+    QImage toDisplayImage(const QImage& image)
+    {
+        if (!isMono16(image))
+            return image;
+
+        QImage result(image.size(), QImage::Format_Indexed8);
+        result.setColorTable(sGreyColourTable);
+        for (int y = 0; y < image.height(); ++y)
+        {
+            const quint16* source = reinterpret_cast<const quint16*>(image.scanLine(y));
+            PixelKernels<quint16>::toDisplay(source, result.scanLine(y), image.width());
+        }
+        return result;
+    }
+}
@@ -0,0 +1,300 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Per-pixel kernels of the image pipeline, templated on the sample type.
+
+@par Sample formats
+    - 8 bit cameras deliver QImage::Format_Indexed8 images with a grey colour
+      table, as always.
+    - Qt 4 has no 16 bit grey format. Cameras with more than 8 bits deliver
+      Mono16Format images instead, which are only used as a container: every
+      pixel is one native endian quint16 sample, not an RGB value. The
+      samples are MSB aligned (a 12 bit camera leaves the lowest 4 bits zero),
+      so the consumers don't need to know the bit depth of the camera.
+    Use isMono16() to tell the two apart and toDisplayImage() before handing
+    an image to anything that interprets the pixels as colours.
+@par SIMD
+    PixelKernels<T> is the plain C++ version for any sample type. The
+    functions on the hot path have SSE2 specialisations for uchar and quint16.
+*/
+
+#ifndef _PixelKernels_H__
+#define _PixelKernels_H__
+
+#include "TrackerPrereqs.h"
+
+#include <cstring>
+#include <QImage>
+#include <QVector>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define TRACKER_HAS_SSE2
+#  include <emmintrin.h>
+#endif
+
+namespace tracker
+{
+    //! Image format carrying the quint16 samples of cameras with more than 8 bits
+    const QImage::Format Mono16Format = QImage::Format_RGB16;
+
+    //! Tells whether \c image holds 16 bit samples (see Mono16Format)
+    inline bool isMono16(const QImage& image)
+        { return image.format() == Mono16Format; }
+
+    /** Returns the colour table of 8 bit grey images (Indexed8, value i is
+        qRgb(i, i, i)). Not available during static initialisation.
+    */
+    const QVector<QRgb>& getGreyColourTable();
+
+    /** Converts a Mono16Format image to an 8 bit grey image (upper 8 bits).
+        Any other image is returned as it is (no copy).
+    */
+    QImage toDisplayImage(const QImage& image);
+
+    /** Line kernels for the sample type T (uchar or quint16).
+        All functions work on \c count consecutive samples, there are no
+        alignment requirements.
+    */
+    template <class T>
+    struct PixelKernels
+    {
+        //! Returns the sum of the samples
+        static quint64 sum(const T* source, int count)
+        {
+            quint64 result = 0;
+            for (int i = 0; i < count; ++i)
+                result += source[i];
+            return result;
+        }
+
+        //! Converts the samples to float
+        static void ingest(const T* source, float* target, int count)
+        {
+            for (int i = 0; i < count; ++i)
+                target[i] = (float)source[i];
+        }
+
+        /** Computes (source - dcValue) * window as float and returns the sum
+            of the samples (see BaseImage::assign()).
+        */
+        static quint64 ingestWindowed(const T* source, const float* window, float* target, int count, float dcValue)
+        {
+            quint64 result = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                target[i] = ((float)source[i] - dcValue) * window[i];
+                result += source[i];
+            }
+            return result;
+        }
+
+        //! Copies the samples shifted left by \c shift bits (MSB alignment of camera data)
+        static void align(const T* source, T* target, int count, int shift)
+        {
+            for (int i = 0; i < count; ++i)
+                target[i] = (T)(source[i] << shift);
+        }
+
+        //! Keeps the upper 8 bits of every sample
+        static void toDisplay(const T* source, uchar* target, int count)
+        {
+            for (int i = 0; i < count; ++i)
+                target[i] = (uchar)(source[i] >> (8 * (sizeof(T) - 1)));
+        }
+    };
+
+    /********** uchar **********/
+
+    template <>
+    inline void PixelKernels<uchar>::align(const uchar* source, uchar* target, int count, int)
+    {
+        std::memcpy(target, source, count);
+    }
+
+    template <>
+    inline void PixelKernels<uchar>::toDisplay(const uchar* source, uchar* target, int count)
+    {
+        std::memcpy(target, source, count);
+    }
+
+#ifdef TRACKER_HAS_SSE2
+    namespace detail
+    {
+        //! Converts four 32 bit integer samples to float and stores (samples - dc) * window
+        inline void storeWindowed(__m128i samples, const float* window, float* target, __m128 dc)
+        {
+            __m128 values = _mm_sub_ps(_mm_cvtepi32_ps(samples), dc);
+            _mm_storeu_ps(target, _mm_mul_ps(values, _mm_loadu_ps(window)));
+        }
+
+        //! Converts four 32 bit integer samples to float and stores them
+        inline void storeFloat(__m128i samples, float* target)
+        {
+            _mm_storeu_ps(target, _mm_cvtepi32_ps(samples));
+        }
+
+        //! Adds the two 64 bit lanes
+        inline quint64 horizontalSum64(__m128i sums)
+        {
+            quint64 lanes[2];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+            return lanes[0] + lanes[1];
+        }
+
+        //! Adds the four 32 bit lanes
+        inline quint64 horizontalSum32(__m128i sums)
+        {
+            quint32 lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+            return (quint64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+
+    template <>
+    inline quint64 PixelKernels<uchar>::sum(const uchar* source, int count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sums = zero;
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, zero));
+        }
+        quint64 result = detail::horizontalSum64(sums);
+        for (; i < count; ++i)
+            result += source[i];
+        return result;
+    }
+
+    template <>
+    inline void PixelKernels<uchar>::ingest(const uchar* source, float* target, int count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            __m128i low  = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            detail::storeFloat(_mm_unpacklo_epi16(low,  zero), target + i);
+            detail::storeFloat(_mm_unpackhi_epi16(low,  zero), target + i + 4);
+            detail::storeFloat(_mm_unpacklo_epi16(high, zero), target + i + 8);
+            detail::storeFloat(_mm_unpackhi_epi16(high, zero), target + i + 12);
+        }
+        for (; i < count; ++i)
+            target[i] = (float)source[i];
+    }
+
+    template <>
+    inline quint64 PixelKernels<uchar>::ingestWindowed(const uchar* source, const float* window, float* target, int count, float dcValue)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 dc = _mm_set1_ps(dcValue);
+        __m128i sums = zero;
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, zero));
+            __m128i low  = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            detail::storeWindowed(_mm_unpacklo_epi16(low,  zero), window + i,      target + i,      dc);
+            detail::storeWindowed(_mm_unpackhi_epi16(low,  zero), window + i + 4,  target + i + 4,  dc);
+            detail::storeWindowed(_mm_unpacklo_epi16(high, zero), window + i + 8,  target + i + 8,  dc);
+            detail::storeWindowed(_mm_unpackhi_epi16(high, zero), window + i + 12, target + i + 12, dc);
+        }
+        quint64 result = detail::horizontalSum64(sums);
+        for (; i < count; ++i)
+        {
+            target[i] = ((float)source[i] - dcValue) * window[i];
+            result += source[i];
+        }
+        return result;
+    }
+
+    /********** quint16 **********/
+
+    template <>
+    inline void PixelKernels<quint16>::ingest(const quint16* source, float* target, int count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            detail::storeFloat(_mm_unpacklo_epi16(samples, zero), target + i);
+            detail::storeFloat(_mm_unpackhi_epi16(samples, zero), target + i + 4);
+        }
+        for (; i < count; ++i)
+            target[i] = (float)source[i];
+    }
+
+    template <>
+    inline quint64 PixelKernels<quint16>::ingestWindowed(const quint16* source, const float* window, float* target, int count, float dcValue)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 dc = _mm_set1_ps(dcValue);
+        // 32 bit lanes don't overflow for lines shorter than 2^18 samples
+        __m128i sums = zero;
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            __m128i low  = _mm_unpacklo_epi16(samples, zero);
+            __m128i high = _mm_unpackhi_epi16(samples, zero);
+            sums = _mm_add_epi32(sums, _mm_add_epi32(low, high));
+            detail::storeWindowed(low,  window + i,     target + i,     dc);
+            detail::storeWindowed(high, window + i + 4, target + i + 4, dc);
+        }
+        quint64 result = detail::horizontalSum32(sums);
+        for (; i < count; ++i)
+        {
+            target[i] = ((float)source[i] - dcValue) * window[i];
+            result += source[i];
+        }
+        return result;
+    }
+
+    template <>
+    inline void PixelKernels<quint16>::align(const quint16* source, quint16* target, int count, int shift)
+    {
+        const __m128i bits = _mm_cvtsi32_si128(shift);
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_sll_epi16(samples, bits));
+        }
+        for (; i < count; ++i)
+            target[i] = (quint16)(source[i] << shift);
+    }
+
+    template <>
+    inline void PixelKernels<quint16>::toDisplay(const quint16* source, uchar* target, int count)
+    {
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i low  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 8));
+            __m128i bytes = _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), bytes);
+        }
+        for (; i < count; ++i)
+            target[i] = (uchar)(source[i] >> 8);
+    }
+#endif /* TRACKER_HAS_SSE2 */
+}
+
+#endif /* _PixelKernels_H__ */
@@ -0,0 +1,210 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "RecordingBuffer.h"
+
+#include <cstring>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+
+#include "Logger.h"
+#include "PathConfig.h"
+
+namespace tracker
+{
+    RecordingBuffer::RecordingBuffer()
+        : mSpilledCount(0)
+        , mMemoryUsage(0)
+        , mSpillFailed(false)
+        , mSegmentCount(0)
+    {
+        this->readSettings();
+    }
+
+    RecordingBuffer::~RecordingBuffer()
+    {
+        while (!mSegments.isEmpty())
+            this->releaseSegment(mSegments.first());
+        this->writeSettings();
+    }
+
+    void RecordingBuffer::readSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("RecordingBuffer");
+
+        mMemoryLimit    = qMax(0, settings.value("Memory_Limit_[MB]", 1024).toInt());
+        mSegmentSize    = qMax(1, settings.value("Segment_Size_[MB]", 256).toInt());
+        mSpillDirectory = settings.value("Spill_Directory", "").toString();
+
+        settings.endGroup();
+    }
+
+    void RecordingBuffer::writeSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("RecordingBuffer");
+
+        settings.setValue("Memory_Limit_[MB]", mMemoryLimit);
+        settings.setValue("Segment_Size_[MB]", mSegmentSize);
+        settings.setValue("Spill_Directory",   mSpillDirectory);
+
+        settings.endGroup();
+    }
+
+    void RecordingBuffer::push(const ImageWriter::Job& job)
+    {
+        Entry entry;
+        entry.job         = job;
+        entry.segment     = NULL;
+        entry.offset      = 0;
+        entry.size        = job.image.size();
+        entry.format      = job.image.format();
+        entry.colourTable = job.image.colorTable();
+        entry.byteCount   = job.image.byteCount();
+        mEntries.append(entry);
+        mMemoryUsage += entry.byteCount;
+
+        const qint64 limit = (qint64)mMemoryLimit * 1024 * 1024;
+        while (mMemoryUsage > limit && mSpilledCount < mEntries.size())
+        {
+            // Out of disk space or similar: keep the images in memory
+            if (!this->spillNext())
+                break;
+        }
+    }
+
+    ImageWriter::Job RecordingBuffer::front()
+    {
+        const Entry& entry = mEntries.first();
+        if (entry.segment == NULL)
+            return entry.job;
+
+        ImageWriter::Job job = entry.job;
+        if (!this->mapSegment(entry.segment))
+        {
+            // The writer reports the null image as failure
+            TRACKER_WARNING("Could not read back spilled image '" + job.filename + "'");
+            return job;
+        }
+        job.image = QImage(entry.size, entry.format);
+        if (!entry.colourTable.isEmpty())
+            job.image.setColorTable(entry.colourTable);
+        memcpy(job.image.bits(), entry.segment->data + entry.offset, entry.byteCount);
+        return job;
+    }
+
+    void RecordingBuffer::pop()
+    {
+        const Entry entry = mEntries.takeFirst();
+        if (entry.segment == NULL)
+        {
+            mMemoryUsage -= entry.byteCount;
+            return;
+        }
+
+        --mSpilledCount;
+        if (--entry.segment->frames == 0)
+            this->releaseSegment(entry.segment);
+    }
+
+    bool RecordingBuffer::spillNext()
+    {
+        Entry& entry = mEntries[mSpilledCount];
+        Segment* segment = this->getWriteSegment(entry.byteCount);
+        if (segment == NULL)
+        {
+            if (!mSpillFailed)
+                TRACKER_WARNING("Could not spill images to disk, keeping them in memory");
+            mSpillFailed = true;
+            return false;
+        }
+        mSpillFailed = false;
+
+        memcpy(segment->data + segment->used, entry.job.image.constBits(), entry.byteCount);
+        entry.segment = segment;
+        entry.offset  = segment->used;
+        segment->used += entry.byteCount;
+        ++segment->frames;
+
+        entry.job.image = QImage();
+        mMemoryUsage -= entry.byteCount;
+        ++mSpilledCount;
+        return true;
+    }
+
+    RecordingBuffer::Segment* RecordingBuffer::getWriteSegment(int bytes)
+    {
+        Segment* segment = mSegments.isEmpty() ? NULL : mSegments.last();
+        if (segment && !segment->closed && segment->size - segment->used >= bytes)
+            return segment;
+
+        if (segment && !segment->closed)
+        {
+            // Full, it is only read from now on. Keep the mapping if reading already started.
+            segment->closed = true;
+            if (segment != mSegments.first())
+            {
+                segment->file->unmap(segment->data);
+                segment->data = NULL;
+                segment->file->close();
+            }
+        }
+
+        const QString directory = mSpillDirectory.isEmpty() ? QDir::tempPath() : mSpillDirectory;
+        segment = new Segment();
+        segment->file   = new QFile(directory + "/tracker_spill_" + QString::number(QCoreApplication::applicationPid())
+                                    + "_" + QString::number(mSegmentCount++) + ".tmp");
+        segment->data   = NULL;
+        segment->size   = qMax((qint64)mSegmentSize * 1024 * 1024, (qint64)bytes);
+        segment->used   = 0;
+        segment->frames = 0;
+        segment->closed = false;
+
+        if (!segment->file->open(QIODevice::ReadWrite | QIODevice::Truncate)
+            || !segment->file->resize(segment->size)
+            || (segment->data = segment->file->map(0, segment->size)) == NULL)
+        {
+            TRACKER_WARNING("Could not create scratch file '" + segment->file->fileName() + "': "
+                            + segment->file->errorString());
+            segment->file->close();
+            segment->file->remove();
+            delete segment->file;
+            delete segment;
+            return NULL;
+        }
+
+        mSegments.append(segment);
+        return segment;
+    }
+
+    bool RecordingBuffer::mapSegment(Segment* segment)
+    {
+        if (segment->data)
+            return true;
+        if (!segment->file->isOpen() && !segment->file->open(QIODevice::ReadOnly))
+            return false;
+        segment->data = segment->file->map(0, segment->size);
+        return segment->data != NULL;
+    }
+
+    void RecordingBuffer::releaseSegment(Segment* segment)
+    {
+        if (segment->data)
+            segment->file->unmap(segment->data);
+        segment->file->close();
+        segment->file->remove();
+        delete segment->file;
+        mSegments.removeOne(segment);
+        delete segment;
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _RecordingBuffer_H__
+#define _RecordingBuffer_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "ImageWriter.h"
+
+class QFile;
+
+namespace tracker
+{
+    /** First in, first out queue of stored images on their way to the
+        ImageWriter, with a fixed memory budget.
+        Images are acquired faster than the writer can store them during
+        Z-stacks and time lapse recordings. Once the pixels of the queued
+        images exceed \c Memory_Limit_[MB], the oldest ones are moved to
+        memory mapped scratch files and only read back when it is their turn.
+        A recording is therefore limited by disk space instead of RAM.
+    @par Scratch files
+        The spilled pixels go to segment files of \c Segment_Size_[MB] in
+        \c Spill_Directory. Only the segment being written and the one being
+        read are mapped at any time (32 bit builds have little address
+        space), a segment file is deleted as soon as all its images are out.
+    @par Thread safety
+        None, use it from one thread (the GUI thread).
+    @par Settings
+         - \c Memory_Limit_[MB]: Pixels kept in memory (default: 1024)
+         - \c Segment_Size_[MB]: Size of one scratch file (default: 256)
+         - \c Spill_Directory: Location of the scratch files (default: the
+           system's temporary directory)
+    */
+    class RecordingBuffer
+    {
+    public:
+        //! Reads the settings, scratch files are only created when needed
+        RecordingBuffer();
+        //! Deletes the scratch files (queued images are lost, drain it first)
+        ~RecordingBuffer();
+
+        //! Queues a job, spills the oldest images if the memory budget is exceeded
+        void push(const ImageWriter::Job& job);
+
+        //! Returns the oldest job, with its image read back if it was spilled
+        ImageWriter::Job front();
+        //! Removes the oldest job
+        void pop();
+
+        //! Tells whether there are no queued jobs
+        bool isEmpty() const
+            { return mEntries.isEmpty(); }
+        //! Returns the number of queued jobs
+        int size() const
+            { return mEntries.size(); }
+        //! Returns the number of queued jobs whose image is in a scratch file
+        int getSpilledCount() const
+            { return mSpilledCount; }
+        //! Returns the bytes of pixel data held in memory
+        qint64 getMemoryUsage() const
+            { return mMemoryUsage; }
+
+    private:
+        Q_DISABLE_COPY(RecordingBuffer);
+
+        //! One scratch file
+        struct Segment
+        {
+            QFile*      file;
+            uchar*      data;           //!< Mapping (NULL while not in use)
+            qint64      size;           //!< File size
+            qint64      used;           //!< Bytes written
+            int         frames;         //!< Images in this segment not popped yet
+            bool        closed;         //!< Full, no more images are added
+        };
+
+        struct Entry
+        {
+            ImageWriter::Job    job;    //!< Image is null while spilled
+            Segment*            segment;
+            qint64              offset; //!< Of the pixels in the segment
+            QSize               size;
+            QImage::Format      format;
+            QVector<QRgb>       colourTable;
+            int                 byteCount;
+        };
+
+        //! Moves the image of the oldest entry still in memory to a scratch file
+        bool spillNext();
+        //! Returns a mapped segment with room for \c bytes, NULL on failure
+        Segment* getWriteSegment(int bytes);
+        //! Maps \c segment if required
+        bool mapSegment(Segment* segment);
+        //! Unmaps and deletes the scratch file
+        void releaseSegment(Segment* segment);
+
+        void readSettings();
+        void writeSettings();
+
+        QList<Entry>        mEntries;       //!< Oldest first, the first mSpilledCount are spilled
+        int                 mSpilledCount;  //!< See getSpilledCount()
+        qint64              mMemoryUsage;   //!< See getMemoryUsage()
+        bool                mSpillFailed;   //!< Warned about a failing scratch file already
+
+        QList<Segment*>     mSegments;      //!< Oldest first, the last one is being written
+        int                 mSegmentCount;  //!< Segments created (for the file names)
+
+        int                 mMemoryLimit;   //!< Memory_Limit_[MB]
+        int                 mSegmentSize;   //!< Segment_Size_[MB]
+        QString             mSpillDirectory; //!< Spill_Directory (empty: temporary directory)
+    };
+}
+
+#endif /* _RecordingBuffer_H__ */
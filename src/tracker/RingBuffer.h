@@ -0,0 +1,106 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _RingBuffer_H__
+#define _RingBuffer_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QVector>
+
+namespace tracker
+{
+    /** History of the last few values with a fixed capacity.
+        Replaces the \c prepend() / \c remove() pattern on QVector and QList
+        in code that runs for every frame: the storage is allocated once in
+        the constructor (or in setCapacity()) and push() never allocates.
+    @par Indexing
+        at(0) is the value pushed last, at(size() - 1) the oldest one still
+        stored.
+    @note
+        A capacity of 0 is allowed, push() then simply discards the value.
+    */
+    template <class T>
+    class RingBuffer
+    {
+    public:
+        //! Creates an empty buffer for at most @a capacity values
+        explicit RingBuffer(int capacity = 0)
+            : mData(qMax(0, capacity))
+            , mNewest(0)
+            , mCount(0)
+        { }
+
+        //! Adds a value and drops the oldest one if the buffer is full
+        void push(const T& value)
+        {
+            if (mData.isEmpty())
+                return;
+            mNewest = (mNewest + 1) % mData.size();
+            mData[mNewest] = value;
+            if (mCount < mData.size())
+                ++mCount;
+        }
+
+        //! Returns the i-th newest value (0 is the last one pushed)
+        const T& at(int i) const
+            { return mData[(mNewest - i + mData.size()) % mData.size()]; }
+        //! Same as at()
+        const T& operator[](int i) const
+            { return this->at(i); }
+
+        //! Returns the number of values stored
+        int size() const
+            { return mCount; }
+        //! Tells whether nothing was pushed since the last clear()
+        bool isEmpty() const
+            { return mCount == 0; }
+        //! Returns the maximum number of values stored
+        int capacity() const
+            { return mData.size(); }
+
+        //! Forgets all values (keeps the storage)
+        void clear()
+            { mCount = 0; }
+
+        //! Overwrites all values with @a value and marks the buffer as full
+        void fill(const T& value)
+        {
+            mData.fill(value);
+            mCount = mData.size();
+        }
+
+        /** Changes the capacity (allocates). The newest values are kept as
+            long as they fit.
+        */
+        void setCapacity(int capacity)
+        {
+            capacity = qMax(0, capacity);
+            if (capacity == mData.size())
+                return;
+
+            QVector<T> data(capacity);
+            int count = qMin(mCount, capacity);
+            // Oldest kept value first, newest at index count - 1
+            for (int i = 0; i < count; ++i)
+                data[i] = this->at(count - 1 - i);
+            mData = data;
+            mCount = count;
+            mNewest = count > 0 ? count - 1 : capacity - 1;
+        }
+
+    private:
+        QVector<T>  mData;      //!< Storage, never resized by push()
+        int         mNewest;    //!< Index of the value pushed last
+        int         mCount;     //!< Number of valid values
+    };
+}
+
+#endif /* _RingBuffer_H__ */
@@ -0,0 +1,499 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "StackFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include "Exception.h"
+#include "FrameCodec.h"
+#include "Logger.h"
+#include "PixelKernels.h"
+
+namespace tracker
+{
+    // The structures are written as they are in memory. All members are
+    // naturally aligned, so there is no padding, and the tracker only runs on
+    // little endian machines.
+
+    static const char    sFileMagic[8]    = { 'T', 'R', 'K', 'S', 'T', 'A', 'C', 'K' };
+    static const char    sIndexMagic[8]   = { 'T', 'R', 'K', 'S', 'I', 'D', 'X', '1' };
+    static const quint32 sFrameMagic      = 0x4D415246; // "FRAM"
+    static const quint32 sVersion         = 1;
+
+    //! Pixel formats in FrameHeader::format
+    enum StackPixelFormat
+    {
+        Grey8  = 0,     //!< One byte per pixel
+        Mono16 = 1      //!< Two bytes per pixel, MSB aligned (see Mono16Format)
+    };
+
+    struct FileHeader
+    {
+        char        magic[8];
+        quint32     version;
+        quint32     headerSize;         //!< sizeof(FileHeader), frames start here
+        quint32     frameHeaderSize;    //!< sizeof(FrameHeader)
+        quint32     reserved[3];
+    };
+
+    struct FrameHeader
+    {
+        quint32     magic;
+        quint32     format;             //!< StackPixelFormat
+        quint32     width;
+        quint32     height;
+        quint32     bytesPerLine;       //!< Of the payload (no padding)
+        quint32     compression;        //!< Compression
+        quint64     payloadSize;        //!< Bytes following the header
+        double      x;
+        double      y;
+        double      z;
+        double      pressure;
+        double      gain;
+        double      exposure;
+        quint64     captureTime;
+        quint64     processTime;
+    };
+
+    struct Trailer
+    {
+        quint64     indexOffset;        //!< Number of frames (u64) followed by the frame offsets (u64)
+        char        magic[8];
+    };
+
+    /** Reads the frame header at @a offset of the mapping and returns false
+        unless the frame lies within it and its fields are consistent.
+        Everything handed out by StackFileReader is checked with this first.
+    */
+    static bool readFrameHeader(const uchar* data, qint64 size, quint64 offset, FrameHeader* header)
+    {
+        // Written so that nothing overflows
+        if (offset < sizeof(FileHeader) || offset > (quint64)size || (quint64)size - offset < sizeof(FrameHeader))
+            return false;
+        memcpy(header, data + offset, sizeof(*header));
+        if (header->magic != sFrameMagic || header->payloadSize > (quint64)size - offset - sizeof(FrameHeader))
+            return false;
+
+        if (header->format != Grey8 && header->format != Mono16)
+            return false;
+        if (header->compression != NoCompression && header->compression != FrameCompression)
+            return false;
+        if (header->width == 0 || header->height == 0 || header->width > 0xFFFF || header->height > 0xFFFF)
+            return false;
+        if (header->bytesPerLine != header->width * (header->format == Mono16 ? 2 : 1))
+            return false;
+        // Packed lines have to be complete
+        return header->compression != NoCompression
+            || (quint64)header->bytesPerLine * header->height <= header->payloadSize;
+    }
+
+    QString StackFrameInfo::toText() const
+    {
+        QString text;
+        QTextStream(&text) << "x: " << x << "\n"
+                           << "y: " << y << "\n"
+                           << "z: " << z << "\n"
+                           << "pressure: " << pressure << "\n"
+                           << "gain: " << gain << "\n"
+                           << "exposure_time: " << exposure << "ms" << "\n"
+                           << "captureTime: " << captureTime << "\n"
+                           << "processTime: " << processTime << "\n";
+        return text;
+    }
+
+
+    /************ StackFileWriter ************/
+
+    StackFileWriter::StackFileWriter()
+        : mCompression(NoCompression)
+    {
+    }
+
+    StackFileWriter::~StackFileWriter()
+    {
+        this->close();
+    }
+
+    bool StackFileWriter::open(const QString& filename)
+    {
+        QMutexLocker lock(&mMutex);
+        if (mFile.isOpen())
+            return false;
+
+        mFile.setFileName(filename);
+        if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            TRACKER_WARNING("Could not create stack file '" + filename + "': " + mFile.errorString());
+            return false;
+        }
+
+        FileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, sFileMagic, sizeof(header.magic));
+        header.version         = sVersion;
+        header.headerSize      = sizeof(FileHeader);
+        header.frameHeaderSize = sizeof(FrameHeader);
+        if (mFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header))
+        {
+            mFile.close();
+            return false;
+        }
+
+        mIndex.clear();
+        return true;
+    }
+
+    void StackFileWriter::close()
+    {
+        QMutexLocker lock(&mMutex);
+        if (!mFile.isOpen())
+            return;
+
+        Trailer trailer;
+        trailer.indexOffset = mFile.pos();
+        memcpy(trailer.magic, sIndexMagic, sizeof(trailer.magic));
+
+        // Capture order, the offsets break ties in append order
+        std::sort(mIndex.begin(), mIndex.end());
+        QVector<quint64> offsets(mIndex.size());
+        for (int i = 0; i < mIndex.size(); ++i)
+            offsets[i] = mIndex[i].second;
+
+        const quint64 count = offsets.size();
+        mFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        mFile.write(reinterpret_cast<const char*>(offsets.constData()), offsets.size() * sizeof(quint64));
+        mFile.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        mFile.close();
+
+        TRACKER_INFO("Closed stack file '" + mFile.fileName() + "' with " + QString::number(count) + " frames", Logger::Low);
+    }
+
+    bool StackFileWriter::isOpen() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mFile.isOpen();
+    }
+
+    QString StackFileWriter::getFilename() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mFile.fileName();
+    }
+
+    void StackFileWriter::setCompression(Compression compression)
+    {
+        QMutexLocker lock(&mMutex);
+        mCompression = compression;
+    }
+
+    int StackFileWriter::getFrameCount() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mIndex.size();
+    }
+
+    bool StackFileWriter::append(const QImage& image, const StackFrameInfo& info)
+    {
+        FrameHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = sFrameMagic;
+        if (isMono16(image))
+            header.format = Mono16;
+        else if (image.depth() == 8)
+            header.format = Grey8;
+        else
+            return false;
+        header.width        = image.width();
+        header.height       = image.height();
+        header.bytesPerLine = image.width() * (header.format == Mono16 ? 2 : 1);
+        header.x            = info.x;
+        header.y            = info.y;
+        header.z            = info.z;
+        header.pressure     = info.pressure;
+        header.gain         = info.gain;
+        header.exposure     = info.exposure;
+        header.captureTime  = info.captureTime;
+        header.processTime  = info.processTime;
+
+        {
+            QMutexLocker lock(&mMutex);
+            header.compression = mCompression;
+        }
+
+        // Compress or pack the lines (QImage pads them to 32 bits) before taking the lock again
+        QByteArray record;
+        if (header.compression == FrameCompression)
+        {
+            const QByteArray payload = compressFrame(image.constBits(), image.width(), image.height(),
+                                                     image.bytesPerLine(), header.format == Mono16 ? 2 : 1);
+            header.payloadSize = payload.size();
+            record.resize((int)(sizeof(header) + header.payloadSize));
+            memcpy(record.data() + sizeof(header), payload.constData(), payload.size());
+        }
+        else
+        {
+            header.payloadSize = (quint64)header.bytesPerLine * header.height;
+            record.resize((int)(sizeof(header) + header.payloadSize));
+            char* payload = record.data() + sizeof(header);
+            for (int y = 0; y < image.height(); ++y)
+                memcpy(payload + y * header.bytesPerLine, image.constScanLine(y), header.bytesPerLine);
+        }
+        memcpy(record.data(), &header, sizeof(header));
+
+        QMutexLocker lock(&mMutex);
+        if (!mFile.isOpen())
+            return false;
+        const quint64 offset = mFile.pos();
+        if (mFile.write(record) != record.size())
+        {
+            // Don't leave half a frame behind, the next one would not be found
+            mFile.resize(offset);
+            mFile.seek(offset);
+            return false;
+        }
+        mIndex.push_back(qMakePair(info.captureTime, offset));
+        return true;
+    }
+
+
+    /************ StackFileReader ************/
+
+    StackFileReader::StackFileReader()
+        : mData(NULL)
+        , mSize(0)
+        , mComplete(false)
+    {
+    }
+
+    StackFileReader::~StackFileReader()
+    {
+        this->close();
+    }
+
+    bool StackFileReader::open(const QString& filename)
+    {
+        this->close();
+
+        mFile.setFileName(filename);
+        if (!mFile.open(QIODevice::ReadOnly))
+        {
+            TRACKER_WARNING("Could not open stack file '" + filename + "': " + mFile.errorString());
+            return false;
+        }
+        mSize = mFile.size();
+        if (mSize < (qint64)sizeof(FileHeader) || (mData = mFile.map(0, mSize)) == NULL)
+        {
+            TRACKER_WARNING("Could not map stack file '" + filename + "'");
+            this->close();
+            return false;
+        }
+
+        FileHeader header;
+        memcpy(&header, mData, sizeof(header));
+        if (memcmp(header.magic, sFileMagic, sizeof(header.magic)) != 0 || header.version != sVersion
+            || header.frameHeaderSize != sizeof(FrameHeader))
+        {
+            TRACKER_WARNING("'" + filename + "' is not a stack file of version " + QString::number(sVersion));
+            this->close();
+            return false;
+        }
+
+        // Read the index if the writer got to write it
+        Trailer trailer;
+        if (mSize >= (qint64)(sizeof(FileHeader) + sizeof(Trailer)))
+        {
+            memcpy(&trailer, mData + mSize - sizeof(Trailer), sizeof(trailer));
+            const quint64 indexEnd = (quint64)mSize - sizeof(Trailer);
+            if (memcmp(trailer.magic, sIndexMagic, sizeof(trailer.magic)) == 0
+                && trailer.indexOffset <= indexEnd && indexEnd - trailer.indexOffset >= sizeof(quint64))
+            {
+                quint64 count;
+                memcpy(&count, mData + trailer.indexOffset, sizeof(count));
+                // Compared by division, (count + 1) * 8 could overflow
+                const quint64 indexBytes = indexEnd - trailer.indexOffset - sizeof(quint64);
+                if (indexBytes % sizeof(quint64) == 0 && count == indexBytes / sizeof(quint64) && count <= 0x7FFFFFFF)
+                {
+                    mOffsets.resize((int)count);
+                    memcpy(mOffsets.data(), mData + trailer.indexOffset + sizeof(quint64), count * sizeof(quint64));
+                    // Same checks as scanFrames() for every entry
+                    mComplete = true;
+                    FrameHeader header;
+                    for (int i = 0; i < mOffsets.size() && mComplete; ++i)
+                        mComplete = readFrameHeader(mData, mSize, mOffsets[i], &header);
+                    if (!mComplete)
+                    {
+                        TRACKER_WARNING("Stack file '" + filename + "' has a corrupt index, scanning the frames");
+                        mOffsets.clear();
+                        this->scanFrames();
+                        return true;
+                    }
+                }
+            }
+        }
+        if (!mComplete)
+        {
+            TRACKER_WARNING("Stack file '" + filename + "' has no index (not closed properly), scanning the frames");
+            this->scanFrames();
+        }
+
+        return true;
+    }
+
+    void StackFileReader::close()
+    {
+        if (mData)
+            mFile.unmap(const_cast<uchar*>(mData));
+        mData = NULL;
+        mSize = 0;
+        mFile.close();
+        mOffsets.clear();
+        mComplete = false;
+    }
+
+    void StackFileReader::scanFrames()
+    {
+        // Same order as an index written by StackFileWriter::close()
+        QVector<QPair<quint64, quint64> > frames;
+        quint64 offset = sizeof(FileHeader);
+        while (offset + sizeof(FrameHeader) <= (quint64)mSize)
+        {
+            // Stops at the last frame if it was only partially written
+            FrameHeader header;
+            if (!readFrameHeader(mData, mSize, offset, &header))
+                break;
+            frames.push_back(qMakePair(header.captureTime, offset));
+            offset += sizeof(FrameHeader) + header.payloadSize;
+        }
+
+        std::sort(frames.begin(), frames.end());
+        mOffsets.resize(frames.size());
+        for (int i = 0; i < frames.size(); ++i)
+            mOffsets[i] = frames[i].second;
+    }
+
+    FrameHeader StackFileReader::getHeader(int index) const
+    {
+        if (index < 0 || index >= mOffsets.size())
+            TRACKER_EXCEPTION("Stack frame index out of range: " + QString::number(index));
+
+        // Checked in open() already, unless the file was changed since then
+        FrameHeader header;
+        if (!readFrameHeader(mData, mSize, mOffsets[index], &header))
+            TRACKER_EXCEPTION("Stack frame " + QString::number(index) + " is corrupt");
+        return header;
+    }
+
+    StackFrameInfo StackFileReader::getInfo(int index) const
+    {
+        const FrameHeader header = this->getHeader(index);
+        StackFrameInfo info;
+        info.x           = header.x;
+        info.y           = header.y;
+        info.z           = header.z;
+        info.pressure    = header.pressure;
+        info.gain        = header.gain;
+        info.exposure    = header.exposure;
+        info.captureTime = header.captureTime;
+        info.processTime = header.processTime;
+        return info;
+    }
+
+    bool StackFileReader::isCompressed(int index) const
+    {
+        const FrameHeader header = this->getHeader(index);
+        return header.compression != NoCompression;
+    }
+
+    const uchar* StackFileReader::getData(int index, QSize* size, int* bytesPerLine, bool* mono16) const
+    {
+        const FrameHeader header = this->getHeader(index);
+        if (header.compression != NoCompression)
+            return NULL;
+
+        if (size)
+            *size = QSize(header.width, header.height);
+        if (bytesPerLine)
+            *bytesPerLine = header.bytesPerLine;
+        if (mono16)
+            *mono16 = (header.format == Mono16);
+        return mData + mOffsets[index] + sizeof(FrameHeader);
+    }
+
+    QImage StackFileReader::getImage(int index) const
+    {
+        const FrameHeader header = this->getHeader(index);
+        const bool mono16 = (header.format == Mono16);
+        const char* payload = reinterpret_cast<const char*>(mData + mOffsets[index] + sizeof(FrameHeader));
+
+        QImage image(header.width, header.height, mono16 ? Mono16Format : QImage::Format_Indexed8);
+        if (image.isNull())
+        {
+            TRACKER_WARNING("Not enough memory for stack frame " + QString::number(index));
+            return QImage();
+        }
+        if (!mono16)
+            image.setColorTable(getGreyColourTable());
+
+        switch (header.compression)
+        {
+        case NoCompression:
+            for (int y = 0; y < image.height(); ++y)
+                memcpy(image.scanLine(y), payload + y * header.bytesPerLine, header.bytesPerLine);
+            break;
+        case FrameCompression:
+            if (!decompressFrame(payload, header.payloadSize, image.bits(), image.width(), image.height(),
+                                 image.bytesPerLine(), mono16 ? 2 : 1))
+            {
+                TRACKER_WARNING("Stack frame " + QString::number(index) + " is corrupt");
+                return QImage();
+            }
+            break;
+        default:
+            TRACKER_WARNING("Unknown compression in stack frame " + QString::number(index));
+            return QImage();
+        }
+        return image;
+    }
+
+
+    /************ Export ************/
+
+    int exportStackToPng(const QString& stackFilename, const QString& baseFilename)
+    {
+        StackFileReader reader;
+        if (!reader.open(stackFilename))
+            return -1;
+
+        for (int i = 0; i < reader.getFrameCount(); ++i)
+        {
+            const QString name = baseFilename + QString("_%1").arg(i + 1, 4, 10, QChar('0'));
+            if (!toDisplayImage(reader.getImage(i)).save(name + ".png", "png"))
+            {
+                TRACKER_WARNING("Could not write '" + name + ".png'");
+                return i;
+            }
+
+            QFile file(name + ".txt");
+            const QByteArray text = reader.getInfo(i).toText().toLocal8Bit();
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Text) || file.write(text) != text.size())
+            {
+                TRACKER_WARNING("Could not write '" + name + ".txt'");
+                return i;
+            }
+        }
+
+        TRACKER_INFO("Exported " + QString::number(reader.getFrameCount()) + " frames of '" + stackFilename + "'", Logger::Low);
+        return reader.getFrameCount();
+    }
+}
@@ -0,0 +1,185 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Container file for Z-stacks and time lapse recordings (".tfs").
+
+@par Layout
+    All numbers are little endian.
+    -# File header (32 bytes): magic "TRKSTACK", version, header sizes
+    -# Frames, one after the other: a fixed size frame header with the
+       StackFrameInfo, the format, the size and the payload size, followed by
+       the payload (the lines of the image without padding or the output of
+       compressFrame(), see FrameCodec.h)
+    -# Index: number of frames and the file offset of every frame header,
+       sorted by capture time
+    -# Trailer (16 bytes): offset of the index and magic "TRKSIDX1"
+@par Robustness
+    The file is only ever appended to, the index is written by
+    StackFileWriter::close(). A file without index (program crashed) can
+    still be read: the reader walks through the frame headers instead and
+    drops an incomplete last frame.
+@par Frame order
+    Frames may be appended out of order (ImageWriter compresses them on
+    several threads). Frame \c i of a StackFileReader is always the \c i-th
+    by capture time, frames with the same capture time keep the order in
+    which they were appended.
+*/
+
+#ifndef _StackFile_H__
+#define _StackFile_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+namespace tracker
+{
+    struct FrameHeader;
+
+    //! Meta data stored with every frame
+    struct StackFrameInfo
+    {
+        double      x;              //!< Stage X position in micrometers
+        double      y;              //!< Stage Y position in micrometers
+        double      z;              //!< Stage Z position in micrometers
+        double      pressure;       //!< Pressure in kPa
+        double      gain;           //!< Camera gain
+        double      exposure;       //!< Exposure time in milliseconds
+        quint64     captureTime;    //!< HPClock time of the capture
+        quint64     processTime;    //!< HPClock time the camera delivered the image
+
+        //! Formats the values like the .txt files written next to single PNG images
+        QString toText() const;
+    };
+
+    //! Encoding of the frame payloads
+    enum Compression
+    {
+        NoCompression    = 0,   //!< Packed lines, can be accessed in place
+        FrameCompression = 1    //!< Lossless, see FrameCodec.h
+    };
+
+    /** Appends frames to a stack file.
+        Every append() is a single sequential write of the frame header and
+        the pixels, independent of the number of frames already stored.
+    @par Thread safety
+        All functions may be called from any thread.
+    */
+    class StackFileWriter
+    {
+    public:
+        StackFileWriter();
+        //! Calls close()
+        ~StackFileWriter();
+
+        //! Creates (or truncates) the file and writes the file header
+        bool open(const QString& filename);
+        //! Writes the index and closes the file
+        void close();
+
+        //! Tells whether open() succeeded and close() was not called yet
+        bool isOpen() const;
+        //! Returns the name given to open()
+        QString getFilename() const;
+        //! Returns the number of frames appended since open()
+        int getFrameCount() const;
+        //! Sets the encoding of the frames appended from now on (default: NoCompression)
+        void setCompression(Compression compression);
+
+        /** Appends an image with its meta data.
+        @param image
+            8 bit grey or Mono16Format (see PixelKernels.h)
+        @return
+            False if the file is not open, the format is not supported or
+            writing failed.
+        */
+        bool append(const QImage& image, const StackFrameInfo& info);
+
+    private:
+        Q_DISABLE_COPY(StackFileWriter);
+
+        mutable QMutex      mMutex;
+        QFile               mFile;
+        //! Capture time and offset of every frame header, sorted and written by close()
+        QVector<QPair<quint64, quint64> > mIndex;
+        Compression         mCompression;   //!< See setCompression()
+    };
+
+    /** Reads a stack file through a memory mapping.
+        Opening a file only reads the index (or walks the frame headers if
+        there is none), the pixels are read when they are accessed.
+    */
+    class StackFileReader
+    {
+    public:
+        StackFileReader();
+        //! Calls close()
+        ~StackFileReader();
+
+        //! Maps the file and reads the index
+        bool open(const QString& filename);
+        //! Unmaps and closes the file
+        void close();
+
+        //! Returns the number of frames (0 if not open)
+        int getFrameCount() const
+            { return mOffsets.size(); }
+        //! Tells whether the file had an index (false if the writer never closed it)
+        bool isComplete() const
+            { return mComplete; }
+
+        //! Returns the meta data of frame \c index
+        StackFrameInfo getInfo(int index) const;
+        //! Returns frame \c index as image (copies or decompresses the pixels once)
+        QImage getImage(int index) const;
+        //! Tells whether frame \c index is stored compressed
+        bool isCompressed(int index) const;
+
+        /** Returns the pixels of frame \c index inside the mapping (valid until
+            close()). The lines are \c bytesPerLine apart.
+            Compressed frames cannot be accessed in place, NULL is returned.
+        */
+        const uchar* getData(int index, QSize* size, int* bytesPerLine, bool* mono16) const;
+
+    private:
+        Q_DISABLE_COPY(StackFileReader);
+
+        //! Walks through the frame headers (file without index)
+        void scanFrames();
+        /** Returns the checked header of frame \c index, throws if the index
+            is out of range or the header is inconsistent.
+        */
+        FrameHeader getHeader(int index) const;
+
+        QFile               mFile;
+        const uchar*        mData;          //!< Mapping of the whole file
+        qint64              mSize;          //!< Size of the mapping
+        QVector<quint64>    mOffsets;       //!< Offsets of the frame headers
+        bool                mComplete;      //!< See isComplete()
+    };
+
+    /** Writes every frame of a stack file as PNG with a .txt meta data file
+        (\c baseFilename + "_0001.png" etc.), the layout used before there
+        were stack files.
+    @return
+        Number of frames exported or -1 if the stack file could not be read.
+    */
+    int exportStackToPng(const QString& stackFilename, const QString& baseFilename);
+}
+
+#endif /* _StackFile_H__ */
@@ -13,6 +13,7 @@
 
 #include "TrackerPrereqs.h"
 
+#include <QMutex>
 #include <QPointF>
 #include <QObject>
 
@@ -20,7 +21,13 @@ namespace tracker
 {
     /** Abstract class defining the interface to the movable stage.
         You can use \ref signalslotspage "Signals and Slots" for move() and
-        stopAll() as well as call them directly (if you are in the same thread!).
+        stopAll() as well as call them directly.
+    @par Thread safety
+        The stage is used from several threads at once (the Controller, the
+        StageCommandScheduler, the DeviceStateCache and the GUI), so every
+        implementation serialises its driver access with mMutex. Blocking moves
+        only hold it while issuing the command and then poll isMovingXY() or
+        isMovingZ(), stopAll() still gets through in the meantime.
     */
     class Stage : public QObject
     {
@@ -85,6 +92,10 @@ namespace tracker
 		//! Sets limts of Z movement
 		virtual void setZlimits(double position)=0;
 
+    protected:
+        //! Serialises all calls to the driver (see class description)
+        QMutex mMutex;
+
     private:
         Q_DISABLE_COPY(Stage);
     };
@@ -0,0 +1,201 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "StageCommandScheduler.h"
+
+#include <QMutexLocker>
+#include <QSettings>
+
+#include "PathConfig.h"
+#include "Stage.h"
+#include "ThreadProfile.h"
+
+namespace tracker
+{
+    //! Issued commands are only kept until somebody collects them, but not forever
+    static const int MAX_ISSUED_RECORDS = 4096;
+
+    StageCommandScheduler::StageCommandScheduler(Stage* stage)
+        : mStage(stage)
+        , mCommandInProgress(false)
+        , mStopRequested(false)
+        , mIssuedCount(0)
+        , mLatenessSum(0)
+        , mMaximumLateness(0)
+    {
+        mIssued.reserve(MAX_ISSUED_RECORDS);
+        this->readSettings();
+    }
+
+    StageCommandScheduler::~StageCommandScheduler()
+    {
+        this->writeSettings();
+    }
+
+    void StageCommandScheduler::schedule(QPointF distance, int block, quint64 deadline, quint64 captureTime)
+    {
+        Command command;
+        command.distance    = distance;
+        command.block       = block;
+        command.deadline    = deadline;
+        command.captureTime = captureTime;
+        command.issueTime   = 0;
+        command.duration    = 0;
+
+        QMutexLocker lock(&mMutex);
+        // Usually there is at most one command in the queue, so a linear search will do
+        QList<Command>::iterator it = mQueue.begin();
+        while (it != mQueue.end() && it->deadline <= deadline)
+            ++it;
+        mQueue.insert(it, command);
+        mCondition.wakeAll();
+    }
+
+    bool StageCommandScheduler::hasPendingCommands() const
+    {
+        QMutexLocker lock(&mMutex);
+        return !mQueue.isEmpty() || mCommandInProgress;
+    }
+
+    void StageCommandScheduler::takeIssuedCommands(QVector<Command>& commands)
+    {
+        QMutexLocker lock(&mMutex);
+        // Element wise: += and clear() would reallocate both vectors
+        for (int i = 0; i < mIssued.size(); ++i)
+            commands.append(mIssued[i]);
+        mIssued.resize(0);
+    }
+
+    void StageCommandScheduler::clear()
+    {
+        QMutexLocker lock(&mMutex);
+        mQueue.clear();
+    }
+
+    void StageCommandScheduler::stop()
+    {
+        QMutexLocker lock(&mMutex);
+        mStopRequested = true;
+        mQueue.clear();
+        mCondition.wakeAll();
+    }
+
+    quint64 StageCommandScheduler::getIssuedCount() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mIssuedCount;
+    }
+
+    double StageCommandScheduler::getAverageLateness() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mIssuedCount == 0 ? 0.0 : (double)mLatenessSum / mIssuedCount;
+    }
+
+    qint64 StageCommandScheduler::getMaximumLateness() const
+    {
+        QMutexLocker lock(&mMutex);
+        return mMaximumLateness;
+    }
+
+    void StageCommandScheduler::resetStatistics()
+    {
+        QMutexLocker lock(&mMutex);
+        mIssuedCount     = 0;
+        mLatenessSum     = 0;
+        mMaximumLateness = 0;
+    }
+
+    void StageCommandScheduler::run(Thread*)
+    {
+        // Keep the spinning away from the core the Controller is confined to
+        applyThreadProfile("StageScheduler");
+
+        QMutexLocker lock(&mMutex);
+        while (!mStopRequested)
+        {
+            if (mQueue.isEmpty())
+            {
+                mCondition.wait(&mMutex);
+                continue;
+            }
+
+            quint64 deadline = mQueue.front().deadline;
+            quint64 now = mClock.getTime();
+            if (now + mSpinMargin < deadline)
+            {
+                quint64 sleepTime = deadline - mSpinMargin - now;
+                if (sleepTime > 2000)
+                {
+                    // Coarse wait that still lets an earlier command or stop() through
+                    mCondition.wait(&mMutex, (unsigned long)(sleepTime / 1000 - 1));
+                }
+                else
+                {
+                    lock.unlock();
+                    usleep(sleepTime);
+                    lock.relock();
+                }
+                continue;
+            }
+
+            Command command = mQueue.takeFirst();
+            mCommandInProgress = true;
+            lock.unlock();
+
+            // Spin for the last few microseconds (querying the clock is cheap enough)
+            while (mClock.getTime() < command.deadline)
+                ;
+            this->issue(command);
+
+            lock.relock();
+            mCommandInProgress = false;
+
+            qint64 lateness = command.getLateness();
+            ++mIssuedCount;
+            mLatenessSum += lateness;
+            mMaximumLateness = qMax(mMaximumLateness, lateness);
+            if (mIssued.size() >= MAX_ISSUED_RECORDS)
+                mIssued.remove(0);
+            mIssued.append(command);
+        }
+
+        // Ready for the next start
+        mQueue.clear();
+        mStopRequested = false;
+    }
+
+    void StageCommandScheduler::issue(Command& command)
+    {
+        command.issueTime = mClock.getTime();
+        mStage->move(command.distance, command.block);
+        command.duration = mClock.getTime() - command.issueTime;
+    }
+
+    void StageCommandScheduler::readSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("StageCommandScheduler");
+
+        mSpinMargin = qMax(0, settings.value("Spin_Margin", 300).toInt());
+
+        settings.endGroup();
+    }
+
+    void StageCommandScheduler::writeSettings()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("StageCommandScheduler");
+
+        settings.setValue("Spin_Margin", mSpinMargin);
+
+        settings.endGroup();
+    }
+}
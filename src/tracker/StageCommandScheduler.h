@@ -0,0 +1,147 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _StageCommandScheduler_H__
+#define _StageCommandScheduler_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QList>
+#include <QMutex>
+#include <QPointF>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "Thread.h"
+#include "Timing.h"
+
+namespace tracker
+{
+    /** Issues horizontal stage moves at a precise point in time.
+        The Controller has to send its stage command a fixed
+        \ref Controller::setStageCommandDelay() "delay" after the image was
+        captured. Instead of busy waiting for that moment in the tracking thread,
+        the move is scheduled here and the Controller continues with the next
+        image right away. \n
+        The scheduler thread keeps the commands in a queue sorted by deadline.
+        It sleeps with a high resolution timer until shortly before the next
+        deadline and spins for the last few microseconds.
+    @par Lateness
+        Every command handed to the stage is recorded with its deadline, the
+        actual issue time and the time spent in Stage::move(). Use
+        takeIssuedCommands() to collect these records from another thread.
+    @par Thread safety
+        All public functions may be called from any thread. Stage::move() is
+        called from the scheduler thread while the Controller still queries
+        the stage from its own thread, the Stage implementations serialise
+        these calls (see Stage).
+    @par Settings
+         - \c Spin_Margin: Time in microseconds before a deadline at which the
+           thread stops sleeping and starts spinning (default: 300)
+         - CPU core and priority: \c StageScheduler thread profile (see ThreadProfile.h)
+    */
+    class StageCommandScheduler : public Runnable
+    {
+        Q_OBJECT;
+
+    public:
+        //! A single horizontal stage move and its timing
+        struct Command
+        {
+            QPointF distance;       //!< Distance to move in micrometers
+            int     block;          //!< Forwarded to Stage::move()
+            quint64 deadline;       //!< Time stamp in microseconds at which the move is due
+            quint64 captureTime;    //!< Capture time stamp of the image the move was computed from
+            quint64 issueTime;      //!< Time stamp in microseconds at which Stage::move() was called
+            quint64 duration;       //!< Time in microseconds spent inside Stage::move()
+
+            //! Returns by how many microseconds the command was late (negative if early)
+            qint64 getLateness() const
+                { return (qint64)issueTime - (qint64)deadline; }
+            //! Returns the microseconds from the capture of the image to the issue of the move
+            quint64 getLatency() const
+                { return issueTime > captureTime ? issueTime - captureTime : 0; }
+        };
+
+        //! Reads the settings. @param stage Stage that receives the commands
+        StageCommandScheduler(Stage* stage);
+        //! Writes the settings
+        ~StageCommandScheduler();
+
+        /** Queues a stage move without blocking.
+        @param distance
+            Distance to move in micrometers
+        @param block
+            See Stage::move()
+        @param deadline
+            Time stamp in microseconds (see HPClock) at which the move should
+            be issued. Commands already overdue are issued immediately.
+        @param captureTime
+            Capture time stamp of the image the move belongs to (see Command::getLatency())
+        */
+        void schedule(QPointF distance, int block, quint64 deadline, quint64 captureTime);
+
+        //! Tells whether a command is queued or currently being issued
+        bool hasPendingCommands() const;
+
+        /** Appends all records of issued commands to @a commands (in issue
+            order). Allocates only if @a commands runs out of capacity.
+        */
+        void takeIssuedCommands(QVector<Command>& commands);
+
+        //! Discards all queued commands that were not yet issued
+        void clear();
+
+        /** Makes the scheduler thread return as soon as possible.
+            Queued commands are discarded. Call Thread::wait() afterwards.
+        */
+        void stop();
+
+        //! Number of commands issued since the last resetStatistics()
+        quint64 getIssuedCount() const;
+        //! Average lateness in microseconds since the last resetStatistics()
+        double getAverageLateness() const;
+        //! Largest lateness in microseconds since the last resetStatistics()
+        qint64 getMaximumLateness() const;
+        //! Clears the lateness statistics
+        void resetStatistics();
+
+    private:
+        Q_DISABLE_COPY(StageCommandScheduler);
+
+        //! Scheduling loop (no Qt event loop required)
+        void run(Thread* thread);
+
+        //! Calls Stage::move() and records the timing. Expects mMutex to be unlocked.
+        void issue(Command& command);
+
+        //! Reads the settings values from the ini file
+        void readSettings();
+        //! Writes the settings values to the ini file
+        void writeSettings();
+
+        Stage*                 mStage;                //!< Stage that receives the commands
+        HPClock                mClock;                //!< Same time base as the capture time stamps
+        mutable QMutex         mMutex;                //!< Protects everything below
+        QWaitCondition         mCondition;            //!< Wakes the thread on new commands or stop()
+        QList<Command>         mQueue;                //!< Pending commands sorted by deadline
+        QVector<Command>       mIssued;               //!< Issued commands not yet collected
+        bool                   mCommandInProgress;    //!< Stage::move() is currently running
+        bool                   mStopRequested;        //!< Set by stop(), reset when run() returns
+
+        quint64                mIssuedCount;          //!< See getIssuedCount()
+        qint64                 mLatenessSum;          //!< Sum of all latenesses for getAverageLateness()
+        qint64                 mMaximumLateness;      //!< See getMaximumLateness()
+
+        int                    mSpinMargin;           //!< Scheduler setting. See readSettings()
+    };
+}
+
+#endif /* _StageCommandScheduler_H__ */
@@ -0,0 +1,168 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Implementation of the per thread CPU core and scheduling configuration.
+*/
+
+#include "ThreadProfile.h"
+
+#include <QSettings>
+
+#include "Logger.h"
+#include "PathConfig.h"
+#include "Timing.h"
+#include "TMath.h"
+
+#ifdef WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  undef min
+#  undef max
+#else
+#  include <errno.h>
+#  include <pthread.h>
+#  include <sched.h>
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <sys/resource.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace tracker
+{
+    //! Default CPU core per thread, chosen to reproduce the former hard coded behaviour
+    static int getDefaultCore(const QString& name)
+    {
+        // The Controller used to confine itself to the first core because of
+        // the Performance Counter, the stage scheduler spins next to it
+        if (name == "Controller")
+            return 0;
+        else if (name == "StageScheduler")
+            return 1;
+        else
+            return -1;
+    }
+
+    ThreadProfile readThreadProfile(const QString& name)
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("ThreadProfiles");
+        settings.beginGroup(name);
+
+        ThreadProfile profile;
+        profile.core = qMax(-1, settings.value("Core", getDefaultCore(name)).toInt());
+        QString scheduling = settings.value("Scheduling", "default").toString().toLower();
+        if (scheduling == "realtime")
+        {
+            profile.scheduling = ThreadProfile::RealTime;
+            profile.priority   = clamp(settings.value("Priority", 50).toInt(), 1, 99);
+        }
+        else if (scheduling == "normal")
+        {
+            profile.scheduling = ThreadProfile::Normal;
+            profile.priority   = clamp(settings.value("Priority", 0).toInt(), -20, 19);
+        }
+        else
+        {
+            if (scheduling != "default")
+                TRACKER_WARNING("Unknown scheduling '" + scheduling + "' for thread " + name);
+            profile.scheduling = ThreadProfile::Default;
+            profile.priority   = 0;
+        }
+
+        settings.endGroup();
+        settings.endGroup();
+        return profile;
+    }
+
+#ifdef WIN32
+    //! Maps nice values to the standard Windows thread priorities
+    static int getWindowsThreadPriority(int nice)
+    {
+        if (nice <= -15)
+            return THREAD_PRIORITY_HIGHEST;
+        else if (nice <= -5)
+            return THREAD_PRIORITY_ABOVE_NORMAL;
+        else if (nice < 5)
+            return THREAD_PRIORITY_NORMAL;
+        else if (nice < 15)
+            return THREAD_PRIORITY_BELOW_NORMAL;
+        else
+            return THREAD_PRIORITY_LOWEST;
+    }
+
+    static bool setScheduling(const ThreadProfile& profile)
+    {
+        int priority = profile.scheduling == ThreadProfile::RealTime
+            ? THREAD_PRIORITY_TIME_CRITICAL : getWindowsThreadPriority(profile.priority);
+        return SetThreadPriority(GetCurrentThread(), priority) != 0;
+    }
+#else
+    static bool setScheduling(const ThreadProfile& profile)
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        if (profile.scheduling == ThreadProfile::RealTime)
+        {
+            param.sched_priority = profile.priority;
+            return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+        }
+        else
+        {
+            if (pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) != 0)
+                return false;
+            // On Linux, the nice value is a per thread attribute
+            return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), profile.priority) == 0;
+        }
+    }
+#endif
+
+    void applyThreadProfile(const QString& name)
+    {
+        ThreadProfile profile = readThreadProfile(name);
+
+        if (profile.core >= 0)
+            setThreadAffinity(profile.core);
+
+        if (profile.scheduling != ThreadProfile::Default && !setScheduling(profile))
+            TRACKER_WARNING("Could not apply the scheduling profile of thread " + name +
+                            " (insufficient privileges?)");
+    }
+
+    void lockProcessMemory()
+    {
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("ThreadProfiles");
+        bool lockMemory = settings.value("Lock_Memory", false).toBool();
+        int workingSet  = qMax(1, settings.value("Locked_Working_Set_[MB]", 512).toInt());
+        settings.endGroup();
+
+        if (!lockMemory)
+            return;
+
+#ifdef WIN32
+        // Windows cannot lock all (future) pages, but a large minimum working
+        // set keeps the pages resident as well
+        SIZE_T minimum = (SIZE_T)workingSet * 1024 * 1024;
+        if (!SetProcessWorkingSetSize(GetCurrentProcess(), minimum, minimum * 2))
+            TRACKER_WARNING("Could not lock the process memory (working set of " +
+                            QString::number(workingSet) + " MB)");
+#else
+        Q_UNUSED(workingSet);
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+            TRACKER_WARNING(QString("Could not lock the process memory: ") + strerror(errno));
+#endif
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Declaration of the per thread CPU core and scheduling configuration.
+
+    Each long-lived thread calls applyThreadProfile() with its name right
+    after it has started. The profiles are read from the \c ThreadProfiles
+    group of the ini file, one sub group per thread:
+     - \c GUI: Main thread with the user interface (the Logger writes here too)
+     - \c Camera: Camera streaming thread
+     - \c Controller: Tracking thread (Controller::run())
+     - \c StageScheduler: StageCommandScheduler thread issuing the stage moves
+     - \c DeviceState: DeviceStateCache thread polling stage, DAC and pressure
+     - \c Microscope: Simulated microscope (dummy build only)
+     - \c Serial: Threads talking to the serial devices (Lamp, LinearMotor)
+@par Settings
+     - \c <Thread>\\Core: CPU core to confine the thread to (-1 to not pin it)
+     - \c <Thread>\\Scheduling: \c default (keep what Qt chose), \c normal
+       or \c realtime
+     - \c <Thread>\\Priority: nice value from -20 to 19 for \c normal, priority
+       from 1 to 99 for \c realtime (SCHED_FIFO). On Windows, \c realtime maps
+       to THREAD_PRIORITY_TIME_CRITICAL and the nice values to the five
+       standard thread priorities.
+     - \c Lock_Memory: Keep all pages of the process in RAM to avoid page
+       faults in the tracking loop
+     - \c Locked_Working_Set_[MB]: Minimum working set on Windows, where only
+       that amount can be kept resident
+@note
+    Real-time scheduling and memory locking usually require elevated rights
+    (CAP_SYS_NICE and CAP_IPC_LOCK or a matching \c ulimit on Linux). Failures
+    only produce a warning.
+*/
+
+#ifndef _ThreadProfile_H__
+#define _ThreadProfile_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QString>
+
+namespace tracker
+{
+    //! Scheduling parameters of a single thread as configured in the ini file
+    struct ThreadProfile
+    {
+        enum Scheduling
+        {
+            Default,    //!< Leave the scheduling untouched
+            Normal,     //!< Time sharing with a nice value
+            RealTime    //!< SCHED_FIFO / time critical priority
+        };
+
+        int         core;        //!< CPU core, -1 for no pinning
+        Scheduling  scheduling;  //!< Scheduling class
+        int         priority;    //!< Nice value or real-time priority, depending on scheduling
+    };
+
+    //! Reads the profile of the thread called @a name from the ini file
+    ThreadProfile readThreadProfile(const QString& name);
+
+    /** Applies the profile of the thread called @a name to the calling thread.
+        Call this from within the thread itself.
+    */
+    void applyThreadProfile(const QString& name);
+
+    //! Locks the process memory if \c Lock_Memory is set in the ini file
+    void lockProcessMemory();
+}
+
+#endif /* _ThreadProfile_H__ */
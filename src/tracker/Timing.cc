@@ -15,24 +15,93 @@
 
 #include "Timing.h"
 
-#ifndef WIN32_LEAN_AND_MEAN
-#  define WIN32_LEAN_AND_MEAN
+#include <QMutex>
+#include <QMutexLocker>
+
+#ifdef WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  undef min
+#  undef max
+// Only declared by recent Windows SDKs (available since Windows 10, 1803)
+#  ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#    define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#  endif
+#else
+#  include <errno.h>
+#  include <pthread.h>
+#  include <sched.h>
+#  include <time.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#  define TRACKER_HAS_TSC
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#    include <x86intrin.h>
+#  endif
 #endif
-#include <windows.h>
-#undef min
-#undef max
 
 namespace tracker
 {
     void msleep(unsigned long milliseconds)
     {
+#ifdef WIN32
         Sleep(milliseconds);
+#else
+        usleep((quint64)milliseconds * 1000);
+#endif
     }
 
     void sleep(unsigned long seconds)
     {
-        Sleep(seconds * 1000);
+        msleep(seconds * 1000);
+    }
+
+#ifdef WIN32
+    void usleep(quint64 microseconds)
+    {
+        if (microseconds == 0)
+            return;
+
+        // Sleep() is bound to the system timer resolution (up to 15.6 ms).
+        // A high resolution waitable timer does much better, older Windows
+        // versions refuse to create one and we fall back to a normal timer.
+        HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (timer == NULL)
+            timer = CreateWaitableTimer(NULL, TRUE, NULL);
+        if (timer == NULL)
+        {
+            Sleep((DWORD)((microseconds + 999) / 1000));
+            return;
+        }
+
+        // Negative values mean relative time in units of 100 nanoseconds
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -(LONGLONG)(microseconds * 10);
+        if (SetWaitableTimer(timer, &dueTime, 0, NULL, NULL, FALSE))
+            WaitForSingleObject(timer, INFINITE);
+        CloseHandle(timer);
+    }
+#else
+    void usleep(quint64 microseconds)
+    {
+        timespec remaining;
+        remaining.tv_sec  = microseconds / 1000000;
+        remaining.tv_nsec = (microseconds % 1000000) * 1000;
+
+        // Note: CLOCK_MONOTONIC_RAW cannot be used for sleeping
+        timespec request;
+        do
+        {
+            request = remaining;
+        } while (clock_nanosleep(CLOCK_MONOTONIC, 0, &request, &remaining) == EINTR);
     }
+#endif
 
     static int dummy = 0;
     void busyWait()
@@ -43,6 +112,7 @@ namespace tracker
             dummy += dummy % i;
     }
 
+#ifdef WIN32
     void setThreadAffinity(unsigned long coreNr)
     {
         if (coreNr < 0)
@@ -74,60 +144,175 @@ namespace tracker
         // Set affinity
         SetThreadAffinityMask(GetCurrentThread(), threadMask);
     }
-
-    HPClock::HPClock()
+#else
+    void setThreadAffinity(unsigned long coreNr)
     {
-        LARGE_INTEGER frequency;
-        QueryPerformanceFrequency(&frequency);
-        mFrequency = frequency.QuadPart;
+        cpu_set_t procMask;
+        CPU_ZERO(&procMask);
+        if (sched_getaffinity(0, sizeof(procMask), &procMask) != 0 || CPU_COUNT(&procMask) == 0)
+            return;
+
+        // Same policy as on Windows: take the core specified with coreNr if
+        // the process may use it, otherwise the lowest one available
+        if (coreNr >= CPU_SETSIZE || !CPU_ISSET(coreNr, &procMask))
+        {
+            coreNr = 0;
+            while (!CPU_ISSET(coreNr, &procMask))
+                ++coreNr;
+        }
+
+        cpu_set_t threadMask;
+        CPU_ZERO(&threadMask);
+        CPU_SET(coreNr, &threadMask);
+        pthread_setaffinity_np(pthread_self(), sizeof(threadMask), &threadMask);
     }
+#endif
 
-    quint64 HPClock::getTime() const
+
+    //! Nanoseconds from the OS clock
+    static quint64 getOSTimeNs()
     {
+#ifdef WIN32
+        static LARGE_INTEGER frequency = { 0 };
+        if (frequency.QuadPart == 0)
+            QueryPerformanceFrequency(&frequency);
         LARGE_INTEGER count;
         QueryPerformanceCounter(&count);
-        return (1000000 * count.QuadPart / mFrequency);
+        // Split the computation, 1e9 * count would overflow after a few hours
+        quint64 seconds = count.QuadPart / frequency.QuadPart;
+        quint64 rest    = count.QuadPart % frequency.QuadPart;
+        return seconds * 1000000000 + rest * 1000000000 / frequency.QuadPart;
+#else
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+        return (quint64)time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+    }
+
+    /** Conversion from time stamp counter ticks to OS clock nanoseconds.
+        Only written once by calibrateTSC() and read only afterwards.
+    */
+    static struct
+    {
+        bool    calibrated;
+        bool    enabled;
+        quint64 baseTicks;
+        quint64 baseTimeNs;
+        double  nsPerTick;
+    } sTSC = { false, false, 0, 0, 0.0 };
+
+    static QMutex sTSCMutex;
+
+#ifdef TRACKER_HAS_TSC
+    //! Returns true if the time stamp counter runs at a constant rate across all cores and power states
+    static bool hasInvariantTSC()
+    {
+        unsigned int regs[4] = { 0, 0, 0, 0 };
+#  ifdef _MSC_VER
+        __cpuid((int*)regs, 0x80000000);
+        if (regs[0] < 0x80000007)
+            return false;
+        __cpuid((int*)regs, 0x80000007);
+#  else
+        if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+            return false;
+        __get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+#  endif
+        return (regs[3] & (1 << 8)) != 0;
+    }
+#endif
+
+    static void calibrateTSC()
+    {
+        QMutexLocker lock(&sTSCMutex);
+        if (sTSC.calibrated)
+            return;
+
+#if defined(TRACKER_USE_TSC) && defined(TRACKER_HAS_TSC)
+        if (hasInvariantTSC())
+        {
+            quint64 startTime  = getOSTimeNs();
+            quint64 startTicks = __rdtsc();
+            usleep(20000);
+            quint64 endTime    = getOSTimeNs();
+            quint64 endTicks   = __rdtsc();
+
+            if (endTicks > startTicks && endTime > startTime)
+            {
+                sTSC.baseTicks  = endTicks;
+                sTSC.baseTimeNs = endTime;
+                sTSC.nsPerTick  = (double)(endTime - startTime) / (endTicks - startTicks);
+                sTSC.enabled    = true;
+            }
+        }
+#endif
+        sTSC.calibrated = true;
+    }
+
+    HPClock::HPClock()
+    {
+        if (!sTSC.calibrated)
+            calibrateTSC();
+    }
+
+    quint64 HPClock::getTimeNs() const
+    {
+#ifdef TRACKER_HAS_TSC
+        if (sTSC.enabled)
+            return sTSC.baseTimeNs + (quint64)((qint64)(__rdtsc() - sTSC.baseTicks) * sTSC.nsPerTick);
+#endif
+        return getOSTimeNs();
+    }
+
+    /*static*/ bool HPClock::usesTSC()
+    {
+        calibrateTSC();
+        return sTSC.enabled;
     }
 
 
-    FrameCounter::FrameCounter(double updatePeriod)
+    FrameCounter::FrameCounter(double updatePeriod, int capacity)
         : mUpdatePeriod(updatePeriod * 1000000)
+        , mFrames(qMax(2, capacity))
+        , mFirst(0)
+        , mCount(0)
     {
     }
 
     void FrameCounter::addFrame(quint64 time)
     {
-        mFrameList.prepend(time);
+        // Full buffer: overwrite the oldest frame
+        if (mCount == mFrames.size())
+        {
+            mFirst = (mFirst + 1) % mFrames.size();
+            --mCount;
+        }
+        mFrames[(mFirst + mCount) % mFrames.size()] = time;
+        ++mCount;
+
+        // Only keep the most recent frame before the update period as reference
+        while (mCount > 2 && this->at(1) + mUpdatePeriod < time)
+        {
+            mFirst = (mFirst + 1) % mFrames.size();
+            --mCount;
+        }
     }
 
-    double FrameCounter::getFrameRate()
+    double FrameCounter::getFrameRate() const
     {
-        if (mFrameList.isEmpty())
+        if (mCount == 0)
             return 0.0;
 
-        quint64 currentTime = mFrameList.front();
-        quint64 pastTime = 0;
-        int frameCount = 0;
-        for (QList<quint64>::iterator it = mFrameList.begin(); it != mFrameList.end();)
-        {
-            if (*it >= currentTime - mUpdatePeriod)
-            {
-                ++frameCount;
-                ++it;
-            }
-            else
-            {
-                if (pastTime == 0)
-                    pastTime = *it;
-                it = mFrameList.erase(it);
-            }
-        }
-        if (pastTime == 0)
-            pastTime = mFrameList.back();
+        quint64 currentTime = this->at(mCount - 1);
+        quint64 pastTime = this->at(0);
+        int frameCount = mCount;
+        // The reference frame itself lies outside the update period
+        if (pastTime + mUpdatePeriod < currentTime)
+            --frameCount;
 
         if (currentTime == pastTime)
             return 0.0;
         else
             return (double)frameCount / (currentTime - pastTime) * 1000000;
     }
-}
\ No newline at end of file
+}
@@ -11,6 +11,9 @@
 @file
 @brief
     Declaration of facilities related to timing
+@note
+    Apart from QtCore, nothing in here depends on Qt or the GUI, so the
+    timing facilities can be used in tools without user interface as well.
  */
 
 #ifndef _Timing_H__
@@ -18,7 +21,7 @@
 
 #include "TrackerPrereqs.h"
 
-#include <QList>
+#include <QVector>
 
 namespace tracker
 {
@@ -26,44 +29,81 @@ namespace tracker
     void msleep(unsigned long milliseconds);
     //! Makes the thread sleep for a few @a seconds
     void sleep(unsigned long seconds);
+    /** Makes the thread sleep for a few @a microseconds.
+        Other than msleep(), this uses a high resolution timer where the OS
+        provides one. Expect the thread to wake up some ten microseconds late.
+    */
+    void usleep(quint64 microseconds);
     //! Waits for approximately 100 microseconds (plus minus 50% or so)
     void busyWait();
 
     //! Confine thread executing this function to a specific CPU core
     void setThreadAffinity(unsigned long coreNr);
 
-    //! Wrapper around the OS high precision timing function.
+    /** Wrapper around the OS high precision timing function.
+        On Windows this is the Performance Counter, elsewhere
+        \c clock_gettime(CLOCK_MONOTONIC_RAW). \n
+        All clocks share the same reference, so time stamps of different
+        HPClock objects (and threads) can be compared.
+    @par Time Stamp Counter
+        With the \c TRACKER_USE_TSC option, the CPU's time stamp counter is read
+        directly instead, which avoids the kernel call and yields time stamps
+        with a resolution well below 100 nanoseconds. The counter is calibrated
+        against the OS clock once when the first clock object gets constructed
+        (takes about 20 ms). If the CPU does not provide an invariant time stamp
+        counter, the OS clock is used anyway.
+    */
     class HPClock
     {
     public:
+        //! Calibrates the time stamp counter if required (only done once)
         HPClock();
         //! Returns a time in microseconds with undefined reference value
-        quint64 getTime() const;
+        quint64 getTime() const
+            { return this->getTimeNs() / 1000; }
+        //! Returns a time in nanoseconds with the same reference value as getTime()
+        quint64 getTimeNs() const;
 
-    private:
-        quint64 mFrequency;  //!< Stores the Performance Counter frequency
+        //! Tells whether the time stamp counter is used instead of the OS clock
+        static bool usesTSC();
     };
 
-    //! Utility class that calculates the frame rate if updated regularly.
+    /** Utility class that calculates the frame rate if updated regularly.
+        The time stamps are stored in a ring buffer of fixed capacity, so both
+        adding a frame and querying the frame rate take constant time and never
+        allocate memory.
+    */
     class FrameCounter
     {
     public:
-        //! @param udpatePeriod Time span in seconds that is used to average the frame rate.
-        FrameCounter(double updatePeriod);
+        /**
+        @param updatePeriod
+            Time span in seconds that is used to average the frame rate.
+        @param capacity
+            Maximum number of frames stored. With more frames per update period,
+            the average is computed over a correspondingly shorter time span.
+        */
+        FrameCounter(double updatePeriod, int capacity = 1024);
         ~FrameCounter() {}
 
         //! Call this function with a time stamp once a new frame has begun
         void addFrame(quint64 time);
         //! Forget all past frames
         void reset()
-            { mFrameList.clear(); }
+            { mFirst = 0; mCount = 0; }
 
         //! Returns the average frames per second over the update period specified in the constructor
-        double getFrameRate();
+        double getFrameRate() const;
 
     private:
-        const quint64  mUpdatePeriod;    //!< Time span in seconds that is used to average the frame rate.
-        QList<quint64> mFrameList;       //!< List of past frames with time stamps
+        //! Returns the i-th oldest time stamp stored
+        quint64 at(int i) const
+            { return mFrames[(mFirst + i) % mFrames.size()]; }
+
+        const quint64    mUpdatePeriod;  //!< Time span in microseconds that is used to average the frame rate.
+        QVector<quint64> mFrames;        //!< Ring buffer with the time stamps of past frames
+        int              mFirst;         //!< Index of the oldest time stamp in mFrames
+        int              mCount;         //!< Number of valid time stamps in mFrames
     };
 }
 
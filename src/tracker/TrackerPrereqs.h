@@ -40,15 +40,30 @@ namespace tracker
     class Thread;
 
     class Camera;
+    class FramePool;
     class PressureSensor;
     class SerialInterface;
     class Stage;
+    class StageCommandScheduler;
     class Dac;
+    class DeviceStartup;
+    class DeviceStateCache;
+    struct DeviceState;
 
     class Controller;
     class Correlator;
+    class CorrelatorCache;
     class BaseImage;
     class CorrelationImage;
+    class DebugImageRenderer;
+    class ImageWriter;
+    class RecordingBuffer;
+    class MotionPredictor;
+    class MultiRoiTracker;
+    class StackFileReader;
+    class StackFileWriter;
+    struct StackFrameInfo;
+    class TransferFunction;
 
     class CurveFitter;
     class FocusTracker;
@@ -62,6 +77,9 @@ namespace tracker
     class DummyCamera;
     class DummyMicroscope;
     class DummyStage;
+    class DummyStackSource;
+    class MicroscopeModel;
+    class SessionFrameCounter;
 #endif
 }
 
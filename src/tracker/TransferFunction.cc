@@ -0,0 +1,82 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "TransferFunction.h"
+
+#include <cmath>
+
+namespace tracker
+{
+    TransferFunction::TransferFunction()
+        : mTotalStageMove(0.0, 0.0)
+        , mMotionPredictorType(0)
+        , mTrackingErrorSum(0.0)
+        , mTrackingErrorCount(0)
+    {
+    }
+
+    void TransferFunction::reset(int motionPredictor, double processNoise, double measurementNoise)
+    {
+        mTotalStageMove = QPointF(0.0, 0.0);
+        mSmithPredictor.fill(QPointF(0.0, 0.0));
+        mMotionPredictorType = motionPredictor;
+        mMotionPredictor.setModel(motionPredictor == 2
+            ? MotionPredictor::ConstantAcceleration : MotionPredictor::ConstantVelocity);
+        mMotionPredictor.setProcessNoise(processNoise);
+        mMotionPredictor.setMeasurementNoise(measurementNoise);
+        mMotionPredictor.reset();
+        mTrackingErrorSum = 0.0;
+        mTrackingErrorCount = 0;
+    }
+
+    void TransferFunction::setPredictorSize(int value)
+    {
+        // Only allocates if the size actually changes
+        mSmithPredictor.setCapacity(qMax(0, value));
+        while (mSmithPredictor.size() < mSmithPredictor.capacity())
+            mSmithPredictor.push(QPointF(0.0, 0.0));
+    }
+
+    QPointF TransferFunction::compute(QPointF offset, quint64 captureTime, quint64 landingTime, double gain)
+    {
+        QPointF stageMove = offset;
+        mTrackingErrorSum += stageMove.x() * stageMove.x() + stageMove.y() * stageMove.y();
+        ++mTrackingErrorCount;
+
+        // Subtract all stage movements that are not yet visible on the image
+        for (int i = 0; i < mSmithPredictor.size(); ++i)
+            stageMove -= mSmithPredictor[i];
+
+        if (mMotionPredictorType != 0)
+        {
+            // stageMove is now the sample position relative to the position the
+            // stage will have after all issued moves. Add mTotalStageMove to get
+            // the absolute sample position at the time of capture.
+            mMotionPredictor.update(stageMove + mTotalStageMove, captureTime);
+            stageMove = mMotionPredictor.predict(landingTime) - mTotalStageMove;
+        }
+
+        return stageMove * gain;
+    }
+
+    void TransferFunction::addStageMove(QPointF move)
+    {
+        // Advance in ring buffer for the Smith Predictor (drops the oldest move)
+        mSmithPredictor.push(move);
+        mTotalStageMove += move;
+    }
+
+    double TransferFunction::getTrackingError() const
+    {
+        if (mTrackingErrorCount == 0)
+            return 0.0;
+        return std::sqrt(mTrackingErrorSum / mTrackingErrorCount);
+    }
+}
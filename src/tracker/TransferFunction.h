@@ -0,0 +1,94 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _TransferFunction_H__
+#define _TransferFunction_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QPointF>
+
+#include "MotionPredictor.h"
+#include "RingBuffer.h"
+
+namespace tracker
+{
+    /** The XY controller of the tracker: turns the offset measured on an
+        image into a stage move.
+        The stage moves of the last few images are not yet visible on the
+        image (camera and stage latency), the Smith Predictor subtracts them
+        from the measured offset. With a Kalman motion predictor, the sample
+        position is estimated from all images so far and the stage is sent to
+        where the sample will be when the move lands instead.
+    @par Usage
+        Call compute() for every image with a valid offset and afterwards
+        addStageMove() with the move actually issued. Images that are skipped
+        (too old, stage still moving, ...) must add a zero move, because the
+        Smith Predictor counts images, not time.
+    @par
+        This class neither knows about the stage nor the camera, so it is
+        shared by the Controller and the offline tools (see
+        tools/ReplayTracker.cc).
+    */
+    class TransferFunction
+    {
+    public:
+        TransferFunction();
+
+        /** Forgets all stage moves and restarts the motion predictor.
+        @param motionPredictor
+            See Controller::setMotionPredictor() (0: Smith Predictor, 1 and 2: Kalman)
+        */
+        void reset(int motionPredictor, double processNoise, double measurementNoise);
+
+        /// Sets the number of images between a stage move and its effect on the image
+        void setPredictorSize(int value);
+
+        /** Returns the desired stage move.
+        @param offset
+            Offset of the sample on the image, in stage coordinates and
+            already inverted (the direction the stage has to move)
+        @param captureTime
+            Time the image was captured (microseconds)
+        @param landingTime
+            Time a move issued now will have arrived (only used by the Kalman predictors)
+        @param gain
+            Controller gain applied to the result
+        */
+        QPointF compute(QPointF offset, quint64 captureTime, quint64 landingTime, double gain);
+
+        /// Records the move issued for the current image (zero if none)
+        void addStageMove(QPointF move);
+
+        /// Returns the sum of all moves since reset()
+        QPointF getTotalStageMove() const
+            { return mTotalStageMove; }
+        /// Returns the velocity estimated by the Kalman predictors (0 for the Smith Predictor)
+        QPointF getVelocity() const
+            { return mMotionPredictorType != 0 ? mMotionPredictor.getVelocity() : QPointF(0.0, 0.0); }
+        /// Returns the RMS of all offsets passed to compute() since reset()
+        double getTrackingError() const;
+        /// Returns the number of compute() calls since reset()
+        int getTrackingErrorCount() const
+            { return mTrackingErrorCount; }
+
+    private:
+        Q_DISABLE_COPY(TransferFunction);
+
+        RingBuffer<QPointF>     mSmithPredictor;        ///< Moves of the last images, newest first
+        QPointF                 mTotalStageMove;        ///< See getTotalStageMove()
+        MotionPredictor         mMotionPredictor;       ///< Used if mMotionPredictorType != 0
+        int                     mMotionPredictorType;   ///< See reset()
+        double                  mTrackingErrorSum;      ///< Sum of the squared offsets
+        int                     mTrackingErrorCount;    ///< See getTrackingErrorCount()
+    };
+}
+
+#endif /* _TransferFunction_H__ */
@@ -10,8 +10,12 @@
 
 #include "DummyCamera.h"
 
+#include <cstring>
 #include <QApplication>
+#include <QDir>
+#include <QFileInfo>
 #include <QSettings>
+#include <QTimerEvent>
 #include <iostream>
 
 #include "gaussianblur.h"
@@ -19,12 +23,15 @@
 #include "Exception.h"
 #include "Logger.h"
 #include "PathConfig.h"
+#include "ThreadProfile.h"
 #include "Timing.h"
 #include "TrackerAssert.h"
 #include "TMath.h"
 #include "Utils.h"
 
 #include "CurveFitter.h"
+#include "DummyStackSource.h"
+#include "PixelKernels.h"
 
 #include <iostream>
 
@@ -36,116 +43,244 @@ namespace tracker
     }
 
     DummyCamera::DummyCamera()
+        : mStackSource(NULL)
+        , mStackReadAhead(4)
+        , mSyntheticFrameRate(0)
+        , mSyntheticBlurLevels(8)
+        , mSyntheticZOffset(0.0)
+        , mNextFrameTime(0)
+        , mSyntheticTimerID(0)
     {
-        // Create colour table for 8 bit grey images
-        mColourTable.resize(256);
-        for (int i = 0; i < 256; ++i)
-            mColourTable[i] = qRgb(i, i, i);
-
         // Load base image
         mBaseImage.load(PathConfig::getDataPath().path() + "/dummy/s01_20140320_165148.png");
-        mBaseImage = mBaseImage.convertToFormat(QImage::Format_Indexed8, mColourTable);
-
-        // Load image stack
-        const double stepSize = 0.1;  // distance between 2 successive images (in microns)
-        QDir stackDir(PathConfig::getDataPath().path() + "/dummy/zstack");
-        if (stackDir.exists()) {
-            QStringList imageFiles = stackDir.entryList(QStringList("*.png"),
-                                                        QDir::Files | QDir::NoSymLinks);
-            if (!imageFiles.isEmpty()) {
-                std::cout << "Loading " << imageFiles.size() << " images to stack" << std::endl;
-                for (int i = 0; i < imageFiles.size(); i++) {
-                    QImage image = QImage(stackDir.absolutePath() + "/" + imageFiles[i]);
-
-                    if (!image.isNull()) {
-                        image = image.convertToFormat(QImage::Format_Indexed8, mColourTable);
-                        mImageStack.append(image);
-/*
-                        QFileInfo info(stackDir.absolutePath() + "/" + imageFiles[i]);
-                        QFile metaData(stackDir.absolutePath() + "/" + info.baseName() + ".txt");
-                        if (!metaData.open(QIODevice::ReadOnly | QIODevice::Text)) {
-                            TRACKER_EXCEPTION("Failed to load meta data for image " + imageFiles[i]);
-                        } else {
-                            QTextStream in(&metaData);
-                            bool foundZPos = false;
-                            while (!in.atEnd() && !foundZPos) {
-                                QString line = in.readLine();
-
-                                // read Z position from metadata
-                                if (line.startsWith("z:")) {
-                                    bool ok = false;
-                                    double zPos = line.mid(2, -1).toDouble(&ok);
-
-                                    if (ok) {
-                                        if (mZPosStack.size() > 0 && mZPosStack.last() < zPos) {
-                                            TRACKER_EXCEPTION("Image stack Z positions not successive: "
-                                                              + QString::number(mZPosStack.last()) + ", " + QString::number(zPos)
-                                                              + "(" + QString::number(mZPosStack.size() - 1) + ", " + QString::number(mZPosStack.size()) + ")");
-                                        } else
-                                            mZPosStack.append(zPos);
-                                    } else
-                                        TRACKER_EXCEPTION("Failed to get Z position for image " + imageFiles[i]);
-                                    foundZPos = true;
-                                }
-                            }
-
-                            if (!foundZPos)
-                                TRACKER_EXCEPTION("Failed to get Z position for image " + imageFiles[i]);
-                            metaData.close();
-                        }
-*/
-                    } else
-                        TRACKER_EXCEPTION("Failed to load image " + imageFiles[i]);
-                }
-
-                std::cout << "Successfully loaded " << mImageStack.size() << " images" << std::endl;
-
-                // Assign Z positions to images, use the middle image as position 0
-                for (int i = 0; i < mImageStack.size(); ++i) {
-                    mZPosStack.append((i - (mImageStack.size() / 2)) * stepSize);
-                }
-            } else
-                TRACKER_WARNING("No images found in stack directory");
-        } else
-            TRACKER_WARNING("Image stack directory " + stackDir.absolutePath() + " not found. Not using image stack.");
+        mBaseImage = mBaseImage.convertToFormat(QImage::Format_Indexed8, getGreyColourTable());
 
         // Define video modes
         mModes["640x480"] = QSize(640, 480);
         mModes["720x540"] = QSize(720, 540);
         mModes["800x600"] = QSize(800, 600);
+        mModes["ROI 320x240"] = QSize(320, 240);
+        mModes["ROI 160x120"] = QSize(160, 120);
+        mRoiModes << "ROI 320x240" << "ROI 160x120";
+        mModes["640x480 Binning 2x2"] = QSize(320, 240);
+        mBinning["640x480 Binning 2x2"] = 2;
         mExposureTime = 10000;
         mGain = 1.0;
 
         mCurrentMode = "640x480";
 
+        // Any seed except zero
+        mNoiseState[0] = 123456789;
+        mNoiseState[1] = 362436069;
+        mNoiseState[2] = 521288629;
+        mNoiseState[3] = 88675123;
+
         this->readSettings();
+        this->openStack();
+        if (mSyntheticFrameRate > 0)
+            this->prepareSyntheticStream();
     }
 
     DummyCamera::~DummyCamera()
     {
+        delete mStackSource;
         this->writeSettings();
     }
 
+    void DummyCamera::openStack()
+    {
+        // Distance between 2 successive images (in microns) if the stack has no Z positions
+        const double stepSize = 0.1;
+
+        QString filename = mStackFile;
+        if (!QFileInfo(filename).isAbsolute())
+            filename = PathConfig::getDataPath().path() + "/" + filename;
+
+        // Stacks used to be directories of PNG files, convert them once
+        if (!QFile::exists(filename))
+        {
+            const QString directory = PathConfig::getDataPath().path() + "/dummy/zstack";
+            if (!QDir(directory).exists() || !DummyStackSource::createFromDirectory(directory, filename, stepSize))
+            {
+                TRACKER_WARNING("Image stack " + filename + " not found. Not using image stack.");
+                return;
+            }
+        }
+
+        mStackSource = new DummyStackSource(mStackReadAhead);
+        if (!mStackSource->open(filename, stepSize) || mStackSource->getFrameCount() == 0)
+        {
+            TRACKER_WARNING("No images found in image stack " + filename);
+            delete mStackSource;
+            mStackSource = NULL;
+        }
+    }
+
     void DummyCamera::run(Thread* thread)
     {
         mIsRunning = true;
+        applyThreadProfile("Camera");
 
         int timerID = this->startTimer(500);
         mFrameCounter.reset();
 
+        // A zero timer fires whenever the event loop is idle, that is the only
+        // way to get well above 1000 frames per second with Qt timers
+        if (!mBlurLevels.isEmpty())
+        {
+            mNextFrameTime = mClock.getTime();
+            mSyntheticTimerID = this->startTimer(0);
+        }
+
         // Start event loop
         thread->exec();
 
         this->killTimer(timerID);
+        if (mSyntheticTimerID)
+        {
+            this->killTimer(mSyntheticTimerID);
+            mSyntheticTimerID = 0;
+        }
+        this->logFramePoolStatistics();
 
         mIsRunning = false;
 
         this->moveToThread(QApplication::instance()->thread());
     }
 
-    void DummyCamera::timerEvent(QTimerEvent*)
+    void DummyCamera::timerEvent(QTimerEvent* event)
+    {
+        if (event->timerId() == mSyntheticTimerID)
+            this->makeSyntheticImage();
+        else
+            emit frameRateUpdated(mFrameCounter.getFrameRate());
+    }
+
+    void DummyCamera::readSettings()
+    {
+        Camera::readSettings();
+
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DummyCamera");
+        mSyntheticFrameRate  = qMax(0, settings.value("Synthetic_Frame_Rate",  0).toInt());
+        mSyntheticBlurLevels = qMax(1, settings.value("Synthetic_Blur_Levels", 8).toInt());
+        mStackFile           = settings.value("Stack_File", "dummy/zstack.tfs").toString();
+        mStackReadAhead      = qMax(0, settings.value("Stack_Read_Ahead", 4).toInt());
+        settings.endGroup();
+    }
+
+    void DummyCamera::writeSettings()
+    {
+        Camera::writeSettings();
+
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DummyCamera");
+        settings.setValue("Synthetic_Frame_Rate",  mSyntheticFrameRate);
+        settings.setValue("Synthetic_Blur_Levels", mSyntheticBlurLevels);
+        settings.setValue("Stack_File",            mStackFile);
+        settings.setValue("Stack_Read_Ahead",      mStackReadAhead);
+        settings.endGroup();
+    }
+
+    void DummyCamera::setSyntheticFrameRate(int value)
+    {
+        mSyntheticFrameRate = qMax(0, value);
+        if (mSyntheticFrameRate == 0)
+            mBlurLevels.clear();
+        else if (mBlurLevels.isEmpty())
+            this->prepareSyntheticStream();
+    }
+
+    void DummyCamera::prepareSyntheticStream()
+    {
+        if (mBaseImage.isNull())
+        {
+            TRACKER_WARNING("DummyCamera: No base image, synthetic streaming disabled");
+            return;
+        }
+
+        // The blur works on contiguous lines only
+        QImage scene = mBaseImage.copy(0, 0, mBaseImage.width() & ~3, mBaseImage.height());
+        TGaussianBlur<uint8_t> blur;
+        mBlurLevels.resize(mSyntheticBlurLevels);
+        for (int i = 0; i < mBlurLevels.size(); ++i)
+        {
+            mBlurLevels[i] = scene.copy();
+            if (i > 0)
+                blur.Filter(mBlurLevels[i].bits(), NULL, scene.width(), scene.height(), 2 * i + 1);
+        }
+        TRACKER_INFO(QString("DummyCamera: Synthetic streaming at %1 fps with %2 blur levels")
+            .arg(mSyntheticFrameRate).arg(mBlurLevels.size()), Logger::Low);
+    }
+
+    void DummyCamera::makeSyntheticImage()
     {
-        emit frameRateUpdated(mFrameCounter.getFrameRate());
+        quint64 now = mClock.getTime();
+        if (!mIsRunning || now < mNextFrameTime)
+            return;
+        // Catch up with at most one frame after a hiccup
+        const quint64 period = 1000000 / mSyntheticFrameRate;
+        mNextFrameTime = qMax(mNextFrameTime, now - qMin(now, period)) + period;
+
+        quint64 captureTime = now;
+        mFrameCounter.addFrame(captureTime);
+
+        // Blur level i corresponds to the window size 2 * |z| + 1 of makeImage()
+        int level = qMin(mBlurLevels.size() - 1, qRound(std::abs(mSyntheticZOffset)));
+        const QImage& scene = mBlurLevels[level];
+        QSize size = mModes[mCurrentMode];
+        if (size.width() > scene.width() || size.height() > scene.height())
+            return;
+
+        // Same geometry as makeImage(), but the view never leaves the scene
+        QRect rect(QPoint(0, 0), size);
+        rect.moveCenter(scene.rect().center() - mSyntheticOffset.toPoint());
+        rect.moveLeft(qBound(0, rect.left(), scene.width() - size.width()));
+        rect.moveTop(qBound(0, rect.top(), scene.height() - size.height()));
+
+        FramePool::Frame frame = mFramePool.acquire(size, QImage::Format_Indexed8, getGreyColourTable());
+        for (int y = 0; y < size.height(); ++y)
+            copyWithNoise(scene.scanLine(rect.top() + y) + rect.left(), frame.scanLine(y), size.width(), mNoiseState);
+
+        if (this->singleShotInProgress())
+            this->finishSingleShot(frame.image, captureTime, mClock.getTime());
+        else
+            emit imageProcessed(frame.image, captureTime, mClock.getTime());
+    }
+
+    /*static*/ void DummyCamera::copyWithNoise(const uchar* source, uchar* target, int count, quint32 state[4])
+    {
+        int i = 0;
+#ifdef TRACKER_HAS_SSE2
+        // Four xorshift32 generators side by side give 16 random bytes per step
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+        const __m128i mask  = _mm_set1_epi8(15);
+        const __m128i eight = _mm_set1_epi8(8);
+        for (; i + 16 <= count; i += 16)
+        {
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+            x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+
+            // noise = r - 8 with r in [0, 15]: add max(r - 8, 0), subtract max(8 - r, 0)
+            __m128i r = _mm_and_si128(x, mask);
+            __m128i up   = _mm_subs_epu8(r, eight);
+            __m128i down = _mm_subs_epu8(eight, r);
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            pixels = _mm_subs_epu8(_mm_adds_epu8(pixels, up), down);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), pixels);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), x);
+#endif
+        // Remainder (or everything without SSE2) with the first generator
+        quint32& s = state[0];
+        for (; i < count; ++i)
+        {
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            target[i] = qMax(0, qMin(source[i] + (int)(s & 15) - 8, 255));
+        }
     }
 
     void DummyCamera::makeImage(QPointF offset, double zOffset, quint64 processTime)
@@ -163,31 +298,41 @@ namespace tracker
         mFrameCounter.addFrame(captureTime);
 
         QRect rect;
-        rect = QRect(QPoint(0, 0), mModes[mCurrentMode]);
+        rect = QRect(QPoint(0, 0), this->getFieldOfView());
 
         // Move the rectangle to the center but with offset
         // Note: The minus sign is required because moveCenter() moves the camera
         //       instead of the picture itself
         rect.moveCenter(mBaseImage.rect().center() - offset.toPoint());
-        QImage image = mBaseImage.copy(rect);
+        FramePool::Frame frame = mFramePool.acquire(mModes[mCurrentMode], QImage::Format_Indexed8, getGreyColourTable());
+        this->extractFrame(mBaseImage, rect, frame);
 
         // TODO: Apply proper out-of-focus simulation using a convolution with a disc
+        // Note: All modes have a width divisible by 4, so the lines are contiguous
         TGaussianBlur<uint8_t> blur;
         int blurSize = std::abs(zOffset) * 2 + 1;
-        blur.Filter(image.scanLine(0), NULL, image.width(), image.height(), blurSize);
+        blur.Filter(frame.bits, NULL, frame.image.width(), frame.image.height(), blurSize);
 
         // Add some noise
-        addImageNoise(image);
+        addImageNoise(frame);
 
         // Send partial image
         if (this->singleShotInProgress())
-            this->finishSingleShot(image, captureTime, mClock.getTime());
+            this->finishSingleShot(frame.image, captureTime, mClock.getTime());
         else
-            emit imageProcessed(image, captureTime, mClock.getTime());
+            emit imageProcessed(frame.image, captureTime, mClock.getTime());
     }
 
     void DummyCamera::makeStackImage(QPointF offset, double zOffset, quint64 processTime)
     {
+        // Synthetic frames are made in timerEvent() at their own rate
+        if (!mBlurLevels.isEmpty())
+        {
+            mSyntheticOffset = offset;
+            mSyntheticZOffset = zOffset;
+            return;
+        }
+
         // Don't let the image buffer overflow due to missing CPU power
         if (mClock.getTime() > processTime + 3000)
             return;
@@ -197,39 +342,41 @@ namespace tracker
         if (!mIsRunning)
             return;
 
-        // We can't get any image with an empty stack
-        if (mImageStack.empty())
+        // We can't get any image without a stack
+        if (mStackSource == NULL)
             return;
 
         quint64 captureTime = mClock.getTime();
         mFrameCounter.addFrame(captureTime);
 
         QRect rect;
-        rect = QRect(QPoint(0, 0), mModes[mCurrentMode]);
+        rect = QRect(QPoint(0, 0), this->getFieldOfView());
 
         // Retreive the image closest to zOffset from the stack, if the value
         // is beyond the range value of the array it is clamped
-        int i = binarySearchClosest(mZPosStack, zOffset);
+        int i = binarySearchClosest(mStackSource->getZPositions(), zOffset);
+        const QImage source = mStackSource->getFrame(i);
         /*
         std::cout << "makeStackImage(): zOffset " << zOffset
                   << ", index " << i
-                  << " (" << mZPosStack.first() << "," << mZPosStack.last() << ")"
+                  << " (" << mStackSource->getZPositions().first() << "," << mStackSource->getZPositions().last() << ")"
                   << std::endl;
         */
         // Move the rectangle to the center but with offset
         // Note: The minus sign is required because moveCenter() moves the camera
         //       instead of the picture itself
-        rect.moveCenter(mImageStack[i].rect().center() - offset.toPoint());
-        QImage image = mImageStack[i].copy(rect);
+        rect.moveCenter(source.rect().center() - offset.toPoint());
+        FramePool::Frame frame = mFramePool.acquire(mModes[mCurrentMode], QImage::Format_Indexed8, getGreyColourTable());
+        this->extractFrame(source, rect, frame);
 
         // Add some noise
-        addImageNoise(image);
+        addImageNoise(frame);
 
         // Send partial image
         if (this->singleShotInProgress())
-            this->finishSingleShot(image, captureTime, mClock.getTime());
+            this->finishSingleShot(frame.image, captureTime, mClock.getTime());
         else
-            emit imageProcessed(image, captureTime, mClock.getTime());
+            emit imageProcessed(frame.image, captureTime, mClock.getTime());
     }
 
     QStringList DummyCamera::getAvailableModes() const
@@ -262,14 +409,54 @@ namespace tracker
             return QSize(0, 0);
     }
 
-    void DummyCamera::addImageNoise(QImage& image)
+    void DummyCamera::addImageNoise(FramePool::Frame& frame)
     {
-        for (int y = 0; y < image.height(); ++y) {
-            uchar* ptr = image.scanLine(y);
-            for (int x = 0; x < image.width(); ++x)
+        for (int y = 0; y < frame.image.height(); ++y) {
+            uchar* ptr = frame.scanLine(y);
+            for (int x = 0; x < frame.image.width(); ++x)
             {
                 ptr[x] = qMax(0, qMin(ptr[x] + (qrand() & 15) - 8, 255));
             }
         }
     }
+
+    void DummyCamera::extractFrame(const QImage& source, QRect rect, FramePool::Frame& frame) const
+    {
+        const int binning = mBinning.value(mCurrentMode, 1);
+        const int width = frame.image.width();
+        const int height = frame.image.height();
+
+        // Common case: plain copy of lines that lie within the source
+        if (binning == 1 && source.rect().contains(rect))
+        {
+            for (int y = 0; y < height; ++y)
+                memcpy(frame.scanLine(y), source.scanLine(rect.top() + y) + rect.left(), width);
+            return;
+        }
+
+        // Average over binning x binning pixels, everything outside the source is black
+        const int area = binning * binning;
+        for (int y = 0; y < height; ++y)
+        {
+            uchar* target = frame.scanLine(y);
+            for (int x = 0; x < width; ++x)
+            {
+                int sum = 0;
+                for (int j = 0; j < binning; ++j)
+                {
+                    int sourceY = rect.top() + y * binning + j;
+                    if (sourceY < 0 || sourceY >= source.height())
+                        continue;
+                    const uchar* line = source.scanLine(sourceY);
+                    for (int i = 0; i < binning; ++i)
+                    {
+                        int sourceX = rect.left() + x * binning + i;
+                        if (sourceX >= 0 && sourceX < source.width())
+                            sum += line[sourceX];
+                    }
+                }
+                target[x] = sum / area;
+            }
+        }
+    }
 }
@@ -23,6 +23,30 @@ namespace tracker
         the actual device.
         This class also implements the virtual stage shift by extracting a
         different sub image of a very large image.
+    @par Modes
+        Next to the full size modes, there are centred sensor ROI modes
+        ("ROI ...", a smaller part of the 640x480 field of view) and a
+        binning mode (the 640x480 field of view averaged over 2x2 pixels).
+        They allow testing the Controller's adaptive camera modes without
+        hardware.
+    @par Synthetic streaming
+        With \c Synthetic_Frame_Rate > 0 in the [DummyCamera] group, the
+        camera does not wait for the DummyMicroscope anymore but streams on
+        its own at that rate (1000 fps and more), showing the scene at the
+        latest stage position received. This is meant for load testing the
+        Controller, the queueing and the logging. To get there:
+        - The scene is blurred for \c Synthetic_Blur_Levels Z positions at
+          startup instead of for every frame.
+        - Cropping and noise are a single pass from the blurred scene into a
+          pooled frame (no intermediate copy), the noise comes from a
+          vectorised xorshift generator instead of qrand().
+        - Binning is not simulated, binning modes show a crop of their size.
+    @par Image stack
+        makeStackImage() shows the image of a Z-stack closest to the focus.
+        The stack is a stack file (see StackFile.h) named by \c Stack_File,
+        read through a DummyStackSource. \c Stack_Read_Ahead images are
+        prepared in advance. A "dummy/zstack" directory of PNG files is
+        converted to a stack file on first use.
     @note
         Most of the functionality has to be configured in the code directly
         because this class is only useful for testing while developing anyway.
@@ -48,6 +72,8 @@ namespace tracker
         void setMode(QString modeText, int exposureTime = -1, double gain = -1.0);
 
         QSize getImageSize(QString mode) const;
+        bool isRegionOfInterest(QString mode) const
+            { return mRoiModes.contains(mode); }
 
         int getExposureTime() const
             { return mExposureTime; }
@@ -64,6 +90,14 @@ namespace tracker
         QPair<double, double> getGainRange() const
             { return qMakePair(1.0, 9.80); }
 
+        /// See Synthetic_Frame_Rate in the class description
+        int getSyntheticFrameRate() const
+            { return mSyntheticFrameRate; }
+        /** Switches synthetic streaming on (frames per second) or off (0).
+            Takes effect with the next start of the camera thread.
+        */
+        void setSyntheticFrameRate(int value);
+
     private slots:
         /** Creates a new image using gaussian blurring, depending on the stage position.
             This function also adds some noise to the image.
@@ -76,7 +110,10 @@ namespace tracker
         */
         void makeImage(QPointF offset, double zOffset, quint64 processTime);
 
-        /** Create a new image using the image stack. */
+        /** Create a new image using the image stack.
+            In synthetic streaming mode, only stores the position for the
+            next frames.
+        */
         void makeStackImage(QPointF offset, double zOffset, quint64 processTime);
 
     private:
@@ -84,22 +121,62 @@ namespace tracker
 
         void run(Thread* thread);
 
-        /// Periodic callback used for framerate updates
-        void timerEvent(QTimerEvent*);
+        /// Periodic callback used for framerate updates and synthetic frames
+        void timerEvent(QTimerEvent* event);
+
+        void readSettings();
+        void writeSettings();
+
+        /// Opens the image stack (converts an old "zstack" PNG directory first)
+        void openStack();
+
+        /// Blurs the scene once for every synthetic blur level
+        void prepareSyntheticStream();
+
+        /// Creates and sends a synthetic frame if it is due
+        void makeSyntheticImage();
+
+        /** Writes \c source + noise (uniform in [-8, 7], saturated) to
+            \c target for \c count pixels.
+        @param state
+            Xorshift state of four generators (never all zero)
+        */
+        static void copyWithNoise(const uchar* source, uchar* target, int count, quint32 state[4]);
 
         /// Add noise to an image
-        void addImageNoise(QImage&);
+        void addImageNoise(FramePool::Frame& frame);
+
+        /** Fills @a frame with the part @a rect of the scene (8 bit image),
+            binned according to the current mode.
+        */
+        void extractFrame(const QImage& source, QRect rect, FramePool::Frame& frame) const;
+
+        /// Returns the part of the scene seen by the sensor in the current mode
+        QSize getFieldOfView() const
+            { return mModes[mCurrentMode] * mBinning.value(mCurrentMode, 1); }
 
         HPClock              mClock;
         QImage               mBaseImage;    ///< Large image depicting the entire scene
-        QVector<QImage>      mImageStack;   ///< Stack of images
-        QVector<double>      mZPosStack;    ///< Stack of Z positions
-        QVector<QRgb>        mColourTable;  ///< Grayscale images require this
+        DummyStackSource*    mStackSource;  ///< Z-stack images (NULL without a stack)
+        QString              mStackFile;    ///< Stack file, relative to the data path
+        int                  mStackReadAhead; ///< Images the stack source prepares in advance
 
         QMap<QString, QSize> mModes;        ///< Available camera modes
+        QMap<QString, int>   mBinning;      ///< Binning factor of the modes (1 if missing)
+        QStringList          mRoiModes;     ///< Modes that only read out a region of the sensor
         int                  mExposureTime; ///< Current exposure time (has no effect on the image)
         double               mGain;         ///< Current gain (has no effect on the images)
         QString              mCurrentMode;  ///< Currently set camera mode
+
+        /*** Synthetic streaming ***/
+        int                  mSyntheticFrameRate;   ///< Frames per second, 0 disables the mode
+        int                  mSyntheticBlurLevels;  ///< Number of Z positions blurred in advance
+        QVector<QImage>      mBlurLevels;           ///< Scene blurred with window 2 * i + 1
+        QPointF              mSyntheticOffset;      ///< Last stage position received
+        double               mSyntheticZOffset;     ///< Last Z position received
+        quint64              mNextFrameTime;        ///< Capture time of the next synthetic frame
+        int                  mSyntheticTimerID;     ///< Timer driving the synthetic frames
+        quint32              mNoiseState[4];        ///< See copyWithNoise()
     };
 }
 #endif /* _DummyCamera_H__ */
@@ -9,20 +9,27 @@
 
 #include "DummyMicroscope.h"
 
-#include <cmath>
 #include <QApplication>
+#include <QSettings>
 
 #include "DummyStage.h"
 #include "Logger.h"
-#include "TMath.h"
+#include "PathConfig.h"
+#include "ThreadProfile.h"
 
 namespace tracker
 {
     DummyMicroscope::DummyMicroscope(DummyStage* stage)
         : mStage(stage)
+        , mVirtualTime(0)
     {
         connect(mStage, SIGNAL(stageMovedXY(QPointF)), SLOT(moveStageXY(QPointF)));
         connect(mStage, SIGNAL(stageMovedZ(double)), SLOT(moveStageZ(double)));
+
+        QSettings settings(PathConfig::getConfigFilename(), QSettings::IniFormat);
+        settings.beginGroup("DummyMicroscope");
+        mModel.readSettings(settings);
+        settings.endGroup();
     }
 
     DummyMicroscope::~DummyMicroscope()
@@ -31,13 +38,10 @@ namespace tracker
 
     void DummyMicroscope::run(Thread* thread)
     {
-        mVirtualTime     = 0.0;
-        mFlexCellOffset  = QPointF(0.0, 0.0);
-        mFlexCellZOffset = 0.0;
-        mStageOffset     = QPointF(0.0, 0.0);
-        mZStageOffset    = 0.0;
-        mStageCommands.clear();
-        mZStageCommands.clear();
+        applyThreadProfile("Microscope");
+
+        mVirtualTime = 0;
+        mModel.reset(mVirtualTime);
 
         // Start timer
         this->startTimer(msDeltaTime/*ms*/);
@@ -50,45 +54,19 @@ namespace tracker
 
     void DummyMicroscope::timerEvent(QTimerEvent* event)
     {
-        mVirtualTime += msDeltaTime / 1000.0;
-
-        // Apply all stage commands with a delay
-        while (!mStageCommands.isEmpty() && mStageCommands.first().second < mVirtualTime)
-        {
-            mStageOffset += mStageCommands.takeFirst().first;
-        }
-        //TRACKER_INFO("stage offset: " + QString::number(mStageOffset.x()) + ", " + QString::number(mStageOffset.y()));
-
-        // Apply all Z stage commands with a delay
-        while (!mZStageCommands.isEmpty() && mZStageCommands.first().second < mVirtualTime)
-        {
-            mZStageOffset += mZStageCommands.takeFirst().first;
-        }
-
-        const double radius = 40.0;
-        const double omega  = math::pi; // 0.5 Hz
-
-        // Move the virtual FlexCell in a circle
-        double x = radius * std::cos(omega * mVirtualTime);
-        double y = radius * std::sin(omega * mVirtualTime);
-        //mFlexCellOffset = QPointF(x, y);
-
-        // Move the virtual FlexCell up and down
-        const double step = 20.0;
-        const double theta = math::pi * 0.5; // 0.25 Hz
-        double z = step * std::cos(theta * mVirtualTime);
-        //mFlexCellZOffset = z;
-
-        emit offsetChanged(mStageOffset + mFlexCellOffset, mZStageOffset + mFlexCellZOffset, mClock.getTime());
+        mVirtualTime += msDeltaTime * 1000;
+        mModel.advance(mVirtualTime);
+
+        emit offsetChanged(mModel.getImageOffset(), mModel.getZOffset(), mClock.getTime());
     }
 
     void DummyMicroscope::moveStageXY(QPointF distance)
     {
-        mStageCommands.append(qMakePair(distance, mVirtualTime + msStageDelay / 1000.0));
+        mModel.moveStageXY(distance, mVirtualTime);
     }
 
     void DummyMicroscope::moveStageZ(double distance)
     {
-        mZStageCommands.append(qMakePair(distance, mVirtualTime + msStageDelay / 1000.0));
+        mModel.moveStageZ(distance, mVirtualTime);
     }
 }
@@ -13,32 +13,43 @@
 #include "TrackerPrereqs.h"
 
 #include <QImage>
-#include <QList>
-#include <QPair>
 #include "Thread.h"
 #include "Timing.h"
+#include "MicroscopeModel.h"
 
 namespace tracker
 {
     /** Manages the DummyStage and DummyCamera objects so that the desired
         behaviour can be simulated.
-        Two virtual mechanisms are implemented: delay for stage movements and
-        some sinusoidal flex cell movements. The noise effect is implemented in
-        DummyCamera.
+        The stage and flex cell physics are a MicroscopeModel that is
+        advanced in steps of msDeltaTime by a timer. The noise effect is
+        implemented in DummyCamera.
+    @par Circular motion
+        The [DummyMicroscope] group of the ini file can move the flex cell on
+        a circle, a known trajectory to compare the Controller's
+        \ref Controller::setMotionPredictor() "motion predictors" on
+        (Circular_Motion, Circle_Radius, Circle_Frequency_[Hz]). The stage
+        latency, jitter and dynamics and the pressure drift are configured in
+        the same group, see MicroscopeModel.
     @note
-        Like the DummyCamera, all the configuration values are hard coded
-        because this class is meant for deployment!
+        The time of the model runs with the wall clock here, use the closed
+        loop simulator (tools/ClosedLoopSimulator.cc) for runs in virtual
+        time.
     */
     class DummyMicroscope : public Runnable
     {
         Q_OBJECT;
 
     public:
-        /// Connects mStage->moved() to moveStage()
+        /// Connects mStage->moved() to moveStage() and reads the settings
         DummyMicroscope(DummyStage* stage);
         /// Does nothing
         ~DummyMicroscope();
 
+        /// Returns the physics to configure them further (only before the thread is started)
+        MicroscopeModel& getModel()
+            { return mModel; }
+
     signals:
         /** Signal for the DummyCamera to make a new image.
         @param offset
@@ -63,17 +74,10 @@ namespace tracker
 
         HPClock mClock;
         DummyStage* mStage;         ///< pointer to the virtual stage
-        double  mVirtualTime;       ///< Absolute time
-        QPointF mFlexCellOffset;    ///< Position of the membrane
-        double  mFlexCellZOffset;
-        QPointF mStageOffset;       ///< Position of the stage
-        double  mZStageOffset;
-        QList<QPair<QPointF, double> > mStageCommands; ///< Helper queue for simulated stage delays
-        QList<QPair<double, double> >  mZStageCommands;
+        quint64 mVirtualTime;       ///< Time of the model in microseconds
+        MicroscopeModel mModel;     ///< Stage, flex cell and focus
 
         static const int msDeltaTime  = 20/*ms*/;   ///< Reciprocal of the update frequency
-        static const int msStageDelay = 50/*ms*/;   ///< Virtual stage command delay
-        static const int msZStageDelay = 50; /*ms*/
     };
 }
 #endif /* _DummyMicroscope_H__ */
@@ -0,0 +1,179 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "DummyStackSource.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QStringList>
+
+#include "Logger.h"
+#include "PixelKernels.h"
+
+namespace tracker
+{
+    //! Prepares one image on the worker thread
+    class DummyStackSource::ReadAhead : public QRunnable
+    {
+    public:
+        ReadAhead(DummyStackSource* source, int index)
+            : mSource(source)
+            , mIndex(index)
+            { }
+
+        void run()
+            { mSource->finishReadAhead(mIndex, mSource->decode(mIndex)); }
+
+    private:
+        DummyStackSource*   mSource;
+        int                 mIndex;
+    };
+
+    DummyStackSource::DummyStackSource(int readAhead)
+        : mLastIndex(-1)
+        , mReadAhead(qMax(0, readAhead))
+    {
+        mPool.setMaxThreadCount(1);
+    }
+
+    DummyStackSource::~DummyStackSource()
+    {
+        mPool.waitForDone();
+        // The cached images point into the mapping
+        mCache.clear();
+        mReader.close();
+    }
+
+    bool DummyStackSource::open(const QString& filename, double stepSize)
+    {
+        if (!mReader.open(filename))
+            return false;
+
+        const int count = mReader.getFrameCount();
+        mZPositions.resize(count);
+        bool ascending = count > 1;
+        for (int i = 0; i < count; ++i)
+        {
+            mZPositions[i] = mReader.getInfo(i).z;
+            if (i > 0 && mZPositions[i] <= mZPositions[i - 1])
+                ascending = false;
+        }
+        if (!ascending)
+        {
+            if (count > 1 && mZPositions.first() != mZPositions.last())
+                TRACKER_WARNING("DummyCamera: Stack Z positions not ascending, using the image order instead");
+            for (int i = 0; i < count; ++i)
+                mZPositions[i] = (i - count / 2) * stepSize;
+        }
+
+        TRACKER_INFO("DummyCamera: Using " + QString::number(count) + " stack images from '" + filename + "'", Logger::Low);
+        return true;
+    }
+
+    QImage DummyStackSource::getFrame(int index)
+    {
+        QImage image;
+        {
+            QMutexLocker lock(&mMutex);
+            image = mCache.value(index);
+        }
+        if (image.isNull())
+            image = this->decode(index);
+
+        QMutexLocker lock(&mMutex);
+        const int direction = index < mLastIndex ? -1 : 1;
+        mLastIndex = index;
+        mCache[index] = image;
+
+        // Forget what is behind, prepare what is ahead
+        QMap<int, QImage>::iterator it = mCache.begin();
+        while (it != mCache.end())
+        {
+            if (qAbs(it.key() - index) > mReadAhead)
+                it = mCache.erase(it);
+            else
+                ++it;
+        }
+        for (int i = 1; i <= mReadAhead; ++i)
+        {
+            const int next = index + direction * i;
+            if (next < 0 || next >= mZPositions.size() || mCache.contains(next) || mPending.contains(next))
+                continue;
+            mPending.insert(next);
+            mPool.start(new ReadAhead(this, next));
+        }
+        return image;
+    }
+
+    void DummyStackSource::finishReadAhead(int index, const QImage& image)
+    {
+        QMutexLocker lock(&mMutex);
+        mPending.remove(index);
+        // The focus may have moved on in the meantime
+        if (qAbs(index - mLastIndex) <= mReadAhead)
+            mCache[index] = image;
+    }
+
+    QImage DummyStackSource::decode(int index) const
+    {
+        QSize size;
+        int bytesPerLine;
+        bool mono16;
+        const uchar* data = mReader.getData(index, &size, &bytesPerLine, &mono16);
+        if (data && !mono16)
+        {
+            // Touch every page, that is where the disk is read for a mapping
+            volatile uchar sink = 0;
+            const qint64 byteCount = (qint64)bytesPerLine * size.height();
+            for (qint64 i = 0; i < byteCount; i += 4096)
+                sink = sink + data[i];
+
+            // The DummyCamera only reads the lines, no colour table required
+            return QImage(data, size.width(), size.height(), bytesPerLine, QImage::Format_Indexed8);
+        }
+        return toDisplayImage(mReader.getImage(index));
+    }
+
+    /*static*/ bool DummyStackSource::createFromDirectory(const QString& directory, const QString& filename, double stepSize)
+    {
+        QDir dir(directory);
+        QStringList files = dir.entryList(QStringList("*.png"), QDir::Files | QDir::NoSymLinks, QDir::Name);
+        if (files.isEmpty())
+            return false;
+
+        TRACKER_INFO("DummyCamera: Converting " + QString::number(files.size()) + " images in '"
+                     + directory + "' to '" + filename + "' (only done once)");
+        StackFileWriter writer;
+        if (!writer.open(filename))
+            return false;
+        for (int i = 0; i < files.size(); ++i)
+        {
+            QImage image(dir.filePath(files[i]));
+            if (image.isNull())
+            {
+                TRACKER_WARNING("Failed to load image " + files[i]);
+                continue;
+            }
+            image = image.convertToFormat(QImage::Format_Indexed8, getGreyColourTable());
+
+            StackFrameInfo info = { 0.0, 0.0, (i - files.size() / 2) * stepSize, 0.0, 1.0, 0.0, 0, 0 };
+            if (!writer.append(image, info))
+            {
+                writer.close();
+                QFile::remove(filename);
+                return false;
+            }
+        }
+        writer.close();
+        return true;
+    }
+}
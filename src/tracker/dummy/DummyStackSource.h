@@ -0,0 +1,92 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _DummyStackSource_H__
+#define _DummyStackSource_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QImage>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+
+#include "StackFile.h"
+
+namespace tracker
+{
+    /** Z-stack images for the DummyCamera, read from a stack file (see
+        StackFile.h) on demand.
+        Opening only maps the file and reads the frame headers, so it takes
+        the same time for 10 or 10000 images, and stacks larger than the RAM
+        work as well. Uncompressed 8 bit frames are used in place in the
+        mapping, other frames are decoded when first needed.
+    @par Read-ahead
+        After every getFrame(), the next few frames in the direction the
+        focus is moving are decoded (or their pages touched) on a worker
+        thread, so a Z sweep rarely waits for the disk.
+    @par Thread safety
+        getFrame() may only be called from one thread at a time.
+    */
+    class DummyStackSource
+    {
+    public:
+        /// @param readAhead Number of frames prepared in advance
+        DummyStackSource(int readAhead);
+        /// Waits for the read-ahead and closes the file
+        ~DummyStackSource();
+
+        /** Opens a stack file. The Z positions are taken from the frames,
+            unless they are not ascending (then \c stepSize apart, middle
+            frame at 0).
+        */
+        bool open(const QString& filename, double stepSize);
+
+        /// Returns the number of images (0 if not open)
+        int getFrameCount() const
+            { return mZPositions.size(); }
+        /// Returns the Z position of every image (ascending)
+        const QVector<double>& getZPositions() const
+            { return mZPositions; }
+
+        /// Returns image \c index as 8 bit grey image, valid while the source is open
+        QImage getFrame(int index);
+
+        /** Writes all PNG files in \c directory (sorted by name) to a new
+            stack file. Used once to convert the old "zstack" directories.
+        */
+        static bool createFromDirectory(const QString& directory, const QString& filename, double stepSize);
+
+    private:
+        Q_DISABLE_COPY(DummyStackSource);
+
+        class ReadAhead;
+        friend class ReadAhead;
+
+        /// Prepares one image (any thread)
+        QImage decode(int index) const;
+        /// Called by ReadAhead when an image is ready
+        void finishReadAhead(int index, const QImage& image);
+
+        StackFileReader     mReader;
+        QVector<double>     mZPositions;
+        QThreadPool         mPool;          ///< Read-ahead worker
+
+        QMutex              mMutex;         ///< Protects the members below
+        QMap<int, QImage>   mCache;         ///< Images around mLastIndex
+        QSet<int>           mPending;       ///< Images being prepared by the worker
+        int                 mLastIndex;     ///< Index of the last getFrame()
+        int                 mReadAhead;     ///< See constructor
+    };
+}
+
+#endif /* _DummyStackSource_H__ */
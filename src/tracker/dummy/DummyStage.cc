@@ -36,22 +36,33 @@ namespace tracker
 
     bool DummyStage::move(QPointF distance, int)
     {
-        mPosXY += distance;
+        {
+            QMutexLocker lock(&mMutex);
+            mPosXY += distance;
+        }
+        // Not locked, the receivers may query the stage
         emit stageMovedXY(distance);
         return true;
     }
 
     bool DummyStage::moveZ(double distance, int)
     {
-        mPosZ += distance;
+        {
+            QMutexLocker lock(&mMutex);
+            mPosZ += distance;
+        }
         emit stageMovedZ(distance);
         return true;
     }
 
     bool DummyStage::moveToZ(double zPos, int)
     {
-        double distance = zPos - mPosZ;
-        mPosZ = zPos;
+        double distance;
+        {
+            QMutexLocker lock(&mMutex);
+            distance = zPos - mPosZ;
+            mPosZ = zPos;
+        }
         emit stageMovedZ(distance);
         return true;
     }
@@ -13,6 +13,8 @@
 
 #include "TrackerPrereqs.h"
 
+#include <QMutexLocker>
+
 #include "Stage.h"
 
 namespace tracker
@@ -39,11 +41,11 @@ namespace tracker
         bool moveToZ(double zPos, int block = 0);
 
         double getZpos()
-            { return mPosZ; }
+            { QMutexLocker lock(&mMutex); return mPosZ; }
         double getXpos()
-            { return mPosXY.x(); }
+            { QMutexLocker lock(&mMutex); return mPosXY.x(); }
         double getYpos()
-            { return mPosXY.y(); }
+            { QMutexLocker lock(&mMutex); return mPosXY.y(); }
 
         void clearZlimits();
 
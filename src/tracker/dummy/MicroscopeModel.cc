@@ -0,0 +1,178 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "MicroscopeModel.h"
+
+#include <cmath>
+#include <QSettings>
+
+#include "TMath.h"
+
+namespace tracker
+{
+    //! Longest integration step in microseconds
+    static const quint64 sMaxStep = 1000;
+
+    MicroscopeModel::MicroscopeModel()
+        : mCircularMotion(false)
+        , mCircleRadius(40.0)
+        , mCircleFrequency(0.5)
+        , mLatency(50.0)
+        , mLatencyJitter(0.0)
+        , mMaxVelocity(0.0)
+        , mSettlingTime(0.0)
+        , mPressureStep(0.0)
+        , mPressureInterval(5.0)
+        , mZDrift(0.0)
+        , mDriftTime(1.0)
+        , mSeed(1)
+    {
+        this->reset(0);
+    }
+
+    void MicroscopeModel::readSettings(QSettings& settings)
+    {
+        mCircularMotion   = settings.value("Circular_Motion",            mCircularMotion).toBool();
+        mCircleRadius     = settings.value("Circle_Radius",              mCircleRadius).toDouble();
+        mCircleFrequency  = settings.value("Circle_Frequency_[Hz]",      mCircleFrequency).toDouble();
+        mLatency          = qMax(0.0, settings.value("Stage_Latency_[ms]",        mLatency).toDouble());
+        mLatencyJitter    = qMax(0.0, settings.value("Stage_Latency_Jitter_[ms]", mLatencyJitter).toDouble());
+        mMaxVelocity      = qMax(0.0, settings.value("Stage_Max_Velocity",        mMaxVelocity).toDouble());
+        mSettlingTime     = qMax(0.0, settings.value("Stage_Settling_Time_[ms]",  mSettlingTime).toDouble());
+        mPressureStep     = settings.value("Pressure_Step_[kPa]",        mPressureStep).toDouble();
+        mPressureInterval = qMax(0.0, settings.value("Pressure_Step_Interval_[s]", mPressureInterval).toDouble());
+        mZDrift           = settings.value("Pressure_Z_Drift_[um/kPa]",  mZDrift).toDouble();
+        mDriftTime        = qMax(0.0, settings.value("Pressure_Drift_Time_[s]",   mDriftTime).toDouble());
+        mSeed             = settings.value("Random_Seed",                mSeed).toUInt();
+    }
+
+    void MicroscopeModel::reset(quint64 time)
+    {
+        mTime            = time;
+        mStartTime       = time;
+        mStagePosition   = QPointF(0.0, 0.0);
+        mStageTarget     = QPointF(0.0, 0.0);
+        mZStagePosition  = 0.0;
+        mSamplePosition  = QPointF(0.0, 0.0);
+        mSampleZ         = 0.0;
+        mPressure        = 0.0;
+        mLastCommandTime = 0;
+        mCommands.clear();
+        mZCommands.clear();
+        // Xorshift must not start at zero
+        mRandomState     = mSeed != 0 ? mSeed : 1;
+    }
+
+    void MicroscopeModel::advance(quint64 time)
+    {
+        while (mTime < time)
+        {
+            const quint64 next = qMin(time, mTime + sMaxStep);
+            this->step(next, (double)(next - mTime));
+            mTime = next;
+        }
+    }
+
+    void MicroscopeModel::step(quint64 time, double dt)
+    {
+        // Commands whose latency has passed
+        while (!mCommands.isEmpty() && mCommands.first().first <= time)
+            mStageTarget += mCommands.takeFirst().second;
+        while (!mZCommands.isEmpty() && mZCommands.first().first <= time)
+            mZStagePosition += mZCommands.takeFirst().second;
+
+        // Settle towards the target, limited by the velocity
+        QPointF delta = mStageTarget - mStagePosition;
+        if (mSettlingTime > 0.0)
+            delta *= 1.0 - std::exp(-dt / (mSettlingTime * 1000.0));
+        if (mMaxVelocity > 0.0)
+        {
+            const double maxDistance = mMaxVelocity * dt / 1e6;
+            const double distance = std::sqrt(delta.x() * delta.x() + delta.y() * delta.y());
+            if (distance > maxDistance)
+                delta *= maxDistance / distance;
+        }
+        mStagePosition += delta;
+
+        const double t = (time - mStartTime) / 1e6;
+
+        // Flex cell on a circle (starting at the origin)
+        if (mCircularMotion)
+        {
+            const double omega = 2.0 * math::pi * mCircleFrequency;
+            mSamplePosition = QPointF(mCircleRadius * (std::cos(omega * t) - 1.0),
+                                      mCircleRadius * std::sin(omega * t));
+        }
+
+        // Pressure alternates between 0 and the step, the sample follows in Z with a delay
+        if (mPressureStep != 0.0 && mPressureInterval > 0.0)
+            mPressure = ((qint64)(t / mPressureInterval) % 2) ? mPressureStep : 0.0;
+        const double zTarget = mPressure * mZDrift;
+        if (mDriftTime > 0.0)
+            mSampleZ += (zTarget - mSampleZ) * (1.0 - std::exp(-dt / (mDriftTime * 1e6)));
+        else
+            mSampleZ = zTarget;
+    }
+
+    quint64 MicroscopeModel::nextLatency()
+    {
+        mRandomState ^= mRandomState << 13;
+        mRandomState ^= mRandomState >> 17;
+        mRandomState ^= mRandomState << 5;
+        const double uniform = mRandomState / 4294967296.0 * 2.0 - 1.0;
+        return (quint64)(qMax(0.0, mLatency + uniform * mLatencyJitter) * 1000.0);
+    }
+
+    void MicroscopeModel::moveStageXY(QPointF distance, quint64 time)
+    {
+        // A stage executes its commands in order, whatever the jitter
+        mLastCommandTime = qMax(time + this->nextLatency(), mLastCommandTime);
+        mCommands.append(qMakePair(mLastCommandTime, distance));
+    }
+
+    void MicroscopeModel::moveStageZ(double distance, quint64 time)
+    {
+        mZCommands.append(qMakePair(time + (quint64)(mLatency * 1000.0), distance));
+    }
+
+    bool MicroscopeModel::isStageMovingXY() const
+    {
+        const QPointF delta = mStageTarget - mStagePosition;
+        return !mCommands.isEmpty() || qAbs(delta.x()) > 1e-3 || qAbs(delta.y()) > 1e-3;
+    }
+
+    void MicroscopeModel::setCircularMotion(double radius, double frequency)
+    {
+        mCircularMotion  = radius != 0.0;
+        mCircleRadius    = radius;
+        mCircleFrequency = frequency;
+    }
+
+    void MicroscopeModel::setStageLatency(double latency, double jitter)
+    {
+        mLatency       = qMax(0.0, latency);
+        mLatencyJitter = qMax(0.0, jitter);
+    }
+
+    void MicroscopeModel::setStageDynamics(double maxVelocity, double settlingTime)
+    {
+        if (maxVelocity >= 0.0)
+            mMaxVelocity = maxVelocity;
+        if (settlingTime >= 0.0)
+            mSettlingTime = settlingTime;
+    }
+
+    void MicroscopeModel::setPressureDrift(double step, double interval, double drift)
+    {
+        mPressureStep     = step;
+        mPressureInterval = qMax(0.0, interval);
+        mZDrift           = drift;
+    }
+}
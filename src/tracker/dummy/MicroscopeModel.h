@@ -0,0 +1,134 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _MicroscopeModel_H__
+#define _MicroscopeModel_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QList>
+#include <QPair>
+#include <QPointF>
+
+class QSettings;
+
+namespace tracker
+{
+    /** Physics of the dummy devices: the stage, the flex cell and the focus.
+        All times are given by the caller (microseconds), the model has no
+        clock of its own. The DummyMicroscope feeds it from a timer, the
+        closed loop simulator (tools/ClosedLoopSimulator.cc) from a virtual
+        clock, which makes a simulation deterministic and independent of the
+        CPU speed.
+    @par Stage
+        A command takes effect after the latency (plus a uniform random
+        jitter, commands are never reordered). The stage then approaches its
+        target exponentially with the settling time as time constant, but
+        never faster than the maximum velocity. A settling time and velocity
+        of 0 make the stage jump.
+    @par Sample
+        The flex cell can move on a circle (see DummyMicroscope). Pressure
+        steps of alternating sign inflate and deflate the membrane, the
+        sample then drifts in Z towards pressure * drift factor.
+    @par Coordinates
+        getImageOffset() is what the camera sees: stage position plus sample
+        position. A perfect tracker keeps it at (0, 0).
+    @par Settings
+        Read from the group opened by the caller (usually [DummyMicroscope]):
+         - \c Circular_Motion, \c Circle_Radius, \c Circle_Frequency_[Hz]
+         - \c Stage_Latency_[ms] (default: 50), \c Stage_Latency_Jitter_[ms] (0)
+         - \c Stage_Max_Velocity in stage units per second (0: unlimited)
+         - \c Stage_Settling_Time_[ms] (0)
+         - \c Pressure_Step_[kPa] (0: off), \c Pressure_Step_Interval_[s] (5)
+         - \c Pressure_Z_Drift_[um/kPa] (0), \c Pressure_Drift_Time_[s] (1)
+         - \c Random_Seed for the jitter (1)
+    */
+    class MicroscopeModel
+    {
+    public:
+        MicroscopeModel();
+
+        /// Reads the settings from the current group of @a settings
+        void readSettings(QSettings& settings);
+
+        /// Puts stage and sample back to the origin at @a time
+        void reset(quint64 time);
+
+        /// Integrates the model up to @a time (earlier times are ignored)
+        void advance(quint64 time);
+
+        /// Issues a relative XY stage move at @a time
+        void moveStageXY(QPointF distance, quint64 time);
+        /// Issues a relative Z stage move at @a time
+        void moveStageZ(double distance, quint64 time);
+
+        /// Returns the offset of the sample on the image (stage units)
+        QPointF getImageOffset() const
+            { return mStagePosition + mSamplePosition; }
+        /// Returns the distance of the sample from the focal plane (micrometers)
+        double getZOffset() const
+            { return mZStagePosition + mSampleZ; }
+        /// Returns the current stage position
+        QPointF getStagePosition() const
+            { return mStagePosition; }
+        /// Returns the pressure currently applied (kPa)
+        double getPressure() const
+            { return mPressure; }
+        /// Tells whether a command is pending or the stage has not arrived yet
+        bool isStageMovingXY() const;
+
+        /// Moves the flex cell on a circle (a radius of 0 disables it)
+        void setCircularMotion(double radius, double frequency);
+        /// Sets the command latency and its jitter in milliseconds
+        void setStageLatency(double latency, double jitter);
+        /** Sets the stage velocity limit (units/s, 0: unlimited) and settling
+            time constant (ms). A negative value keeps the current setting.
+        */
+        void setStageDynamics(double maxVelocity, double settlingTime);
+        /// Sets the pressure steps (kPa, 0: off), their interval (s) and the Z drift (um/kPa)
+        void setPressureDrift(double step, double interval, double drift);
+
+    private:
+        /// Moves the state forward by @a dt microseconds
+        void step(quint64 time, double dt);
+        /// Returns the latency of the next command in microseconds
+        quint64 nextLatency();
+
+        /*** State ***/
+        quint64                 mTime;              ///< Time of the last advance()
+        quint64                 mStartTime;         ///< Time of the last reset()
+        QPointF                 mStagePosition;
+        QPointF                 mStageTarget;       ///< Position after all active commands
+        double                  mZStagePosition;
+        QPointF                 mSamplePosition;
+        double                  mSampleZ;
+        double                  mPressure;          ///< kPa
+        quint64                 mLastCommandTime;   ///< Keeps the commands in order
+        QList<QPair<quint64, QPointF> > mCommands;  ///< Pending XY moves with their activation time
+        QList<QPair<quint64, double> >  mZCommands; ///< Pending Z moves with their activation time
+        quint32                 mRandomState;       ///< Xorshift state for the jitter
+
+        /*** Settings ***/
+        bool                    mCircularMotion;
+        double                  mCircleRadius;      ///< Stage units
+        double                  mCircleFrequency;   ///< Revolutions per second
+        double                  mLatency;           ///< Milliseconds
+        double                  mLatencyJitter;     ///< Milliseconds
+        double                  mMaxVelocity;       ///< Stage units per second
+        double                  mSettlingTime;      ///< Milliseconds
+        double                  mPressureStep;      ///< kPa
+        double                  mPressureInterval;  ///< Seconds
+        double                  mZDrift;            ///< Micrometers per kPa
+        double                  mDriftTime;         ///< Seconds
+        quint32                 mSeed;
+    };
+}
+
+#endif /* _MicroscopeModel_H__ */
@@ -0,0 +1,356 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#include "SessionBenchmark.h"
+
+#include <algorithm>
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QSettings>
+#include <QTimer>
+
+#include "Controller.h"
+#include "DummyCamera.h"
+#include "DummyMicroscope.h"
+#include "DummyStage.h"
+#include "Exception.h"
+#include "Logger.h"
+#include "PathConfig.h"
+#include "Thread.h"
+#include "Timing.h"
+
+namespace tracker
+{
+    SessionFrameCounter::SessionFrameCounter(int frames)
+        : mCount(0)
+        , mFrames(frames)
+    {
+    }
+
+    void SessionFrameCounter::countFrame(const QImage, quint64, quint64)
+    {
+        if (mCount.fetchAndAddOrdered(1) + 1 == mFrames)
+            emit finished();
+    }
+
+    namespace
+    {
+        //! Measured values of one session, also the format of a baseline
+        struct SessionResults
+        {
+            int     frames;             //!< Requested number of frames
+            int     frameRate;          //!< Requested synthetic frame rate
+            QString mode;               //!< Camera mode
+            int     capturedFrames;
+            quint64 receivedFrames;     //!< Images that reached Controller::trackImage()
+            quint64 droppedFrames;      //!< Images older than the maximum process delay
+            double  sustainedFrameRate; //!< Images tracked per second
+            int     stageCommands;
+            quint32 latency50;          //!< Capture to Stage::move() in microseconds
+            quint32 latency90;
+            quint32 latency99;
+            quint32 latencyMax;
+
+            double getDropRatio() const
+                { return receivedFrames == 0 ? 0.0 : (double)droppedFrames / receivedFrames; }
+        };
+
+        void writeResults(const QString& filename, const SessionResults& results)
+        {
+            QFile::remove(filename);
+            QSettings settings(filename, QSettings::IniFormat);
+            settings.beginGroup("SessionBenchmark");
+            settings.setValue("Frames",                      results.frames);
+            settings.setValue("Frame_Rate_[fps]",            results.frameRate);
+            settings.setValue("Camera_Mode",                 results.mode);
+            settings.setValue("Captured_Frames",             results.capturedFrames);
+            settings.setValue("Received_Frames",             results.receivedFrames);
+            settings.setValue("Dropped_Frames",              results.droppedFrames);
+            settings.setValue("Sustained_Frame_Rate_[fps]",  results.sustainedFrameRate);
+            settings.setValue("Stage_Commands",              results.stageCommands);
+            settings.setValue("Latency_P50_[us]",            results.latency50);
+            settings.setValue("Latency_P90_[us]",            results.latency90);
+            settings.setValue("Latency_P99_[us]",            results.latency99);
+            settings.setValue("Latency_Max_[us]",            results.latencyMax);
+            settings.endGroup();
+        }
+
+        bool readResults(const QString& filename, SessionResults* results)
+        {
+            if (!QFile::exists(filename))
+                return false;
+            QSettings settings(filename, QSettings::IniFormat);
+            settings.beginGroup("SessionBenchmark");
+            results->frames             = settings.value("Frames",                     0).toInt();
+            results->frameRate          = settings.value("Frame_Rate_[fps]",           0).toInt();
+            results->mode               = settings.value("Camera_Mode",                "").toString();
+            results->capturedFrames     = settings.value("Captured_Frames",            0).toInt();
+            results->receivedFrames     = settings.value("Received_Frames",            0).toULongLong();
+            results->droppedFrames      = settings.value("Dropped_Frames",             0).toULongLong();
+            results->sustainedFrameRate = settings.value("Sustained_Frame_Rate_[fps]", 0.0).toDouble();
+            results->stageCommands      = settings.value("Stage_Commands",             0).toInt();
+            results->latency50          = settings.value("Latency_P50_[us]",           0).toUInt();
+            results->latency90          = settings.value("Latency_P90_[us]",           0).toUInt();
+            results->latency99          = settings.value("Latency_P99_[us]",           0).toUInt();
+            results->latencyMax         = settings.value("Latency_Max_[us]",           0).toUInt();
+            settings.endGroup();
+            return results->frames > 0;
+        }
+
+        /** Compares with a baseline and logs every regression.
+        @return
+            Number of regressions
+        */
+        int compareResults(const SessionResults& baseline, const SessionResults& results,
+                           double threshold, double dropTolerance)
+        {
+            int regressions = 0;
+            const double factor = threshold / 100.0;
+
+            if (results.sustainedFrameRate < baseline.sustainedFrameRate * (1.0 - factor))
+            {
+                TRACKER_WARNING(QString("Session benchmark: frame rate %1 fps, baseline %2 fps")
+                    .arg(results.sustainedFrameRate, 0, 'f', 1).arg(baseline.sustainedFrameRate, 0, 'f', 1));
+                ++regressions;
+            }
+            if (results.getDropRatio() > baseline.getDropRatio() + dropTolerance / 100.0)
+            {
+                TRACKER_WARNING(QString("Session benchmark: %1 % dropped frames, baseline %2 %")
+                    .arg(results.getDropRatio() * 100.0, 0, 'f', 2).arg(baseline.getDropRatio() * 100.0, 0, 'f', 2));
+                ++regressions;
+            }
+
+            // The maximum is a single sample and too noisy to fail on
+            const char* names[] = { "P50", "P90", "P99" };
+            const quint32 values[] = { results.latency50, results.latency90, results.latency99 };
+            const quint32 baselineValues[] = { baseline.latency50, baseline.latency90, baseline.latency99 };
+            for (int i = 0; i < 3; ++i)
+            {
+                if (values[i] > baselineValues[i] * (1.0 + factor))
+                {
+                    TRACKER_WARNING(QString("Session benchmark: latency %1 %2 us, baseline %3 us")
+                        .arg(names[i]).arg(values[i]).arg(baselineValues[i]));
+                    ++regressions;
+                }
+            }
+            return regressions;
+        }
+
+        //! Returns the p-th percentile of sorted @a values
+        quint32 percentile(const QVector<quint32>& values, int p)
+        {
+            if (values.isEmpty())
+                return 0;
+            return values[qMin(values.size() - 1, values.size() * p / 100)];
+        }
+
+        //! Lets the GUI thread deliver events until @a condition returns true or @a timeout (us) has passed
+        template <class Condition>
+        bool waitFor(Condition condition, quint64 timeout)
+        {
+            HPClock clock;
+            const quint64 end = clock.getTime() + timeout;
+            while (!condition())
+            {
+                if (clock.getTime() > end)
+                    return false;
+                QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+                usleep(10000);
+            }
+            return true;
+        }
+
+        struct ControllerValid
+        {
+            ControllerValid(const Controller& controller) : mController(controller) { }
+            bool operator()() const { return mController.valid(); }
+            const Controller& mController;
+        };
+    }
+
+    int runSessionBenchmark(const QStringList& arguments)
+    {
+        // Options
+        int frames = 5000;
+        int frameRate = 500;
+        QString mode = "640x480";
+        double radius = 40.0;
+        double frequency = 0.5;
+        QString resultsFilename = PathConfig::getLogPath().path() + "/session_benchmark.ini";
+        QString baselineFilename;
+        double threshold = 10.0;
+        double dropTolerance = 0.5;
+        for (int i = 0; i + 1 < arguments.size(); i += 2)
+        {
+            const QString& option = arguments[i];
+            const QString& value = arguments[i + 1];
+            if (option == "--frames")
+                frames = qMax(1, value.toInt());
+            else if (option == "--fps")
+                frameRate = qMax(1, value.toInt());
+            else if (option == "--mode")
+                mode = value;
+            else if (option == "--circle" && value.split(',').size() == 2)
+            {
+                radius = value.split(',')[0].toDouble();
+                frequency = value.split(',')[1].toDouble();
+            }
+            else if (option == "--results")
+                resultsFilename = value;
+            else if (option == "--baseline")
+                baselineFilename = value;
+            else if (option == "--threshold")
+                threshold = value.toDouble();
+            else if (option == "--drop-tolerance")
+                dropTolerance = value.toDouble();
+            else
+            {
+                TRACKER_WARNING("Session benchmark: invalid option " + option + " " + value);
+                return 2;
+            }
+        }
+
+        SessionResults baseline;
+        if (!baselineFilename.isEmpty() && !readResults(baselineFilename, &baseline))
+        {
+            TRACKER_WARNING("Session benchmark: could not read the baseline " + baselineFilename);
+            return 2;
+        }
+
+        // The devices, connected like in MainWindow
+        DummyCamera camera;
+        if (!camera.hasMode(mode))
+        {
+            TRACKER_WARNING("Session benchmark: unknown camera mode " + mode);
+            return 2;
+        }
+        QVector<QPair<QString, QSize> > modes;
+        foreach (QString modeName, camera.getAvailableModes())
+            modes.append(qMakePair(camera.getName() + "__sep__" + modeName, camera.getImageSize(modeName)));
+
+        Controller controller(modes);
+        // Child of the Controller so that both live in the same thread
+        DummyStage* stage = static_cast<DummyStage*>(Stage::makeStage(&controller));
+        DummyMicroscope microscope(stage);
+        microscope.getModel().setCircularMotion(radius, frequency);
+
+        Thread cameraThread(&camera, NULL);
+        Thread controllerThread(&controller, NULL);
+        Thread microscopeThread(&microscope, NULL);
+
+        controller.initialise(stage);
+        controller.setOptionsKey(camera.getName() + "__sep__" + mode);
+        camera.setMode(mode);
+        const int savedFrameRate = camera.getSyntheticFrameRate();
+        camera.setSyntheticFrameRate(frameRate);
+
+        // The Correlators are planned in the background
+        if (!waitFor(ControllerValid(controller), 60000000))
+        {
+            TRACKER_WARNING("Session benchmark: the Correlator could not be built");
+            camera.setSyntheticFrameRate(savedFrameRate);
+            return 2;
+        }
+
+        // Tracking of XY only, the log files of the session go to the log directory
+        const QString storagePath = PathConfig::getLogPath().path() + "/session_benchmark";
+        QDir().mkpath(storagePath);
+        controller.setMode(Controller::Tracking);
+        controller.setStorageFilename(storagePath + "/session");
+        controller.setExposureTime(camera.getExposureTime());
+        controller.setXYTrackingEnabled(true);
+        controller.setZStackEnabled(false);
+
+        SessionFrameCounter counter(frames);
+        QObject::connect(&microscope, SIGNAL(offsetChanged(QPointF, double, quint64)),
+                         &camera,     SLOT(makeStackImage(QPointF, double, quint64)));
+        QObject::connect(&camera,     SIGNAL(imageProcessed(QImage, quint64, quint64)),
+                         &controller, SLOT(trackImage(const QImage, quint64, quint64)));
+        QObject::connect(&camera,     SIGNAL(imageProcessed(QImage, quint64, quint64)),
+                         &counter,    SLOT(countFrame(const QImage, quint64, quint64)), Qt::DirectConnection);
+        QEventLoop loop;
+        QObject::connect(&counter, SIGNAL(finished()), &loop, SLOT(quit()));
+
+        TRACKER_INFO(QString("Session benchmark: %1 frames at %2 fps, mode %3").arg(frames).arg(frameRate).arg(mode));
+        microscope.moveToThread(&microscopeThread);
+        microscopeThread.start();
+        controller.moveToThread(&controllerThread);
+        controllerThread.start();
+        camera.moveToThread(&cameraThread);
+        cameraThread.start();
+
+        // Give up if the camera is far slower than requested
+        HPClock clock;
+        const quint64 start = clock.getTime();
+        QTimer::singleShot(qMin(2 * 1000 * frames / frameRate + 10000, 600000), &loop, SLOT(quit()));
+        loop.exec();
+        const double captureDuration = (clock.getTime() - start) / 1e6;
+
+        // Stop the camera first and let the Controller work off the queued images
+        cameraThread.quit();
+        cameraThread.wait();
+        usleep(500000);
+        controllerThread.quit();
+        controllerThread.wait();
+        microscopeThread.quit();
+        microscopeThread.wait();
+        camera.setSyntheticFrameRate(savedFrameRate);
+
+        // Evaluation
+        const Controller::SessionStatistics& statistics = controller.getSessionStatistics();
+        QVector<quint32> latencies = statistics.commandLatencies;
+        std::sort(latencies.begin(), latencies.end());
+
+        SessionResults results;
+        results.frames         = frames;
+        results.frameRate      = frameRate;
+        results.mode           = mode;
+        results.capturedFrames = counter.getCount();
+        results.receivedFrames = statistics.receivedFrames;
+        results.droppedFrames  = statistics.droppedFrames;
+        const quint64 tracked  = statistics.receivedFrames - statistics.droppedFrames;
+        const quint64 span     = statistics.lastFrameTime - statistics.firstFrameTime;
+        results.sustainedFrameRate = tracked > 1 && span > 0 ? (tracked - 1) * 1e6 / span : 0.0;
+        results.stageCommands  = latencies.size();
+        results.latency50      = percentile(latencies, 50);
+        results.latency90      = percentile(latencies, 90);
+        results.latency99      = percentile(latencies, 99);
+        results.latencyMax     = latencies.isEmpty() ? 0 : latencies.last();
+        writeResults(resultsFilename, results);
+
+        TRACKER_INFO(QString("Session benchmark: captured %1 frames in %2 s, Controller received %3, dropped %4, "
+                             "tracked at %5 fps")
+            .arg(results.capturedFrames).arg(captureDuration, 0, 'f', 2).arg(results.receivedFrames)
+            .arg(results.droppedFrames).arg(results.sustainedFrameRate, 0, 'f', 1));
+        TRACKER_INFO(QString("Session benchmark: %1 stage commands, latency P50 %2 us, P90 %3 us, P99 %4 us, max %5 us")
+            .arg(results.stageCommands).arg(results.latency50).arg(results.latency90)
+            .arg(results.latency99).arg(results.latencyMax));
+        TRACKER_INFO("Session benchmark: results written to " + resultsFilename);
+
+        if (results.capturedFrames < frames)
+            TRACKER_WARNING(QString("Session benchmark: the camera only delivered %1 of %2 frames in time")
+                .arg(results.capturedFrames).arg(frames));
+
+        if (baselineFilename.isEmpty())
+            return 0;
+        if (baseline.frames != frames || baseline.frameRate != frameRate || baseline.mode != mode)
+        {
+            TRACKER_WARNING("Session benchmark: the baseline was recorded with other frames, frame rate or mode");
+            return 2;
+        }
+        const int regressions = compareResults(baseline, results, threshold, dropTolerance);
+        if (regressions > 0)
+            return 1;
+        TRACKER_INFO("Session benchmark: no regression against " + baselineFilename);
+        return 0;
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+#ifndef _SessionBenchmark_H__
+#define _SessionBenchmark_H__
+
+#include "TrackerPrereqs.h"
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QObject>
+#include <QStringList>
+
+namespace tracker
+{
+    /** Counts the frames of the camera during a session benchmark and
+        reports when enough have been captured.
+        Connected directly (Qt::DirectConnection) to the camera, so counting
+        costs no event in the GUI thread.
+    */
+    class SessionFrameCounter : public QObject
+    {
+        Q_OBJECT;
+
+    public:
+        /// @param frames Number of frames after which finished() is emitted
+        SessionFrameCounter(int frames);
+
+        /// Frames counted so far
+        int getCount() const
+            { return (int)mCount; }
+
+    signals:
+        /// Emitted once, from the camera thread
+        void finished();
+
+    public slots:
+        /// Called from the camera thread for every frame
+        void countFrame(const QImage image, quint64 captureTime, quint64 processTime);
+
+    private:
+        Q_DISABLE_COPY(SessionFrameCounter);
+
+        QAtomicInt  mCount;
+        int         mFrames;
+    };
+
+    /** Runs a tracking session with the dummy devices and without GUI and
+        checks the throughput and latency against a baseline.
+        Started with "tracker --session-benchmark [options]". The whole path
+        of a real session is used: DummyCamera thread (synthetic streaming),
+        Controller thread with XY tracking, StageCommandScheduler, DummyStage
+        and the DummyMicroscope moving the sample on a circle.
+    @par Options
+        - \c --frames \c n: Frames to capture (default: 5000)
+        - \c --fps \c n: Synthetic frame rate of the DummyCamera (500)
+        - \c --mode \c text: Camera mode (640x480)
+        - \c --circle \c radius,Hz: Motion of the sample (40,0.5)
+        - \c --results \c file: Where to write the results
+          (default: session_benchmark.ini in the log directory)
+        - \c --baseline \c file: Results of an earlier run to compare with
+        - \c --threshold \c percent: Allowed loss of frame rate and increase
+          of the latency percentiles (default: 10)
+        - \c --drop-tolerance \c percent: Allowed increase of the share of
+          dropped frames in percentage points (default: 0.5)
+    @par Results
+        An ini file with a [SessionBenchmark] group: the conditions (frames,
+        frame rate, mode), the frames captured, received and dropped by the
+        Controller (the maximum process delay path), the sustained tracking
+        frame rate and the 50th, 90th and 99th percentile and the maximum of
+        the latency from the capture of an image to Stage::move() of the
+        command computed from it. A results file can be used as baseline
+        directly. The stage command delay of the camera mode is part of the
+        latency.
+    @return
+        0 if there is no baseline or no regression, 1 for a regression and
+        2 if the session could not be run or the conditions of the baseline
+        differ.
+    @note
+        The numbers depend on the PC and on tracker.ini (camera mode options,
+        [DummyMicroscope]), keep a baseline per machine and configuration.
+    */
+    int runSessionBenchmark(const QStringList& arguments);
+}
+
+#endif /* _SessionBenchmark_H__ */
@@ -0,0 +1,264 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Checks that the per-frame tracking path does not allocate in steady state.
+
+    Usage: trackalloc [-n frames] [--warmup frames] [--fft-size WxH]
+                      [--depth n] [image file]
+
+    Frames cut out of the image (default: the scene of the DummyCamera) on
+    a small circle go through the same calls as Controller::trackImage():
+    Correlator::computeBrennerValueForSnapshot(), Correlator::getLastFocus(),
+    Correlator::track() and TransferFunction::compute() with
+    TransferFunction::addStageMove(). The first frames (default: 50) fill
+    the histories, the heap allocations of the following ones (default: 500)
+    are counted. Returns 1 if there was any, 0 otherwise.
+@par Counting
+    This executable replaces the global operator new and delete. The Qt
+    containers allocate with malloc() instead, so with glibc malloc(),
+    calloc(), realloc() and free() are interposed as well and forwarded to
+    the C library. With other C libraries only operator new is counted.
+@par Not covered
+    The CSV logs of the Controller (QTextStream converts every value to a
+    QString) and the queued signals (one event per emit) allocate in Qt by
+    design, they are not part of the tracking computation checked here.
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QImage>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "Correlator.h"
+#include "Exception.h"
+#include "Logger.h"
+#include "PixelKernels.h"
+#include "TMath.h"
+#include "TransferFunction.h"
+
+using namespace tracker;
+
+namespace
+{
+    // Plain (constant initialised) atomics: operator new may run before main()
+    QBasicAtomicInt sCounting    = Q_BASIC_ATOMIC_INITIALIZER(0);
+    QBasicAtomicInt sAllocations = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+    inline void countAllocation()
+    {
+        if (sCounting)
+            sAllocations.ref();
+    }
+}
+
+#if defined(__GLIBC__)
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* pointer, size_t size);
+    void  __libc_free(void* pointer);
+
+    void* malloc(size_t size) __THROW
+    {
+        countAllocation();
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) __THROW
+    {
+        countAllocation();
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, size_t size) __THROW
+    {
+        countAllocation();
+        return __libc_realloc(pointer, size);
+    }
+
+    void free(void* pointer) __THROW
+    {
+        __libc_free(pointer);
+    }
+}
+#endif
+
+void* operator new(std::size_t size)
+{
+#if !defined(__GLIBC__)
+    countAllocation();
+#endif
+    // Counted by malloc() with glibc
+    void* pointer = std::malloc(size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* pointer) throw()
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) throw()
+{
+    std::free(pointer);
+}
+
+#if __cplusplus >= 201402L
+void operator delete(void* pointer, std::size_t) throw()
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) throw()
+{
+    std::free(pointer);
+}
+#endif
+
+namespace
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    //! Cuts @a count frames of @a size out of @a image along a circle
+    QVector<QImage> makeFrames(const QImage& image, QSize size, int count)
+    {
+        static const int radius = 8;
+        QVector<QImage> frames;
+        if (image.width() < size.width() + 2 * radius || image.height() < size.height() + 2 * radius)
+            return frames;
+        for (int i = 0; i < count; ++i)
+        {
+            const double angle = 2.0 * math::pi * i / count;
+            frames.append(image.copy(radius + qRound(radius * std::cos(angle)), radius + qRound(radius * std::sin(angle)),
+                                     size.width(), size.height()));
+        }
+        return frames;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    Logger logger;
+
+    QStringList arguments = app.arguments();
+    arguments.removeFirst();
+
+    int frameCount = 500;
+    int warmup = 50;
+    int depth = 2;
+    QSize size(256, 256);
+    QString filename = TRACKER_ALLOCATION_SCENE;
+    while (!arguments.isEmpty())
+    {
+        const QString argument = arguments.takeFirst();
+        if (!argument.startsWith("-"))
+        {
+            filename = argument;
+            continue;
+        }
+        if (arguments.isEmpty())
+        {
+            err << "Missing value for " << argument << endl;
+            return 2;
+        }
+        const QString value = arguments.takeFirst();
+        if (argument == "-n")
+            frameCount = qMax(1, value.toInt());
+        else if (argument == "--warmup")
+            warmup = qMax(0, value.toInt());
+        else if (argument == "--depth")
+            depth = qMax(1, value.toInt());
+        else if (argument == "--fft-size" && value.split('x').size() == 2)
+            size = QSize(value.split('x')[0].toInt(), value.split('x')[1].toInt());
+        else
+        {
+            err << "Invalid option " << argument << " " << value << endl;
+            return 2;
+        }
+    }
+
+    const QImage source(filename);
+    if (source.isNull())
+    {
+        err << "Could not load " << filename << endl;
+        return 2;
+    }
+    const QImage grey = source.convertToFormat(QImage::Format_Indexed8, getGreyColourTable());
+    // All frames exist before counting, the loop only shares them
+    const QVector<QImage> frames = makeFrames(grey, size, 16);
+    if (frames.isEmpty())
+    {
+        err << filename << " is too small for " << size.width() << "x" << size.height() << endl;
+        return 2;
+    }
+
+    int allocations = 0;
+    try
+    {
+        Correlator correlator(size, depth);
+        TransferFunction transferFunction;
+        transferFunction.setPredictorSize(3);
+        transferFunction.reset(0, 1000.0, 0.5);
+
+        const quint64 period = 20000;
+        for (int i = 0; i < warmup + frameCount; ++i)
+        {
+            if (i == warmup)
+            {
+                sAllocations.fetchAndStoreOrdered(0);
+                sCounting.fetchAndStoreOrdered(1);
+            }
+
+            const QImage& frame = frames[i % frames.size()];
+            const quint64 captureTime = i * period;
+            correlator.computeBrennerValueForSnapshot(frame);
+            correlator.getLastFocus();
+
+            float confidence = 0.0f;
+            const QPointF offset = correlator.track(frame, &confidence);
+            QPointF stageMove(0.0, 0.0);
+            if (correlator.isReady())
+                stageMove = transferFunction.compute(-offset, captureTime, captureTime + period, 0.5);
+            transferFunction.addStageMove(stageMove);
+        }
+        sCounting.fetchAndStoreOrdered(0);
+        allocations = sAllocations;
+    }
+    catch (const tracker::Exception& ex)
+    {
+        sCounting.fetchAndStoreOrdered(0);
+        err << ex.getDescription() << endl;
+        return 2;
+    }
+
+    out << "frames: " << frameCount << " (after " << warmup << " warm-up frames), "
+        << size.width() << "x" << size.height() << ", depth " << depth << "\n"
+        << "allocations: " << allocations << " (" << (double)allocations / frameCount << " per frame)\n"
+        << (allocations == 0 ? "OK" : "FAILED") << endl;
+    return allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,519 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Closed loop simulation of the XY tracker in virtual time.
+
+    Usage: tracksim [options]
+
+    The dummy scene is seen through a camera that captures at a fixed rate,
+    every frame is tracked with a Correlator and the TransferFunction, and
+    the stage moves of MicroscopeModel close the loop. Nothing waits for the
+    wall clock: time is a counter that jumps from event to event (capture,
+    end of processing, stage command), so a run takes as long as the
+    correlations and gives the same result every time.
+@par Timing model
+    - Frame \c k is captured at \c k / fps and delivered \c --readout later.
+    - The Controller handles one frame at a time and needs \c --process-time
+      per frame. Frames that wait longer than \c --max-process-delay are
+      dropped like in Controller::trackImage().
+    - A move is issued at capture time + stage command delay (or as soon as
+      it is computed, if that is later), like the StageCommandScheduler.
+      No move is computed while the stage is still moving.
+    - The stage latency, jitter, velocity and settling and the pressure
+      induced Z drift are those of MicroscopeModel.
+@par Parameter sweep
+    \c --gain, \c --predictor-size and \c --stage-delay take comma separated
+    lists, every combination is simulated. One CSV line per combination goes
+    to stdout:
+    \code
+    gain,predictor_size,stage_delay_ms,frames,dropped,held,rms_error,p95_error,max_error,mean_abs_z
+    \endcode
+    The errors are the true distances (stage units) between the sample and
+    the centre of the image at capture time, after \c --warmup seconds.
+@par Other options
+    - \c --config \c file: [DummyMicroscope] settings of a tracker.ini
+    - \c --duration \c s (default 20), \c --fps \c n (50), \c --frame-size
+      \c WxH (640x480), \c --fft-size \c WxH (frame size), \c --depth \c n (2)
+    - \c --readout \c us (1000), \c --process-time \c us (2000),
+      \c --max-process-delay \c us (3000), \c --warmup \c s (1)
+    - \c --motion-predictor \c 0|1|2, \c --min-confidence \c x
+    - \c --circle \c radius,Hz (40,0.5), \c --latency \c ms[,jitter]
+      (50,0), \c --velocity \c units/s (0), \c --settling \c ms (0),
+      \c --pressure \c kPa,interval_s,um/kPa (0,5,0)
+    - \c --scene \c file: Image of the scene (the DummyCamera base image)
+    - \c --trace \c file: Per frame CSV of the first combination
+@par Limitations
+    The Z tracker is not part of the loop (Controller::trackZ() depends on
+    an acquired Z stack), the Z drift only blurs the images.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+#include <QSettings>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "dummy/gaussianblur.h"
+#include "dummy/MicroscopeModel.h"
+#include "Correlator.h"
+#include "Exception.h"
+#include "Logger.h"
+#include "PixelKernels.h"
+#include "Timing.h"
+#include "TransferFunction.h"
+
+using namespace tracker;
+
+namespace
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    struct Options
+    {
+        Options()
+            : duration(20.0), fps(50.0), frameSize(640, 480), depth(2)
+            , readout(1000), processTime(2000), maxProcessDelay(3000), warmup(1.0)
+            , motionPredictor(0), minimumConfidence(0.0), blurLevels(8)
+            , sceneFilename(TRACKER_SIMULATOR_SCENE)
+        {
+            gains << 0.5;
+            predictorSizes << 3;
+            stageDelays << 0.0;
+        }
+
+        double          duration;           //!< Seconds of virtual time
+        double          fps;
+        QSize           frameSize;
+        QSize           fftSize;            //!< Frame size if empty
+        int             depth;
+        int             readout;            //!< Microseconds
+        int             processTime;        //!< Microseconds
+        int             maxProcessDelay;    //!< Microseconds
+        double          warmup;             //!< Seconds without statistics
+        int             motionPredictor;
+        double          minimumConfidence;
+        int             blurLevels;
+        QString         sceneFilename;
+        QString         traceFilename;
+        QList<double>   gains;
+        QList<int>      predictorSizes;
+        QList<double>   stageDelays;        //!< Milliseconds
+    };
+
+    //! Result of one parameter combination
+    struct Result
+    {
+        int     frames;
+        int     dropped;    //!< Waited too long for the Controller
+        int     held;       //!< No move because the stage was still moving
+        double  rmsError;
+        double  p95Error;
+        double  maxError;
+        double  meanAbsZ;
+    };
+
+    //! Stage move waiting for its deadline (StageCommandScheduler)
+    struct Command
+    {
+        quint64 deadline;
+        QPointF distance;
+    };
+
+    void printUsage()
+    {
+        err << "Usage: tracksim [--config tracker.ini] [--duration s] [--fps n] [--frame-size WxH]" << endl
+            << "                [--fft-size WxH] [--depth n] [--readout us] [--process-time us]" << endl
+            << "                [--max-process-delay us] [--warmup s] [--motion-predictor 0|1|2]" << endl
+            << "                [--min-confidence x] [--gain x,...] [--predictor-size n,...]" << endl
+            << "                [--stage-delay ms,...] [--circle radius,Hz] [--latency ms[,jitter]]" << endl
+            << "                [--velocity units/s] [--settling ms] [--pressure kPa,s,um/kPa]" << endl
+            << "                [--scene file] [--trace file]" << endl;
+    }
+
+    //! Splits a comma separated list of numbers, returns false if one is invalid
+    bool parseList(const QString& value, QList<double>* list)
+    {
+        list->clear();
+        foreach (const QString& item, value.split(','))
+        {
+            bool ok;
+            list->append(item.toDouble(&ok));
+            if (!ok)
+                return false;
+        }
+        return !list->isEmpty();
+    }
+
+    bool parseArguments(QStringList arguments, Options* options, MicroscopeModel* model)
+    {
+        // The defaults of the simulation, the configuration file and then the options
+        model->setCircularMotion(40.0, 0.5);
+        const int configIndex = arguments.indexOf("--config");
+        if (configIndex >= 0)
+        {
+            if (configIndex + 1 >= arguments.size() || !QFile::exists(arguments[configIndex + 1]))
+                return false;
+            QSettings settings(arguments[configIndex + 1], QSettings::IniFormat);
+            settings.beginGroup("DummyMicroscope");
+            model->readSettings(settings);
+            settings.endGroup();
+        }
+
+        while (!arguments.isEmpty())
+        {
+            const QString option = arguments.takeFirst();
+            if (arguments.isEmpty())
+                return false;
+            const QString value = arguments.takeFirst();
+
+            QList<double> list;
+            bool ok = parseList(value, &list);
+            if (option == "--config")
+                ; // See above
+            else if (option == "--scene")
+                options->sceneFilename = value;
+            else if (option == "--trace")
+                options->traceFilename = value;
+            else if (option == "--frame-size" || option == "--fft-size")
+            {
+                const QStringList size = value.split('x');
+                ok = size.size() == 2;
+                if (ok)
+                    (option == "--fft-size" ? options->fftSize : options->frameSize) = QSize(size[0].toInt(), size[1].toInt());
+            }
+            else if (!ok)
+                ;
+            else if (option == "--gain")
+                options->gains = list;
+            else if (option == "--predictor-size")
+            {
+                options->predictorSizes.clear();
+                foreach (double size, list)
+                    options->predictorSizes << qMax(0, (int)size);
+            }
+            else if (option == "--stage-delay")
+                options->stageDelays = list;
+            else if (option == "--circle" && list.size() == 2)
+                model->setCircularMotion(list[0], list[1]);
+            else if (option == "--latency" && list.size() <= 2)
+                model->setStageLatency(list[0], list.value(1, 0.0));
+            else if (option == "--velocity")
+                model->setStageDynamics(list[0], -1.0);
+            else if (option == "--settling")
+                model->setStageDynamics(-1.0, list[0]);
+            else if (option == "--pressure" && list.size() == 3)
+                model->setPressureDrift(list[0], list[1], list[2]);
+            else if (list.size() != 1)
+                ok = false;
+            else if (option == "--duration")
+                options->duration = list[0];
+            else if (option == "--fps")
+                options->fps = qMax(1.0, list[0]);
+            else if (option == "--depth")
+                options->depth = qMax(1, (int)list[0]);
+            else if (option == "--readout")
+                options->readout = (int)list[0];
+            else if (option == "--process-time")
+                options->processTime = (int)list[0];
+            else if (option == "--max-process-delay")
+                options->maxProcessDelay = (int)list[0];
+            else if (option == "--warmup")
+                options->warmup = list[0];
+            else if (option == "--motion-predictor")
+                options->motionPredictor = qBound(0, (int)list[0], 2);
+            else if (option == "--min-confidence")
+                options->minimumConfidence = list[0];
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                err << "Invalid option " << option << " " << value << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //! Blurs the scene once for every focus level, like the synthetic DummyCamera
+    QVector<QImage> prepareScene(const QString& filename, int levels)
+    {
+        QVector<QImage> blurLevels;
+        QImage scene(filename);
+        if (scene.isNull())
+            return blurLevels;
+        scene = scene.convertToFormat(QImage::Format_Indexed8, getGreyColourTable());
+        // The blur works on contiguous lines only
+        scene = scene.copy(0, 0, scene.width() & ~3, scene.height());
+
+        TGaussianBlur<uint8_t> blur;
+        blurLevels.resize(levels);
+        for (int i = 0; i < levels; ++i)
+        {
+            blurLevels[i] = scene.copy();
+            if (i > 0)
+                blur.Filter(blurLevels[i].bits(), NULL, scene.width(), scene.height(), 2 * i + 1);
+        }
+        return blurLevels;
+    }
+
+    /** Camera image for the sample at @a offset and @a zOffset from the focus.
+        Same geometry and noise amplitude as DummyCamera::makeSyntheticImage().
+    */
+    void renderFrame(const QVector<QImage>& blurLevels, QPointF offset, double zOffset, quint32* noiseState, QImage* frame)
+    {
+        const QImage& scene = blurLevels[qMin(blurLevels.size() - 1, qRound(std::abs(zOffset)))];
+        const QSize size = frame->size();
+        QRect rect(QPoint(0, 0), size);
+        rect.moveCenter(scene.rect().center() - offset.toPoint());
+        rect.moveLeft(qBound(0, rect.left(), scene.width() - size.width()));
+        rect.moveTop(qBound(0, rect.top(), scene.height() - size.height()));
+
+        quint32& s = *noiseState;
+        for (int y = 0; y < size.height(); ++y)
+        {
+            const uchar* source = scene.scanLine(rect.top() + y) + rect.left();
+            uchar* target = frame->scanLine(y);
+            for (int x = 0; x < size.width(); ++x)
+            {
+                s ^= s << 13;
+                s ^= s >> 17;
+                s ^= s << 5;
+                target[x] = qMax(0, qMin(source[x] + (int)(s & 15) - 8, 255));
+            }
+        }
+    }
+
+    class Simulation
+    {
+    public:
+        Simulation(const Options& options, const MicroscopeModel& model, const QVector<QImage>& blurLevels,
+                   Correlator* correlator)
+            : mOptions(options)
+            , mModelTemplate(model)
+            , mBlurLevels(blurLevels)
+            , mCorrelator(correlator)
+            , mTrace(NULL)
+            { }
+
+        //! Writes the per frame values of the next run() to @a stream (NULL: off)
+        void setTrace(QTextStream* stream)
+            { mTrace = stream; }
+
+        Result run(double gain, int predictorSize, double stageDelay);
+
+    private:
+        //! Moves the model to @a time, issuing the commands that are due
+        void advanceTo(quint64 time);
+
+        const Options&          mOptions;
+        const MicroscopeModel&  mModelTemplate;
+        const QVector<QImage>&  mBlurLevels;
+        Correlator*             mCorrelator;
+        QTextStream*            mTrace;
+
+        MicroscopeModel         mModel;
+        QList<Command>          mCommands;  //!< Sorted by deadline
+    };
+
+    void Simulation::advanceTo(quint64 time)
+    {
+        while (!mCommands.isEmpty() && mCommands.first().deadline <= time)
+        {
+            const Command command = mCommands.takeFirst();
+            mModel.advance(command.deadline);
+            mModel.moveStageXY(command.distance, command.deadline);
+        }
+        mModel.advance(time);
+    }
+
+    Result Simulation::run(double gain, int predictorSize, double stageDelay)
+    {
+        mModel = mModelTemplate;
+        mModel.reset(0);
+        mCommands.clear();
+        mCorrelator->reset();
+
+        TransferFunction transferFunction;
+        transferFunction.setPredictorSize(predictorSize);
+        transferFunction.reset(mOptions.motionPredictor, 1000.0, 0.5);
+
+        QImage frame(mOptions.frameSize, QImage::Format_Indexed8);
+        frame.setColorTable(getGreyColourTable());
+        quint32 noiseState = 88675123;
+
+        Result result = { 0, 0, 0, 0.0, 0.0, 0.0, 0.0 };
+        QVector<double> errors;
+        double sumAbsZ = 0.0;
+
+        const quint64 period = (quint64)(1e6 / mOptions.fps);
+        const quint64 end = (quint64)(mOptions.duration * 1e6);
+        const quint64 warmup = (quint64)(mOptions.warmup * 1e6);
+        quint64 busyUntil = 0;
+        for (quint64 captureTime = 0; captureTime < end; captureTime += period)
+        {
+            ++result.frames;
+            this->advanceTo(captureTime);
+            const QPointF trueOffset = mModel.getImageOffset();
+            const double zOffset = mModel.getZOffset();
+            if (captureTime >= warmup)
+            {
+                errors.append(std::sqrt(trueOffset.x() * trueOffset.x() + trueOffset.y() * trueOffset.y()));
+                sumAbsZ += std::abs(zOffset);
+            }
+
+            // Frames the Controller cannot take in time are dropped (Controller::trackImage())
+            const quint64 processTime = captureTime + mOptions.readout;
+            const quint64 start = qMax(processTime, busyUntil);
+            if (start > processTime + mOptions.maxProcessDelay)
+            {
+                ++result.dropped;
+                transferFunction.addStageMove(QPointF(0.0, 0.0));
+                if (mTrace)
+                    *mTrace << captureTime << "," << trueOffset.x() << "," << trueOffset.y() << ",,,,,," << zOffset << ","
+                            << mModel.getPressure() << ",1\n";
+                continue;
+            }
+            renderFrame(mBlurLevels, trueOffset, zOffset, &noiseState, &frame);
+            busyUntil = start + mOptions.processTime;
+
+            float confidence = 0.0f;
+            const QPointF offset = mCorrelator->track(frame, &confidence);
+
+            // Same decisions as Controller::trackXY(), with the pixel size 1 of the DummyCamera
+            QPointF stageMove(0.0, 0.0);
+            if (mCorrelator->isReady() && confidence >= mOptions.minimumConfidence)
+            {
+                const quint64 landingTime = captureTime + (quint64)(stageDelay * 1000);
+                stageMove = transferFunction.compute(-offset, captureTime, landingTime, gain);
+                const QPointF localMax(frame.width() / 4, frame.height() / 4);
+                stageMove.rx() = qMax(-localMax.x(), qMin(localMax.x(), stageMove.x()));
+                stageMove.ry() = qMax(-localMax.y(), qMin(localMax.y(), stageMove.y()));
+            }
+            this->advanceTo(busyUntil);
+            if (!stageMove.isNull() && (mModel.isStageMovingXY() || !mCommands.isEmpty()))
+            {
+                ++result.held;
+                stageMove = QPointF(0.0, 0.0);
+            }
+            if (!stageMove.isNull())
+            {
+                Command command = { qMax(captureTime + (quint64)(stageDelay * 1000), busyUntil), stageMove };
+                mCommands.append(command);
+            }
+            transferFunction.addStageMove(stageMove);
+
+            if (mTrace)
+                *mTrace << captureTime << "," << trueOffset.x() << "," << trueOffset.y() << ","
+                        << offset.x() << "," << offset.y() << "," << confidence << ","
+                        << stageMove.x() << "," << stageMove.y() << "," << zOffset << "," << mModel.getPressure() << ",0\n";
+        }
+
+        if (!errors.isEmpty())
+        {
+            double sum = 0.0;
+            foreach (double error, errors)
+                sum += error * error;
+            result.rmsError = std::sqrt(sum / errors.size());
+            result.meanAbsZ = sumAbsZ / errors.size();
+            std::sort(errors.begin(), errors.end());
+            result.p95Error = errors[qMin(errors.size() - 1, errors.size() * 95 / 100)];
+            result.maxError = errors.last();
+        }
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // No QApplication: runs on machines without a display
+    QCoreApplication app(argc, argv);
+    Logger logger;
+
+    QStringList arguments = app.arguments();
+    arguments.removeFirst();
+    Options options;
+    MicroscopeModel model;
+    if (!parseArguments(arguments, &options, &model))
+    {
+        printUsage();
+        return 2;
+    }
+
+    const QVector<QImage> blurLevels = prepareScene(options.sceneFilename, options.blurLevels);
+    if (blurLevels.isEmpty())
+    {
+        err << "Could not load the scene " << options.sceneFilename << endl;
+        return 1;
+    }
+    const QSize fftSize = options.fftSize.isEmpty() ? options.frameSize : options.fftSize;
+    if (options.frameSize.width() > blurLevels[0].width() || options.frameSize.height() > blurLevels[0].height()
+        || fftSize.width() > options.frameSize.width() || fftSize.height() > options.frameSize.height())
+    {
+        err << "The frame must fit into the scene and the FFT size into the frame" << endl;
+        return 1;
+    }
+
+    QFile traceFile(options.traceFilename);
+    QTextStream trace(&traceFile);
+    if (!options.traceFilename.isEmpty())
+    {
+        if (!traceFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            err << "Could not open " << options.traceFilename << endl;
+            return 1;
+        }
+        trace << "time_us,true_x,true_y,offset_x,offset_y,confidence,stage_move_x,stage_move_y,z,pressure,dropped\n";
+    }
+
+    try
+    {
+        Correlator correlator(fftSize, options.depth);
+        Simulation simulation(options, model, blurLevels, &correlator);
+
+        HPClock clock;
+        const quint64 start = clock.getTime();
+        int runs = 0;
+        out << "gain,predictor_size,stage_delay_ms,frames,dropped,held,rms_error,p95_error,max_error,mean_abs_z" << endl;
+        foreach (double gain, options.gains)
+        {
+            foreach (int predictorSize, options.predictorSizes)
+            {
+                foreach (double stageDelay, options.stageDelays)
+                {
+                    simulation.setTrace(runs == 0 && traceFile.isOpen() ? &trace : NULL);
+                    const Result result = simulation.run(gain, predictorSize, stageDelay);
+                    out << gain << "," << predictorSize << "," << stageDelay << ","
+                        << result.frames << "," << result.dropped << "," << result.held << ","
+                        << result.rmsError << "," << result.p95Error << "," << result.maxError << ","
+                        << result.meanAbsZ << endl;
+                    ++runs;
+                }
+            }
+        }
+        const double elapsed = (clock.getTime() - start) / 1e6;
+        err << runs << " runs of " << options.duration << " s in " << QString::number(elapsed, 'f', 2)
+            << " s (" << QString::number(runs * options.duration / qMax(elapsed, 1e-6), 'f', 1) << "x real time)" << endl;
+    }
+    catch (const tracker::Exception& ex)
+    {
+        err << ex.getDescription() << endl;
+        return 1;
+    }
+    return 0;
+}
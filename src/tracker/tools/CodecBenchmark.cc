@@ -0,0 +1,208 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Compares the throughput and ratio of FrameCodec with PNG.
+
+    Usage: codecbench [-n repetitions] [image files]
+
+    Without files, all images in data/dummy are used. Every image is
+    converted to 8 bit grey and to 12 bit data in Mono16Format (what a 12 bit
+    camera delivers, see PixelKernels.h). For each, the encoding and decoding
+    speed in MB/s of raw frame data and the compression ratio are printed.
+    PNG is measured with quality 100 (the setting of the PNG storage path)
+    and with the default quality. Qt cannot write 16 bit grey PNG files, so
+    those rows only exist for 8 bit.
+@par
+    The program returns 1 if any frame does not decompress to the original.
+*/
+
+#include <cstring>
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "FrameCodec.h"
+#include "PixelKernels.h"
+#include "Timing.h"
+
+using namespace tracker;
+
+namespace
+{
+    QTextStream out(stdout);
+
+    struct Result
+    {
+        double  ratio;
+        double  encodeRate;     //!< MB/s
+        double  decodeRate;     //!< MB/s
+    };
+
+    void printResult(const QString& name, const QString& method, const Result& result)
+    {
+        out << qSetFieldWidth(28) << left << name
+            << qSetFieldWidth(12) << method
+            << qSetFieldWidth(10) << right << QString::number(result.ratio, 'f', 2)
+            << qSetFieldWidth(12) << QString::number(result.encodeRate, 'f', 1)
+            << qSetFieldWidth(12) << QString::number(result.decodeRate, 'f', 1)
+            << qSetFieldWidth(0) << endl;
+    }
+
+    //! Returns the image as 8 bit grey (Indexed8 with grey colour table)
+    QImage toGrey8(const QImage& source)
+    {
+        const QImage rgb = source.convertToFormat(QImage::Format_RGB32);
+        QImage grey(rgb.size(), QImage::Format_Indexed8);
+        grey.setColorTable(getGreyColourTable());
+        for (int y = 0; y < rgb.height(); ++y)
+        {
+            const QRgb* line = reinterpret_cast<const QRgb*>(rgb.scanLine(y));
+            uchar* target = grey.scanLine(y);
+            for (int x = 0; x < rgb.width(); ++x)
+                target[x] = (uchar)qGray(line[x]);
+        }
+        return grey;
+    }
+
+    //! Expands 8 bit grey to 12 bit samples, MSB aligned in Mono16Format
+    QImage toMono12(const QImage& grey)
+    {
+        QImage image(grey.size(), Mono16Format);
+        for (int y = 0; y < grey.height(); ++y)
+        {
+            const uchar* source = grey.scanLine(y);
+            quint16* target = reinterpret_cast<quint16*>(image.scanLine(y));
+            for (int x = 0; x < grey.width(); ++x)
+                target[x] = (quint16)(((source[x] << 4) | (source[x] >> 4)) << 4);
+        }
+        return image;
+    }
+
+    Result benchmarkPng(const QImage& image, int quality, int repetitions)
+    {
+        HPClock clock;
+        const double megaBytes = image.width() * image.height() / 1e6;
+
+        QByteArray encoded;
+        quint64 start = clock.getTimeNs();
+        for (int i = 0; i < repetitions; ++i)
+        {
+            encoded.clear();
+            QBuffer buffer(&encoded);
+            buffer.open(QIODevice::WriteOnly);
+            image.save(&buffer, "png", quality);
+        }
+        const double encodeTime = (clock.getTimeNs() - start) / 1e9 / repetitions;
+
+        start = clock.getTimeNs();
+        for (int i = 0; i < repetitions; ++i)
+            QImage::fromData(encoded, "png");
+        const double decodeTime = (clock.getTimeNs() - start) / 1e9 / repetitions;
+
+        Result result = { megaBytes * 1e6 / encoded.size(), megaBytes / encodeTime, megaBytes / decodeTime };
+        return result;
+    }
+
+    Result benchmarkCodec(const QImage& image, int repetitions, bool* identical)
+    {
+        HPClock clock;
+        const int bytesPerSample = isMono16(image) ? 2 : 1;
+        const double megaBytes = image.width() * image.height() * bytesPerSample / 1e6;
+
+        QByteArray encoded;
+        quint64 start = clock.getTimeNs();
+        for (int i = 0; i < repetitions; ++i)
+            encoded = compressFrame(image.constBits(), image.width(), image.height(), image.bytesPerLine(), bytesPerSample);
+        const double encodeTime = (clock.getTimeNs() - start) / 1e9 / repetitions;
+
+        QImage decoded(image.size(), image.format());
+        start = clock.getTimeNs();
+        for (int i = 0; i < repetitions; ++i)
+        {
+            decompressFrame(encoded.constData(), encoded.size(), decoded.bits(),
+                            image.width(), image.height(), decoded.bytesPerLine(), bytesPerSample);
+        }
+        const double decodeTime = (clock.getTimeNs() - start) / 1e9 / repetitions;
+
+        *identical = true;
+        for (int y = 0; y < image.height(); ++y)
+        {
+            if (memcmp(image.constScanLine(y), decoded.constScanLine(y), image.width() * bytesPerSample) != 0)
+                *identical = false;
+        }
+
+        Result result = { megaBytes * 1e6 / encoded.size(), megaBytes / encodeTime, megaBytes / decodeTime };
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList arguments = app.arguments();
+    arguments.removeFirst();
+    int repetitions = 10;
+    if (arguments.size() >= 2 && arguments[0] == "-n")
+    {
+        repetitions = qMax(1, arguments[1].toInt());
+        arguments = arguments.mid(2);
+    }
+
+    QStringList files = arguments;
+    if (files.isEmpty())
+    {
+        QDir dir(TRACKER_BENCHMARK_DATA);
+        foreach (const QString& file, dir.entryList(QStringList() << "*.png" << "*.jpg" << "*.bmp", QDir::Files))
+            files << dir.filePath(file);
+    }
+
+    out << qSetFieldWidth(28) << left << "Image" << qSetFieldWidth(12) << "Method"
+        << qSetFieldWidth(10) << right << "Ratio" << qSetFieldWidth(12) << "Enc MB/s"
+        << qSetFieldWidth(12) << "Dec MB/s" << qSetFieldWidth(0) << endl;
+
+    bool allIdentical = true;
+    foreach (const QString& file, files)
+    {
+        const QImage source(file);
+        if (source.isNull())
+        {
+            out << "Could not load " << file << endl;
+            continue;
+        }
+        const QImage grey = toGrey8(source);
+        const QImage mono12 = toMono12(grey);
+        const QString name = QFileInfo(file).fileName();
+
+        printResult(name + " (8 bit)", "png q100", benchmarkPng(grey, 100, repetitions));
+        printResult(name + " (8 bit)", "png", benchmarkPng(grey, -1, repetitions));
+
+        bool identical;
+        printResult(name + " (8 bit)", "codec", benchmarkCodec(grey, repetitions, &identical));
+        allIdentical = allIdentical && identical;
+        printResult(name + " (12 bit)", "codec", benchmarkCodec(mono12, repetitions, &identical));
+        allIdentical = allIdentical && identical;
+    }
+
+    if (!allIdentical)
+    {
+        out << "ERROR: decompressed frames differ from the original" << endl;
+        return 1;
+    }
+    return 0;
+}
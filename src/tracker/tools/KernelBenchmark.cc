@@ -0,0 +1,576 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Times the tracking and focus kernels on their own.
+
+    Usage: kernelbench [-n repetitions] [--config tracker.ini] [--fft-size WxH]
+                       [--filter text] [-o results.csv] [image files]
+    \n
+    Usage: kernelbench --compare baseline.csv results.csv [--threshold percent]
+
+    Without files, all images in data/dummy are used (converted to 8 bit
+    grey). Every kernel runs for every FFT image size of the camera modes in
+    the [Controller] group of tracker.ini (or the sizes given with
+    \c --fft-size, which can be repeated):
+     - \c assign: BaseImage::assign()
+     - \c transform: CorrelationImage::assignAndTransform(QImage, float)
+     - \c cross_spectrum: CorrelationImage::assignAndTransform(const CorrelationImage*, const CorrelationImage*)
+     - \c filter: CorrelationImage::filterImage()
+     - \c maximum: CorrelationImage::getSpatialMaximum() with confidence
+     - \c track: Correlator::track() at the track depths 1 to 4
+     - \c brenner: BaseImage::extractFocusBrenner()
+     - \c blur: TGaussianBlur::Filter() with the window sizes 5 and 15
+     - \c curve_fit: CurveFitter::fit() of a noisy Z stack (independent of the size)
+    \n
+    \c --filter only runs the kernels whose name contains the text.
+@par Output
+    One CSV line per kernel, size and variant (image name, track depth or
+    window size), times in microseconds:
+    \code
+    kernel,size,variant,repetitions,median_us,min_us,mean_us
+    \endcode
+    Every repetition is timed on its own. The median is what \c --compare
+    looks at: it lists the change of every row present in both files and
+    returns 1 if any median got slower by more than the threshold
+    (default: 10 percent).
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QSettings>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "dummy/gaussianblur.h"
+#include "CorrelationImage.h"
+#include "Correlator.h"
+#include "CurveFitter.h"
+#include "Exception.h"
+#include "Logger.h"
+#include "PixelKernels.h"
+#include "Timing.h"
+
+using namespace tracker;
+
+namespace
+{
+    QTextStream err(stderr);
+
+    //! Collects the duration of every repetition
+    class Samples
+    {
+    public:
+        Samples(int repetitions)
+            { mTimes.reserve(repetitions); }
+
+        void start()
+            { mStart = mClock.getTimeNs(); }
+        void stop()
+            { mTimes.append(mClock.getTimeNs() - mStart); }
+
+        int size() const
+            { return mTimes.size(); }
+
+        //! Returns median, minimum and mean in microseconds
+        void getStatistics(double* median, double* minimum, double* mean)
+        {
+            std::sort(mTimes.begin(), mTimes.end());
+            quint64 sum = 0;
+            foreach (quint64 time, mTimes)
+                sum += time;
+            *median  = mTimes[mTimes.size() / 2] / 1e3;
+            *minimum = mTimes.first() / 1e3;
+            *mean    = sum / 1e3 / mTimes.size();
+        }
+
+    private:
+        HPClock         mClock;
+        quint64         mStart;
+        QVector<quint64> mTimes;    //!< Nanoseconds
+    };
+
+    class Benchmark
+    {
+    public:
+        Benchmark(QTextStream& out, int repetitions, const QString& filter)
+            : mOut(out)
+            , mRepetitions(repetitions)
+            , mFilter(filter)
+            { }
+
+        void printHeader()
+            { mOut << "kernel,size,variant,repetitions,median_us,min_us,mean_us" << endl; }
+
+        //! Runs all kernels that depend on the FFT size
+        void run(const QImage& image, const QString& name, QSize size);
+        //! Runs the kernels that do not depend on the image
+        void runCurveFit();
+
+    private:
+        bool enabled(const QString& kernel) const
+            { return mFilter.isEmpty() || kernel.contains(mFilter); }
+        void report(const QString& kernel, QSize size, const QString& variant, Samples& samples);
+
+        void benchmarkAssign(const QImage& image, const QString& name, QSize size);
+        void benchmarkTransforms(const QImage& image, const QString& name, QSize size);
+        void benchmarkTrack(const QImage& image, const QString& name, QSize size);
+        void benchmarkBrenner(const QImage& image, const QString& name, QSize size);
+        void benchmarkBlur(const QImage& image, const QString& name, QSize size);
+
+        QTextStream&    mOut;
+        int             mRepetitions;
+        QString         mFilter;
+    };
+
+    void Benchmark::report(const QString& kernel, QSize size, const QString& variant, Samples& samples)
+    {
+        double median, minimum, mean;
+        samples.getStatistics(&median, &minimum, &mean);
+        const QString sizeText = size.isValid() ? QString("%1x%2").arg(size.width()).arg(size.height()) : "-";
+        mOut << kernel << "," << sizeText << "," << variant << "," << samples.size() << ","
+             << QString::number(median, 'f', 3) << "," << QString::number(minimum, 'f', 3) << ","
+             << QString::number(mean, 'f', 3) << endl;
+    }
+
+    void Benchmark::run(const QImage& image, const QString& name, QSize size)
+    {
+        if (enabled("assign"))
+            this->benchmarkAssign(image, name, size);
+        if (enabled("transform") || enabled("cross_spectrum") || enabled("filter") || enabled("maximum"))
+            this->benchmarkTransforms(image, name, size);
+        if (enabled("track"))
+            this->benchmarkTrack(image, name, size);
+        if (enabled("brenner"))
+            this->benchmarkBrenner(image, name, size);
+        if (enabled("blur"))
+            this->benchmarkBlur(image, name, size);
+    }
+
+    void Benchmark::benchmarkAssign(const QImage& image, const QString& name, QSize size)
+    {
+        BaseImage target(size);
+        float dcValue = target.assign(image, 128.0f);
+        Samples samples(mRepetitions);
+        for (int i = 0; i < mRepetitions; ++i)
+        {
+            samples.start();
+            dcValue = target.assign(image, dcValue);
+            samples.stop();
+        }
+        this->report("assign", size, name, samples);
+    }
+
+    void Benchmark::benchmarkTransforms(const QImage& image, const QString& name, QSize size)
+    {
+        // Second image shifted by a few pixels, like two succeeding frames
+        const bool canShift = image.width() >= size.width() + 5 && image.height() >= size.height() + 3;
+        const QImage shifted = canShift ? image.copy(5, 3, image.width() - 5, image.height() - 3) : image;
+        CorrelationImage first(size);
+        CorrelationImage second(size);
+        CorrelationImage crossSpectrum(size);
+        float dcValue = first.assignAndTransform(image, 128.0f);
+        second.assignAndTransform(shifted, dcValue);
+
+        if (enabled("transform"))
+        {
+            Samples samples(mRepetitions);
+            for (int i = 0; i < mRepetitions; ++i)
+            {
+                samples.start();
+                dcValue = first.assignAndTransform(image, dcValue);
+                samples.stop();
+            }
+            this->report("transform", size, name, samples);
+        }
+
+        crossSpectrum.assignAndTransform(&first, &second);
+        if (enabled("cross_spectrum"))
+        {
+            Samples samples(mRepetitions);
+            for (int i = 0; i < mRepetitions; ++i)
+            {
+                samples.start();
+                crossSpectrum.assignAndTransform(&first, &second);
+                samples.stop();
+            }
+            this->report("cross_spectrum", size, name, samples);
+        }
+
+        if (enabled("maximum"))
+        {
+            Samples samples(mRepetitions);
+            float confidence;
+            for (int i = 0; i < mRepetitions; ++i)
+            {
+                samples.start();
+                crossSpectrum.getSpatialMaximum(&confidence);
+                samples.stop();
+            }
+            this->report("maximum", size, name, samples);
+        }
+
+        if (enabled("filter"))
+        {
+            // Filtering the same data over and over would end in denormals:
+            // restore the unfiltered spectrum before every repetition
+            const QSize frequencySize = first.getFrequencySize();
+            const size_t bytes = frequencySize.width() * frequencySize.height() * sizeof(fftwf_complex);
+            QByteArray spectrum((const char*)first.getFrequencyData(), (int)bytes);
+            Samples samples(mRepetitions);
+            for (int i = 0; i < mRepetitions; ++i)
+            {
+                std::memcpy(crossSpectrum.getFrequencyData(), spectrum.constData(), bytes);
+                samples.start();
+                crossSpectrum.filterImage();
+                samples.stop();
+            }
+            this->report("filter", size, name, samples);
+        }
+    }
+
+    void Benchmark::benchmarkTrack(const QImage& image, const QString& name, QSize size)
+    {
+        // A sample moving on a small circle
+        static const int frameCount = 16;
+        static const int radius = 8;
+        if (image.width() < size.width() + 2 * radius || image.height() < size.height() + 2 * radius)
+        {
+            err << name << " is too small to track at " << size.width() << "x" << size.height() << endl;
+            return;
+        }
+        QVector<QImage> frames;
+        for (int i = 0; i < frameCount; ++i)
+        {
+            const double angle = 2.0 * math::pi * i / frameCount;
+            frames.append(image.copy(radius + qRound(radius * std::cos(angle)), radius + qRound(radius * std::sin(angle)),
+                                     size.width(), size.height()));
+        }
+
+        Correlator correlator(size, 4);
+        for (int depth = 1; depth <= 4; ++depth)
+        {
+            correlator.reset();
+            correlator.setTrackDepth(depth);
+            int frame = 0;
+            while (!correlator.isReady())
+                correlator.track(frames[frame++ % frameCount]);
+
+            Samples samples(mRepetitions);
+            float confidence;
+            for (int i = 0; i < mRepetitions; ++i)
+            {
+                samples.start();
+                correlator.track(frames[frame++ % frameCount], &confidence);
+                samples.stop();
+            }
+            this->report("track", size, QString("%1/depth%2").arg(name).arg(depth), samples);
+        }
+    }
+
+    void Benchmark::benchmarkBrenner(const QImage& image, const QString& name, QSize size)
+    {
+        BaseImage target(size);
+        target.assignZ(image);
+        Samples samples(mRepetitions);
+        for (int i = 0; i < mRepetitions; ++i)
+        {
+            samples.start();
+            target.extractFocusBrenner();
+            samples.stop();
+        }
+        this->report("brenner", size, name, samples);
+    }
+
+    void Benchmark::benchmarkBlur(const QImage& image, const QString& name, QSize size)
+    {
+        // The blur works on contiguous lines only (see DummyCamera)
+        const QImage source = image.copy(0, 0, size.width() & ~3, size.height());
+        QImage result(source.size(), source.format());
+        TGaussianBlur<uint8_t> blur;
+        const int windows[] = { 5, 15 };
+        for (int w = 0; w < 2; ++w)
+        {
+            Samples samples(mRepetitions);
+            for (int i = 0; i < mRepetitions; ++i)
+            {
+                samples.start();
+                blur.Filter(const_cast<uchar*>(source.constBits()), result.bits(), source.width(), source.height(), windows[w]);
+                samples.stop();
+            }
+            this->report("blur", size, QString("%1/w%2").arg(name).arg(windows[w]), samples);
+        }
+    }
+
+    void Benchmark::runCurveFit()
+    {
+        if (!enabled("curve_fit"))
+            return;
+
+        // Z stack like the one of FocusTracker: 41 positions around the focus
+        QVector<double> x, y;
+        quint32 state = 2463534242u;
+        for (int i = 0; i <= 40; ++i)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            const double z = -10.0 + 0.5 * i;
+            const double noise = (state / 4294967296.0 - 0.5) * 0.1;
+            x.append(z);
+            y.append(0.8 + 3.0 * std::exp(-(z - 0.7) * (z - 0.7) / (2.0 * 2.0 * 2.0)) + noise);
+        }
+
+        // Same initial guess as FocusTracker
+        QVector<double> guess;
+        guess << 3.0 << 0.0 << 2.2 << 0.8;
+        CurveFitter fitter(CurveFitter::CurveGaussian1Offset);
+        Samples samples(mRepetitions);
+        for (int i = 0; i < mRepetitions; ++i)
+        {
+            fitter.setParams(guess);
+            samples.start();
+            fitter.fit(x, y);
+            samples.stop();
+        }
+        this->report("curve_fit", QSize(), QString("points%1").arg(x.size()), samples);
+    }
+
+    //! Returns the image as 8 bit grey (Indexed8 with grey colour table)
+    QImage toGrey8(const QImage& source)
+    {
+        const QImage rgb = source.convertToFormat(QImage::Format_RGB32);
+        QImage grey(rgb.size(), QImage::Format_Indexed8);
+        grey.setColorTable(getGreyColourTable());
+        for (int y = 0; y < rgb.height(); ++y)
+        {
+            const QRgb* line = reinterpret_cast<const QRgb*>(rgb.scanLine(y));
+            uchar* target = grey.scanLine(y);
+            for (int x = 0; x < rgb.width(); ++x)
+                target[x] = (uchar)qGray(line[x]);
+        }
+        return grey;
+    }
+
+    //! Returns the distinct FFT image sizes of all camera modes in the [Controller] group
+    QList<QSize> readFFTSizes(const QString& filename)
+    {
+        QList<QSize> sizes;
+        QSettings settings(filename, QSettings::IniFormat);
+        settings.beginGroup("Controller");
+        foreach (const QString& mode, settings.childGroups())
+        {
+            const QSize size = settings.value(mode + "/FFT_Image_Size").toSize();
+            if (size.isValid() && !sizes.contains(size))
+                sizes.append(size);
+        }
+        settings.endGroup();
+        return sizes;
+    }
+
+    //! Reads a result file into rows keyed by kernel, size and variant
+    bool readResults(const QString& filename, QStringList* keys, QHash<QString, double>* medians)
+    {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            err << "Could not open " << filename << endl;
+            return false;
+        }
+        QTextStream in(&file);
+        in.readLine(); // Header
+        while (!in.atEnd())
+        {
+            const QStringList fields = in.readLine().split(',');
+            if (fields.size() < 7)
+                continue;
+            const QString key = QStringList(fields.mid(0, 3)).join(",");
+            keys->append(key);
+            medians->insert(key, fields[4].toDouble());
+        }
+        return true;
+    }
+
+    int compare(const QString& baseline, const QString& current, double threshold)
+    {
+        QStringList baseKeys, keys;
+        QHash<QString, double> baseMedians, medians;
+        if (!readResults(baseline, &baseKeys, &baseMedians) || !readResults(current, &keys, &medians))
+            return 2;
+
+        QTextStream out(stdout);
+        out << "kernel,size,variant,baseline_us,current_us,change_percent,status" << endl;
+        int regressions = 0;
+        foreach (const QString& key, keys)
+        {
+            if (!baseMedians.contains(key))
+            {
+                out << key << ",," << medians[key] << ",,new" << endl;
+                continue;
+            }
+            const double before = baseMedians[key];
+            const double after = medians[key];
+            const double change = before > 0.0 ? (after / before - 1.0) * 100.0 : 0.0;
+            QString status = "ok";
+            if (change > threshold)
+            {
+                status = "slower";
+                ++regressions;
+            }
+            else if (change < -threshold)
+                status = "faster";
+            out << key << "," << before << "," << after << "," << QString::number(change, 'f', 1) << "," << status << endl;
+        }
+        foreach (const QString& key, baseKeys)
+        {
+            if (!medians.contains(key))
+                out << key << "," << baseMedians[key] << ",,,missing" << endl;
+        }
+
+        if (regressions > 0)
+        {
+            err << regressions << " kernel(s) slower by more than " << threshold << " percent" << endl;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    Logger logger;
+
+    QStringList arguments = app.arguments();
+    arguments.removeFirst();
+
+    if (!arguments.isEmpty() && arguments[0] == "--compare")
+    {
+        double threshold = 10.0;
+        const int index = arguments.indexOf("--threshold");
+        if (index >= 0 && index + 1 < arguments.size())
+        {
+            threshold = arguments[index + 1].toDouble();
+            arguments.erase(arguments.begin() + index, arguments.begin() + index + 2);
+        }
+        if (arguments.size() != 3)
+        {
+            err << "Usage: kernelbench --compare baseline.csv results.csv [--threshold percent]" << endl;
+            return 2;
+        }
+        return compare(arguments[1], arguments[2], threshold);
+    }
+
+    int repetitions = 50;
+    QString configFilename = TRACKER_BENCHMARK_CONFIG;
+    QString filter;
+    QString outputFilename;
+    QList<QSize> sizes;
+    QStringList files;
+    while (!arguments.isEmpty())
+    {
+        const QString argument = arguments.takeFirst();
+        if (!argument.startsWith("-"))
+        {
+            files << argument;
+            continue;
+        }
+        if (arguments.isEmpty())
+        {
+            err << "Missing value for " << argument << endl;
+            return 2;
+        }
+        const QString value = arguments.takeFirst();
+        if (argument == "-n")
+            repetitions = qMax(1, value.toInt());
+        else if (argument == "--config")
+            configFilename = value;
+        else if (argument == "--filter")
+            filter = value;
+        else if (argument == "-o")
+            outputFilename = value;
+        else if (argument == "--fft-size" && value.split('x').size() == 2)
+            sizes << QSize(value.split('x')[0].toInt(), value.split('x')[1].toInt());
+        else
+        {
+            err << "Invalid option " << argument << " " << value << endl;
+            return 2;
+        }
+    }
+
+    if (sizes.isEmpty())
+        sizes = readFFTSizes(configFilename);
+    if (sizes.isEmpty())
+    {
+        err << "No FFT image sizes in " << configFilename << endl;
+        return 2;
+    }
+    if (files.isEmpty())
+    {
+        QDir dir(TRACKER_BENCHMARK_DATA);
+        foreach (const QString& file, dir.entryList(QStringList() << "*.png" << "*.jpg" << "*.bmp", QDir::Files))
+            files << dir.filePath(file);
+    }
+
+    QFile outputFile;
+    if (outputFilename.isEmpty())
+        outputFile.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    else
+        outputFile.setFileName(outputFilename);
+    if (!outputFile.isOpen() && !outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        err << "Could not open " << outputFilename << endl;
+        return 2;
+    }
+    QTextStream out(&outputFile);
+
+    try
+    {
+        Benchmark benchmark(out, repetitions, filter);
+        benchmark.printHeader();
+        foreach (const QString& file, files)
+        {
+            const QImage source(file);
+            if (source.isNull())
+            {
+                err << "Could not load " << file << endl;
+                continue;
+            }
+            const QImage grey = toGrey8(source);
+            const QString name = QFileInfo(file).fileName();
+            foreach (QSize size, sizes)
+            {
+                if (size.width() > grey.width() || size.height() > grey.height())
+                {
+                    err << name << " is smaller than " << size.width() << "x" << size.height() << endl;
+                    continue;
+                }
+                benchmark.run(grey, name, size);
+            }
+        }
+        benchmark.runCurveFit();
+    }
+    catch (const tracker::Exception& ex)
+    {
+        err << ex.getDescription() << endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,459 @@
+/*
+ Copyright (c) 2009-2012, Reto Grieder & Benjamin Beyeler
+ Copyright (c) 2014, Tobias Klauser
+
+ Permission to use, copy, modify, and/or distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+ This software is provided 'as-is', without any express or implied warranty.
+*/
+
+/**
+@file
+@brief
+    Runs a recorded stack file through the tracking core without GUI or devices.
+
+    Usage: trackreplay [options] <stack file>
+
+    Every frame of the stack (see StackFile.h, "Storage_Format=stack") is
+    tracked with a Correlator, its Brenner focus value is computed like in
+    Controller::trackZ() and the offset goes through the XY TransferFunction.
+    One CSV line per frame is written with the offsets, focus values, the
+    resulting stage moves and the time spent in every stage (microseconds):
+    \code
+    frame,capture_time,z,offset_x,offset_y,confidence,track_depth,stage_move_x,stage_move_y,brenner_focus,load_us,track_us,focus_us,control_us
+    \endcode
+    A summary with the frame rate and the mean, median, 99th percentile and
+    maximum of every stage goes to stderr.
+@par Options
+    - \c -o \c file: Writes the CSV to a file instead of stdout
+    - \c --paced: Processes the frames at their original capture times
+      instead of as fast as possible. Frames whose processing ends after the
+      capture time of the next frame are counted as overruns.
+    - \c --config \c file [\c --mode \c key]: Reads the [Controller] options
+      of a tracker.ini, with \c --mode also the ones of a camera mode
+    - \c --fft-size \c WxH, \c --depth \c n, \c --adaptive-depth,
+      \c --sharp-peak \c x, \c --min-confidence \c x, \c --min-offset \c x:
+      Correlator options (default: frame size, 2, off, 10, 0, 4)
+    - \c --gain \c x, \c --predictor-size \c n, \c --stage-delay \c ms,
+      \c --pixel-size \c x,y, \c --motion-predictor \c 0|1|2,
+      \c --lookahead \c ms: Transfer function options (default: 0.5, 3, 0,
+      1,1, 0, 0)
+    - \c --max-stage-move \c x: Total stage move at which the replay stops
+      like the Controller aborts the tracking (default: 5000)
+    The defaults are the ones of Controller::readSettings().
+    - \c --no-focus: Skips the Brenner focus value
+@par Limitations
+    The recorded images do not follow the computed stage moves, the moves
+    show what the Controller would have issued for the recorded sequence.
+    Like in Controller::trackXY(), moves below 0.01 in both axes are dropped
+    (reported as 0 and not passed to the Smith Predictor). The stage is
+    assumed to be never busy, so no move is skipped because of a running one.
+    The Z decision in Controller::trackZ() depends on the live stage state
+    and an acquired Z stack, only its input (the Brenner focus value) is
+    reported here.
+*/
+
+#include <algorithm>
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+#include <QSettings>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "Correlator.h"
+#include "Exception.h"
+#include "Logger.h"
+#include "StackFile.h"
+#include "Timing.h"
+#include "TransferFunction.h"
+
+using namespace tracker;
+
+namespace
+{
+    QTextStream err(stderr);
+
+    //! Options of the Correlator and the Controller used for the replay
+    struct Options
+    {
+        Options()
+            : paced(false), focus(true), fftSize(0, 0), depth(2), adaptiveDepth(false)
+            , sharpPeakConfidence(10.0), minimumConfidence(0.0), minimumOffset(4.0)
+            , gain(0.5), predictorSize(3), stageCommandDelay(0.0), pixelSize(1.0, 1.0)
+            , motionPredictor(0), processNoise(1000.0), measurementNoise(0.5), lookahead(0.0)
+            , maxTotalStageMove(5000.0)
+        { }
+
+        QString     stackFilename;
+        QString     csvFilename;
+        bool        paced;
+        bool        focus;
+        QSize       fftSize;                //!< Frame size if empty
+        int         depth;
+        bool        adaptiveDepth;
+        double      sharpPeakConfidence;
+        double      minimumConfidence;
+        double      minimumOffset;
+        double      gain;
+        int         predictorSize;
+        double      stageCommandDelay;      //!< Milliseconds
+        QPointF     pixelSize;
+        int         motionPredictor;
+        double      processNoise;
+        double      measurementNoise;
+        double      lookahead;              //!< Milliseconds
+        double      maxTotalStageMove;
+    };
+
+    //! Durations of one processing stage over all frames
+    class StageTimes
+    {
+    public:
+        StageTimes(const QString& name)
+            : mName(name)
+            { }
+
+        void add(quint64 microseconds)
+            { mSamples.append(microseconds); }
+
+        void print()
+        {
+            if (mSamples.isEmpty())
+                return;
+            std::sort(mSamples.begin(), mSamples.end());
+            quint64 sum = 0;
+            foreach (quint64 sample, mSamples)
+                sum += sample;
+            err << qSetFieldWidth(10) << left << mName
+                << qSetFieldWidth(12) << right << QString::number((double)sum / mSamples.size(), 'f', 1)
+                << qSetFieldWidth(12) << mSamples[mSamples.size() / 2]
+                << qSetFieldWidth(12) << mSamples[qMin(mSamples.size() - 1, mSamples.size() * 99 / 100)]
+                << qSetFieldWidth(12) << mSamples.last()
+                << qSetFieldWidth(0) << endl;
+        }
+
+    private:
+        QString             mName;
+        QVector<quint64>    mSamples;
+    };
+
+    void printUsage()
+    {
+        err << "Usage: trackreplay [-o csv] [--paced] [--no-focus] [--config tracker.ini [--mode key]]" << endl
+            << "                   [--fft-size WxH] [--depth n] [--adaptive-depth] [--sharp-peak x]" << endl
+            << "                   [--min-confidence x] [--min-offset x] [--gain x] [--predictor-size n]" << endl
+            << "                   [--stage-delay ms] [--pixel-size x,y] [--motion-predictor 0|1|2]" << endl
+            << "                   [--lookahead ms] [--max-stage-move x] <stack file>" << endl;
+    }
+
+    //! Reads the options the Controller would use (same keys and defaults as Controller::readSettings())
+    void readConfig(const QString& filename, QString mode, Options* options)
+    {
+        QSettings settings(filename, QSettings::IniFormat);
+        settings.beginGroup("Controller");
+        options->minimumOffset       = settings.value("Minimum_Offset",            options->minimumOffset).toDouble();
+        options->adaptiveDepth       = settings.value("Adaptive_Correlator_Depth", options->adaptiveDepth).toBool();
+        options->sharpPeakConfidence = settings.value("Sharp_Peak_Confidence",     options->sharpPeakConfidence).toDouble();
+        options->minimumConfidence   = settings.value("Minimum_Peak_Confidence",   options->minimumConfidence).toDouble();
+        options->motionPredictor     = settings.value("Motion_Predictor",          options->motionPredictor).toInt();
+        options->processNoise        = settings.value("Kalman_Process_Noise",      options->processNoise).toDouble();
+        options->measurementNoise    = settings.value("Kalman_Measurement_Noise",  options->measurementNoise).toDouble();
+        options->lookahead           = settings.value("Prediction_Lookahead",      options->lookahead).toDouble();
+        options->maxTotalStageMove   = settings.value("Maximum_Stage_Move",        options->maxTotalStageMove).toDouble();
+        settings.endGroup();
+
+        if (mode.isEmpty())
+            return;
+        settings.beginGroup("Controller/" + mode.replace('\\', "__fwd_sl__").replace('/', "__bwd_sl__"));
+        options->fftSize             = settings.value("FFT_Image_Size",      options->fftSize).toSize();
+        options->gain                = settings.value("Controller_Gain",     options->gain).toDouble();
+        options->stageCommandDelay   = settings.value("Stage_Command_Delay", options->stageCommandDelay).toDouble();
+        options->depth               = settings.value("Correlator_Depth",    options->depth).toInt();
+        options->predictorSize       = settings.value("Predictor_Size",      options->predictorSize).toInt();
+        options->pixelSize.rx()      = settings.value("Pixel_Size_X",        options->pixelSize.x()).toDouble();
+        options->pixelSize.ry()      = settings.value("Pixel_Size_Y",        options->pixelSize.y()).toDouble();
+        settings.endGroup();
+    }
+
+    bool parseArguments(QStringList arguments, Options* options)
+    {
+        // The configuration file first, the other options override it
+        const int configIndex = arguments.indexOf("--config");
+        if (configIndex >= 0)
+        {
+            if (configIndex + 1 >= arguments.size() || !QFile::exists(arguments[configIndex + 1]))
+                return false;
+            const int modeIndex = arguments.indexOf("--mode");
+            const QString mode = modeIndex >= 0 && modeIndex + 1 < arguments.size() ? arguments[modeIndex + 1] : QString();
+            readConfig(arguments[configIndex + 1], mode, options);
+        }
+
+        while (!arguments.isEmpty())
+        {
+            const QString option = arguments.takeFirst();
+            if (!option.startsWith('-'))
+            {
+                if (!options->stackFilename.isEmpty())
+                    return false;
+                options->stackFilename = option;
+                continue;
+            }
+            if (option == "--paced")
+            {
+                options->paced = true;
+                continue;
+            }
+            if (option == "--no-focus")
+            {
+                options->focus = false;
+                continue;
+            }
+            if (option == "--adaptive-depth")
+            {
+                options->adaptiveDepth = true;
+                continue;
+            }
+
+            // All other options have a value
+            if (arguments.isEmpty())
+                return false;
+            const QString value = arguments.takeFirst();
+            bool ok = true;
+            if (option == "-o")
+                options->csvFilename = value;
+            else if (option == "--config" || option == "--mode")
+                ; // See above
+            else if (option == "--fft-size")
+            {
+                const QStringList size = value.split('x');
+                ok = size.size() == 2;
+                if (ok)
+                    options->fftSize = QSize(size[0].toInt(), size[1].toInt());
+            }
+            else if (option == "--depth")
+                options->depth = value.toInt(&ok);
+            else if (option == "--sharp-peak")
+                options->sharpPeakConfidence = value.toDouble(&ok);
+            else if (option == "--min-confidence")
+                options->minimumConfidence = value.toDouble(&ok);
+            else if (option == "--min-offset")
+                options->minimumOffset = value.toDouble(&ok);
+            else if (option == "--gain")
+                options->gain = value.toDouble(&ok);
+            else if (option == "--predictor-size")
+                options->predictorSize = value.toInt(&ok);
+            else if (option == "--stage-delay")
+                options->stageCommandDelay = value.toDouble(&ok);
+            else if (option == "--pixel-size")
+            {
+                const QStringList size = value.split(',');
+                ok = size.size() == 2;
+                if (ok)
+                    options->pixelSize = QPointF(size[0].toDouble(), size[1].toDouble());
+            }
+            else if (option == "--motion-predictor")
+                options->motionPredictor = value.toInt(&ok);
+            else if (option == "--lookahead")
+                options->lookahead = value.toDouble(&ok);
+            else if (option == "--max-stage-move")
+                options->maxTotalStageMove = value.toDouble(&ok);
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                err << "Invalid option " << option << " " << value << endl;
+                return false;
+            }
+        }
+        return !options->stackFilename.isEmpty();
+    }
+
+    int replay(const Options& options)
+    {
+        StackFileReader reader;
+        if (!reader.open(options.stackFilename))
+            return 1;
+        const int frameCount = reader.getFrameCount();
+        if (frameCount == 0)
+        {
+            err << "The stack file contains no frames" << endl;
+            return 1;
+        }
+
+        QFile csvFile;
+        if (options.csvFilename.isEmpty())
+            csvFile.open(stdout, QIODevice::WriteOnly);
+        else
+            csvFile.setFileName(options.csvFilename);
+        if (!csvFile.isOpen() && !csvFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            err << "Could not open " << options.csvFilename << endl;
+            return 1;
+        }
+        QTextStream csv(&csvFile);
+        csv << "frame,capture_time,z,offset_x,offset_y,confidence,track_depth,stage_move_x,stage_move_y,"
+               "brenner_focus,load_us,track_us,focus_us,control_us\n";
+
+        HPClock clock;
+
+        // Correlator like Controller::updateCorrelator(), the planning is reported separately
+        const QSize frameSize = reader.getImage(0).size();
+        const QSize fftSize = options.fftSize.isEmpty() ? frameSize : options.fftSize;
+        if (fftSize.width() > frameSize.width() || fftSize.height() > frameSize.height())
+        {
+            err << "The FFT size is larger than the frames" << endl;
+            return 1;
+        }
+        quint64 time = clock.getTime();
+        Correlator correlator(fftSize, qMax(1, options.depth));
+        correlator.setMinimumOffset((float)options.minimumOffset);
+        correlator.setTrackDepth(options.depth);
+        correlator.setAdaptiveDepth(options.adaptiveDepth);
+        correlator.setSharpPeakConfidence((float)options.sharpPeakConfidence);
+        const quint64 setupTime = clock.getTime() - time;
+
+        TransferFunction transferFunction;
+        transferFunction.setPredictorSize(options.predictorSize);
+        transferFunction.reset(qBound(0, options.motionPredictor, 2), options.processNoise, qMax(1e-3, options.measurementNoise));
+
+        StageTimes loadTimes("load");
+        StageTimes trackTimes("track");
+        StageTimes focusTimes("focus");
+        StageTimes controlTimes("control");
+        const quint64 firstCapture = reader.getInfo(0).captureTime;
+        int overruns = 0;
+
+        int replayedCount = 0;
+        const quint64 start = clock.getTime();
+        for (int i = 0; i < frameCount; ++i)
+        {
+            const StackFrameInfo info = reader.getInfo(i);
+            if (options.paced)
+            {
+                const quint64 due = start + (info.captureTime - firstCapture);
+                time = clock.getTime();
+                if (time < due)
+                    tracker::usleep(due - time);
+            }
+
+            time = clock.getTime();
+            const QImage image = reader.getImage(i);
+            const quint64 loadTime = clock.getTime() - time;
+            if (image.size() != frameSize)
+            {
+                // The Controller stops as well when the camera mode changes
+                err << "Frame " << i << " has a different size, stopping" << endl;
+                break;
+            }
+
+            time = clock.getTime();
+            float confidence = 0.0f;
+            const QPointF offset = correlator.track(image, &confidence);
+            const bool ready = correlator.isReady();
+            const quint64 trackTime = clock.getTime() - time;
+
+            time = clock.getTime();
+            if (options.focus)
+                correlator.computeBrennerValueForSnapshot(image);
+            const quint64 focusTime = clock.getTime() - time;
+
+            // Same decisions as Controller::trackXY() with a stage that is never busy
+            time = clock.getTime();
+            QPointF stageMove(0.0, 0.0);
+            bool recordMove = true;
+            if (ready && confidence >= options.minimumConfidence)
+            {
+                const quint64 landingTime = info.captureTime + (quint64)((options.stageCommandDelay + options.lookahead) * 1000);
+                const QPointF stageOffset(offset.x() * options.pixelSize.x(), offset.y() * options.pixelSize.y());
+                stageMove = transferFunction.compute(-stageOffset, info.captureTime, landingTime, options.gain);
+
+                // Limit local movements (no more than a quarter of the image)
+                const QPointF localMax(image.width() / 4 * options.pixelSize.x(), image.height() / 4 * options.pixelSize.y());
+                stageMove.rx() = qMax(-localMax.x(), qMin(localMax.x(), stageMove.x()));
+                stageMove.ry() = qMax(-localMax.y(), qMin(localMax.y(), stageMove.y()));
+
+                // The Controller returns without issuing or recording tiny moves
+                if (!stageMove.isNull() && qAbs(stageMove.x()) < 0.01 && qAbs(stageMove.y()) < 0.01)
+                {
+                    stageMove = QPointF(0.0, 0.0);
+                    recordMove = false;
+                }
+            }
+
+            // Limit total movement
+            const QPointF totalStageMove = transferFunction.getTotalStageMove() + stageMove;
+            if (qAbs(totalStageMove.x()) > options.maxTotalStageMove || qAbs(totalStageMove.y()) > options.maxTotalStageMove)
+            {
+                err << "Frame " << i << ": Tracking aborted: Total distance moved by the stage was exceeded" << endl;
+                break;
+            }
+            if (recordMove)
+                transferFunction.addStageMove(stageMove);
+            const quint64 controlTime = clock.getTime() - time;
+
+            loadTimes.add(loadTime);
+            trackTimes.add(trackTime);
+            if (options.focus)
+                focusTimes.add(focusTime);
+            controlTimes.add(controlTime);
+            if (options.paced && i + 1 < frameCount
+                && clock.getTime() > start + (reader.getInfo(i + 1).captureTime - firstCapture))
+                ++overruns;
+
+            csv << i << "," << info.captureTime << "," << info.z << ","
+                << offset.x() << "," << offset.y() << "," << confidence << "," << correlator.getLastTrackDepth() << ","
+                << stageMove.x() << "," << stageMove.y() << ","
+                << (options.focus ? correlator.getLastFocus().brennerFocus : 0.0f) << ","
+                << loadTime << "," << trackTime << "," << focusTime << "," << controlTime << "\n";
+            ++replayedCount;
+        }
+        csv.flush();
+        const double elapsed = (clock.getTime() - start) / 1e6;
+
+        // The loop stops early at a change of the frame size or an exceeded total stage move
+        err << "Frames: " << replayedCount << " of " << frameCount << ", " << QString::number(elapsed, 'f', 3) << " s, "
+            << QString::number(replayedCount / qMax(elapsed, 1e-6), 'f', 1) << " fps"
+            << (options.paced ? QString(", %1 overruns").arg(overruns) : QString()) << endl;
+        err << "Correlator setup (FFT planning): " << setupTime << " us, FFT size "
+            << fftSize.width() << "x" << fftSize.height() << endl;
+        err << "Tracking error (RMS): " << QString::number(transferFunction.getTrackingError(), 'f', 3) << endl;
+        err << qSetFieldWidth(10) << left << "Stage" << qSetFieldWidth(12) << right << "Mean us"
+            << qSetFieldWidth(12) << "Median us" << qSetFieldWidth(12) << "P99 us"
+            << qSetFieldWidth(12) << "Max us" << qSetFieldWidth(0) << endl;
+        loadTimes.print();
+        trackTimes.print();
+        focusTimes.print();
+        controlTimes.print();
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // No QApplication: runs on machines without a display
+    QCoreApplication app(argc, argv);
+    Logger logger;
+
+    QStringList arguments = app.arguments();
+    arguments.removeFirst();
+    Options options;
+    if (!parseArguments(arguments, &options))
+    {
+        printUsage();
+        return 2;
+    }
+
+    try
+    {
+        return replay(options);
+    }
+    catch (const tracker::Exception& ex)
+    {
+        err << ex.getDescription() << endl;
+        return 1;
+    }
+}
@@ -16,6 +16,8 @@
 
 #include "Exception.h"
 #include "PathConfig.h"
+#include "PixelKernels.h"
+#include "ThreadProfile.h"
 #include "Timing.h"
 #include "TMath.h"
 #include <iostream>
@@ -35,11 +37,6 @@ namespace tracker
     {
         qRegisterMetaType<HANDLE>("HANDLE");
 
-        // Create colour table for 8 bit grey images
-        mMonochromeColourTable.resize(256);
-        for (int i = 0; i < 256; ++i)
-            mMonochromeColourTable[i] = qRgb(i, i, i);
-
         assertSuccess(FX_InitLibrary(), "FX Library initialisation failed.");
         // FX library creates two threads of its own. So even in the case of an
         // exception we have to release these with FX_DeInitLibrary.
@@ -87,8 +84,9 @@ namespace tracker
                           "Failed to list camera formats.");
             for (int iFormat = 0; iFormat < nImageFormats; ++iFormat)
             {
-                // Only use 8 Bit B/W or 24 Bit colour images
-                if (imageFormats[iFormat]->iPixelBits != 8 && imageFormats[iFormat]->iPixelBits != 24)
+                // Only use 8 to 16 Bit B/W or 24 Bit colour images
+                const int pixelBits = imageFormats[iFormat]->iPixelBits;
+                if ((pixelBits < 8 || pixelBits > 16) && pixelBits != 24)
                     continue;
 
                 int nImageCodes;
@@ -107,7 +105,8 @@ namespace tracker
                     QSize size(imageFormats[iFormat]->iSizeX, imageFormats[iFormat]->iSizeY);
                     QString name = imageFormats[iFormat]->aName;
                     name += ", Coding " + QString::number(imageCodes[iCode]->iCode);
-                    Mode mode = { imageFormats[iFormat]->iFormat, *(imageCodes[iCode]), size, name, mModes.size() };
+                    Mode mode = { imageFormats[iFormat]->iFormat, *(imageCodes[iCode]), size, name, mModes.size(),
+                                  qMin(pixelBits, 16) };
                     mModes.append(mode);
                 }
             }
@@ -159,6 +158,7 @@ namespace tracker
     void WindowsCamera::run(Thread* thread)
     {
         mIsRunning = true;
+        applyThreadProfile("Camera");
 
         // Just in case single shot mode waiting was still in progress
         finishSingleShot(QImage(), mClock.getTime(), mClock.getTime());
@@ -177,6 +177,7 @@ namespace tracker
                 thread->exec();
 
                 warnIfError(FX_StartDataCapture(mCamID, FALSE), "Failed to stop camera capturing");
+                this->logFramePoolStatistics();
             }
         }
 
@@ -225,60 +226,63 @@ namespace tracker
         // Important, clear struct because we could theoretically set some flags beforehand
         memset(&imageHeader, 0, sizeof(tBoImgDataInfoHeader));
 
+        // 8 bit monochrome images are read straight into a pooled buffer as
+        // long as its lines are contiguous (width divisible by 4)
+        const QSize size = mCurrentMode->size;
+        const bool direct = mCurrentMode->code.iCanals == 1 && mCurrentMode->code.iCanalBytes == 1
+                         && mCurrentMode->code.iPlanes == 1 && size.width() % 4 == 0;
+        FramePool::Frame frame;
+        unsigned char* target = mBuffer;
+        int targetSize = mBufferSize;
+        if (direct)
+        {
+            frame = mFramePool.acquire(size, QImage::Format_Indexed8, getGreyColourTable());
+            target = frame.bits;
+            targetSize = frame.bytesPerLine * size.height();
+        }
+
         // Grab image (failure happens often when changing exposure time, gain or binning)
-        if (FX_GetImageData(mCamID, &imageHeader, (void*)mBuffer, mBufferSize) != TRUE)
+        if (FX_GetImageData(mCamID, &imageHeader, (void*)target, targetSize) != TRUE)
             return;
 
         if (!imageHeader.sDataCode.operator ==(mCurrentMode->code) ||
-            imageHeader.iSizeX    != mCurrentMode->size.width() ||
-            imageHeader.iSizeY    != mCurrentMode->size.height())
+            imageHeader.iSizeX    != size.width() ||
+            imageHeader.iSizeY    != size.height())
         {
             // Unsuitable image, discard (should not happen anyway)
             return;
         }
 
-        // Copy image
-        QImage image;
         if (imageHeader.sDataCode.iCanals > 1)
         {
             // Colour image
             TRACKER_EXCEPTION("Colour image decoding not yet implemented!", Logger::High);
         }
-        else
+        else if (imageHeader.sDataCode.iCanalBytes == 2)
         {
-            // Monochrome image, stored as 8 bit colour table with grey values
-            image = QImage(mCurrentMode->size, QImage::Format_Indexed8);
-            image.setColorTable(mMonochromeColourTable);
+            // More than 8 bits: keep the native samples, MSB aligned (see PixelKernels.h)
+            frame = mFramePool.acquire(size, Mono16Format);
 
-            int width = image.width();
-            int fastWidth = width / 8 / 4 * 4;
-            int fastByteWidth = fastWidth * 8;
-            for (int y = 0; y < image.height(); ++y)
+            const int width = size.width();
+            const int shift = 16 - mCurrentMode->bitDepth;
+            for (int y = 0; y < size.height(); ++y)
             {
-                // Copy line based to avoid alignment issues (QImage is 32 bit aligned
-                // and the source is 'as is')
-
-                const unsigned char* source = mBuffer + y * width;
-                const unsigned char* sourceEnd = source + fastByteWidth;
-                unsigned char* target = image.scanLine(y);
-
-                // Optimised 4 x 64 bit copying
-                while (source < sourceEnd)
-                {
-                    ((uint64_t*)target)[0] = ((const uint64_t*)source)[0];
-                    ((uint64_t*)target)[1] = ((const uint64_t*)source)[1];
-                    ((uint64_t*)target)[2] = ((const uint64_t*)source)[2];
-                    ((uint64_t*)target)[3] = ((const uint64_t*)source)[3];
-                    source += 4 * 8;
-                    target += 4 * 8;
-                }
-
-                // Copy the rest that is not divisible by 8 * 4
-                int restWidth = width - fastByteWidth;
-                for (int x = 0; x < restWidth; ++x)
-                    target[x] = source[x];
+                const quint16* source = reinterpret_cast<const quint16*>(mBuffer) + y * width;
+                PixelKernels<quint16>::align(source, reinterpret_cast<quint16*>(frame.scanLine(y)), width, shift);
             }
         }
+        else if (!direct)
+        {
+            // Monochrome image, stored as 8 bit colour table with grey values
+            frame = mFramePool.acquire(size, QImage::Format_Indexed8, getGreyColourTable());
+
+            // Copy line based to avoid alignment issues (QImage is 32 bit aligned
+            // and the source is 'as is')
+            const int width = size.width();
+            for (int y = 0; y < size.height(); ++y)
+                PixelKernels<uchar>::align(mBuffer + y * width, frame.scanLine(y), width, 0);
+        }
+        const QImage image = frame.image;
         //This function takes 7ms until here from its beginning
         if (singleShotInProgress())
         {
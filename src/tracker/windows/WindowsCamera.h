@@ -26,6 +26,8 @@ namespace tracker
     @par Limitations
         - Designed for non colour images only. That can be changed rather
           easily though.
+        - Monochrome modes with more than 8 bits per pixel are delivered as
+          Mono16Format images with MSB aligned samples (see PixelKernels.h).
         - One single camera (the first one enumerated if there are multiple)
         - For the Leica DFC 360 FX camera, the second colour codings are ignored
           because there doesn't seem to be any noticeable difference.
@@ -92,6 +94,7 @@ namespace tracker
             QSize         size;
             QString       name;
             int           index;
+            int           bitDepth;     ///< Significant bits of a monochrome sample
         };
 
         /// Starts the capture and the event loop.
@@ -126,7 +129,6 @@ namespace tracker
         HANDLE                mMessageEvent;
         QWinEventNotifier*    mMessageNotifier;
         QVector<Mode>         mModes;
-        QVector<QRgb>         mMonochromeColourTable;
         QPair<int, int>       mExposureTimeRange;
         QPair<double, double> mGainRange;
         QString               mCamName;
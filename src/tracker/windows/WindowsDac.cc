@@ -1,5 +1,7 @@
 #include "WindowsDac.h"
 
+#include <QMutexLocker>
+
 namespace tracker
 {
     /*static*/ Dac* Dac::makeDac(QObject* parent)
@@ -88,6 +90,7 @@ void WindowsDac::setvoltage(float voltage){
     //DAQmxErrChk (
 
 
+    QMutexLocker lock(&mMutex);
     DAQmxWriteAnalogF64(aotaskHandle,1,1,10.0,DAQmx_Val_GroupByChannel,data,NULL,NULL);//);
 
 /*Error:
@@ -118,6 +121,7 @@ float WindowsDac::readvoltage() const
     // DAQmx Start Code
     /*********************************************/
 
+    QMutexLocker lock(&mMutex);
     DAQmxStartTask(aitaskHandle);
 
     /*********************************************/
@@ -2,6 +2,7 @@
 #define _WindowsDac_H__
 
 #include "Dac.h"
+#include <QMutex>
 #include <NIDAQmx.h>
 
 namespace tracker
@@ -27,6 +28,8 @@ namespace tracker
         int timeinterval;
         int tickcounter;
         int dactimerID;
+        //! Serialises the DAQmx calls (GUI and DeviceStateCache thread)
+        mutable QMutex mMutex;
     };
 }
 
@@ -20,7 +20,10 @@
 #include <windows.h>
 #include <Oasis4i.h>
 
+#include <QMutexLocker>
+
 #include "Exception.h"
+#include "Timing.h"
 
 #include <iostream>
 
@@ -86,7 +89,13 @@ namespace tracker
         if (!this->mbDriverOpen)
             return false;
 
-        OI_StepXY(distance.x(), distance.y(), block);
+        {
+            QMutexLocker lock(&mMutex);
+            OI_StepXY(distance.x(), distance.y(), 0);
+        }
+        // Wait without the lock (see Stage)
+        while (block && this->isMovingXY())
+            usleep(1000);
         return true;
     }
 
@@ -95,18 +104,23 @@ namespace tracker
         if (!this->mbDriverOpen)
             return false;
 
-        int test = OI_StepZ(distance, block);
-        if (test != OI_OK) {
-            std::cout << __FUNCTION__ << ": Failed to step by " << distance << std::endl;
-            return false;
+        {
+            QMutexLocker lock(&mMutex);
+            int test = OI_StepZ(distance, 0);
+            if (test != OI_OK) {
+                std::cout << __FUNCTION__ << ": Failed to step by " << distance << std::endl;
+                return false;
+            }
+
+            double direction = distance < 0.0 ? -1.0 : 1.0;
+            if (mPrevZDirection != direction)
+                OI_StepZ(0, 0); // this line fixes a bug when direction is changed
+
+            mPrevZDirection = direction;
         }
 
-        double direction = distance < 0.0 ? -1.0 : 1.0;
-        if (mPrevZDirection != direction)
-            OI_StepZ(0, 0); // this line fixes a bug when direction is changed
-
-        mPrevZDirection = direction;
-
+        while (block && this->isMovingZ())
+            usleep(1000);
         return true;
     }
 
@@ -115,16 +129,22 @@ namespace tracker
         if (!this->mbDriverOpen)
             return false;
 
-        if (OI_MoveToZ(zPos, block) != OI_OK) {
-            std::cout << __FUNCTION__ << ": Failed to move to " << zPos << std::endl;
-            return false;
+        {
+            QMutexLocker lock(&mMutex);
+            if (OI_MoveToZ(zPos, 0) != OI_OK) {
+                std::cout << __FUNCTION__ << ": Failed to move to " << zPos << std::endl;
+                return false;
+            }
         }
 
+        while (block && this->isMovingZ())
+            usleep(1000);
         return true;
     }
 
     double WindowsStage::getZpos()
     {
+        QMutexLocker lock(&mMutex);
         double zpos;
         if (OI_ReadZ(&zpos) != OI_OK)
             std::cout << __FUNCTION__ << ": Failed to get Z position" << std::endl;
@@ -133,6 +153,7 @@ namespace tracker
 
     double WindowsStage::getXpos()
     {
+        QMutexLocker lock(&mMutex);
         double xpos,ypos;
         OI_ReadXY(&xpos,&ypos);
         return xpos;
@@ -140,6 +161,7 @@ namespace tracker
 
     double WindowsStage::getYpos()
     {
+        QMutexLocker lock(&mMutex);
         double xpos,ypos;
         OI_ReadXY(&xpos,&ypos);
         return ypos;
@@ -147,11 +169,13 @@ namespace tracker
 
 	void WindowsStage::clearZlimits()
 	{
+		QMutexLocker lock(&mMutex);
 		OI_ClearUserLimitsZ();
 	}
 
 	void WindowsStage::setZlimits(double position)
 	{
+		QMutexLocker lock(&mMutex);
 		int test;
 		test = OI_SetUserLimitsZ(position - 400, position + 400);
 	}
@@ -160,6 +184,7 @@ namespace tracker
     {
         if (this->mbDriverOpen)
         {
+            QMutexLocker lock(&mMutex);
             //OI_HaltXY();
             OI_HaltAllAxes();
         }
@@ -169,6 +194,7 @@ namespace tracker
     {
         if (this->mbDriverOpen)
         {
+            QMutexLocker lock(&mMutex);
             WORD xStatus, yStatus;
             OI_ReadStatusXY(&xStatus, &yStatus);
             if ((xStatus & S_MOVING) != 0 || (yStatus & S_MOVING) != 0)
@@ -181,6 +207,7 @@ namespace tracker
     {
         if (this->mbDriverOpen)
         {
+            QMutexLocker lock(&mMutex);
             WORD zStatus;
             OI_ReadStatusZ(&zStatus);
             if ((zStatus & S_MOVING) != 0)